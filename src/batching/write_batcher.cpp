@@ -3,12 +3,17 @@
 #include "../metrics/metrics.h"
 #include <iostream>
 
-WriteBatcher::WriteBatcher(KVStore& store) : store_(store) {
+WriteBatcher::WriteBatcher(KVStore& store, const BatcherOptions& options)
+    : store_(store), options_(options), head_(&stub_), tail_(&stub_) {
+    if (options_.max_batch == 0) {
+        options_.max_batch = 1;
+    }
     flusher_thread_ = std::thread([this]() { background_flusher(); });
 }
 
 WriteBatcher::~WriteBatcher() {
     running_ = false;
+    wake_cv_.notify_one();
     if (flusher_thread_.joinable()) {
         flusher_thread_.join();
     }
@@ -16,50 +21,170 @@ WriteBatcher::~WriteBatcher() {
     flush_to_store();
 }
 
-void WriteBatcher::add_to_batch(const ParsedCommand& cmd) {
-    // Only batch SET and DEL commands (writes)
-    if (cmd.type != CommandType::SET && cmd.type != CommandType::DEL) {
+void WriteBatcher::add_to_batch(ParsedCommand cmd, WriteCompletion* completion, WriteStatus* status) {
+    // Only batch SET, DEL, MSET and VSET commands (writes)
+    if (cmd.type != CommandType::SET && cmd.type != CommandType::DEL && cmd.type != CommandType::MSET &&
+        cmd.type != CommandType::VSET) {
         // Execute non-write commands immediately
         store_.execute(cmd);
         return;
     }
     
-    {
-        std::lock_guard<std::mutex> lock(batch_mtx_);
-        current_batch_.commands.push_back(cmd);
-        
-        // Flush if batch is full
-        if (current_batch_.size() >= BATCH_SIZE_THRESHOLD) {
-            flush_to_store();
+    Node* node = new Node;
+    node->cmd = std::move(cmd);
+    node->completion = completion;
+    node->status = status;
+    if (completion) {
+        completion->submitted++;
+    }
+    
+    // Counted before the push so the flusher never sees more nodes than queued_
+    bool full = queued_.fetch_add(1, std::memory_order_relaxed) + 1 == options_.max_batch;
+    push(node);
+    
+    // Flush if batch is full
+    if (full) {
+        wake_cv_.notify_one();
+    }
+}
+
+bool WriteBatcher::wait(WriteCompletion& completion) {
+    if (completion.pending()) {
+        // The waiter's executor thread submits nothing more until it is
+        // released, so flush now rather than let the latency timer run out
+        flush_requested_.store(true, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(wake_mtx_);
         }
+        wake_cv_.notify_one();
+        
+        std::unique_lock<std::mutex> lock(done_mtx_);
+        done_cv_.wait(lock, [&] { return !completion.pending(); });
     }
+    
+    if (options_.ack_mode == AckMode::DURABLE) {
+        return store_.wait_durable(completion.lsn.load(std::memory_order_acquire));
+    }
+    return true;
 }
 
-void WriteBatcher::flush_to_store() {
-    Batch batch_to_flush;
+void WriteBatcher::drain() {
+    // An invalid command is skipped by apply_batch() but still acknowledged,
+    // after everything queued ahead of it
+    WriteCompletion barrier;
+    Node* node = new Node;
+    node->cmd.type = CommandType::UNKNOWN;
+    node->cmd.valid = false;
+    node->completion = &barrier;
+    barrier.submitted = 1;
+    queued_.fetch_add(1, std::memory_order_relaxed);
+    push(node);
+    wait(barrier);
+}
+
+void WriteBatcher::push(Node* node) {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    // Between the exchange and this store the list is briefly unlinked;
+    // pop() treats that as empty and picks the node up on the next pass
+    prev->next.store(node, std::memory_order_release);
+}
+
+WriteBatcher::Node* WriteBatcher::pop() {
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
     
-    {
-        std::lock_guard<std::mutex> lock(batch_mtx_);
-        if (current_batch_.commands.empty()) {
-            return;
+    if (tail == &stub_) {
+        if (next == nullptr) {
+            return nullptr;
         }
-        batch_to_flush = current_batch_;
-        current_batch_.clear();
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
     }
     
-    // Record batch statistics
-    Metrics::instance().record_batch(batch_to_flush.size());
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
     
-    // Apply all commands in batch
-    for (const auto& cmd : batch_to_flush.commands) {
-        store_.execute(cmd);
+    if (tail != head_.load(std::memory_order_acquire)) {
+        return nullptr; // A producer is mid-push
+    }
+    
+    // tail is the last node: re-insert the stub behind it so it can be taken
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void WriteBatcher::flush_to_store() {
+    while (true) {
+        batch_.clear();
+        batch_nodes_.clear();
+        
+        Node* node;
+        while (batch_.size() < options_.max_batch && (node = pop()) != nullptr) {
+            batch_.commands.push_back(std::move(node->cmd));
+            batch_nodes_.push_back(node);
+        }
+        if (batch_.commands.empty()) {
+            return;
+        }
+        queued_.fetch_sub(batch_.size(), std::memory_order_relaxed);
+        
+        // Record batch statistics
+        Metrics::instance().record_batch(batch_.size());
+        
+        // Apply the whole batch: one lock per shard, one WAL append
+        RequestTrace& trace = Metrics::trace();
+        trace.clear();
+        uint64_t start = Metrics::now_ns();
+        uint64_t lsn = store_.apply_batch(batch_.commands, &batch_status_);
+        Metrics::instance().record_stage(Metrics::BATCH_ROW, Stage::EXECUTE, Metrics::now_ns() - start);
+        Metrics::instance().record_stage(Metrics::BATCH_ROW, Stage::LOCK_WAIT, trace.lock_wait_ns);
+        Metrics::instance().record_stage(Metrics::BATCH_ROW, Stage::WAL, trace.wal_ns);
+        
+        bool notify = false;
+        for (size_t i = 0; i < batch_nodes_.size(); ++i) {
+            Node* n = batch_nodes_[i];
+            if (n->status) {
+                *n->status = batch_status_[i]; // Published by the applied increment
+            }
+            if (n->completion) {
+                if (lsn > n->completion->lsn.load(std::memory_order_relaxed)) {
+                    n->completion->lsn.store(lsn, std::memory_order_relaxed);
+                }
+                n->completion->applied.fetch_add(1, std::memory_order_release);
+                notify = true;
+            }
+            delete n;
+        }
+        
+        if (notify) {
+            // Taking the lock orders the counter updates before a waiter's
+            // predicate check, so no wakeup is lost
+            { std::lock_guard<std::mutex> lock(done_mtx_); }
+            done_cv_.notify_all();
+        }
     }
 }
 
 void WriteBatcher::background_flusher() {
+    auto interval = std::chrono::microseconds(options_.max_latency_us);
     while (running_) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        {
+            std::unique_lock<std::mutex> lock(wake_mtx_);
+            wake_cv_.wait_for(lock, interval, [this] {
+                return !running_ || flush_requested_.load(std::memory_order_relaxed) ||
+                       queued_.load(std::memory_order_relaxed) >= options_.max_batch;
+            });
+        }
+        flush_requested_.store(false, std::memory_order_relaxed);
         flush_to_store();
     }
 }
-
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
 #include <atomic>
 #include <chrono>
@@ -9,6 +11,32 @@
 
 // Forward declaration
 class KVStore;
+enum class WriteStatus : uint8_t;
+
+// When a batched write is acknowledged to the client.
+enum class AckMode {
+    IMMEDIATE, // On enqueue (fastest; a crash or refusal is not reported)
+    APPLIED,   // Once the batch holding the write is applied to the store
+    DURABLE    // Once the batch's WAL records are durable under the fsync policy
+};
+
+struct BatcherOptions {
+    size_t max_batch = 256;          // Flush as soon as this many writes are queued
+    uint32_t max_latency_us = 1000;  // Flush at least this often while writes are queued
+    AckMode ack_mode = AckMode::IMMEDIATE;
+    bool multi_key = true;           // Queue MSET and multi-key DEL too; if not, connections apply them directly
+};
+
+// Tracks one producer's (one connection's) writes for APPLIED/DURABLE acks.
+// The producer bumps submitted; the flusher bumps applied and publishes the
+// highest LSN covering them.
+struct WriteCompletion {
+    uint64_t submitted = 0;
+    std::atomic<uint64_t> applied{0};
+    std::atomic<uint64_t> lsn{0};
+    
+    bool pending() const { return applied.load(std::memory_order_acquire) != submitted; }
+};
 
 struct Batch {
     std::vector<ParsedCommand> commands;
@@ -18,24 +46,61 @@ struct Batch {
     void clear() { commands.clear(); }
 };
 
+// Groups writes from every connection into batches applied with
+// KVStore::apply_batch(): one lock per touched shard and one WAL append per
+// batch. Producers push onto a lock-free MPSC queue (Vyukov's intrusive
+// list); a single flusher thread drains it.
 class WriteBatcher {
 public:
-    WriteBatcher(KVStore& store);
+    WriteBatcher(KVStore& store, const BatcherOptions& options = BatcherOptions());
     ~WriteBatcher();
     
-    void add_to_batch(const ParsedCommand& cmd);
-    void flush_to_store();
+    // Queues a SET/DEL/MSET. Anything else executes immediately. Pass a
+    // completion to be able to wait() for the write to be acknowledged, and
+    // status to have its outcome stored there before it is.
+    void add_to_batch(ParsedCommand cmd, WriteCompletion* completion = nullptr, WriteStatus* status = nullptr);
+    
+    // Blocks until every write submitted with `completion` is applied, and
+    // durable in DURABLE mode. False if the WAL failed before they were durable.
+    bool wait(WriteCompletion& completion);
     
+    // Blocks until every write queued before the call has been applied
+    void drain();
+    
+    AckMode ack_mode() const { return options_.ack_mode; }
+    bool multi_key() const { return options_.multi_key; }
+
 private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        ParsedCommand cmd;
+        WriteCompletion* completion = nullptr;
+        WriteStatus* status = nullptr;
+    };
+    
+    void push(Node* node);
+    Node* pop();                     // Flusher only
     void background_flusher();
+    void flush_to_store();           // Flusher only: drains the queue in batches
     
     KVStore& store_;
-    std::mutex batch_mtx_;
-    Batch current_batch_;
+    BatcherOptions options_;
+    
+    // MPSC queue: producers exchange head_, the flusher owns tail_
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+    std::atomic<size_t> queued_{0};
+    std::atomic<bool> flush_requested_{false}; // A wait() is blocked on queued writes
+    
+    std::mutex wake_mtx_;
+    std::condition_variable wake_cv_;     // Flusher: batch full or shutdown
+    std::mutex done_mtx_;
+    std::condition_variable done_cv_;     // Waiters: a batch was applied
+    
+    Batch batch_;
+    std::vector<Node*> batch_nodes_;
+    std::vector<WriteStatus> batch_status_;
     std::atomic<bool> running_{true};
     std::thread flusher_thread_;
-    
-    static constexpr size_t BATCH_SIZE_THRESHOLD = 50;
-    static constexpr size_t FLUSH_INTERVAL_MS = 10;
 };
-
@@ -0,0 +1,592 @@
+#include "cluster.h"
+#include "../replication/wire.h"
+#include <iostream>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace replication_wire;
+
+namespace {
+
+// "first-last" or a single slot
+bool parse_range(std::string_view text, uint16_t& first, uint16_t& last) {
+    size_t dash = text.find('-');
+    uint64_t a = 0;
+    uint64_t b = 0;
+    if (!parse_u64(std::string(text.substr(0, dash)), a)) {
+        return false;
+    }
+    b = a;
+    if (dash != std::string_view::npos && !parse_u64(std::string(text.substr(dash + 1)), b)) {
+        return false;
+    }
+    if (a > b || b >= CLUSTER_SLOTS) {
+        return false;
+    }
+    first = static_cast<uint16_t>(a);
+    last = static_cast<uint16_t>(b);
+    return true;
+}
+
+std::string range_text(size_t first, size_t last) {
+    return first == last ? std::to_string(first) : std::to_string(first) + "-" + std::to_string(last);
+}
+
+bool split_addr(std::string_view addr, std::string& host, int& port) {
+    size_t colon = addr.rfind(':');
+    uint64_t n = 0;
+    if (colon == std::string_view::npos || colon == 0 || !parse_u64(std::string(addr.substr(colon + 1)), n) ||
+        n == 0 || n > 65535) {
+        return false;
+    }
+    host = std::string(addr.substr(0, colon));
+    port = static_cast<int>(n);
+    return true;
+}
+
+} // namespace
+
+Cluster::Cluster(const std::string& self_id, const std::string& nodes_spec, KVStore& store)
+    : store_(store) {
+    for (size_t slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+        set_state(static_cast<uint16_t>(slot), SlotState());
+    }
+    if (!parse_nodes(nodes_spec)) {
+        return;
+    }
+    self_ = find_node(self_id);
+    if (self_ == NO_NODE) {
+        error_ = "--cluster-self " + self_id + " is not in --cluster-nodes";
+        return;
+    }
+    
+    size_t unassigned = 0;
+    size_t owned = 0;
+    for (size_t slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+        SlotState s = state(static_cast<uint16_t>(slot));
+        unassigned += s.owner == NO_NODE;
+        owned += s.owner == self_;
+    }
+    if (unassigned > 0) {
+        std::cerr << "Warning: " << unassigned << " hash slots are not assigned to any node" << std::endl;
+    }
+    std::cout << "Cluster node " << self_id << " owns " << owned << " of " << CLUSTER_SLOTS << " slots" << std::endl;
+}
+
+Cluster::SlotState Cluster::state(uint16_t slot) const {
+    uint64_t packed = slots_[slot].load(std::memory_order_acquire);
+    SlotState s;
+    s.owner = static_cast<uint16_t>(packed);
+    s.migrating = static_cast<uint16_t>(packed >> 16);
+    s.importing = static_cast<uint16_t>(packed >> 32);
+    return s;
+}
+
+void Cluster::set_state(uint16_t slot, const SlotState& s) {
+    uint64_t packed = s.owner | (static_cast<uint64_t>(s.migrating) << 16) | (static_cast<uint64_t>(s.importing) << 32);
+    slots_[slot].store(packed, std::memory_order_release);
+}
+
+bool Cluster::parse_nodes(const std::string& spec) {
+    std::vector<std::pair<uint16_t, std::string>> ranges; // Node index, slot list
+    size_t pos = 0;
+    while (pos <= spec.size()) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+        pos = comma == std::string::npos ? spec.size() + 1 : comma + 1;
+        
+        size_t eq = item.find('=');
+        size_t at = item.find('@');
+        ClusterNode node;
+        if (eq == std::string::npos || eq == 0 ||
+            !split_addr(std::string_view(item).substr(eq + 1, at == std::string::npos ? std::string::npos : at - eq - 1),
+                        node.host, node.port)) {
+            error_ = "bad --cluster-nodes entry '" + item + "', expected id=host:port[@slots]";
+            return false;
+        }
+        node.id = item.substr(0, eq);
+        if (find_node(node.id) != NO_NODE) {
+            error_ = "node " + node.id + " is listed twice";
+            return false;
+        }
+        if (at != std::string::npos) {
+            ranges.emplace_back(static_cast<uint16_t>(nodes_.size()), item.substr(at + 1));
+        }
+        nodes_.push_back(node);
+    }
+    if (nodes_.size() >= NO_NODE) {
+        error_ = "too many cluster nodes";
+        return false;
+    }
+    
+    if (ranges.empty()) {
+        size_t n = nodes_.size();
+        for (size_t slot = 0; slot < CLUSTER_SLOTS; ++slot) {
+            SlotState s;
+            s.owner = static_cast<uint16_t>(slot * n / CLUSTER_SLOTS);
+            set_state(static_cast<uint16_t>(slot), s);
+        }
+        return true;
+    }
+    
+    for (const auto& [index, list] : ranges) {
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t slash = list.find('/', start);
+            std::string_view text = std::string_view(list).substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+            start = slash == std::string::npos ? list.size() + 1 : slash + 1;
+            uint16_t first = 0;
+            uint16_t last = 0;
+            if (!parse_range(text, first, last)) {
+                error_ = "bad slot range '" + std::string(text) + "' for node " + nodes_[index].id;
+                return false;
+            }
+            for (size_t slot = first; slot <= last; ++slot) {
+                SlotState s = state(static_cast<uint16_t>(slot));
+                if (s.owner != NO_NODE) {
+                    error_ = "slot " + std::to_string(slot) + " is assigned twice";
+                    return false;
+                }
+                s.owner = index;
+                set_state(static_cast<uint16_t>(slot), s);
+            }
+        }
+    }
+    return true;
+}
+
+uint16_t Cluster::find_node(std::string_view id) {
+    std::lock_guard<std::mutex> lock(nodes_mtx_);
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        if (nodes_[i].id == id) {
+            return static_cast<uint16_t>(i);
+        }
+    }
+    return NO_NODE;
+}
+
+ClusterNode Cluster::node(uint16_t index) {
+    std::lock_guard<std::mutex> lock(nodes_mtx_);
+    return nodes_[index];
+}
+
+void Cluster::redirect(std::string& out, const char* kind, uint16_t slot, uint16_t node_index) {
+    out += kind;
+    out += " " + std::to_string(slot) + " " + node(node_index).addr() + "\n";
+}
+
+void Cluster::lock_shared(Guard& guard) {
+    { std::lock_guard<std::mutex> turn(turnstile_); }
+    guard = Guard(migrate_mtx_);
+}
+
+bool Cluster::route(const CommandView& cmd, bool asking, std::string& out, Guard& guard) {
+    // The keys the command reads or writes. VSIM's are its query, unless
+    // that is an inline vector, and its listed candidates; a PREFIX scan
+    // only covers the keys on this node.
+    thread_local std::vector<std::string_view> keys;
+    keys.clear();
+    switch (cmd.type) {
+        case CommandType::SET:
+        case CommandType::GET:
+        case CommandType::DEL:
+        case CommandType::MGET:
+        case CommandType::MSET:
+        case CommandType::VSET:
+        case CommandType::VGET:
+            for (size_t i = 0, n = write_count(cmd); i < n; ++i) {
+                keys.push_back(write_key(cmd, i));
+            }
+            break;
+        case CommandType::VSIM:
+            if (cmd.key.empty() || cmd.key.front() != '[') {
+                keys.push_back(cmd.key);
+            }
+            keys.insert(keys.end(), cmd.keys.begin(), cmd.keys.end());
+            break;
+        default:
+            return true;
+    }
+    
+    size_t count = keys.size();
+    while (true) {
+        bool migrating = false;
+        bool same_slot = true;
+        uint16_t first_slot = 0;
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t slot = key_slot(keys[i]);
+            if (i == 0) {
+                first_slot = slot;
+            }
+            same_slot = same_slot && slot == first_slot;
+            
+            SlotState s = state(slot);
+            if (s.owner == self_) {
+                migrating = migrating || s.migrating != NO_NODE;
+                continue;
+            }
+            if (asking && s.importing != NO_NODE) {
+                continue;
+            }
+            if (guard.owns_lock()) {
+                guard.unlock();
+            }
+            if (s.owner == NO_NODE) {
+                out += "ERROR: CLUSTERDOWN Hash slot " + std::to_string(slot) + " is not served\n";
+            } else {
+                redirect(out, "MOVED", slot, s.owner);
+            }
+            return false;
+        }
+        if (!migrating) {
+            return true;
+        }
+        if (!guard.owns_lock()) {
+            // Look again under the lock; a SETSLOT may have got in first
+            lock_shared(guard);
+            continue;
+        }
+        
+        // Keys MIGRATE has already moved are answered by the target
+        size_t checked = 0;
+        size_t missing = 0;
+        uint16_t target = NO_NODE;
+        for (size_t i = 0; i < count; ++i) {
+            std::string_view key = keys[i];
+            SlotState s = state(key_slot(key));
+            if (s.owner == self_ && s.migrating != NO_NODE) {
+                checked++;
+                target = s.migrating;
+                missing += !store_.contains(key);
+            }
+        }
+        if (missing == 0) {
+            return true;
+        }
+        guard.unlock();
+        if (missing == checked && same_slot) {
+            redirect(out, "ASK", first_slot, target);
+        } else {
+            out += "TRYAGAIN Multiple keys request during rehashing of slot\n";
+        }
+        return false;
+    }
+}
+
+void Cluster::execute(const CommandView& cmd, WriteBatcher& batcher, std::string& out) {
+    const std::string_view sub = cmd.key;
+    const std::vector<std::string_view>& args = cmd.keys;
+    
+    if (sub == "MYID" && args.empty()) {
+        out += node(self_).id + "\n";
+    } else if (sub == "NODES" && args.empty()) {
+        nodes_spec(out);
+        out += "\n";
+    } else if (sub == "SLOTS" && args.empty()) {
+        slots_json(out);
+        out += "\n";
+    } else if (sub == "KEYSLOT" && args.size() == 1) {
+        out += std::to_string(key_slot(args[0])) + "\n";
+    } else if (sub == "MEET") {
+        meet(args, out);
+    } else if (sub == "SETSLOT") {
+        setslot(args, out);
+    } else if (sub == "COUNTKEYSINSLOT" && args.size() == 1) {
+        uint16_t slot = 0;
+        if (!parse_range(args[0], slot, slot)) {
+            out += "ERROR: Invalid slot\n";
+            return;
+        }
+        out += std::to_string(keys_in_slots(slot, slot, static_cast<size_t>(-1), nullptr)) + "\n";
+    } else if (sub == "GETKEYSINSLOT" && args.size() == 2) {
+        uint16_t slot = 0;
+        uint64_t limit = 0;
+        if (!parse_range(args[0], slot, slot) || !parse_u64(std::string(args[1]), limit)) {
+            out += "ERROR: Invalid slot or count\n";
+            return;
+        }
+        std::vector<std::string> keys;
+        keys_in_slots(slot, slot, limit, &keys);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            out += i > 0 ? " " : "";
+            out += keys[i];
+        }
+        out += "\n";
+    } else if (sub == "MIGRATE") {
+        migrate(args, batcher, out);
+    } else if (sub == "RESTORE" && args.size() == 1) {
+        restore(args[0], out);
+    } else {
+        out += "ERROR: Unknown CLUSTER subcommand or wrong number of arguments\n";
+    }
+}
+
+// The current layout in --cluster-nodes form, so a restarted node can be
+// given it back
+void Cluster::nodes_spec(std::string& out) {
+    size_t node_count;
+    {
+        std::lock_guard<std::mutex> lock(nodes_mtx_);
+        node_count = nodes_.size();
+    }
+    std::vector<std::string> lists(node_count);
+    
+    size_t first = 0;
+    for (size_t slot = 1; slot <= CLUSTER_SLOTS; ++slot) {
+        uint16_t owner = state(static_cast<uint16_t>(first)).owner;
+        if (slot < CLUSTER_SLOTS && state(static_cast<uint16_t>(slot)).owner == owner) {
+            continue;
+        }
+        if (owner != NO_NODE) {
+            lists[owner] += (lists[owner].empty() ? "" : "/") + range_text(first, slot - 1);
+        }
+        first = slot;
+    }
+    
+    for (size_t i = 0; i < node_count; ++i) {
+        ClusterNode n = node(static_cast<uint16_t>(i));
+        out += i > 0 ? "," : "";
+        out += n.id + "=" + n.addr();
+        if (!lists[i].empty()) {
+            out += "@" + lists[i];
+        }
+    }
+}
+
+// [{"start":0,"end":5460,"id":"a","addr":"10.0.0.1:7001"},...], contiguous
+// ranges with one owner, plus the ranges being migrated away from here
+void Cluster::slots_json(std::string& out) {
+    out += "[";
+    bool any = false;
+    size_t first = 0;
+    for (size_t slot = 1; slot <= CLUSTER_SLOTS; ++slot) {
+        SlotState a = state(static_cast<uint16_t>(first));
+        if (slot < CLUSTER_SLOTS) {
+            SlotState b = state(static_cast<uint16_t>(slot));
+            if (b.owner == a.owner && b.migrating == a.migrating && b.importing == a.importing) {
+                continue;
+            }
+        }
+        if (a.owner != NO_NODE) {
+            ClusterNode n = node(a.owner);
+            out += any ? "," : "";
+            out += "{\"start\":" + std::to_string(first) + ",\"end\":" + std::to_string(slot - 1);
+            out += ",\"id\":\"" + n.id + "\",\"addr\":\"" + n.addr() + "\"";
+            if (a.migrating != NO_NODE) {
+                out += ",\"migrating\":\"" + node(a.migrating).id + "\"";
+            }
+            if (a.importing != NO_NODE) {
+                out += ",\"importing\":\"" + node(a.importing).id + "\"";
+            }
+            out += "}";
+            any = true;
+        }
+        first = slot;
+    }
+    out += "]";
+}
+
+// CLUSTER MEET <id> <host:port>: adds a node (owning no slots) or moves one
+void Cluster::meet(const std::vector<std::string_view>& args, std::string& out) {
+    ClusterNode n;
+    if (args.size() != 2 || args[0].empty() || args[0].find_first_of("=@,") != std::string_view::npos ||
+        !split_addr(args[1], n.host, n.port)) {
+        out += "ERROR: Usage: CLUSTER MEET <id> <host:port>\n";
+        return;
+    }
+    n.id = std::string(args[0]);
+    
+    std::lock_guard<std::mutex> lock(nodes_mtx_);
+    for (ClusterNode& existing : nodes_) {
+        if (existing.id == n.id) {
+            existing = n;
+            out += "OK\n";
+            return;
+        }
+    }
+    if (nodes_.size() + 1 >= NO_NODE) {
+        out += "ERROR: Too many cluster nodes\n";
+        return;
+    }
+    nodes_.push_back(n);
+    out += "OK\n";
+}
+
+// CLUSTER SETSLOT <slots> MIGRATING|IMPORTING|NODE <id> | STABLE
+void Cluster::setslot(const std::vector<std::string_view>& args, std::string& out) {
+    uint16_t first = 0;
+    uint16_t last = 0;
+    if (args.size() < 2 || !parse_range(args[0], first, last)) {
+        out += "ERROR: Usage: CLUSTER SETSLOT <slot>[-<last>] MIGRATING|IMPORTING|NODE <id> | STABLE\n";
+        return;
+    }
+    std::string_view action = args[1];
+    uint16_t target = NO_NODE;
+    if (action == "STABLE") {
+        if (args.size() != 2) {
+            out += "ERROR: CLUSTER SETSLOT STABLE takes no node\n";
+            return;
+        }
+    } else if (action == "MIGRATING" || action == "IMPORTING" || action == "NODE") {
+        if (args.size() != 3 || (target = find_node(args[2])) == NO_NODE) {
+            out += "ERROR: Unknown node " + std::string(args.size() == 3 ? args[2] : "") + "\n";
+            return;
+        }
+    } else {
+        out += "ERROR: Unknown CLUSTER SETSLOT action " + std::string(action) + "\n";
+        return;
+    }
+    
+    // Exclusive: commands on migrating slots finish before the map changes
+    std::lock_guard<std::mutex> turn(turnstile_);
+    std::unique_lock<std::shared_mutex> lock(migrate_mtx_);
+    
+    bool giving_away = false;
+    for (size_t slot = first; slot <= last; ++slot) {
+        SlotState s = state(static_cast<uint16_t>(slot));
+        if (action == "MIGRATING" && (s.owner != self_ || target == self_)) {
+            out += "ERROR: Hash slot " + std::to_string(slot) + " is not owned here, or the target is this node\n";
+            return;
+        }
+        if (action == "IMPORTING" && (s.owner == self_ || target == self_)) {
+            out += "ERROR: Hash slot " + std::to_string(slot) + " is already owned here, or the source is this node\n";
+            return;
+        }
+        giving_away = giving_away || (action == "NODE" && s.owner == self_ && target != self_);
+    }
+    if (giving_away) {
+        size_t left = keys_in_slots(first, last, static_cast<size_t>(-1), nullptr);
+        if (left > 0) {
+            out += "ERROR: Slots " + range_text(first, last) + " still hold " + std::to_string(left) +
+                   " keys here, CLUSTER MIGRATE them first\n";
+            return;
+        }
+    }
+    
+    for (size_t slot = first; slot <= last; ++slot) {
+        SlotState s = state(static_cast<uint16_t>(slot));
+        if (action == "MIGRATING") {
+            s.migrating = target;
+        } else if (action == "IMPORTING") {
+            s.importing = target;
+        } else if (action == "NODE") {
+            s = SlotState();
+            s.owner = target;
+        } else {
+            s.migrating = NO_NODE;
+            s.importing = NO_NODE;
+        }
+        set_state(static_cast<uint16_t>(slot), s);
+    }
+    out += "OK\n";
+}
+
+// CLUSTER MIGRATE <slots> [count]: moves up to count keys of migrating
+// slots to their target and replies with how many moved; 0 means none are
+// left. Keys go in shard groups, one round trip to the target each; the
+// shard lock is only held to copy and to delete, never across the send.
+void Cluster::migrate(const std::vector<std::string_view>& args, WriteBatcher& batcher, std::string& out) {
+    uint16_t first = 0;
+    uint16_t last = 0;
+    uint64_t limit = MIGRATE_DEFAULT_COUNT;
+    if (args.empty() || args.size() > 2 || !parse_range(args[0], first, last) ||
+        (args.size() == 2 && (!parse_u64(std::string(args[1]), limit) || limit == 0))) {
+        out += "ERROR: Usage: CLUSTER MIGRATE <slot>[-<last>] [count]\n";
+        return;
+    }
+    
+    uint16_t target = state(first).migrating;
+    for (size_t slot = first; slot <= last; ++slot) {
+        SlotState s = state(static_cast<uint16_t>(slot));
+        if (s.owner != self_ || s.migrating == NO_NODE || s.migrating != target) {
+            out += "ERROR: Slots " + range_text(first, last) + " are not all migrating to one node\n";
+            return;
+        }
+    }
+    
+    batcher.drain();
+    std::vector<std::string> keys;
+    if (keys_in_slots(first, last, limit, &keys) == 0) {
+        out += "0\n";
+        return;
+    }
+    
+    ClusterNode to = node(target);
+    int fd = connect_to(to.host, to.port);
+    if (fd < 0) {
+        out += "ERROR: MIGRATE could not connect to " + to.addr() + "\n";
+        return;
+    }
+    timeval timeout{MIGRATE_TIMEOUT_S, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    long long moved;
+    {
+        std::lock_guard<std::mutex> turn(turnstile_);
+        std::unique_lock<std::shared_mutex> lock(migrate_mtx_);
+        std::string in;
+        std::string line;
+        moved = store_.move_keys(keys, [&](const std::string& records) {
+            std::string header = "*3\r\n$7\r\nCLUSTER\r\n$7\r\nRESTORE\r\n$" + std::to_string(records.size()) + "\r\n";
+            if (!send_all(fd, header) || !send_all(fd, records) || !send_all(fd, "\r\n") || !read_line(fd, in, line)) {
+                return false;
+            }
+            if (line != "OK") {
+                std::cerr << "Warning: MIGRATE to " << to.addr() << " refused: " << line << std::endl;
+                return false;
+            }
+            return true;
+        });
+    }
+    close(fd);
+    
+    if (moved < 0) {
+        out += "ERROR: MIGRATE to " + to.addr() + " failed; the keys not moved stay here\n";
+        return;
+    }
+    out += std::to_string(moved) + "\n";
+}
+
+// CLUSTER RESTORE <records>, sent by a migrating node: WAL records for
+// slots owned or being imported here
+void Cluster::restore(std::string_view data, std::string& out) {
+    std::vector<WalRecord> records;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        WalRecord rec;
+        size_t consumed = 0;
+        if (WriteAheadLog::decode(data.data() + pos, data.size() - pos, rec, consumed) != WriteAheadLog::DecodeStatus::OK) {
+            out += "ERROR: Corrupt RESTORE payload\n";
+            return;
+        }
+        int refused = -1; // First slot not served here
+        WriteAheadLog::for_each(rec, [&](const WalRecord& r) {
+            uint16_t slot = key_slot(r.key);
+            SlotState s = state(slot);
+            if (s.owner != self_ && s.importing == NO_NODE) {
+                refused = slot;
+            }
+        });
+        if (refused >= 0) {
+            out += "ERROR: Hash slot " + std::to_string(refused) + " is neither owned nor importing here\n";
+            return;
+        }
+        records.push_back(rec);
+        pos += consumed;
+    }
+    
+    // The source deletes its copies on OK, so ours must be in the log first
+    if (!store_.wait_durable(store_.apply_replicated(records))) {
+        out += write_error(WriteStatus::IO_ERROR);
+        return;
+    }
+    out += "OK\n";
+}
+
+size_t Cluster::keys_in_slots(uint16_t first, uint16_t last, size_t limit, std::vector<std::string>* keys) {
+    return store_.scan_keys([first, last](std::string_view key) {
+        uint16_t slot = key_slot(key);
+        return slot >= first && slot <= last;
+    }, limit, keys);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "slots.h"
+#include "../storage/kv_store.h"
+#include "../batching/write_batcher.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ClusterNode {
+    std::string id;
+    std::string host;
+    int port = 0;
+    
+    std::string addr() const { return host + ":" + std::to_string(port); }
+};
+
+// Hash-slot cluster (--cluster-nodes, --cluster-self). Every node is started
+// with the same node list and there is no gossip: the slot map only changes
+// through CLUSTER SETSLOT, which an operator (or tools/cluster_admin) sends
+// to every node. A command runs here when all of its keys' slots are owned
+// here; otherwise the client gets "MOVED <slot> <host:port>" and is expected
+// to update its map and go there directly. Keys of several slots may be
+// combined freely as long as this node owns them all.
+//
+// Online migration of slots from A to B, as in Redis Cluster:
+//   B: CLUSTER SETSLOT <slots> IMPORTING A
+//   A: CLUSTER SETSLOT <slots> MIGRATING B
+//   A: CLUSTER MIGRATE <slots> [count]      repeated until it replies 0
+//   all: CLUSTER SETSLOT <slots> NODE B
+// While a slot is migrating, A serves the keys it still holds and answers
+// "ASK <slot> <host:port>" for the rest; B serves an importing slot only to
+// a client that sent ASKING first. MIGRATE copies keys to B as WAL records
+// with their absolute expiry and deletes them here once B has applied them.
+// Commands on a migrating slot hold a shared migration lock from the
+// existence check to the end of execution, and MIGRATE holds it exclusively,
+// so a key is never seen missing from both nodes or present on both.
+class Cluster {
+public:
+    // spec: id=host:port[@first-last[/first-last...]],... When no node lists
+    // slots they are split evenly, in order.
+    Cluster(const std::string& self_id, const std::string& nodes_spec, KVStore& store);
+    
+    bool valid() const { return error_.empty(); }
+    const std::string& error() const { return error_; }
+    
+    // Decides whether cmd runs here. Appends the redirect or error and
+    // returns false if not. When cmd touches a migrating slot, guard comes
+    // back locked and must be held until cmd has executed.
+    using Guard = std::shared_lock<std::shared_mutex>;
+    bool route(const CommandView& cmd, bool asking, std::string& out, Guard& guard);
+    
+    // Whether this node owns key's slot, migrating or not
+    bool owns(std::string_view key) const { return state(key_slot(key)).owner == self_; }
+    
+    // CLUSTER <subcommand>. MIGRATE first drains the write batcher, so writes
+    // queued before the slots began migrating are applied, and moved, too.
+    void execute(const CommandView& cmd, WriteBatcher& batcher, std::string& out);
+
+private:
+    // One slot's owner and migration state, packed for a single load
+    static constexpr uint16_t NO_NODE = 0xFFFF;
+    struct SlotState {
+        uint16_t owner = NO_NODE;
+        uint16_t migrating = NO_NODE; // Target, on the owner
+        uint16_t importing = NO_NODE; // Source, on the target
+    };
+    
+    SlotState state(uint16_t slot) const;
+    void set_state(uint16_t slot, const SlotState& state);
+    
+    bool parse_nodes(const std::string& spec);
+    uint16_t find_node(std::string_view id);
+    ClusterNode node(uint16_t index);
+    void redirect(std::string& out, const char* kind, uint16_t slot, uint16_t node_index);
+    void lock_shared(Guard& guard);
+    
+    void nodes_spec(std::string& out);
+    void slots_json(std::string& out);
+    void meet(const std::vector<std::string_view>& args, std::string& out);
+    void setslot(const std::vector<std::string_view>& args, std::string& out);
+    void migrate(const std::vector<std::string_view>& args, WriteBatcher& batcher, std::string& out);
+    void restore(std::string_view records, std::string& out);
+    size_t keys_in_slots(uint16_t first, uint16_t last, size_t limit, std::vector<std::string>* keys);
+    
+    KVStore& store_;
+    std::string error_;
+    uint16_t self_ = NO_NODE;
+    
+    std::mutex nodes_mtx_;               // Guards nodes_; CLUSTER MEET appends
+    std::vector<ClusterNode> nodes_;
+    std::atomic<uint64_t> slots_[CLUSTER_SLOTS];
+    
+    // Shared by commands on migrating slots, exclusive for MIGRATE and
+    // SETSLOT. The turnstile stops a stream of readers starving them.
+    std::shared_mutex migrate_mtx_;
+    std::mutex turnstile_;
+    
+    static constexpr size_t MIGRATE_DEFAULT_COUNT = 1000;
+    static constexpr int MIGRATE_TIMEOUT_S = 10;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Cluster keyspace: every key maps to one of CLUSTER_SLOTS hash slots, and
+// slots are assigned to nodes. The slot is CRC16 (XMODEM) of the key mod
+// 16384, as in Redis Cluster, so existing client routing tables carry over.
+// A non-empty "{tag}" in the key hashes only the tag, which lets related
+// keys share a slot. Header-only so the client tools can route too.
+constexpr size_t CLUSTER_SLOTS = 16384;
+
+namespace slot_detail {
+
+constexpr std::array<uint16_t, 256> make_crc16_table() {
+    std::array<uint16_t, 256> table{};
+    for (unsigned i = 0; i < 256; ++i) {
+        uint16_t crc = static_cast<uint16_t>(i << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> CRC16_TABLE = make_crc16_table();
+
+} // namespace slot_detail
+
+inline uint16_t crc16(const char* data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t index = static_cast<uint8_t>((crc >> 8) ^ static_cast<uint8_t>(data[i]));
+        crc = static_cast<uint16_t>((crc << 8) ^ slot_detail::CRC16_TABLE[index]);
+    }
+    return crc;
+}
+
+inline uint16_t key_slot(std::string_view key) {
+    size_t open = key.find('{');
+    if (open != std::string_view::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close > open + 1) {
+            key = key.substr(open + 1, close - open - 1);
+        }
+    }
+    return static_cast<uint16_t>(crc16(key.data(), key.size()) & (CLUSTER_SLOTS - 1));
+}
@@ -0,0 +1,147 @@
+#include "affinity.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace {
+
+// "0-3,8-11" as in /sys/devices/system/node/node<N>/cpulist
+std::vector<int> parse_cpu_list(const std::string& list) {
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch (...) {
+            // Blank or malformed range
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+struct Topology {
+    std::vector<int> cpus;               // Allowed CPUs, ascending
+    std::vector<std::vector<int>> nodes; // Allowed CPUs of each node that has any
+    std::vector<int> node_ids;           // Kernel node number of nodes[i]
+};
+
+Topology read_topology() {
+    Topology topo;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return topo;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            topo.cpus.push_back(cpu);
+        }
+    }
+    
+    std::vector<int> ids;
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                name.find_first_not_of("0123456789", 4) == std::string::npos) {
+                ids.push_back(std::stoi(name.substr(4)));
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+    
+    for (int node : ids) {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus;
+        for (int cpu : parse_cpu_list(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.push_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            topo.nodes.push_back(std::move(cpus));
+            topo.node_ids.push_back(node);
+        }
+    }
+    return topo;
+}
+
+// Read once; the allowed set is taken before any thread pins itself
+const Topology& topology() {
+    static const Topology topo = read_topology();
+    return topo;
+}
+
+int node_of(const Topology& topo, int cpu) {
+    for (size_t n = 0; n < topo.nodes.size(); ++n) {
+        for (int c : topo.nodes[n]) {
+            if (c == cpu) {
+                return topo.node_ids[n];
+            }
+        }
+    }
+    return -1;
+}
+
+bool pin_to(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace
+
+int pin_current_thread(Affinity affinity, size_t index, size_t count) {
+    const Topology& topo = topology();
+    if (affinity == Affinity::NONE || topo.cpus.empty()) {
+        return -1;
+    }
+    
+    if (affinity == Affinity::CPU || topo.nodes.empty()) {
+        int cpu = topo.cpus[index % topo.cpus.size()];
+        return pin_to({cpu}) ? node_of(topo, cpu) : -1;
+    }
+    
+    // Contiguous blocks of threads per node, so neighbours share a node
+    size_t n = count > 0 ? (index % count) * topo.nodes.size() / count : 0;
+    return pin_to(topo.nodes[n]) ? topo.node_ids[n] : -1;
+}
+
+size_t numa_node_count() {
+    size_t nodes = topology().nodes.size();
+    return nodes > 0 ? nodes : 1;
+}
+
+#else
+
+int pin_current_thread(Affinity, size_t, size_t) {
+    return -1;
+}
+
+size_t numa_node_count() {
+    return 1;
+}
+
+#endif
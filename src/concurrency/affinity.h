@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+enum class Affinity {
+    NONE, // Left to the OS scheduler
+    CPU,  // One CPU per thread
+    NUMA  // The CPUs of one NUMA node per thread, threads spread evenly over nodes
+};
+
+// Pins the calling thread, the index-th of count threads placed together,
+// according to affinity. CPUs are taken from the process's allowed set in
+// order, so CPU pinning also fills one node before the next. Returns the NUMA
+// node the thread now runs on, or -1 when unpinned or unknown. Failing to pin
+// only costs locality, so errors are not reported.
+int pin_current_thread(Affinity affinity, size_t index, size_t count);
+
+// NUMA nodes with at least one allowed CPU; 1 without NUMA information
+size_t numa_node_count();
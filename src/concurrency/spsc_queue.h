@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded single-producer single-consumer ring. One thread pushes and one
+// thread pops, so each index has a single writer and the ring needs no
+// read-modify-write atomics. Each side keeps a cached copy of the other's
+// index and only reloads it when the ring looks full (or empty), so in steady
+// state a push or pop touches no cache line the other thread is writing.
+template <typename T>
+class SpscQueue {
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        slots_.reset(new T[n]);
+        mask_ = n - 1;
+    }
+    
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+    
+    // Producer only. Returns false when the ring is full.
+    bool push(const T& item) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer only. Returns false when the ring is empty.
+    bool pop(T& item) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_) {
+                return false;
+            }
+        }
+        item = slots_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Consumer only
+    bool empty() const {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+private:
+    // Consumer side
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;
+    
+    // Producer side
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;
+    
+    alignas(64) std::unique_ptr<T[]> slots_;
+    size_t mask_ = 0;
+};
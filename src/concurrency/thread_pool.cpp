@@ -1,57 +1,102 @@
 #include "thread_pool.h"
 #include <iostream>
 
-ThreadPool::ThreadPool(size_t num_threads, std::function<void(int)> handler)
-    : stop_(false), handler_(handler) {
+namespace {
+
+// The pool and worker the current thread belongs to, if any
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t num_threads, const ThreadPoolOptions& options) : options_(options) {
+    if (num_threads == 0) {
+        num_threads = 1;
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    // Every deque exists before any worker starts stealing
     for (size_t i = 0; i < num_threads; ++i) {
-        workers_.emplace_back([this] { worker_loop(); });
+        workers_[i]->thread = std::thread([this, i] { worker_loop(i); });
     }
 }
 
-void ThreadPool::worker_loop() {
+bool ThreadPool::take(size_t index, Task& task) {
+    size_t n = workers_.size();
+    for (size_t k = 0; k < n; ++k) {
+        Worker& worker = *workers_[(index + k) % n];
+        std::lock_guard<std::mutex> lock(worker.mtx);
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    current_pool = this;
+    current_worker = index;
+    pin_current_thread(options_.affinity, index, workers_.size());
+    
     while (true) {
-        int socket;
-        
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex_);
-            condition_.wait(lock, [this] { 
-                return stop_ || !tasks_.empty(); 
-            });
-            
-            if (stop_ && tasks_.empty()) {
-                return;
-            }
-            
-            socket = tasks_.front();
-            tasks_.pop();
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
         }
         
-        handler_(socket);
+        // Registering as a sleeper before re-checking queued_ pairs with
+        // enqueue(), which bumps queued_ before checking for sleepers: one
+        // of the two always sees the other
+        std::unique_lock<std::mutex> lock(sleep_mtx_);
+        sleepers_.fetch_add(1);
+        condition_.wait(lock, [this] {
+            return stop_.load() || queued_.load() > 0;
+        });
+        sleepers_.fetch_sub(1);
+        
+        if (stop_.load() && queued_.load() == 0) {
+            return;
+        }
     }
 }
 
-void ThreadPool::enqueue(int client_socket) {
+void ThreadPool::enqueue(Task task) {
+    if (stop_.load(std::memory_order_relaxed)) {
+        return;
+    }
+    
+    size_t target = current_pool == this
+        ? current_worker
+        : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        if (stop_) {
-            return;
-        }
-        tasks_.push(client_socket);
+        Worker& worker = *workers_[target];
+        std::lock_guard<std::mutex> lock(worker.mtx);
+        worker.tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1);
+    
+    if (sleepers_.load() > 0) {
+        // Taking the lock waits out a worker between its check and its wait
+        { std::lock_guard<std::mutex> lock(sleep_mtx_); }
+        condition_.notify_one();
     }
-    condition_.notify_one();
 }
 
 ThreadPool::~ThreadPool() {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
+        std::lock_guard<std::mutex> lock(sleep_mtx_);
         stop_ = true;
     }
     condition_.notify_all();
     
-    for (std::thread& worker : workers_) {
-        if (worker.joinable()) {
-            worker.join();
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
         }
     }
 }
-
@@ -1,26 +1,52 @@
 #pragma once
 
-#include <queue>
+#include "affinity.h"
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <vector>
 #include <functional>
 
+struct ThreadPoolOptions {
+    Affinity affinity = Affinity::NONE; // Worker i is pinned as the i-th of size() threads
+};
+
+// Each worker has its own task deque behind its own mutex. Tasks enqueued
+// from outside the pool are dealt round-robin across the deques, and a task
+// enqueued by a worker goes to that worker's deque. A worker runs its own
+// tasks oldest first and, once its deque is empty, steals the oldest task of
+// the next non-empty deque after its own, so submitters and workers rarely
+// meet on the same lock. Workers only sleep when every deque is empty.
 class ThreadPool {
 public:
-    ThreadPool(size_t num_threads, std::function<void(int)> handler);
-    void enqueue(int client_socket);
+    using Task = std::function<void()>;
+    
+    explicit ThreadPool(size_t num_threads, const ThreadPoolOptions& options = {});
+    void enqueue(Task task);
+    size_t size() const { return workers_.size(); }
     ~ThreadPool();
 
 private:
-    std::vector<std::thread> workers_;
-    std::queue<int> tasks_;
-    std::mutex queue_mutex_;
-    std::condition_variable condition_;
-    bool stop_;
-    std::function<void(int)> handler_;
+    struct alignas(64) Worker {
+        std::mutex mtx;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
     
-    void worker_loop();
+    void worker_loop(size_t index);
+    bool take(size_t index, Task& task); // Own deque, then steal
+    
+    ThreadPoolOptions options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_{0};       // Round-robin target for outside submitters
+    std::atomic<size_t> queued_{0};     // Tasks in all deques
+    
+    // Idle workers sleep here; enqueue() only takes sleep_mtx_ when one is
+    std::mutex sleep_mtx_;
+    std::condition_variable condition_;
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<bool> stop_{false};
 };
-
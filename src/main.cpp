@@ -1,16 +1,313 @@
 #include "net/server.h"
 #include "storage/kv_store.h"
+#include "protocol/parser.h"
+#include "metrics/metrics.h"
+#include "replication/primary.h"
+#include "replication/replica.h"
+#include "cluster/cluster.h"
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
 #include <thread>
 
-int main() {
-    KVStore store("../data/wal.log");
+namespace {
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --port <n>          TCP port (default 8080)\n"
+              << "  --threads <n>       Executor threads (default: hardware concurrency)\n"
+              << "  --io <mode>         reactor | threaded | percore (default reactor)\n"
+              << "  --reactors <n>      Reactor threads in reactor mode (default 2)\n"
+              << "  --cores <n>         Event loops in percore mode, at most --shards (default --threads)\n"
+              << "  --affinity <m>      none | cpu | numa pinning of executor threads and cores\n"
+              << "                      (default none for executors, cpu for percore cores)\n"
+              << "  --parser-scan <m>   simd | scalar delimiter scanning (default simd)\n"
+              << "  --appendfsync <p>   no | everysec | always WAL sync policy (default everysec)\n"
+              << "  --batch-size <n>    Writes per batch before an early flush (default 256)\n"
+              << "  --batch-latency-us <n>  Max time a write waits in the batcher (default 1000)\n"
+              << "  --write-ack <m>     immediate | applied | durable reply for SET/DEL (default immediate)\n"
+              << "  --batch-multi-key <yes|no>  Queue MSET and multi-key DEL in the batcher (default yes)\n"
+              << "  --shards <n>        Storage shards, a power of two (default 16)\n"
+              << "  --maxmemory <size>  Memory budget, e.g. 512mb or 4gb (default 0 = unlimited)\n"
+              << "  --maxmemory-policy <p>  noeviction | allkeys-lru | allkeys-lfu (default allkeys-lru)\n"
+              << "  --tier-path <dir>   Tiered storage: move cold values to a log in this directory\n"
+              << "  --tier-memory <size>  Entry memory kept in RAM with --tier-path, e.g. 1gb\n"
+              << "  --compress-min-size <size>  LZ4-compress values at least this large, e.g. 1kb\n"
+              << "                      (default 0 = off)\n"
+              << "  --hot-keys <n>      Track the n most read keys, at most 64, and serve their GETs\n"
+              << "                      from per-thread copies (default 16, 0 = off)\n"
+              << "  --import <file>     Bulk-load a text or binary dump at startup, then snapshot\n"
+              << "  --import-dir <dir>  Allow IMPORT <name> of dumps in this directory (default off)\n"
+              << "  --slowlog-slower-than <us>  Log requests slower than this; -1 disables (default 10000)\n"
+              << "  --slowlog-max-len <n>  Slow log entries kept (default 128)\n"
+              << "  --repl-port <n>     Accept replicas on this port (default 0 = off)\n"
+              << "  --repl-backlog <size>  Replication backlog kept for resuming replicas (default 64mb)\n"
+              << "  --replicaof <host:port>  Run as a read-only replica of that replication port\n"
+              << "  --cluster-nodes <spec>  Cluster mode: id=host:port[@slots],... for every node;\n"
+              << "                      slots are first-last ranges joined by '/' (default: even split)\n"
+              << "  --cluster-self <id>  This node's id in --cluster-nodes\n";
+}
+
+// Accepts a plain byte count or a kb/mb/gb suffix. Returns false on junk.
+bool parse_size(const std::string& text, size_t& out) {
+    size_t pos = 0;
+    unsigned long long n;
+    try {
+        n = std::stoull(text, &pos);
+    } catch (...) {
+        return false;
+    }
+    
+    std::string unit = text.substr(pos);
+    for (auto& c : unit) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    
+    if (unit.empty() || unit == "b") {
+        out = n;
+    } else if (unit == "kb" || unit == "k") {
+        out = n << 10;
+    } else if (unit == "mb" || unit == "m") {
+        out = n << 20;
+    } else if (unit == "gb" || unit == "g") {
+        out = n << 30;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    ServerOptions options;
+    StoreOptions store_options;
+    long long slowlog_slower_than_us = 10000;
+    size_t slowlog_max_len = 128;
+    int repl_port = 0;
+    size_t repl_backlog = 64 * 1024 * 1024;
+    std::string replicaof_host;
+    int replicaof_port = 0;
+    std::string cluster_nodes;
+    std::string cluster_self;
+    std::string import_path;
     
     size_t num_threads = std::thread::hardware_concurrency();
     if (num_threads == 0) {
         num_threads = 8;
     }
+    options.num_threads = num_threads;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        
+        if (arg == "--port") {
+            options.port = std::stoi(value);
+        } else if (arg == "--threads") {
+            options.num_threads = std::stoul(value);
+        } else if (arg == "--reactors") {
+            options.num_reactors = std::stoul(value);
+        } else if (arg == "--cores") {
+            options.num_cores = std::stoul(value);
+        } else if (arg == "--affinity") {
+            Affinity affinity;
+            if (value == "none") {
+                affinity = Affinity::NONE;
+            } else if (value == "cpu") {
+                affinity = Affinity::CPU;
+            } else if (value == "numa") {
+                affinity = Affinity::NUMA;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            options.executor_affinity = affinity;
+            options.core_affinity = affinity;
+        } else if (arg == "--io") {
+            if (value == "reactor") {
+                options.mode = ServerMode::REACTOR;
+            } else if (value == "threaded") {
+                options.mode = ServerMode::THREADED;
+            } else if (value == "percore") {
+                options.mode = ServerMode::PER_CORE;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--appendfsync") {
+            if (value == "no") {
+                store_options.fsync_policy = FsyncPolicy::NO;
+            } else if (value == "everysec") {
+                store_options.fsync_policy = FsyncPolicy::EVERYSEC;
+            } else if (value == "always") {
+                store_options.fsync_policy = FsyncPolicy::ALWAYS;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--batch-size") {
+            options.batching.max_batch = std::stoul(value);
+        } else if (arg == "--batch-latency-us") {
+            options.batching.max_latency_us = std::stoul(value);
+        } else if (arg == "--write-ack") {
+            if (value == "immediate") {
+                options.batching.ack_mode = AckMode::IMMEDIATE;
+            } else if (value == "applied") {
+                options.batching.ack_mode = AckMode::APPLIED;
+            } else if (value == "durable") {
+                options.batching.ack_mode = AckMode::DURABLE;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--batch-multi-key") {
+            if (value == "yes") {
+                options.batching.multi_key = true;
+            } else if (value == "no") {
+                options.batching.multi_key = false;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--shards") {
+            store_options.shard_count = std::stoul(value);
+        } else if (arg == "--maxmemory") {
+            if (!parse_size(value, store_options.maxmemory_bytes)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--maxmemory-policy") {
+            if (value == "noeviction") {
+                store_options.eviction_policy = EvictionPolicy::NOEVICTION;
+            } else if (value == "allkeys-lru") {
+                store_options.eviction_policy = EvictionPolicy::ALLKEYS_LRU;
+            } else if (value == "allkeys-lfu") {
+                store_options.eviction_policy = EvictionPolicy::ALLKEYS_LFU;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--tier-path") {
+            store_options.tier_path = value;
+        } else if (arg == "--tier-memory") {
+            if (!parse_size(value, store_options.tier_memory_bytes) || store_options.tier_memory_bytes == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--compress-min-size") {
+            if (!parse_size(value, store_options.compress_min_bytes)) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--hot-keys") {
+            store_options.hot_keys = std::stoul(value);
+        } else if (arg == "--import") {
+            import_path = value;
+        } else if (arg == "--import-dir") {
+            store_options.import_dir = value;
+        } else if (arg == "--slowlog-slower-than") {
+            slowlog_slower_than_us = std::stoll(value);
+        } else if (arg == "--slowlog-max-len") {
+            slowlog_max_len = std::stoul(value);
+        } else if (arg == "--repl-port") {
+            repl_port = std::stoi(value);
+        } else if (arg == "--repl-backlog") {
+            if (!parse_size(value, repl_backlog) || repl_backlog == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--replicaof") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos || colon == 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            replicaof_host = value.substr(0, colon);
+            replicaof_port = std::stoi(value.substr(colon + 1));
+        } else if (arg == "--cluster-nodes") {
+            cluster_nodes = value;
+        } else if (arg == "--cluster-self") {
+            cluster_self = value;
+        } else if (arg == "--parser-scan") {
+            if (value == "simd") {
+                Parser::set_scan_mode(Parser::ScanMode::SIMD);
+            } else if (value == "scalar") {
+                Parser::set_scan_mode(Parser::ScanMode::SCALAR);
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (!store_options.tier_path.empty() && store_options.tier_memory_bytes == 0) {
+        std::cerr << "--tier-path needs --tier-memory" << std::endl;
+        return 1;
+    }
+    
+    Metrics::instance().slowlog.configure(slowlog_max_len, slowlog_slower_than_us);
+    
+    if (!import_path.empty() && !replicaof_host.empty()) {
+        std::cerr << "--import cannot be used with --replicaof" << std::endl;
+        return 1;
+    }
+    
+    KVStore store("../data/wal.log", store_options);
+    
+    std::unique_ptr<Cluster> cluster;
+    if (!cluster_nodes.empty() || !cluster_self.empty()) {
+        cluster = std::make_unique<Cluster>(cluster_self, cluster_nodes, store);
+        if (!cluster->valid()) {
+            std::cerr << "Invalid cluster configuration: " << cluster->error() << std::endl;
+            return 1;
+        }
+        options.cluster = cluster.get();
+        store.set_import_filter([&cluster](std::string_view key) { return cluster->owns(key); });
+    }
+    
+    // Before replicas can attach, so their first full sync has the keys
+    if (!import_path.empty()) {
+        KVStore::ImportResult result = store.import_file(import_path);
+        if (!result.error.empty()) {
+            std::cerr << "Import of " << import_path << " failed: " << result.error << std::endl;
+            return 1;
+        }
+        std::cout << "Imported " << result.imported << " keys from " << import_path << " in " << result.ms
+                  << "ms (" << result.skipped << " records skipped, " << result.refused << " refused)" << std::endl;
+    }
+    
+    // A replica's own writes are not logged in a form its replicas could
+    // follow (a full sync clears it silently), so replicas do not chain
+    std::unique_ptr<ReplicationPrimary> primary;
+    std::unique_ptr<ReplicaClient> replica;
+    if (!replicaof_host.empty()) {
+        if (repl_port > 0) {
+            std::cerr << "Warning: --repl-port is ignored on a replica" << std::endl;
+        }
+        replica = std::make_unique<ReplicaClient>(replicaof_host, replicaof_port, store);
+        store.set_role_reporter([&replica](std::string& out) { replica->describe(out); });
+        replica->start();
+    } else if (repl_port > 0) {
+        primary = std::make_unique<ReplicationPrimary>(repl_port, store, repl_backlog);
+        if (!primary->start()) {
+            return 1;
+        }
+        store.set_role_reporter([&primary](std::string& out) { primary->describe(out); });
+    }
     
-    Server server(8080, store, num_threads);
+    Server server(options, store);
     server.run();
     return 0;
-}
\ No newline at end of file
+}
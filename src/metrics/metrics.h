@@ -4,72 +4,212 @@
 #include <string>
 #include <chrono>
 #include <vector>
-#include <algorithm>
-#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <utility>
+#include "slowlog.h"
 
-struct LatencyHistogram {
-    // Buckets: <1ms, <5ms, <10ms, <50ms, <100ms, >=100ms
-    std::atomic<uint64_t> bucket_1ms{0};
-    std::atomic<uint64_t> bucket_5ms{0};
-    std::atomic<uint64_t> bucket_10ms{0};
-    std::atomic<uint64_t> bucket_50ms{0};
-    std::atomic<uint64_t> bucket_100ms{0};
-    std::atomic<uint64_t> bucket_plus{0};
-    
-    // Store individual latencies for percentile calculation
-    mutable std::vector<uint64_t> latency_samples;
-    mutable std::mutex samples_mtx;
-    static constexpr size_t MAX_SAMPLES = 10000; // Keep last 10k samples
-    
-    void record(uint64_t micros) {
-        uint64_t millis = micros / 1000;
-        
-        if (millis < 1) bucket_1ms++;
-        else if (millis < 5) bucket_5ms++;
-        else if (millis < 10) bucket_10ms++;
-        else if (millis < 50) bucket_50ms++;
-        else if (millis < 100) bucket_100ms++;
-        else bucket_plus++;
-        
-        // Store sample for percentile calculation
-        {
-            std::lock_guard<std::mutex> lock(samples_mtx);
-            latency_samples.push_back(micros);
-            if (latency_samples.size() > MAX_SAMPLES) {
-                latency_samples.erase(latency_samples.begin());
-            }
+namespace metrics_detail {
+
+constexpr size_t STRIPES = 16;
+
+inline size_t& thread_stripe() {
+    thread_local size_t index = STRIPES; // Not yet assigned
+    return index;
+}
+
+// Stripe owned by the calling thread, handed out round-robin on first use.
+// Up to STRIPES threads each get their own; beyond that stripes are shared.
+inline size_t stripe_index() {
+    static std::atomic<size_t> next{0};
+    size_t& index = thread_stripe();
+    if (index == STRIPES) {
+        index = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+    }
+    return index;
+}
+
+// Gives the calling thread a fixed stripe before it records anything, e.g.
+// one per core thread so their hot counters never share a cache line
+inline void bind_stripe(size_t stripe) {
+    thread_stripe() = stripe % STRIPES;
+}
+
+} // namespace metrics_detail
+
+// Counter split into per-thread stripes on separate cache lines, so hot-path
+// increments never contend. load() sums the stripes and may miss adds that
+// are in flight, which is fine for monitoring.
+class StripedCounter {
+public:
+    void add(uint64_t n = 1) {
+        stripes_[metrics_detail::stripe_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    
+    uint64_t load() const {
+        uint64_t total = 0;
+        for (const Stripe& s : stripes_) {
+            total += s.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> value{0};
+    };
+    Stripe stripes_[metrics_detail::STRIPES];
+};
+
+// Log-linear latency histogram in the HdrHistogram layout. Values below
+// SUB_COUNT are exact; every power of two above that is split into SUB_COUNT
+// linear sub-buckets, so a recorded value is off by at most 1/32 (~3%).
+// 1024 buckets cover 0us to ~19 hours; anything larger lands in the last one.
+//
+// Recording is one relaxed add into the calling thread's stripe. Percentiles
+// are only computed on a merged Snapshot, when STATS is asked for. A stripe
+// (8KB) is allocated the first time its thread records, so histograms that
+// are rarely or never used cost next to nothing.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr size_t SUB_COUNT = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = 1024;
+    
+    LatencyHistogram() = default;
+    
+    ~LatencyHistogram() {
+        for (auto& s : stripes_) {
+            delete s.load(std::memory_order_relaxed);
+        }
+    }
+    
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+    
+    static size_t bucket_of(uint64_t value) {
+        if (value < SUB_COUNT) {
+            return static_cast<size_t>(value);
         }
+        unsigned msb = 63 - __builtin_clzll(value);
+        size_t bucket = SUB_COUNT * (msb - SUB_BITS + 1) +
+                        ((value >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
     }
     
-    // Calculate percentiles from samples
-    uint64_t percentile(double p) const {
-        std::lock_guard<std::mutex> lock(samples_mtx);
-        if (latency_samples.empty()) return 0;
+    // Smallest and largest value that map to bucket b
+    static uint64_t bucket_low(size_t b) {
+        if (b < SUB_COUNT) {
+            return b;
+        }
+        size_t octave = b / SUB_COUNT;
+        return (SUB_COUNT + b % SUB_COUNT) << (octave - 1);
+    }
+    
+    static uint64_t bucket_high(size_t b) {
+        if (b < SUB_COUNT) {
+            return b;
+        }
+        return bucket_low(b) + (uint64_t(1) << (b / SUB_COUNT - 1)) - 1;
+    }
+    
+    void record(uint64_t value) {
+        Stripe& s = stripe();
+        s.counts[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        s.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+    
+    // Merged copy of every stripe
+    struct Snapshot {
+        std::vector<uint64_t> counts;
+        uint64_t total = 0;
+        uint64_t sum = 0;
         
-        std::vector<uint64_t> sorted = latency_samples;
-        std::sort(sorted.begin(), sorted.end());
+        // Highest value equivalent to the p-th recorded value (p in [0, 1])
+        uint64_t percentile(double p) const {
+            if (total == 0) return 0;
+            uint64_t rank = static_cast<uint64_t>(p * total);
+            if (rank >= total) rank = total - 1;
+            
+            uint64_t seen = 0;
+            for (size_t b = 0; b < counts.size(); ++b) {
+                seen += counts[b];
+                if (seen > rank) {
+                    return bucket_high(b);
+                }
+            }
+            return bucket_high(counts.size() - 1);
+        }
         
-        size_t index = static_cast<size_t>(p * sorted.size());
-        if (index >= sorted.size()) index = sorted.size() - 1;
+        // Values recorded below `micros`, to bucket resolution
+        uint64_t count_below(uint64_t micros) const {
+            uint64_t n = 0;
+            for (size_t b = 0; b < bucket_of(micros); ++b) {
+                n += counts[b];
+            }
+            return n;
+        }
         
-        return sorted[index];
-    }
+        double mean() const {
+            return total > 0 ? (1.0 * sum / total) : 0.0;
+        }
+    };
     
-    // Get histogram counts
-    struct BucketCounts {
-        uint64_t b1ms, b5ms, b10ms, b50ms, b100ms, bplus;
+    Snapshot snapshot() const {
+        Snapshot snap;
+        snap.counts.assign(BUCKETS, 0);
+        for (const auto& stripe : stripes_) {
+            const Stripe* p = stripe.load(std::memory_order_acquire);
+            if (p == nullptr) {
+                continue;
+            }
+            const Stripe& s = *p;
+            for (size_t b = 0; b < BUCKETS; ++b) {
+                uint64_t c = s.counts[b].load(std::memory_order_relaxed);
+                snap.counts[b] += c;
+                snap.total += c;
+            }
+            snap.sum += s.sum.load(std::memory_order_relaxed);
+        }
+        return snap;
+    }
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<uint64_t> counts[BUCKETS] = {};
+        std::atomic<uint64_t> sum{0};
     };
     
-    BucketCounts get_counts() const {
-        return {
-            bucket_1ms.load(),
-            bucket_5ms.load(),
-            bucket_10ms.load(),
-            bucket_50ms.load(),
-            bucket_100ms.load(),
-            bucket_plus.load()
-        };
+    Stripe& stripe() {
+        auto& slot = stripes_[metrics_detail::stripe_index()];
+        Stripe* s = slot.load(std::memory_order_acquire);
+        if (s != nullptr) {
+            return *s;
+        }
+        // First record from this stripe; another thread sharing it may race us
+        Stripe* fresh = new Stripe;
+        if (slot.compare_exchange_strong(s, fresh, std::memory_order_acq_rel)) {
+            return *fresh;
+        }
+        delete fresh;
+        return *s;
     }
+    
+    std::atomic<Stripe*> stripes_[metrics_detail::STRIPES] = {};
+};
+
+// Lock wait and WAL time the store accumulates for the request the calling
+// thread is executing. The caller clears it before KVStore::execute() or
+// apply_batch() and reads it afterwards.
+struct RequestTrace {
+    uint64_t lock_wait_ns = 0;
+    uint64_t wal_ns = 0;
+    uint32_t locks = 0;
+    uint32_t wal_appends = 0;
+    
+    void clear() { *this = RequestTrace(); }
 };
 
 class Metrics {
@@ -79,75 +219,295 @@ public:
         return inst;
     }
     
-    std::atomic<uint64_t> cache_hits{0};
-    std::atomic<uint64_t> cache_misses{0};
-    std::atomic<uint64_t> total_requests{0};
-    std::atomic<uint64_t> total_latency_us{0};
+    StripedCounter cache_hits;
+    StripedCounter cache_misses;
+    StripedCounter total_requests;
     
+    // GET/MGET latency; its sum replaces a separate total_latency_us
     LatencyHistogram latency_histogram;
     
     // Batch statistics
-    std::atomic<uint64_t> total_batches{0};
-    std::atomic<uint64_t> total_batched_writes{0};
+    StripedCounter total_batches;
+    StripedCounter total_batched_writes;
+    
+    // Keys removed by the active expiry sweep
+    StripedCounter expired_keys;
+    
+    // maxmemory: keys evicted, and SETs refused under noeviction
+    StripedCounter evicted_keys;
+    StripedCounter rejected_writes;
+    
+    // Tiered storage: values moved to the cold log, read back from it (and
+    // of those, brought back into memory), and cold reads that failed
+    StripedCounter cold_spills;
+    StripedCounter cold_reads;
+    StripedCounter cold_promotions;
+    StripedCounter cold_read_errors;
+    
+    // Compression: values stored compressed, with their bytes before and
+    // after; values left raw because they did not shrink by an eighth; and
+    // the CPU time spent compressing and decompressing
+    StripedCounter compressed_writes;
+    StripedCounter incompressible_writes;
+    StripedCounter compress_in_bytes;
+    StripedCounter compress_out_bytes;
+    StripedCounter compress_ns;
+    StripedCounter decompressions;
+    StripedCounter decompress_ns;
+    StripedCounter decompress_errors;
+    
+    // Hot keys: GETs served from a reading thread's copy of a hot value,
+    // and copies taken under the shard lock
+    StripedCounter hot_key_hits;
+    StripedCounter hot_key_fills;
+    
+    // Per-command stage latencies in nanoseconds. The extra row is for
+    // batches applied by the WriteBatcher flusher (EXECUTE, LOCK_WAIT, WAL).
+    static constexpr size_t BATCH_ROW = COMMAND_TYPE_COUNT;
+    static constexpr size_t STAGE_ROWS = COMMAND_TYPE_COUNT + 1;
+    LatencyHistogram stages[STAGE_ROWS][STAGE_COUNT];
+    
+    SlowLog slowlog;
+    
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    static RequestTrace& trace() {
+        thread_local RequestTrace t;
+        return t;
+    }
+    
+    // Fixed stripe for the calling thread's counters and histograms
+    static void bind_stripe(size_t stripe) {
+        metrics_detail::bind_stripe(stripe);
+    }
+    
+    static const char* row_name(size_t row) {
+        return row == BATCH_ROW ? "BATCH" : command_name(static_cast<CommandType>(row));
+    }
+    
+    void record_stage(size_t row, Stage stage, uint64_t ns) {
+        stages[row][static_cast<size_t>(stage)].record(ns);
+    }
+    
+    // Records a replied-to request into its stage histograms and, when it
+    // was slow enough, the slow log
+    void record_request(const RequestSample& sample, uint64_t sent_ns) {
+        uint64_t stage_ns[STAGE_COUNT] = {};
+        stage_ns[static_cast<size_t>(Stage::QUEUE)] = sample.parsed_ns - sample.recv_ns;
+        stage_ns[static_cast<size_t>(Stage::EXECUTE)] = sample.executed_ns - sample.parsed_ns;
+        stage_ns[static_cast<size_t>(Stage::LOCK_WAIT)] = sample.lock_wait_ns;
+        stage_ns[static_cast<size_t>(Stage::WAL)] = sample.wal_ns;
+        stage_ns[static_cast<size_t>(Stage::SEND)] = sent_ns - sample.executed_ns;
+        stage_ns[static_cast<size_t>(Stage::TOTAL)] = sent_ns - sample.recv_ns;
+        
+        size_t row = static_cast<size_t>(sample.type);
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            Stage stage = static_cast<Stage>(s);
+            if ((stage == Stage::LOCK_WAIT && !sample.locked) || (stage == Stage::WAL && !sample.logged)) {
+                continue;
+            }
+            stages[row][s].record(stage_ns[s]);
+        }
+        
+        if (slowlog.wants(stage_ns[static_cast<size_t>(Stage::TOTAL)])) {
+            slowlog.record(sample, stage_ns);
+        }
+    }
     
-    std::string to_json() const {
+    // extra_fields is spliced in before the histogram, e.g. ",\"used_memory\":123"
+    std::string to_json(const std::string& extra_fields = "") const {
         uint64_t hits = cache_hits.load();
         uint64_t misses = cache_misses.load();
         uint64_t total = total_requests.load();
-        uint64_t latency = total_latency_us.load();
         
         double hit_rate = total > 0 ? (100.0 * hits / total) : 0.0;
-        double avg_latency_us = total > 0 ? (1.0 * latency / total) : 0.0;
         
-        // Calculate percentiles
-        uint64_t p50_us = latency_histogram.percentile(0.50);
-        uint64_t p95_us = latency_histogram.percentile(0.95);
-        uint64_t p99_us = latency_histogram.percentile(0.99);
+        // Percentiles from one merged snapshot
+        LatencyHistogram::Snapshot latency = latency_histogram.snapshot();
+        uint64_t p50_us = latency.percentile(0.50);
+        uint64_t p95_us = latency.percentile(0.95);
+        uint64_t p99_us = latency.percentile(0.99);
         
         // Batch statistics
         uint64_t batches = total_batches.load();
         uint64_t batched_writes = total_batched_writes.load();
         double avg_batch_size = batches > 0 ? (1.0 * batched_writes / batches) : 0.0;
         
-        // Histogram buckets
-        auto buckets = latency_histogram.get_counts();
-        uint64_t p50_less_than_1ms = buckets.b1ms;
-        uint64_t p99_tail_events = buckets.bplus; // Events >= 100ms
+        // Coarse buckets kept for existing dashboards
+        uint64_t below_1ms = latency.count_below(1000);
+        uint64_t below_5ms = latency.count_below(5000);
+        uint64_t below_10ms = latency.count_below(10000);
+        uint64_t below_50ms = latency.count_below(50000);
+        uint64_t below_100ms = latency.count_below(100000);
+        uint64_t p99_tail_events = latency.total - below_100ms; // Events >= 100ms
         
         return "{\"cache_hits\":" + std::to_string(hits) +
                ",\"cache_misses\":" + std::to_string(misses) +
                ",\"total_requests\":" + std::to_string(total) +
                ",\"hit_rate\":" + std::to_string(hit_rate) +
-               ",\"avg_latency_us\":" + std::to_string(avg_latency_us) +
+               ",\"avg_latency_us\":" + std::to_string(latency.mean()) +
                ",\"p50_latency_us\":" + std::to_string(p50_us) +
                ",\"p95_latency_us\":" + std::to_string(p95_us) +
                ",\"p99_latency_us\":" + std::to_string(p99_us) +
-               ",\"p50_less_than_1ms\":" + std::to_string(p50_less_than_1ms) +
+               ",\"p50_less_than_1ms\":" + std::to_string(below_1ms) +
                ",\"p99_tail_events\":" + std::to_string(p99_tail_events) +
                ",\"batch_avg_size\":" + std::to_string(avg_batch_size) +
+               ",\"expired_keys\":" + std::to_string(expired_keys.load()) +
+               ",\"evicted_keys\":" + std::to_string(evicted_keys.load()) +
+               ",\"rejected_writes\":" + std::to_string(rejected_writes.load()) +
+               ",\"compression\":" + compression_json() +
+               extra_fields +
+               ",\"slowlog_len\":" + std::to_string(slowlog.len()) +
+               ",\"commands\":" + stages_json() +
                ",\"histogram\":{" +
-               "\"<1ms\":" + std::to_string(buckets.b1ms) +
-               ",\"<5ms\":" + std::to_string(buckets.b5ms) +
-               ",\"<10ms\":" + std::to_string(buckets.b10ms) +
-               ",\"<50ms\":" + std::to_string(buckets.b50ms) +
-               ",\"<100ms\":" + std::to_string(buckets.b100ms) +
-               ",\">=100ms\":" + std::to_string(buckets.bplus) +
+               "\"<1ms\":" + std::to_string(below_1ms) +
+               ",\"<5ms\":" + std::to_string(below_5ms - below_1ms) +
+               ",\"<10ms\":" + std::to_string(below_10ms - below_5ms) +
+               ",\"<50ms\":" + std::to_string(below_50ms - below_10ms) +
+               ",\"<100ms\":" + std::to_string(below_100ms - below_50ms) +
+               ",\">=100ms\":" + std::to_string(p99_tail_events) +
                "}}";
     }
     
+    // Prometheus text exposition format. extra_lines is appended before the
+    // terminating empty line, which line-based clients can read up to and
+    // Prometheus parsers skip. ("# EOF" would make it OpenMetrics.)
+    std::string to_prometheus(const std::string& extra_lines = "") const {
+        std::string out;
+        out += prometheus_metric("memkv_cache_hits_total", "counter", "GETs that found a live key", cache_hits.load());
+        out += prometheus_metric("memkv_cache_misses_total", "counter", "GETs that found no live key", cache_misses.load());
+        out += prometheus_metric("memkv_requests_total", "counter", "GET requests served", total_requests.load());
+        out += prometheus_metric("memkv_batches_total", "counter", "Write batches applied", total_batches.load());
+        out += prometheus_metric("memkv_batched_writes_total", "counter", "Writes applied through the batcher", total_batched_writes.load());
+        out += prometheus_metric("memkv_expired_keys_total", "counter", "Keys removed by the expiry sweep", expired_keys.load());
+        out += prometheus_metric("memkv_evicted_keys_total", "counter", "Keys evicted under maxmemory", evicted_keys.load());
+        out += prometheus_metric("memkv_rejected_writes_total", "counter", "SETs refused under noeviction", rejected_writes.load());
+        out += prometheus_metric("memkv_compressed_writes_total", "counter", "Values stored compressed", compressed_writes.load());
+        out += prometheus_metric("memkv_compress_input_bytes_total", "counter", "Bytes of the values stored compressed", compress_in_bytes.load());
+        out += prometheus_metric("memkv_compress_output_bytes_total", "counter", "Their compressed bytes", compress_out_bytes.load());
+        out += prometheus_metric("memkv_decompressions_total", "counter", "Compressed values decompressed for a read", decompressions.load());
+        out += "# HELP memkv_compression_cpu_seconds_total Time spent compressing and decompressing values\n";
+        out += "# TYPE memkv_compression_cpu_seconds_total counter\n";
+        out += "memkv_compression_cpu_seconds_total{op=\"compress\"} " + std::to_string(compress_ns.load() / 1e9) + "\n";
+        out += "memkv_compression_cpu_seconds_total{op=\"decompress\"} " + std::to_string(decompress_ns.load() / 1e9) + "\n";
+        
+        LatencyHistogram::Snapshot latency = latency_histogram.snapshot();
+        out += "# HELP memkv_read_latency_seconds GET/MGET latency\n";
+        out += "# TYPE memkv_read_latency_seconds summary\n";
+        static const std::pair<double, const char*> quantiles[] = {
+            {0.5, "0.5"}, {0.9, "0.9"}, {0.99, "0.99"}, {0.999, "0.999"}};
+        for (const auto& q : quantiles) {
+            out += "memkv_read_latency_seconds{quantile=\"" + std::string(q.second) + "\"} " +
+                   std::to_string(latency.percentile(q.first) / 1e6) + "\n";
+        }
+        out += "memkv_read_latency_seconds_sum " + std::to_string(latency.sum / 1e6) + "\n";
+        out += "memkv_read_latency_seconds_count " + std::to_string(latency.total) + "\n";
+        
+        out += "# HELP memkv_request_stage_seconds Request latency by command and stage\n";
+        out += "# TYPE memkv_request_stage_seconds summary\n";
+        for (size_t row = 0; row < STAGE_ROWS; ++row) {
+            for (size_t s = 0; s < STAGE_COUNT; ++s) {
+                LatencyHistogram::Snapshot snap = stages[row][s].snapshot();
+                if (snap.total == 0) {
+                    continue;
+                }
+                std::string labels = "command=\"" + std::string(row_name(row)) +
+                                     "\",stage=\"" + stage_name(static_cast<Stage>(s)) + "\"";
+                for (const auto& q : quantiles) {
+                    out += "memkv_request_stage_seconds{" + labels + ",quantile=\"" + q.second + "\"} " +
+                           std::to_string(snap.percentile(q.first) / 1e9) + "\n";
+                }
+                out += "memkv_request_stage_seconds_sum{" + labels + "} " + std::to_string(snap.sum / 1e9) + "\n";
+                out += "memkv_request_stage_seconds_count{" + labels + "} " + std::to_string(snap.total) + "\n";
+            }
+        }
+        
+        out += extra_lines;
+        out += "\n";
+        return out;
+    }
+    
+    // Ratio is uncompressed over compressed bytes of the values stored
+    // compressed; the averages are per value tried and per decompression
+    std::string compression_json() const {
+        uint64_t writes = compressed_writes.load();
+        uint64_t raw = incompressible_writes.load();
+        uint64_t in = compress_in_bytes.load();
+        uint64_t out = compress_out_bytes.load();
+        uint64_t reads = decompressions.load();
+        uint64_t compress = compress_ns.load();
+        uint64_t decompress = decompress_ns.load();
+        return "{\"compressed_writes\":" + std::to_string(writes) +
+               ",\"incompressible_writes\":" + std::to_string(raw) +
+               ",\"bytes_in\":" + std::to_string(in) +
+               ",\"bytes_out\":" + std::to_string(out) +
+               ",\"ratio\":" + std::to_string(out > 0 ? 1.0 * in / out : 0.0) +
+               ",\"compress_us\":" + format_us(compress) +
+               ",\"compress_avg_us\":" + format_us(writes + raw > 0 ? compress / (writes + raw) : 0) +
+               ",\"decompressions\":" + std::to_string(reads) +
+               ",\"decompress_us\":" + format_us(decompress) +
+               ",\"decompress_avg_us\":" + format_us(reads > 0 ? decompress / reads : 0) +
+               ",\"decompress_errors\":" + std::to_string(decompress_errors.load()) + "}";
+    }
+    
+    // {"GET":{"total":{"count":..,"p50_us":..,"p99_us":..,"p999_us":..},...},...}
+    // covering only the commands and stages that have been recorded
+    std::string stages_json() const {
+        std::string out = "{";
+        bool first_row = true;
+        for (size_t row = 0; row < STAGE_ROWS; ++row) {
+            std::string fields;
+            for (size_t s = 0; s < STAGE_COUNT; ++s) {
+                LatencyHistogram::Snapshot snap = stages[row][s].snapshot();
+                if (snap.total == 0) {
+                    continue;
+                }
+                if (!fields.empty()) fields += ',';
+                fields += "\"" + std::string(stage_name(static_cast<Stage>(s))) + "\":{" +
+                          "\"count\":" + std::to_string(snap.total) +
+                          ",\"p50_us\":" + format_us(snap.percentile(0.50)) +
+                          ",\"p99_us\":" + format_us(snap.percentile(0.99)) +
+                          ",\"p999_us\":" + format_us(snap.percentile(0.999)) + "}";
+            }
+            if (fields.empty()) {
+                continue;
+            }
+            if (!first_row) out += ',';
+            first_row = false;
+            out += "\"" + std::string(row_name(row)) + "\":{" + fields + "}";
+        }
+        out += "}";
+        return out;
+    }
+    
+    static std::string format_us(uint64_t ns) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.1f", ns / 1000.0);
+        return buf;
+    }
+    
+    // One HELP/TYPE/sample block
+    static std::string prometheus_metric(const std::string& name, const std::string& type,
+                                         const std::string& help, uint64_t value) {
+        return "# HELP " + name + " " + help + "\n" +
+               "# TYPE " + name + " " + type + "\n" +
+               name + " " + std::to_string(value) + "\n";
+    }
+    
     void record_latency(uint64_t microseconds) {
-        total_latency_us.fetch_add(microseconds);
         latency_histogram.record(microseconds);
     }
     
     void record_batch(size_t batch_size) {
-        total_batches++;
-        total_batched_writes.fetch_add(batch_size);
+        total_batches.add();
+        total_batched_writes.add(batch_size);
     }
-    
+
 private:
     Metrics() = default;
     Metrics(const Metrics&) = delete;
     Metrics& operator=(const Metrics&) = delete;
 };
-
@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../protocol/command.h"
+
+// Request stages timed per command type. QUEUE runs from the read that
+// completed the request to its parse (executor queueing and pipelined
+// predecessors), EXECUTE is the store call itself (LOCK_WAIT and WAL are the
+// parts of it spent waiting for shard locks and on WAL append/fsync), SEND
+// runs from execution to the reply leaving the socket (including any
+// APPLIED/DURABLE ack wait), and TOTAL is recv to send.
+enum class Stage { QUEUE, EXECUTE, LOCK_WAIT, WAL, SEND, TOTAL, COUNT };
+
+constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::COUNT);
+
+inline const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::QUEUE: return "queue";
+        case Stage::EXECUTE: return "execute";
+        case Stage::LOCK_WAIT: return "lock_wait";
+        case Stage::WAL: return "wal";
+        case Stage::SEND: return "send";
+        case Stage::TOTAL: return "total";
+        default: return "unknown";
+    }
+}
+
+// One finished request, as recorded into the stage histograms and offered to
+// the slow log. Timestamps are Metrics::now_ns() values.
+struct RequestSample {
+    static constexpr size_t KEY_PREFIX = 32;
+    
+    CommandType type = CommandType::UNKNOWN;
+    uint64_t recv_ns = 0;
+    uint64_t parsed_ns = 0;
+    uint64_t executed_ns = 0;
+    uint64_t lock_wait_ns = 0;
+    uint64_t wal_ns = 0;
+    bool locked = false;        // The store took a shard lock for it
+    bool logged = false;        // The store appended to the WAL for it
+    uint8_t key_len = 0;
+    uint32_t key_full_len = 0;
+    char key[KEY_PREFIX];
+    
+    void set_key(std::string_view k) {
+        key_full_len = static_cast<uint32_t>(k.size());
+        key_len = static_cast<uint8_t>(std::min(k.size(), KEY_PREFIX));
+        std::memcpy(key, k.data(), key_len);
+    }
+};
+
+// Bounded lock-free log of the most recent requests slower than a threshold,
+// in the spirit of Redis SLOWLOG. Each slot is a seqlock over atomic words: a
+// writer claims a slot by moving its version from even to odd, and a reader
+// skips a slot that is mid-write or whose version changed under it. A writer that finds
+// its slot already being written (the ring lapped a stalled writer) drops its
+// entry rather than wait.
+class SlowLog {
+public:
+    struct Entry {
+        uint64_t id = 0;
+        long long timestamp_ms = 0;
+        CommandType type = CommandType::UNKNOWN;
+        uint64_t stage_ns[STAGE_COUNT] = {};
+        std::string key;
+        uint32_t key_full_len = 0;
+    };
+    
+    explicit SlowLog(size_t capacity = 128, long long slower_than_us = 10000) {
+        configure(capacity, slower_than_us);
+    }
+    
+    // Not thread-safe; call before requests are served. A negative threshold
+    // disables the log, 0 logs every request.
+    void configure(size_t capacity, long long slower_than_us) {
+        capacity_ = capacity == 0 ? 1 : capacity;
+        slots_.reset(new Slot[capacity_]);
+        slower_than_ns_.store(slower_than_us < 0 ? -1 : slower_than_us * 1000, std::memory_order_relaxed);
+    }
+    
+    bool wants(uint64_t total_ns) const {
+        long long threshold = slower_than_ns_.load(std::memory_order_relaxed);
+        return threshold >= 0 && total_ns >= static_cast<uint64_t>(threshold);
+    }
+    
+    void record(const RequestSample& sample, const uint64_t (&stage_ns)[STAGE_COUNT]) {
+        uint64_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        Slot& slot = slots_[id % capacity_];
+        
+        uint64_t version = slot.version.load(std::memory_order_relaxed);
+        if ((version & 1) != 0 ||
+            !slot.version.compare_exchange_strong(version, version + 1, std::memory_order_acquire)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        
+        auto wall = std::chrono::system_clock::now().time_since_epoch();
+        slot.words[W_ID].store(id, std::memory_order_relaxed);
+        slot.words[W_TIME].store(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(wall).count()), std::memory_order_relaxed);
+        slot.words[W_META].store(static_cast<uint64_t>(sample.type) |
+                                 (static_cast<uint64_t>(sample.key_len) << 8) |
+                                 (static_cast<uint64_t>(sample.key_full_len) << 32),
+                                 std::memory_order_relaxed);
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            slot.words[W_STAGES + s].store(stage_ns[s], std::memory_order_relaxed);
+        }
+        for (size_t w = 0; w < KEY_WORDS; ++w) {
+            uint64_t bytes = 0;
+            size_t offset = w * 8;
+            if (offset < sample.key_len) {
+                std::memcpy(&bytes, sample.key + offset, std::min<size_t>(8, sample.key_len - offset));
+            }
+            slot.words[W_KEY + w].store(bytes, std::memory_order_relaxed);
+        }
+        
+        slot.version.store(version + 2, std::memory_order_release);
+    }
+    
+    // Up to `count` entries, newest first
+    std::vector<Entry> get(size_t count) const {
+        std::vector<Entry> out;
+        uint64_t end = next_id_.load(std::memory_order_acquire);
+        uint64_t begin = reset_id_.load(std::memory_order_relaxed);
+        if (end > capacity_ && end - capacity_ > begin) {
+            begin = end - capacity_;
+        }
+        
+        for (uint64_t id = end; id > begin && out.size() < count; --id) {
+            Entry entry;
+            if (read(id - 1, entry)) {
+                out.push_back(std::move(entry));
+            }
+        }
+        return out;
+    }
+    
+    size_t len() const {
+        return get(capacity_).size();
+    }
+    
+    void reset() {
+        reset_id_.store(next_id_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    
+    uint64_t dropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    
+    // JSON array for SLOWLOG GET. Keys are cut to their first KEY_PREFIX
+    // bytes; key_len is the full length.
+    static std::string to_json(const std::vector<Entry>& entries) {
+        std::string out = "[";
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const Entry& e = entries[i];
+            if (i > 0) out += ',';
+            out += "{\"id\":" + std::to_string(e.id) +
+                   ",\"timestamp_ms\":" + std::to_string(e.timestamp_ms) +
+                   ",\"duration_us\":" + std::to_string(e.stage_ns[static_cast<size_t>(Stage::TOTAL)] / 1000) +
+                   ",\"command\":\"" + command_name(e.type) + "\"" +
+                   ",\"key\":\"" + json_escape(e.key) + "\"" +
+                   ",\"key_len\":" + std::to_string(e.key_full_len) +
+                   ",\"stages_us\":{";
+            for (size_t s = 0; s < STAGE_COUNT; ++s) {
+                if (static_cast<Stage>(s) == Stage::TOTAL) continue;
+                if (s > 0) out += ',';
+                out += "\"" + std::string(stage_name(static_cast<Stage>(s))) + "\":" +
+                       std::to_string(e.stage_ns[s] / 1000);
+            }
+            out += "}}";
+        }
+        out += "]";
+        return out;
+    }
+    
+    static std::string json_escape(std::string_view s) {
+        static const char hex[] = "0123456789abcdef";
+        std::string out;
+        out.reserve(s.size());
+        for (char c : s) {
+            unsigned char u = static_cast<unsigned char>(c);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (u < 0x20 || u >= 0x7F) {
+                out += "\\u00";
+                out += hex[u >> 4];
+                out += hex[u & 0xF];
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+
+private:
+    static constexpr size_t KEY_WORDS = RequestSample::KEY_PREFIX / 8;
+    static constexpr size_t W_ID = 0;
+    static constexpr size_t W_TIME = 1;
+    static constexpr size_t W_META = 2;         // type | key_len << 8 | key_full_len << 32
+    static constexpr size_t W_STAGES = 3;
+    static constexpr size_t W_KEY = W_STAGES + STAGE_COUNT;
+    static constexpr size_t WORDS = W_KEY + KEY_WORDS;
+    
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> version{0};          // Odd while a write is in progress
+        std::atomic<uint64_t> words[WORDS] = {};
+    };
+    
+    // False if the slot no longer (or not yet) holds entry `id`
+    bool read(uint64_t id, Entry& entry) const {
+        const Slot& slot = slots_[id % capacity_];
+        uint64_t words[WORDS];
+        uint64_t before = slot.version.load(std::memory_order_acquire);
+        if ((before & 1) != 0 || before == 0) {
+            return false;
+        }
+        for (size_t w = 0; w < WORDS; ++w) {
+            words[w] = slot.words[w].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) != before || words[W_ID] != id) {
+            return false;
+        }
+        
+        entry.id = id;
+        entry.timestamp_ms = static_cast<long long>(words[W_TIME]);
+        entry.type = static_cast<CommandType>(words[W_META] & 0xFF);
+        size_t key_len = (words[W_META] >> 8) & 0xFF;
+        entry.key_full_len = static_cast<uint32_t>(words[W_META] >> 32);
+        for (size_t s = 0; s < STAGE_COUNT; ++s) {
+            entry.stage_ns[s] = words[W_STAGES + s];
+        }
+        char key[RequestSample::KEY_PREFIX];
+        std::memcpy(key, &words[W_KEY], sizeof(key));
+        entry.key.assign(key, key_len);
+        return true;
+    }
+    
+    size_t capacity_ = 0;
+    std::unique_ptr<Slot[]> slots_;
+    std::atomic<uint64_t> next_id_{0};
+    std::atomic<uint64_t> reset_id_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<long long> slower_than_ns_{-1};
+};
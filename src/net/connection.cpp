@@ -1,37 +1,265 @@
 #include "connection.h"
+#include "core_loop.h"
+#include "../cluster/cluster.h"
 #include "../protocol/parser.h"
 #include <sys/socket.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 
-Connection::Connection(int sock_fd, KVStore& store, WriteBatcher& batcher) 
-    : sock_fd_(sock_fd), store_(store), batcher_(batcher) {}
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
-void Connection::handle() {
-    char buffer[BUFFER_SIZE];
-    while (true) {
-        std::memset(buffer, 0, BUFFER_SIZE);
+Connection::Connection(int sock_fd, KVStore& store, WriteBatcher& batcher, CoreLoop* core, Cluster* cluster) 
+    : sock_fd_(sock_fd), store_(store), batcher_(batcher), core_(core), cluster_(cluster) {}
+
+void Connection::execute(const CommandView& cmd) {
+    // Cluster mode: first decide whether the command runs on this node
+    Cluster::Guard guard;
+    if (cluster_ && cmd.valid) {
+        bool asking = asking_;
+        asking_ = false;
+        if (cmd.type == CommandType::ASKING) {
+            asking_ = true;
+            output_ += "OK\n";
+            return;
+        }
+        if (cmd.type == CommandType::CLUSTER) {
+            cluster_->execute(cmd, batcher_, output_);
+            return;
+        }
+        if (!cluster_->route(cmd, asking, output_, guard)) {
+            return;
+        }
+    }
+    
+    bool write = cmd.type == CommandType::SET || cmd.type == CommandType::DEL || cmd.type == CommandType::MSET ||
+                 cmd.type == CommandType::VSET;
+    if (cmd.valid && write && store_.read_only()) {
+        output_ += "ERROR: READONLY replica, send writes to the primary\n";
+        return;
+    }
+    
+    // A migrating slot: run it now, on this thread, while the guard keeps
+    // MIGRATE from moving its keys
+    if (guard.owns_lock()) {
+        if (writes_.pending()) {
+            wait_for_writes();
+        }
+        store_.execute(cmd, output_);
+        return;
+    }
+    
+    // Per-core mode: the core runs the command or hands it to its owners
+    if (core_) {
+        suspended_ = !core_->execute(*this, cmd, output_);
+        return;
+    }
+    
+    // Route writes through batcher, reads directly. MSET and multi-key DEL
+    // are grouped by shard already, so they may skip the batcher (multi_key
+    // off) and be applied here, which saves copying every pair.
+    bool direct_write = write && !batcher_.multi_key() && (cmd.type == CommandType::MSET || !cmd.keys.empty());
+    if (cmd.valid && write && !direct_write) {
+        // Queued writes are also tracked when a direct write may follow them
+        bool acked = batcher_.ack_mode() != AckMode::IMMEDIATE || !batcher_.multi_key();
+        WriteStatus* status = nullptr;
+        if (batcher_.ack_mode() != AckMode::IMMEDIATE) {
+            queued_replies_.push_back({output_.size(), WriteStatus::OK});
+            status = &queued_replies_.back().status;
+        }
+        batcher_.add_to_batch(cmd.to_owned(), acked ? &writes_ : nullptr, status);
+        output_ += "OK\n"; // Sent once process() has waited for the ack, if any
+        return;
+    }
+    
+    // A read after this connection's own queued writes must see them, and a
+    // direct write must not overtake them. IMMEDIATE reads never wait.
+    if (writes_.pending() && (direct_write || batcher_.ack_mode() != AckMode::IMMEDIATE)) {
+        wait_for_writes();
+    }
+    
+    // GET, MGET, STATS, etc. execute immediately, replying straight into output_
+    store_.execute(cmd, output_);
+}
+
+void Connection::process() {
+    // One clock read per command: each command's parse time is the previous
+    // one's execute time, which only leaves out the parse itself
+    uint64_t now = Metrics::now_ns();
+    while (!input_.empty() && !suspended_) {
+        size_t consumed = Parser::parse_view(input_.data(), input_.size(), command_);
+        if (consumed == 0) {
+            break; // Partial frame, wait for the rest
+        }
+        if (command_.protocol_error) {
+            // As in Redis: the rest of the stream cannot be parsed safely
+            input_.consume(consumed);
+            output_ += "ERROR: Protocol error, closing connection\n";
+            closing_ = true;
+            break;
+        }
         
-        ssize_t bytes = recv(sock_fd_, buffer, BUFFER_SIZE - 1, 0);
+        RequestSample& sample = samples_.emplace_back();
+        sample.type = command_.valid ? command_.type : CommandType::UNKNOWN;
+        sample.recv_ns = recv_ns_;
+        sample.parsed_ns = now;
+        sample.set_key(command_.keys.empty() ? command_.key : command_.keys[0]);
+        
+        RequestTrace& trace = Metrics::trace();
+        trace.clear();
+        execute(command_);
+        if (suspended_) {
+            suspended_bytes_ = consumed; // command_ still views this input
+            return;
+        }
+        now = finish_command(consumed);
+    }
+    
+    // APPLIED/DURABLE acks: one wait covers every write in this read, and no
+    // reply leaves before its write is acknowledged
+    if (batcher_.ack_mode() != AckMode::IMMEDIATE && writes_.submitted > 0) {
+        wait_for_writes();
+    }
+    
+    if (input_.size() > MAX_INPUT_BUFFER) {
+        output_ += "ERROR: Request too large\n";
+        closing_ = true;
+    }
+}
+
+void Connection::wait_for_writes() {
+    bool durable = batcher_.wait(writes_);
+    
+    // A write the batcher could not apply, or make durable, gets the error
+    // the direct path would have replied with in place of its OK
+    bool failed = false;
+    for (QueuedReply& reply : queued_replies_) {
+        if (!durable && reply.status == WriteStatus::OK) {
+            reply.status = WriteStatus::IO_ERROR;
+        }
+        failed = failed || reply.status != WriteStatus::OK;
+    }
+    if (failed) {
+        std::string settled;
+        size_t from = 0;
+        for (const QueuedReply& reply : queued_replies_) {
+            settled.append(output_, from, reply.offset - from);
+            settled += reply.status == WriteStatus::OK ? std::string("OK\n") : write_error(reply.status);
+            from = reply.offset + 3;
+        }
+        settled.append(output_, from, std::string::npos);
+        output_.swap(settled);
+    }
+    queued_replies_.clear();
+}
+
+uint64_t Connection::finish_command(size_t consumed) {
+    input_.consume(consumed);
+    
+    uint64_t now = Metrics::now_ns();
+    const RequestTrace& trace = Metrics::trace();
+    RequestSample& sample = samples_.back();
+    sample.executed_ns = now;
+    sample.lock_wait_ns = trace.lock_wait_ns;
+    sample.wal_ns = trace.wal_ns;
+    sample.locked = trace.locks > 0;
+    sample.logged = trace.wal_appends > 0;
+    return now;
+}
+
+void Connection::resume() {
+    // The other cores' lock and WAL time is part of the execute stage
+    Metrics::trace().clear();
+    suspended_ = false;
+    finish_command(suspended_bytes_);
+    process();
+}
+
+void Connection::handle() {
+    while (!closing_) {
+        char* dst = input_.prepare(READ_CHUNK);
+        ssize_t bytes = recv(sock_fd_, dst, input_.writable(), 0);
         if (bytes <= 0) {
             break;
         }
+        input_.commit(bytes);
+        recv_ns_ = Metrics::now_ns();
         
-        std::string raw(buffer, bytes);
-        
-        ParsedCommand cmd = Parser::parse(raw);
+        process();
         
-        // Route writes through batcher, reads directly
-        if (cmd.type == CommandType::SET || cmd.type == CommandType::DEL) {
-            batcher_.add_to_batch(cmd);
-            send(sock_fd_, "OK\n", 3, 0); // Immediate acknowledgment
-        } else {
-            // GET, MGET, STATS, etc. execute immediately
-            std::string response = store_.execute(cmd);
-            send(sock_fd_, response.c_str(), response.length(), 0);
+        // Blocking socket: flush_output() only returns once everything is sent
+        if (!flush_output()) {
+            break;
         }
     }
     
     close(sock_fd_);
 }
 
+bool Connection::read_input() {
+    size_t total = 0;
+    while (total < READ_BUDGET) {
+        char* dst = input_.prepare(READ_CHUNK);
+        ssize_t bytes = recv(sock_fd_, dst, input_.writable(), 0);
+        if (bytes > 0) {
+            input_.commit(bytes);
+            total += bytes;
+            continue;
+        }
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        // Orderly shutdown or error: serve what already arrived, then close
+        closing_ = true;
+        break;
+    }
+    if (total > 0) {
+        recv_ns_ = Metrics::now_ns();
+    }
+    return !(closing_ && total == 0);
+}
+
+bool Connection::flush_output() {
+    while (output_sent_ < output_.size()) {
+        ssize_t sent = send(sock_fd_, output_.data() + output_sent_,
+                            output_.size() - output_sent_, MSG_NOSIGNAL);
+        if (sent > 0) {
+            output_sent_ += sent;
+            continue;
+        }
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true; // Socket buffer full, wait for EPOLLOUT
+        }
+        return false;
+    }
+    output_.clear();
+    output_sent_ = 0;
+    if (output_.capacity() > MAX_RETAINED_OUTPUT) {
+        std::string().swap(output_); // After a huge MGET reply
+    }
+    finish_requests();
+    return true;
+}
+
+void Connection::finish_requests() {
+    if (samples_.empty()) {
+        return;
+    }
+    uint64_t sent_ns = Metrics::now_ns();
+    Metrics& metrics = Metrics::instance();
+    for (const RequestSample& sample : samples_) {
+        metrics.record_request(sample, sent_ns);
+    }
+    samples_.clear();
+    if (samples_.capacity() > MAX_RETAINED_SAMPLES) {
+        std::vector<RequestSample>().swap(samples_); // After a huge pipelined read
+    }
+}
@@ -2,17 +2,99 @@
 
 #include "../storage/kv_store.h"
 #include "../batching/write_batcher.h"
+#include "../metrics/metrics.h"
+#include "read_buffer.h"
+#include <atomic>
+#include <deque>
 #include <string>
+#include <thread>
+#include <vector>
+
+class CoreLoop;
+class Cluster;
 
 class Connection {
 public:
-    Connection(int sock_fd, KVStore& store, WriteBatcher& batcher);
+    // With a core, commands are executed through CoreLoop::execute() (per-core
+    // mode). With a cluster, commands for keys owned elsewhere are redirected.
+    Connection(int sock_fd, KVStore& store, WriteBatcher& batcher, CoreLoop* core = nullptr,
+               Cluster* cluster = nullptr);
+    
+    // Thread-per-connection mode: blocks until the client disconnects.
     void handle();
+    
+    // Reactor mode: the socket is non-blocking and driven by an EventLoop.
+    // read_input() is called from the reactor thread, process() and
+    // flush_output() from an executor thread. EPOLLONESHOT guarantees only
+    // one thread touches a connection at a time.
+    bool read_input();          // false once the peer is gone and nothing is left to serve
+    void process();             // executes every complete command, keeps partial frames
+    bool flush_output();        // false on a fatal write error
+    bool has_pending_output() const { return output_sent_ < output_.size(); }
+    bool closing() const { return closing_; }
+    int fd() const { return sock_fd_; }
+    
+    // The executor gives the connection back by re-arming its descriptor.
+    // Only the kernel orders that before the reactor's next event for it,
+    // out of sight of the memory model and TSAN, and that event can arrive
+    // before epoll_ctl() has returned on the executor. The executor brackets
+    // the rearm with begin_handoff()/end_handoff(); take_over(), called
+    // when the event is handled, waits out an unfinished one and pairs with
+    // end_handoff() as an explicit release/acquire.
+    void begin_handoff() { handing_off_.store(true, std::memory_order_relaxed); }
+    void end_handoff() { handing_off_.store(false, std::memory_order_release); }
+    void take_over() const {
+        while (handing_off_.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+    }
+    
+    // Per-core mode: a command handed to other cores suspends the connection
+    // with its input left in place. The core appends the merged reply to
+    // output() and calls resume(), which carries on with the buffered input.
+    bool suspended() const { return suspended_; }
+    std::string& output() { return output_; }
+    void resume();
 
 private:
+    void execute(const CommandView& cmd);
+    uint64_t finish_command(size_t consumed); // Consumes its input, completes its sample
+    void finish_requests();     // Records samples_ once their replies are sent
+    void wait_for_writes();     // Waits for the queued writes' acks and settles their replies
+    
     int sock_fd_;
     KVStore& store_;
     WriteBatcher& batcher_;
-    static constexpr int BUFFER_SIZE = 1024;
+    CoreLoop* core_;
+    Cluster* cluster_;
+    static constexpr size_t READ_CHUNK = 16 * 1024;
+    static constexpr size_t READ_BUDGET = 256 * 1024;     // Per readiness event, for fairness
+    static constexpr size_t MAX_INPUT_BUFFER = 1024 * 1024 * 1024;
+    static constexpr size_t MAX_RETAINED_SAMPLES = 1024;
+    static constexpr size_t MAX_RETAINED_OUTPUT = 1024 * 1024;  // Bytes of output_ capacity kept between replies
+    
+    ReadBuffer input_;
+    CommandView command_;       // Reused so steady-state parsing never allocates
+    std::string output_;        // Replies for every command in one read, sent with one write; reused
+    size_t output_sent_ = 0;
+    bool closing_ = false;      // Close once output_ has been flushed
+    bool suspended_ = false;    // Waiting on other cores for the command in command_
+    size_t suspended_bytes_ = 0; // Input bytes of that command
+    WriteCompletion writes_;    // Batched writes awaiting an APPLIED/DURABLE ack
+    std::atomic<bool> handing_off_{false}; // Inside rearm(), see take_over()
+    
+    // APPLIED/DURABLE: where in output_ each queued write's "OK\n" stands,
+    // and the outcome the batcher stores for it; a deque so the batcher's
+    // pointers stay valid as more are queued
+    struct QueuedReply {
+        size_t offset;
+        WriteStatus status;
+    };
+    std::deque<QueuedReply> queued_replies_;
+    bool asking_ = false;       // Cluster: ASKING was sent, applies to the next command
+    
+    // Stage timing: when the latest bytes arrived, and the requests whose
+    // replies are in output_
+    uint64_t recv_ns_ = 0;
+    std::vector<RequestSample> samples_;
 };
-
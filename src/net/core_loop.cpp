@@ -0,0 +1,510 @@
+#include "core_loop.h"
+#include "connection.h"
+#include "../metrics/metrics.h"
+#include <iostream>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+CoreLoop::CoreLoop(size_t id, size_t cores, KVStore& store, WriteBatcher& batcher, Affinity affinity, Cluster* cluster)
+    : id_(id), cores_(cores), affinity_(affinity), store_(store), batcher_(batcher), cluster_(cluster), backlog_(cores) {
+    for (size_t i = 0; i < cores_; ++i) {
+        inbox_.push_back(std::make_unique<SpscQueue<Part*>>(RING_CAPACITY));
+    }
+    
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        perror("epoll_create1 failed");
+        return;
+    }
+    
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // nullptr marks the wakeup descriptor
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+CoreLoop::~CoreLoop() {
+    running_ = false;
+    wake();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    
+    for (auto& [fd, peer] : conns_) {
+        close(fd);
+    }
+    conns_.clear();
+    
+    if (wake_fd_ >= 0) close(wake_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool CoreLoop::supported() {
+    return true;
+}
+
+void CoreLoop::connect(const std::vector<std::unique_ptr<CoreLoop>>& cores) {
+    for (const auto& core : cores) {
+        core->peers_.clear();
+        for (const auto& peer : cores) {
+            core->peers_.push_back(peer.get());
+        }
+    }
+}
+
+void CoreLoop::start() {
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+}
+
+void CoreLoop::add_connection(int client_socket) {
+    {
+        std::lock_guard<std::mutex> lock(accept_mtx_);
+        accepted_.push_back(client_socket);
+    }
+    wake();
+}
+
+void CoreLoop::wake() {
+    if (wake_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void CoreLoop::run() {
+    // Once pinned, rebuild the owned shards' tables so they are allocated
+    // from this core's NUMA node; slab pages the shards add later are first
+    // written here anyway
+    if (pin_current_thread(affinity_, id_, cores_) >= 0) {
+        for (size_t shard = id_; shard < store_.shard_count(); shard += cores_) {
+            store_.localize_shard(shard);
+        }
+    }
+    Metrics::bind_stripe(id_);
+    epoll_event events[MAX_EVENTS];
+    
+    while (running_) {
+        drain_inboxes();
+        
+        // Park only with nothing left to deliver. The fence pairs with the
+        // one in send(): either the sender sees parked_ and wakes us, or we
+        // see its part here.
+        int timeout = 1;
+        if (flush_backlog()) {
+            parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!inboxes_empty()) {
+                parked_.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            timeout = -1;
+        }
+        
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, timeout);
+        parked_.store(false, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+        
+        for (int i = 0; i < n; ++i) {
+            auto* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn == nullptr) {
+                uint64_t count;
+                ssize_t ignored = read(wake_fd_, &count, sizeof(count));
+                (void)ignored;
+                accept_new();
+                deliver_imports();
+                continue;
+            }
+            
+            uint32_t mask = events[i].events;
+            if (mask & EPOLLERR) {
+                close_connection(conn);
+            } else if (mask & EPOLLOUT) {
+                on_writable(conn);
+            } else if (mask & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+                on_readable(conn);
+            }
+        }
+    }
+}
+
+// A suspended connection is disarmed and so never closed under its reply
+void CoreLoop::deliver_imports() {
+    std::vector<std::pair<Connection*, std::string>> replies;
+    {
+        std::lock_guard<std::mutex> lock(import_mtx_);
+        replies.swap(imported_);
+    }
+    
+    for (auto& reply : replies) {
+        Connection* conn = reply.first;
+        conn->output() += reply.second;
+        conn->resume();
+        after_process(conn);
+    }
+}
+
+void CoreLoop::accept_new() {
+    std::vector<int> fds;
+    {
+        std::lock_guard<std::mutex> lock(accept_mtx_);
+        fds.swap(accepted_);
+    }
+    
+    for (int fd : fds) {
+        Peer& peer = conns_[fd];
+        peer.conn = std::make_unique<Connection>(fd, store_, batcher_, this, cluster_);
+        
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = peer.conn.get();
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl add failed");
+            conns_.erase(fd);
+            close(fd);
+        }
+    }
+}
+
+bool CoreLoop::execute(Connection& conn, const CommandView& cmd, std::string& out) {
+    if (!cmd.valid) {
+        store_.execute(cmd, out);
+        return true;
+    }
+    
+    switch (cmd.type) {
+        case CommandType::GET:
+        case CommandType::SET:
+        case CommandType::DEL:
+        case CommandType::MGET:
+        case CommandType::MSET:
+        case CommandType::VSET:
+        case CommandType::VGET:
+            return dispatch(conn, cmd, out);
+        
+        case CommandType::IMPORT:
+            // Never on this loop: the connection waits for the maintenance
+            // thread while the core serves everyone else
+            store_.import_command(cmd.key, [this, conn = &conn](std::string reply) {
+                {
+                    std::lock_guard<std::mutex> lock(import_mtx_);
+                    imported_.emplace_back(conn, std::move(reply));
+                }
+                wake();
+            });
+            return false;
+        
+        default:
+            // STATS, SLOWLOG and COMPACT are not tied to a shard. VSIM reads
+            // the other cores' shards under their locks, like a split MGET
+            // that is never split.
+            store_.execute(cmd, out);
+            return true;
+    }
+}
+
+// Executes a keyed command here if this core owns all its keys. Otherwise
+// sends each owning core its share and returns false; a multi-key command
+// is then no longer read or written under all of its locks at once.
+bool CoreLoop::dispatch(Connection& conn, const CommandView& cmd, std::string& out) {
+    bool multi = cmd.type == CommandType::MGET || !cmd.keys.empty();
+    
+    thread_local std::vector<uint32_t> key_core;
+    key_core.clear();
+    size_t first = 0;
+    bool single = true;
+    if (multi) {
+        for (size_t i = 0; i < cmd.keys.size(); ++i) {
+            key_core.push_back(static_cast<uint32_t>(core_of(cmd.keys[i])));
+            single = single && key_core[i] == key_core[0];
+        }
+        first = key_core.empty() ? id_ : key_core[0];
+    } else {
+        first = core_of(cmd.key);
+    }
+    
+    if (single && first == id_) {
+        store_.execute(cmd, out);
+        return true;
+    }
+    
+    Peer& peer = conns_[conn.fd()];
+    if (!peer.request) {
+        peer.request = std::make_unique<Request>();
+        peer.request->parts.resize(cores_);
+    }
+    Request& request = *peer.request;
+    request.conn = &conn;
+    request.type = cmd.type;
+    request.split = !single;
+    request.outstanding = 0;
+    request.start_ns = Metrics::now_ns();
+    
+    if (single) {
+        // Whole command to its one owner
+        Part& part = request.parts[first];
+        part.request = &request;
+        part.origin = id_;
+        part.active = true;
+        part.values = false;
+        part.cmd = cmd;
+        request.owner = first;
+        request.outstanding = 1;
+        send(first, &part);
+        return false;
+    }
+    
+    request.key_core.swap(key_core);
+    for (Part& part : request.parts) {
+        part.request = &request;
+        part.origin = id_;
+        part.active = false;
+        part.values = cmd.type == CommandType::MGET;
+        part.bytes.clear();
+        part.sizes.clear();
+        part.cmd.reset();
+        part.cmd.type = cmd.type;
+        part.cmd.valid = true;
+    }
+    for (size_t i = 0; i < cmd.keys.size(); ++i) {
+        Part& part = request.parts[request.key_core[i]];
+        part.active = true;
+        CommandView& sub = part.cmd;
+        sub.keys.push_back(cmd.keys[i]);
+        if (cmd.type == CommandType::MSET) {
+            sub.values.push_back(cmd.values[i]);
+            sub.ttls.push_back(cmd.ttls[i]);
+        }
+    }
+    if (cmd.type == CommandType::DEL) {
+        for (Part& part : request.parts) {
+            if (part.cmd.keys.size() == 1) {
+                part.cmd.key = part.cmd.keys[0];
+                part.cmd.keys.clear(); // Single-key DEL form
+            }
+        }
+    }
+    
+    // Remote parts first so they run while this core does its own share
+    bool local = false;
+    for (size_t core = 0; core < cores_; ++core) {
+        Part& part = request.parts[core];
+        if (!part.active) {
+            continue;
+        }
+        if (core == id_) {
+            local = true;
+        } else {
+            request.outstanding++;
+            send(core, &part);
+        }
+    }
+    if (local) {
+        run_part(request.parts[id_]);
+    }
+    return false;
+}
+
+void CoreLoop::run_part(Part& part) {
+    part.bytes.clear();
+    part.sizes.clear();
+    if (part.values) {
+        store_.mget_values(part.cmd.keys, part.bytes, part.sizes);
+    } else {
+        store_.execute(part.cmd, part.bytes);
+    }
+}
+
+// Posts a part to core `to`, or back to its origin once it has run. Parts
+// queue in order behind a full ring, so a core never blocks on a busy peer.
+void CoreLoop::send(size_t to, Part* part) {
+    std::deque<Part*>& backlog = backlog_[to];
+    if (!backlog.empty() || !peers_[to]->inbox_[id_]->push(part)) {
+        backlog.push_back(part);
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (peers_[to]->parked_.load(std::memory_order_relaxed)) {
+        peers_[to]->wake();
+    }
+}
+
+// Returns true once every backlog is empty
+bool CoreLoop::flush_backlog() {
+    bool empty = true;
+    for (size_t to = 0; to < cores_; ++to) {
+        std::deque<Part*>& backlog = backlog_[to];
+        if (backlog.empty()) {
+            continue;
+        }
+        while (!backlog.empty() && peers_[to]->inbox_[id_]->push(backlog.front())) {
+            backlog.pop_front();
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (peers_[to]->parked_.load(std::memory_order_relaxed)) {
+            peers_[to]->wake();
+        }
+        empty = empty && backlog.empty();
+    }
+    return empty;
+}
+
+bool CoreLoop::inboxes_empty() const {
+    for (const auto& inbox : inbox_) {
+        if (!inbox->empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs parts other cores sent here and completes this core's requests whose
+// parts came back. Returns whether anything was received.
+bool CoreLoop::drain_inboxes() {
+    bool any = false;
+    for (size_t from = 0; from < cores_; ++from) {
+        Part* part;
+        while (inbox_[from]->pop(part)) {
+            any = true;
+            if (part->origin != id_) {
+                run_part(*part);
+                send(part->origin, part);
+                continue;
+            }
+            Request& request = *part->request;
+            if (--request.outstanding == 0) {
+                complete(request);
+            }
+        }
+    }
+    return any;
+}
+
+// Merges a request's parts into the connection's reply and resumes it
+void CoreLoop::complete(Request& request) {
+    Connection* conn = request.conn;
+    std::string& out = conn->output();
+    
+    if (!request.split) {
+        Part& part = request.parts[request.owner];
+        out += part.bytes;
+        part.bytes.clear();
+        part.active = false;
+    } else if (request.type == CommandType::MGET) {
+        static constexpr std::string_view NIL = "(nil)";
+        thread_local std::vector<std::pair<size_t, size_t>> cursor; // (offset, index) per part
+        cursor.assign(cores_, {0, 0});
+        for (size_t i = 0; i < request.key_core.size(); ++i) {
+            uint32_t core = request.key_core[i];
+            const Part& part = request.parts[core];
+            size_t size = part.sizes[cursor[core].second++];
+            if (i > 0) out += ' ';
+            if (size == KVStore::MISS) {
+                out += NIL;
+            } else {
+                out.append(part.bytes, cursor[core].first, size);
+                cursor[core].first += size;
+            }
+        }
+        out += '\n';
+        auto us = (Metrics::now_ns() - request.start_ns) / 1000;
+        Metrics::instance().record_latency(us);
+    } else {
+        // MSET, DEL: the first error if any part failed
+        std::string_view reply = "OK\n";
+        for (const Part& part : request.parts) {
+            if (part.active && part.bytes.compare(0, 6, "ERROR:") == 0) {
+                reply = part.bytes;
+                break;
+            }
+        }
+        out += reply;
+    }
+    
+    conn->resume();
+    after_process(conn);
+}
+
+void CoreLoop::after_process(Connection* conn) {
+    if (conn->suspended()) {
+        return; // Stays disarmed until its request completes
+    }
+    if (!conn->flush_output()) {
+        close_connection(conn);
+        return;
+    }
+    rearm(conn);
+}
+
+void CoreLoop::on_readable(Connection* conn) {
+    if (!conn->read_input()) {
+        close_connection(conn);
+        return;
+    }
+    conn->process();
+    after_process(conn);
+}
+
+void CoreLoop::on_writable(Connection* conn) {
+    if (!conn->flush_output()) {
+        close_connection(conn);
+        return;
+    }
+    rearm(conn);
+}
+
+void CoreLoop::rearm(Connection* conn) {
+    if (conn->closing() && !conn->has_pending_output()) {
+        close_connection(conn);
+        return;
+    }
+    
+    epoll_event ev{};
+    ev.events = (conn->has_pending_output() ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd(), &ev) < 0) {
+        close_connection(conn);
+    }
+}
+
+void CoreLoop::close_connection(Connection* conn) {
+    int fd = conn->fd();
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    conns_.erase(fd);
+    close(fd);
+}
+
+#else
+
+CoreLoop::CoreLoop(size_t id, size_t cores, KVStore& store, WriteBatcher& batcher, Affinity affinity, Cluster* cluster)
+    : id_(id), cores_(cores), affinity_(affinity), store_(store), batcher_(batcher), cluster_(cluster) {}
+
+CoreLoop::~CoreLoop() {}
+
+bool CoreLoop::supported() {
+    return false;
+}
+
+void CoreLoop::connect(const std::vector<std::unique_ptr<CoreLoop>>&) {}
+
+void CoreLoop::start() {}
+
+void CoreLoop::add_connection(int client_socket) {
+    std::cerr << "Per-core mode requires epoll; closing connection" << std::endl;
+    close(client_socket);
+}
+
+bool CoreLoop::execute(Connection&, const CommandView&, std::string&) {
+    return true;
+}
+
+#endif
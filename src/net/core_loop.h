@@ -0,0 +1,127 @@
+#pragma once
+
+#include "../storage/kv_store.h"
+#include "../batching/write_batcher.h"
+#include "../concurrency/spsc_queue.h"
+#include "../concurrency/affinity.h"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Connection;
+class Cluster;
+
+// One core of the thread-per-core mode (--io percore). Each CoreLoop is an
+// epoll loop on its own thread that owns a fixed subset of the store's shards
+// (shard % cores == id) and executes requests inline, with no executor pool
+// and no write batcher. A command whose keys live on other cores is split
+// into one part per owning core and posted to them over SPSC rings; its
+// connection is suspended, and reads nothing, until every part has come back
+// and the replies are merged in key order. Shards are therefore only ever
+// locked by their own core on the request path, so their mutexes and entries
+// stay in that core's cache.
+class CoreLoop {
+public:
+    CoreLoop(size_t id, size_t cores, KVStore& store, WriteBatcher& batcher,
+             Affinity affinity = Affinity::CPU, Cluster* cluster = nullptr);
+    ~CoreLoop();
+    
+    static bool supported();
+    
+    // Wires every core to every other. Call once, before any start().
+    static void connect(const std::vector<std::unique_ptr<CoreLoop>>& cores);
+    
+    void start();
+    void add_connection(int client_socket); // From the accept thread
+    
+    // Called from Connection::execute() on this core's thread. Appends the
+    // reply to out and returns true, or returns false once the command has
+    // been handed to other cores; the connection is then resumed later.
+    bool execute(Connection& conn, const CommandView& cmd, std::string& out);
+    
+    size_t core_of(std::string_view key) const { return store_.shard_of(key) % cores_; }
+
+private:
+    struct Request;
+    
+    // One core's share of a dispatched command. Travels to the owning core
+    // and back through the same pointer; `cmd` views the origin connection's
+    // input, which is left untouched until the request completes.
+    struct Part {
+        Request* request = nullptr;
+        size_t origin = 0;
+        bool active = false;        // Has keys in the current request
+        bool values = false;        // MGET part: reply with mget_values()
+        CommandView cmd;
+        std::string bytes;          // Reply, or the values of an MGET part
+        std::vector<size_t> sizes;  // MGET part: value sizes or KVStore::MISS
+    };
+    
+    // The command a suspended connection is waiting on; reused for its next one
+    struct Request {
+        Connection* conn = nullptr;
+        CommandType type = CommandType::UNKNOWN;
+        bool split = false;              // Parts hold a share of the keys each
+        size_t owner = 0;                // Not split: the core running the whole command
+        std::vector<Part> parts;         // Indexed by core
+        std::vector<uint32_t> key_core;  // Owning core of each key, in key order
+        size_t outstanding = 0;
+        uint64_t start_ns = 0;
+    };
+    
+    struct Peer {
+        std::unique_ptr<Connection> conn;
+        std::unique_ptr<Request> request;
+    };
+    
+    void run();
+    bool dispatch(Connection& conn, const CommandView& cmd, std::string& out);
+    void run_part(Part& part);
+    void send(size_t to, Part* part);
+    bool flush_backlog();
+    bool drain_inboxes();
+    bool inboxes_empty() const;
+    void complete(Request& request);
+    void wake();
+    void accept_new();
+    void deliver_imports();
+    void after_process(Connection* conn);
+    void on_readable(Connection* conn);
+    void on_writable(Connection* conn);
+    void rearm(Connection* conn);
+    void close_connection(Connection* conn);
+    
+    size_t id_;
+    size_t cores_;
+    Affinity affinity_;
+    KVStore& store_;
+    WriteBatcher& batcher_;
+    Cluster* cluster_;
+    std::vector<CoreLoop*> peers_;
+    
+    // inbox_[from] carries parts from core `from` (requests) and parts this
+    // core sent to `from`, coming back (replies). Only this thread pops.
+    std::vector<std::unique_ptr<SpscQueue<Part*>>> inbox_;
+    std::vector<std::deque<Part*>> backlog_; // Per destination, while its ring is full
+    std::atomic<bool> parked_{false};        // In epoll_wait with nothing queued
+    
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+    
+    std::mutex accept_mtx_;
+    std::vector<int> accepted_;                 // Handed over by add_connection()
+    std::mutex import_mtx_;
+    std::vector<std::pair<Connection*, std::string>> imported_; // IMPORT replies from the maintenance thread
+    std::unordered_map<int, Peer> conns_;       // This thread only
+    
+    static constexpr size_t RING_CAPACITY = 4096;
+    static constexpr int MAX_EVENTS = 256;
+};
@@ -0,0 +1,196 @@
+#include "event_loop.h"
+#include "connection.h"
+#include <iostream>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+EventLoop::EventLoop(KVStore& store, WriteBatcher& batcher, ThreadPool& executors, Cluster* cluster)
+    : store_(store), batcher_(batcher), executors_(executors), cluster_(cluster) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        perror("epoll_create1 failed");
+        return;
+    }
+    
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr; // nullptr marks the wakeup descriptor
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+}
+
+EventLoop::~EventLoop() {
+    running_ = false;
+    if (wake_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+        (void)ignored;
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(conns_mtx_);
+        for (auto& [fd, conn] : conns_) {
+            close(fd);
+        }
+        conns_.clear();
+    }
+    
+    if (wake_fd_ >= 0) close(wake_fd_);
+    if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool EventLoop::supported() {
+    return true;
+}
+
+void EventLoop::start() {
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+}
+
+void EventLoop::add_connection(int client_socket) {
+    auto conn = std::make_unique<Connection>(client_socket, store_, batcher_, nullptr, cluster_);
+    Connection* raw = conn.get();
+    
+    {
+        std::lock_guard<std::mutex> lock(conns_mtx_);
+        conns_[client_socket] = std::move(conn);
+    }
+    
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = raw;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, client_socket, &ev) < 0) {
+        perror("epoll_ctl add failed");
+        std::lock_guard<std::mutex> lock(conns_mtx_);
+        conns_.erase(client_socket);
+        close(client_socket);
+    }
+}
+
+size_t EventLoop::connection_count() {
+    std::lock_guard<std::mutex> lock(conns_mtx_);
+    return conns_.size();
+}
+
+void EventLoop::run() {
+    epoll_event events[MAX_EVENTS];
+    
+    while (running_) {
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait failed");
+            break;
+        }
+        
+        for (int i = 0; i < n; ++i) {
+            auto* conn = static_cast<Connection*>(events[i].data.ptr);
+            if (conn == nullptr) {
+                continue; // Shutdown wakeup
+            }
+            
+            conn->take_over(); // Pairs with end_handoff() in rearm()
+            uint32_t mask = events[i].events;
+            if (mask & EPOLLERR) {
+                close_connection(conn);
+            } else if (mask & EPOLLOUT) {
+                on_writable(conn);
+            } else if (mask & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) {
+                on_readable(conn);
+            }
+        }
+    }
+}
+
+void EventLoop::on_readable(Connection* conn) {
+    if (!conn->read_input()) {
+        close_connection(conn);
+        return;
+    }
+    
+    // The descriptor stays disarmed (EPOLLONESHOT) until the executor is
+    // done, which keeps replies on one connection in request order.
+    executors_.enqueue([this, conn]() {
+        conn->process();
+        if (!conn->flush_output()) {
+            close_connection(conn);
+            return;
+        }
+        rearm(conn);
+    });
+}
+
+void EventLoop::on_writable(Connection* conn) {
+    if (!conn->flush_output()) {
+        close_connection(conn);
+        return;
+    }
+    rearm(conn);
+}
+
+void EventLoop::rearm(Connection* conn) {
+    if (conn->closing() && !conn->has_pending_output()) {
+        close_connection(conn);
+        return;
+    }
+    
+    epoll_event ev{};
+    ev.events = (conn->has_pending_output() ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = conn;
+    // The reactor may take conn over as soon as it is re-armed; it waits for
+    // end_handoff(), after the last access here (see Connection::take_over())
+    conn->begin_handoff();
+    bool armed = epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, conn->fd(), &ev) == 0;
+    conn->end_handoff();
+    if (!armed) {
+        close_connection(conn);
+    }
+}
+
+void EventLoop::close_connection(Connection* conn) {
+    int fd = conn->fd();
+    std::unique_ptr<Connection> owned;
+    {
+        // Drop the map entry before close() so a reused fd number from a
+        // concurrent accept() can never be erased by mistake.
+        std::lock_guard<std::mutex> lock(conns_mtx_);
+        auto it = conns_.find(fd);
+        if (it != conns_.end()) {
+            owned = std::move(it->second);
+            conns_.erase(it);
+        }
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+}
+
+#else
+
+EventLoop::EventLoop(KVStore& store, WriteBatcher& batcher, ThreadPool& executors, Cluster* cluster)
+    : store_(store), batcher_(batcher), executors_(executors), cluster_(cluster) {}
+
+EventLoop::~EventLoop() {}
+
+bool EventLoop::supported() {
+    return false;
+}
+
+void EventLoop::start() {}
+
+void EventLoop::add_connection(int client_socket) {
+    std::cerr << "Reactor mode requires epoll; closing connection" << std::endl;
+    close(client_socket);
+}
+
+size_t EventLoop::connection_count() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "../storage/kv_store.h"
+#include "../batching/write_batcher.h"
+#include "../concurrency/thread_pool.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+class Connection;
+class Cluster;
+
+// A reactor thread multiplexing many non-blocking client sockets with epoll.
+// The reactor only reads; executing a request and writing the reply is handed
+// to the shared ThreadPool, so the number of open connections no longer
+// bounds how many clients can be served at once.
+class EventLoop {
+public:
+    EventLoop(KVStore& store, WriteBatcher& batcher, ThreadPool& executors, Cluster* cluster = nullptr);
+    ~EventLoop();
+    
+    static bool supported();
+    
+    void start();
+    void add_connection(int client_socket);
+    size_t connection_count();
+
+private:
+    void run();
+    void on_readable(Connection* conn);
+    void on_writable(Connection* conn);
+    void rearm(Connection* conn);
+    void close_connection(Connection* conn);
+    
+    KVStore& store_;
+    WriteBatcher& batcher_;
+    ThreadPool& executors_;
+    Cluster* cluster_;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread thread_;
+    
+    std::mutex conns_mtx_;
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    
+    static constexpr int MAX_EVENTS = 256;
+};
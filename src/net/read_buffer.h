@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+// Growable per-connection receive buffer. Bytes between begin_ and end_ are
+// unparsed input; a partial frame at the tail stays put until the next read
+// completes it. Consumed space is reclaimed by sliding the tail to the front.
+class ReadBuffer {
+public:
+    static constexpr size_t INITIAL_CAPACITY = 16 * 1024;
+    
+    const char* data() const { return buf_.get() + begin_; }
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    
+    // Writable tail with room for at least min_bytes.
+    char* prepare(size_t min_bytes) {
+        if (capacity_ - end_ >= min_bytes) {
+            return buf_.get() + end_;
+        }
+        
+        size_t live = size();
+        if (begin_ > 0 && capacity_ - live >= min_bytes && live <= capacity_ / 2) {
+            std::memmove(buf_.get(), buf_.get() + begin_, live);
+        } else {
+            size_t new_capacity = capacity_ > 0 ? capacity_ : INITIAL_CAPACITY;
+            while (new_capacity - live < min_bytes) {
+                new_capacity *= 2;
+            }
+            std::unique_ptr<char[]> grown(new char[new_capacity]);
+            if (live > 0) {
+                std::memcpy(grown.get(), buf_.get() + begin_, live);
+            }
+            buf_ = std::move(grown);
+            capacity_ = new_capacity;
+        }
+        begin_ = 0;
+        end_ = live;
+        return buf_.get() + end_;
+    }
+    
+    size_t writable() const { return capacity_ - end_; }
+    
+    void commit(size_t n) { end_ += n; }
+    
+    void consume(size_t n) {
+        begin_ += n;
+        if (begin_ == end_) {
+            begin_ = end_ = 0;
+        }
+    }
+
+private:
+    std::unique_ptr<char[]> buf_;
+    size_t capacity_ = 0;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
@@ -4,16 +4,66 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <thread>
 
-Server::Server(int port, KVStore& store, size_t num_threads) 
-    : port_(port), server_fd_(-1), store_(store) {
-    batcher_ = std::make_unique<WriteBatcher>(store);
+namespace {
+
+ServerOptions make_options(int port, size_t num_threads) {
+    ServerOptions options;
+    options.port = port;
+    options.num_threads = num_threads;
+    return options;
+}
+
+bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+} // namespace
+
+Server::Server(int port, KVStore& store, size_t num_threads)
+    : Server(make_options(port, num_threads), store) {}
+
+Server::Server(const ServerOptions& options, KVStore& store) 
+    : server_fd_(-1), options_(options), store_(store) {
+    batcher_ = std::make_unique<WriteBatcher>(store, options_.batching);
     
-    thread_pool_ = std::make_unique<ThreadPool>(num_threads, [this](int client_socket) {
-        Connection conn(client_socket, store_, *batcher_);
-        conn.handle();
-    });
+    if (options_.mode == ServerMode::PER_CORE && !CoreLoop::supported()) {
+        std::cerr << "Warning: per-core mode unavailable on this platform, using threaded mode" << std::endl;
+        options_.mode = ServerMode::THREADED;
+    }
+    if (options_.mode == ServerMode::REACTOR && !EventLoop::supported()) {
+        std::cerr << "Warning: reactor mode unavailable on this platform, using threaded mode" << std::endl;
+        options_.mode = ServerMode::THREADED;
+    }
+    
+    if (options_.mode == ServerMode::PER_CORE) {
+        // Cores own whole shards, so more cores than shards would sit idle
+        size_t cores = options_.num_cores > 0 ? options_.num_cores : options_.num_threads;
+        if (cores > store_.shard_count()) {
+            std::cerr << "Warning: " << cores << " cores but only " << store_.shard_count()
+                      << " shards, using " << store_.shard_count() << " cores" << std::endl;
+            cores = store_.shard_count();
+        }
+        for (size_t i = 0; i < cores; ++i) {
+            cores_.push_back(std::make_unique<CoreLoop>(i, cores, store_, *batcher_, options_.core_affinity, options_.cluster));
+        }
+        CoreLoop::connect(cores_);
+        return; // No executor pool: each core executes its own requests
+    }
+    
+    ThreadPoolOptions pool;
+    pool.affinity = options_.executor_affinity;
+    thread_pool_ = std::make_unique<ThreadPool>(options_.num_threads, pool);
+    
+    if (options_.mode == ServerMode::REACTOR) {
+        size_t reactors = options_.num_reactors > 0 ? options_.num_reactors : 1;
+        for (size_t i = 0; i < reactors; ++i) {
+            reactors_.push_back(std::make_unique<EventLoop>(store_, *batcher_, *thread_pool_, options_.cluster));
+        }
+    }
 }
 
 void Server::run() {
@@ -33,7 +83,7 @@ void Server::run() {
     sockaddr_in address{};
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port_);
+    address.sin_port = htons(options_.port);
 
     if (bind(server_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
         perror("Bind failed");
@@ -47,21 +97,50 @@ void Server::run() {
         return;
     }
 
-    std::cout << "Server listening on port " << port_ << "..." << std::endl;
+    for (auto& reactor : reactors_) {
+        reactor->start();
+    }
+    for (auto& core : cores_) {
+        core->start();
+    }
+
+    const char* mode = !cores_.empty() ? " (per-core)" : reactors_.empty() ? " (threaded)" : " (reactor)";
+    std::cout << "Server listening on port " << options_.port << mode << "..." << std::endl;
 
+    size_t next_reactor = 0;
+    size_t next_core = 0;
     while (true) {
         sockaddr_in address;
         socklen_t addrlen = sizeof(address);
         
         int client_socket = accept(server_fd_, reinterpret_cast<sockaddr*>(&address), &addrlen);
         
-        if (client_socket >= 0) {
-            thread_pool_->enqueue(client_socket);
-        } else {
+        if (client_socket < 0) {
             perror("Accept failed");
+            continue;
+        }
+        
+        if (!cores_.empty()) {
+            if (set_nonblocking(client_socket)) {
+                cores_[next_core]->add_connection(client_socket);
+                next_core = (next_core + 1) % cores_.size();
+            } else {
+                perror("fcntl O_NONBLOCK failed");
+                close(client_socket);
+            }
+        } else if (reactors_.empty()) {
+            thread_pool_->enqueue([this, client_socket]() {
+                Connection conn(client_socket, store_, *batcher_, nullptr, options_.cluster);
+                conn.handle();
+            });
+        } else if (set_nonblocking(client_socket)) {
+            reactors_[next_reactor]->add_connection(client_socket);
+            next_reactor = (next_reactor + 1) % reactors_.size();
+        } else {
+            perror("fcntl O_NONBLOCK failed");
+            close(client_socket);
         }
     }
 
     close(server_fd_);
 }
-
@@ -3,18 +3,43 @@
 #include "../storage/kv_store.h"
 #include "../concurrency/thread_pool.h"
 #include "../batching/write_batcher.h"
+#include "event_loop.h"
+#include "core_loop.h"
 #include <memory>
+#include <vector>
+
+class Cluster;
+
+enum class ServerMode {
+    THREADED, // One worker owns a connection until it disconnects
+    REACTOR,  // epoll reactors multiplex sockets, workers execute requests
+    PER_CORE  // One event loop per core, each owning a subset of the shards
+};
+
+struct ServerOptions {
+    int port = 8080;
+    size_t num_threads = 8;
+    ServerMode mode = ServerMode::REACTOR;
+    size_t num_reactors = 2;
+    size_t num_cores = 0;     // PER_CORE: loops to run, 0 = num_threads
+    Affinity executor_affinity = Affinity::NONE; // ThreadPool workers
+    Affinity core_affinity = Affinity::CPU;      // PER_CORE loops
+    BatcherOptions batching;
+    Cluster* cluster = nullptr; // Cluster mode: routes keys owned by other nodes
+};
 
 class Server {
 public:
     Server(int port, KVStore& store, size_t num_threads = 8);
+    Server(const ServerOptions& options, KVStore& store);
     void run();
 
 private:
     int server_fd_;
-    int port_;
+    ServerOptions options_;
     KVStore& store_;
     std::unique_ptr<WriteBatcher> batcher_;
     std::unique_ptr<ThreadPool> thread_pool_;
+    std::vector<std::unique_ptr<EventLoop>> reactors_;
+    std::vector<std::unique_ptr<CoreLoop>> cores_;
 };
-
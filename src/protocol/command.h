@@ -1,16 +1,117 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <vector>
 
-enum class CommandType { SET, GET, DEL, COMPACT, STATS, MGET, UNKNOWN };
+enum class CommandType { SET, GET, DEL, COMPACT, STATS, MGET, SLOWLOG, MSET, ROLE, CLUSTER, ASKING, VSET, VGET, VSIM, IMPORT, UNKNOWN };
+
+constexpr size_t COMMAND_TYPE_COUNT = static_cast<size_t>(CommandType::UNKNOWN) + 1;
+
+inline const char* command_name(CommandType type) {
+    switch (type) {
+        case CommandType::SET: return "SET";
+        case CommandType::GET: return "GET";
+        case CommandType::DEL: return "DEL";
+        case CommandType::COMPACT: return "COMPACT";
+        case CommandType::STATS: return "STATS";
+        case CommandType::MGET: return "MGET";
+        case CommandType::SLOWLOG: return "SLOWLOG";
+        case CommandType::MSET: return "MSET";
+        case CommandType::ROLE: return "ROLE";
+        case CommandType::CLUSTER: return "CLUSTER";
+        case CommandType::ASKING: return "ASKING";
+        case CommandType::VSET: return "VSET";
+        case CommandType::VGET: return "VGET";
+        case CommandType::VSIM: return "VSIM";
+        case CommandType::IMPORT: return "IMPORT";
+        default: return "UNKNOWN";
+    }
+}
+
+// How VSIM scores a candidate against the query
+enum class VectorMetric { COSINE, DOT, L2 };
 
 struct ParsedCommand {
     CommandType type;
     std::string key;
     std::string value;
-    std::vector<std::string> keys; // For MGET
+    std::vector<std::string> keys; // For MGET, MSET, multi-key DEL and VSIM candidates
+    std::vector<std::string> values; // For MSET, one per key; VSET's numbers
+    std::vector<int> ttls;           // For MSET, one per key (0 = none)
     int ttl_seconds = 0; // New: ML Cache TTL
+    int count = 0;                   // For VSIM, how many results
+    VectorMetric metric = VectorMetric::COSINE;
+    bool prefix = false;             // For VSIM, value is a key prefix to scan instead of keys
     bool valid = true;
 };
 
+// Keys written by a SET, DEL or MSET: a DEL of several keys lists all of
+// them in keys, a single-key DEL only sets key
+template <typename Command>
+size_t write_count(const Command& cmd) {
+    return cmd.keys.empty() ? 1 : cmd.keys.size();
+}
+
+template <typename Command>
+const auto& write_key(const Command& cmd, size_t i) {
+    return cmd.keys.empty() ? cmd.key : cmd.keys[i];
+}
+
+// Non-owning command produced by Parser::parse_view(). Every view points into
+// the buffer that was parsed and is only valid until that buffer is consumed.
+// Connections keep one CommandView alive and reuse it, so once keys has grown
+// to the largest MGET or MSET seen, parsing allocates nothing.
+struct CommandView {
+    CommandType type = CommandType::UNKNOWN;
+    std::string_view key;
+    std::string_view value;
+    std::vector<std::string_view> keys;   // For MGET, MSET, multi-key DEL and VSIM candidates
+    std::vector<std::string_view> values; // For MSET, one per key; VSET's numbers
+    std::vector<int> ttls;                // For MSET, one per key (0 = none)
+    int ttl_seconds = 0;
+    int count = 0;                        // For VSIM, how many results
+    VectorMetric metric = VectorMetric::COSINE;
+    bool prefix = false;                  // For VSIM, value is a key prefix to scan instead of keys
+    bool valid = false;
+    bool protocol_error = false;          // Malformed RESP framing; the connection must close
+    
+    void reset() {
+        type = CommandType::UNKNOWN;
+        key = {};
+        value = {};
+        keys.clear();
+        values.clear();
+        ttls.clear();
+        ttl_seconds = 0;
+        count = 0;
+        metric = VectorMetric::COSINE;
+        prefix = false;
+        valid = false;
+        protocol_error = false;
+    }
+    
+    // Deep copy for consumers that outlive the read buffer (e.g. WriteBatcher)
+    ParsedCommand to_owned() const {
+        ParsedCommand cmd;
+        cmd.type = type;
+        cmd.key.assign(key.data(), key.size());
+        cmd.value.assign(value.data(), value.size());
+        cmd.keys.reserve(keys.size());
+        for (std::string_view k : keys) {
+            cmd.keys.emplace_back(k);
+        }
+        cmd.values.reserve(values.size());
+        for (std::string_view v : values) {
+            cmd.values.emplace_back(v);
+        }
+        cmd.ttls = ttls;
+        cmd.ttl_seconds = ttl_seconds;
+        cmd.count = count;
+        cmd.metric = metric;
+        cmd.prefix = prefix;
+        cmd.valid = valid;
+        return cmd;
+    }
+};
@@ -1,9 +1,265 @@
 #include "parser.h"
-#include <sstream>
+#include "../vector/embedding.h"
+#include <atomic>
 #include <cstring>
-#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define MEMKV_PARSER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define MEMKV_PARSER_NEON 1
+#endif
+
+namespace {
+
+std::atomic<Parser::ScanMode> g_scan_mode{
+#if defined(MEMKV_PARSER_SSE2) || defined(MEMKV_PARSER_NEON)
+    Parser::ScanMode::SIMD
+#else
+    Parser::ScanMode::SCALAR
+#endif
+};
+
+const char* find_byte_scalar(const char* p, const char* end, char c) {
+    for (; p < end; ++p) {
+        if (*p == c) return p;
+    }
+    return nullptr;
+}
+
+const char* find_byte_simd(const char* p, const char* end, char c) {
+#if defined(MEMKV_PARSER_SSE2)
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#elif defined(MEMKV_PARSER_NEON)
+    const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+    while (end - p >= 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p)), needle);
+        // Narrow each 8-bit lane to 4 bits so the mask fits in 64 bits
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != 0) {
+            return p + (__builtin_ctzll(mask) >> 2);
+        }
+        p += 16;
+    }
+#endif
+    return find_byte_scalar(p, end, c);
+}
+
+inline const char* find_byte(const char* p, const char* end, char c) {
+    if (g_scan_mode.load(std::memory_order_relaxed) == Parser::ScanMode::SIMD) {
+        return find_byte_simd(p, end, c);
+    }
+    return find_byte_scalar(p, end, c);
+}
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Next whitespace-separated token starting at pos; advances pos past it.
+inline bool next_token(std::string_view line, size_t& pos, std::string_view& token) {
+    while (pos < line.size() && is_space(line[pos])) ++pos;
+    size_t start = pos;
+    while (pos < line.size() && !is_space(line[pos])) ++pos;
+    token = line.substr(start, pos - start);
+    return !token.empty();
+}
+
+inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && is_space(s.front())) s.remove_prefix(1);
+    while (!s.empty() && is_space(s.back())) s.remove_suffix(1);
+    return s;
+}
+
+bool parse_positive_int(std::string_view s, int& out) {
+    if (s.empty() || s.size() > 9) return false;
+    int value = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + (c - '0');
+    }
+    out = value;
+    return true;
+}
+
+// SLOWLOG GET [count] | LEN | RESET
+bool valid_slowlog(std::string_view subcommand, std::string_view count) {
+    int n = 0;
+    if (subcommand == "GET") {
+        return count.empty() || parse_positive_int(count, n);
+    }
+    return (subcommand == "LEN" || subcommand == "RESET") && count.empty();
+}
+
+// MSET key value [EX seconds] [key value [EX seconds] ...]. Splits the
+// arguments collected in cmd.keys into keys, values and ttls, in place. An
+// EX (or TTL) after a value is only read as a TTL when an integer follows it.
+bool split_mset(CommandView& cmd) {
+    auto& args = cmd.keys;
+    size_t out = 0;
+    for (size_t i = 0; i < args.size(); ) {
+        if (i + 1 >= args.size()) {
+            break; // Key without a value
+        }
+        std::string_view key = args[i];
+        std::string_view value = args[i + 1];
+        i += 2;
+        int ttl = 0;
+        if (i + 1 < args.size() && (args[i] == "EX" || args[i] == "TTL") && parse_positive_int(args[i + 1], ttl)) {
+            i += 2;
+        }
+        args[out++] = key;
+        cmd.values.push_back(value);
+        cmd.ttls.push_back(ttl);
+        if (i == args.size()) {
+            args.resize(out);
+            return true;
+        }
+    }
+    args.clear();
+    cmd.values.clear();
+    cmd.ttls.clear();
+    return false;
+}
+
+// VSET key number [number ...] [EX seconds], from the arguments collected
+// in cmd.keys. The numbers are checked here so a batched VSET cannot fail
+// later, but stay text in values; the store converts them when it applies
+// the write.
+bool split_vset(CommandView& cmd) {
+    auto& args = cmd.keys;
+    size_t end = args.size();
+    int ttl = 0;
+    if (end >= 4 && (args[end - 2] == "EX" || args[end - 2] == "TTL") && parse_positive_int(args[end - 1], ttl)) {
+        cmd.ttl_seconds = ttl;
+        end -= 2;
+    }
+    if (end < 2) {
+        args.clear();
+        return false;
+    }
+    cmd.key = args[0];
+    cmd.values.assign(args.begin() + 1, args.begin() + end);
+    args.clear();
+    
+    thread_local std::vector<float> numbers;
+    numbers.clear();
+    for (std::string_view text : cmd.values) {
+        if (!parse_vector(text, numbers) || numbers.size() > MAX_VECTOR_DIMS) {
+            cmd.values.clear();
+            return false;
+        }
+    }
+    if (numbers.empty()) {
+        cmd.values.clear();
+        return false;
+    }
+    return true;
+}
+
+bool parse_metric(std::string_view name, VectorMetric& out) {
+    if (name == "COSINE" || name == "cosine") {
+        out = VectorMetric::COSINE;
+    } else if (name == "DOT" || name == "dot") {
+        out = VectorMetric::DOT;
+    } else if (name == "L2" || name == "l2") {
+        out = VectorMetric::L2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// VSIM query k [METRIC COSINE|DOT|L2] (PREFIX prefix | key [key ...]), from
+// the arguments collected in cmd.keys, which are left holding the candidate
+// keys. The query is a key or an inline [number,...] vector.
+bool split_vsim(CommandView& cmd) {
+    auto& args = cmd.keys;
+    size_t i = 2;
+    bool ok = args.size() > i && parse_positive_int(args[1], cmd.count) && cmd.count > 0;
+    if (ok && args[i] == "METRIC") {
+        ok = i + 1 < args.size() && parse_metric(args[i + 1], cmd.metric);
+        i += 2;
+    }
+    ok = ok && i < args.size();
+    if (!ok) {
+        args.clear();
+        return false;
+    }
+    cmd.key = args[0];
+    if (args[i] == "PREFIX" && i + 2 == args.size()) {
+        cmd.prefix = true;
+        cmd.value = args[i + 1];
+        args.clear();
+        return true;
+    }
+    args.erase(args.begin(), args.begin() + i);
+    return true;
+}
+
+// Parses the decimal integer on a RESP header line starting at pos+1 (after
+// the type byte). Sets line_end to one past the '\n'. Returns false if the
+// line is not yet complete; value is -1 when the line is malformed.
+bool read_resp_header(const char* data, size_t len, size_t pos, long long& value, size_t& line_end) {
+    const char* nl = find_byte(data + pos, data + len, '\n');
+    if (nl == nullptr) {
+        return false;
+    }
+    line_end = static_cast<size_t>(nl - data) + 1;
+    
+    size_t end = line_end - 1;
+    if (end > pos && data[end - 1] == '\r') {
+        --end;
+    }
+    
+    value = 0;
+    size_t digits = 0;
+    for (size_t i = pos + 1; i < end; ++i, ++digits) {
+        if (data[i] < '0' || data[i] > '9' || digits > 18) {
+            value = -1;
+            return true;
+        }
+        value = value * 10 + (data[i] - '0');
+    }
+    if (digits == 0) {
+        value = -1;
+    }
+    return true;
+}
+
+} // namespace
+
+void Parser::set_scan_mode(ScanMode mode) {
+    if (mode == ScanMode::SIMD && !simd_available()) {
+        mode = ScanMode::SCALAR;
+    }
+    g_scan_mode.store(mode, std::memory_order_relaxed);
+}
+
+Parser::ScanMode Parser::scan_mode() {
+    return g_scan_mode.load(std::memory_order_relaxed);
+}
+
+bool Parser::simd_available() {
+#if defined(MEMKV_PARSER_SSE2) || defined(MEMKV_PARSER_NEON)
+    return true;
+#else
+    return false;
+#endif
+}
 
 ParsedCommand Parser::parse(const std::string& input) {
+    CommandView view;
+    
     if (input.empty()) {
         ParsedCommand cmd;
         cmd.type = CommandType::UNKNOWN;
@@ -12,168 +268,318 @@ ParsedCommand Parser::parse(const std::string& input) {
     }
     
     if (input[0] == '*') {
-        return parse_resp(input);
+        if (parse_resp(input.data(), input.size(), view) == 0) {
+            view.reset();
+        }
+    } else {
+        parse_plain_line(std::string_view(input), view);
     }
     
-    return parse_plain_text(input);
+    return view.to_owned();
 }
 
-ParsedCommand Parser::parse_plain_text(const std::string& input) {
-    std::stringstream ss(input);
-    std::string cmd_name;
-    ss >> cmd_name;
+size_t Parser::parse_view(const char* data, size_t len, CommandView& out) {
+    out.reset();
     
-    ParsedCommand cmd;
+    // Skip blank lines between pipelined commands; they are consumed together
+    // with the command that follows them.
+    size_t skip = 0;
+    while (skip < len && (data[skip] == '\r' || data[skip] == '\n')) {
+        ++skip;
+    }
+    if (skip == len) {
+        return 0;
+    }
+    
+    if (data[skip] == '*') {
+        size_t consumed = parse_resp(data + skip, len - skip, out);
+        return consumed == 0 ? 0 : skip + consumed;
+    }
+    
+    const char* start = data + skip;
+    const char* nl = find_byte(start, data + len, '\n');
+    if (nl == nullptr) {
+        return 0;
+    }
+    
+    parse_plain_line(std::string_view(start, nl - start), out);
+    return static_cast<size_t>(nl - data) + 1;
+}
+
+void Parser::parse_plain_line(std::string_view line, CommandView& cmd) {
+    size_t pos = 0;
+    std::string_view cmd_name;
+    next_token(line, pos, cmd_name);
+    
+    cmd.valid = true;
     if (cmd_name == "SET") {
         cmd.type = CommandType::SET;
-        ss >> cmd.key;
+        if (!next_token(line, pos, cmd.key)) {
+            cmd.valid = false;
+            return;
+        }
         
-        // Read value (may contain spaces)
-        std::string value_part;
-        std::getline(ss >> std::ws, value_part);
+        // Value is the rest of the line (may contain spaces)
+        std::string_view rest = trim(line.substr(pos));
+        cmd.value = rest;
         
         // Check for TTL: SET key value EX 3600
-        std::stringstream value_stream(value_part);
-        std::string ttl_keyword;
-        std::string potential_ttl;
-        
-        // Try to parse TTL if present
-        std::vector<std::string> parts;
-        std::string part;
-        while (value_stream >> part) {
-            parts.push_back(part);
+        size_t ttl_start = rest.find_last_of(" \t");
+        if (ttl_start == std::string_view::npos) {
+            return;
         }
-        
-        if (parts.size() >= 3 && (parts[parts.size()-2] == "EX" || parts[parts.size()-2] == "TTL")) {
-            // Has TTL: value is everything except last 2 parts
-            cmd.ttl_seconds = std::stoi(parts.back());
-            for (size_t i = 0; i < parts.size() - 2; ++i) {
-                if (i > 0) cmd.value += " ";
-                cmd.value += parts[i];
-            }
-        } else {
-            // No TTL: entire value_part is the value
-            cmd.value = value_part;
+        std::string_view before_ttl = trim(rest.substr(0, ttl_start));
+        size_t kw_start = before_ttl.find_last_of(" \t");
+        if (kw_start == std::string_view::npos) {
+            return; // Needs a value in front of the keyword
+        }
+        std::string_view keyword = before_ttl.substr(kw_start + 1);
+        int ttl = 0;
+        if ((keyword == "EX" || keyword == "TTL") && parse_positive_int(rest.substr(ttl_start + 1), ttl)) {
+            cmd.ttl_seconds = ttl;
+            cmd.value = trim(before_ttl.substr(0, kw_start));
         }
     } 
     else if (cmd_name == "GET") {
         cmd.type = CommandType::GET;
-        ss >> cmd.key;
+        cmd.valid = next_token(line, pos, cmd.key);
     } 
     else if (cmd_name == "DEL") {
         cmd.type = CommandType::DEL;
-        ss >> cmd.key;
+        cmd.valid = next_token(line, pos, cmd.key);
+        std::string_view key;
+        while (next_token(line, pos, key)) {
+            if (cmd.keys.empty()) {
+                cmd.keys.push_back(cmd.key);
+            }
+            cmd.keys.push_back(key);
+        }
     }
     else if (cmd_name == "COMPACT") {
         cmd.type = CommandType::COMPACT;
     }
     else if (cmd_name == "STATS") {
         cmd.type = CommandType::STATS;
+        next_token(line, pos, cmd.key); // Optional format, e.g. "prometheus"
+    }
+    else if (cmd_name == "ROLE") {
+        cmd.type = CommandType::ROLE;
+    }
+    else if (cmd_name == "CLUSTER") {
+        // Subcommand in key, its arguments in keys
+        cmd.type = CommandType::CLUSTER;
+        cmd.valid = next_token(line, pos, cmd.key);
+        std::string_view arg;
+        while (next_token(line, pos, arg)) {
+            cmd.keys.push_back(arg);
+        }
+    }
+    else if (cmd_name == "ASKING") {
+        cmd.type = CommandType::ASKING;
+    }
+    else if (cmd_name == "SLOWLOG") {
+        cmd.type = CommandType::SLOWLOG;
+        next_token(line, pos, cmd.key);
+        next_token(line, pos, cmd.value);
+        std::string_view extra;
+        cmd.valid = valid_slowlog(cmd.key, cmd.value) && !next_token(line, pos, extra);
     }
     else if (cmd_name == "MGET") {
         cmd.type = CommandType::MGET;
-        std::string key;
-        while (ss >> key) {
+        std::string_view key;
+        while (next_token(line, pos, key)) {
             cmd.keys.push_back(key);
         }
         cmd.valid = !cmd.keys.empty(); // Valid only if we have at least one key
     }
+    else if (cmd_name == "MSET") {
+        cmd.type = CommandType::MSET;
+        std::string_view arg;
+        while (next_token(line, pos, arg)) {
+            cmd.keys.push_back(arg);
+        }
+        cmd.valid = split_mset(cmd);
+    }
+    else if (cmd_name == "VSET" || cmd_name == "VSIM") {
+        cmd.type = cmd_name == "VSET" ? CommandType::VSET : CommandType::VSIM;
+        std::string_view arg;
+        while (next_token(line, pos, arg)) {
+            cmd.keys.push_back(arg);
+        }
+        cmd.valid = cmd.type == CommandType::VSET ? split_vset(cmd) : split_vsim(cmd);
+    }
+    else if (cmd_name == "VGET") {
+        cmd.type = CommandType::VGET;
+        cmd.valid = next_token(line, pos, cmd.key);
+    }
+    else if (cmd_name == "IMPORT") {
+        cmd.type = CommandType::IMPORT;
+        cmd.valid = next_token(line, pos, cmd.key);
+    }
     else {
         cmd.type = CommandType::UNKNOWN;
         cmd.valid = false;
     }
-    return cmd;
 }
 
-ParsedCommand Parser::parse_resp(const std::string& input) {
-    ParsedCommand cmd;
-    cmd.valid = false;
-    
-    std::istringstream ss(input);
-    std::string line;
-    
-    if (!std::getline(ss, line) || line[0] != '*') {
-        cmd.type = CommandType::UNKNOWN;
-        return cmd;
+size_t Parser::parse_resp(const char* data, size_t len, CommandView& cmd) {
+    long long array_len = 0;
+    size_t pos = 0;
+    if (!read_resp_header(data, len, 0, array_len, pos)) {
+        return 0;
     }
-    
-    int array_len = std::stoi(line.substr(1));
-    if (array_len < 1) {
-        cmd.type = CommandType::UNKNOWN;
-        return cmd;
+    if (array_len < 1 || array_len > MAX_ARRAY_LENGTH) {
+        return protocol_error(len, cmd);
     }
     
-    if (!std::getline(ss, line) || line[0] != '$') {
-        cmd.type = CommandType::UNKNOWN;
-        return cmd;
+    // Arguments after the command name are collected in cmd.keys, which
+    // interpret_resp() then maps onto key/value, leaves as MGET or DEL keys,
+    // or splits into MSET pairs and VSET or VSIM arguments.
+    std::string_view cmd_name;
+    for (long long i = 0; i < array_len; ++i) {
+        if (pos >= len) {
+            return 0;
+        }
+        
+        long long bulk_len = 0;
+        size_t line_end = 0;
+        if (!read_resp_header(data, len, pos, bulk_len, line_end)) {
+            return 0;
+        }
+        if (data[pos] != '$' || bulk_len < 0 || static_cast<size_t>(bulk_len) > MAX_BULK_LENGTH) {
+            return protocol_error(len, cmd);
+        }
+        
+        // Payload plus its trailing \r\n; the payload itself is never scanned
+        size_t payload_end = line_end + static_cast<size_t>(bulk_len) + 2;
+        if (payload_end > len) {
+            return 0;
+        }
+        if (data[payload_end - 2] != '\r' || data[payload_end - 1] != '\n') {
+            return protocol_error(len, cmd);
+        }
+        
+        std::string_view arg(data + line_end, static_cast<size_t>(bulk_len));
+        if (i == 0) {
+            cmd_name = arg;
+        } else {
+            cmd.keys.push_back(arg);
+        }
+        pos = payload_end;
     }
     
-    int cmd_len = std::stoi(line.substr(1));
-    std::string cmd_name;
-    cmd_name.resize(cmd_len);
-    ss.read(&cmd_name[0], cmd_len);
-    std::getline(ss, line);
+    interpret_resp(cmd_name, cmd);
+    return pos;
+}
+
+// Nothing after a bad frame can be trusted to start a command (it may be
+// the middle of a value), so the whole buffer is consumed and the caller
+// closes the connection
+size_t Parser::protocol_error(size_t len, CommandView& cmd) {
+    cmd.reset();
+    cmd.protocol_error = true;
+    return len;
+}
+
+void Parser::interpret_resp(std::string_view cmd_name, CommandView& cmd) {
+    const auto& args = cmd.keys;
+    cmd.valid = false;
     
-    if (cmd_name == "SET" && array_len >= 3) {
+    if (cmd_name == "SET" && args.size() >= 2) {
         cmd.type = CommandType::SET;
-        
-        std::getline(ss, line);
-        int key_len = std::stoi(line.substr(1));
-        cmd.key.resize(key_len);
-        ss.read(&cmd.key[0], key_len);
-        std::getline(ss, line);
-        
-        std::getline(ss, line);
-        int val_len = std::stoi(line.substr(1));
-        cmd.value.resize(val_len);
-        ss.read(&cmd.value[0], val_len);
-        cmd.valid = true;
+        cmd.key = args[0];
+        cmd.value = args[1];
+        if (args.size() == 4) {
+            int ttl = 0;
+            if ((args[2] == "EX" || args[2] == "TTL") && parse_positive_int(args[3], ttl)) {
+                cmd.ttl_seconds = ttl;
+            } else {
+                cmd.keys.clear();
+                return;
+            }
+        }
+        cmd.valid = args.size() == 2 || args.size() == 4;
+        cmd.keys.clear();
     }
-    else if (cmd_name == "GET" && array_len >= 2) {
+    else if (cmd_name == "GET" && args.size() >= 1) {
         cmd.type = CommandType::GET;
-        
-        std::getline(ss, line);
-        int key_len = std::stoi(line.substr(1));
-        cmd.key.resize(key_len);
-        ss.read(&cmd.key[0], key_len);
+        cmd.key = args[0];
         cmd.valid = true;
+        cmd.keys.clear();
     }
-    else if (cmd_name == "DEL" && array_len >= 2) {
+    else if (cmd_name == "DEL" && args.size() >= 1) {
         cmd.type = CommandType::DEL;
-        
-        std::getline(ss, line);
-        int key_len = std::stoi(line.substr(1));
-        cmd.key.resize(key_len);
-        ss.read(&cmd.key[0], key_len);
+        cmd.key = args[0];
         cmd.valid = true;
+        if (args.size() == 1) {
+            cmd.keys.clear(); // Several keys stay in keys
+        }
     }
-    else if (cmd_name == "COMPACT" && array_len == 1) {
+    else if (cmd_name == "COMPACT" && args.empty()) {
         cmd.type = CommandType::COMPACT;
         cmd.valid = true;
     }
-    else if (cmd_name == "MGET" && array_len >= 2) {
-        cmd.type = CommandType::MGET;
-        
-        for (int i = 1; i < array_len; ++i) {
-            std::getline(ss, line);
-            if (line[0] != '$') {
-                cmd.valid = false;
-                return cmd;
-            }
-            int key_len = std::stoi(line.substr(1));
-            std::string key;
-            key.resize(key_len);
-            ss.read(&key[0], key_len);
-            std::getline(ss, line);
-            cmd.keys.push_back(key);
+    else if (cmd_name == "STATS" && args.size() <= 1) {
+        cmd.type = CommandType::STATS;
+        if (!args.empty()) {
+            cmd.key = args[0];
         }
         cmd.valid = true;
+        cmd.keys.clear();
+    }
+    else if (cmd_name == "ROLE" && args.empty()) {
+        cmd.type = CommandType::ROLE;
+        cmd.valid = true;
+    }
+    else if (cmd_name == "CLUSTER" && args.size() >= 1) {
+        cmd.type = CommandType::CLUSTER;
+        cmd.key = args[0];
+        cmd.keys.erase(cmd.keys.begin());
+        cmd.valid = true;
+    }
+    else if (cmd_name == "ASKING" && args.empty()) {
+        cmd.type = CommandType::ASKING;
+        cmd.valid = true;
+    }
+    else if (cmd_name == "SLOWLOG" && args.size() >= 1 && args.size() <= 2) {
+        cmd.type = CommandType::SLOWLOG;
+        cmd.key = args[0];
+        if (args.size() == 2) {
+            cmd.value = args[1];
+        }
+        cmd.valid = valid_slowlog(cmd.key, cmd.value);
+        cmd.keys.clear();
+    }
+    else if (cmd_name == "MGET" && args.size() >= 1) {
+        cmd.type = CommandType::MGET;
+        cmd.valid = true;
+    }
+    else if (cmd_name == "MSET" && args.size() >= 2) {
+        cmd.type = CommandType::MSET;
+        cmd.valid = split_mset(cmd);
+    }
+    else if (cmd_name == "VSET" && args.size() >= 2) {
+        cmd.type = CommandType::VSET;
+        cmd.valid = split_vset(cmd);
+    }
+    else if (cmd_name == "VGET" && args.size() == 1) {
+        cmd.type = CommandType::VGET;
+        cmd.key = args[0];
+        cmd.valid = true;
+        cmd.keys.clear();
+    }
+    else if (cmd_name == "IMPORT" && args.size() == 1) {
+        cmd.type = CommandType::IMPORT;
+        cmd.key = args[0];
+        cmd.valid = true;
+        cmd.keys.clear();
+    }
+    else if (cmd_name == "VSIM" && args.size() >= 3) {
+        cmd.type = CommandType::VSIM;
+        cmd.valid = split_vsim(cmd);
     }
     else {
         cmd.type = CommandType::UNKNOWN;
-        cmd.valid = false;
+        cmd.keys.clear();
     }
-    
-    return cmd;
 }
-
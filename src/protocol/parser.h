@@ -1,14 +1,35 @@
 #pragma once
 
 #include "command.h"
+#include <cstddef>
 #include <string>
+#include <string_view>
 
 class Parser {
 public:
+    // Owning parse of a single command (used by journal replay and tools).
     static ParsedCommand parse(const std::string& input);
     
+    // Zero-copy parse of the first complete command at the start of data.
+    // Returns the bytes consumed including the terminator, or 0 if more bytes
+    // are needed. `out` only holds views into data. RESP bulk strings are
+    // binary safe. A malformed RESP frame consumes all of data and sets
+    // out.protocol_error: the caller replies with an error and closes.
+    static size_t parse_view(const char* data, size_t len, CommandView& out);
+    
+    // Delimiter scanning strategy. SIMD uses SSE2/NEON compares 16 bytes at a
+    // time and is the default where available; SCALAR is a plain byte loop.
+    enum class ScanMode { SCALAR, SIMD };
+    static void set_scan_mode(ScanMode mode);
+    static ScanMode scan_mode();
+    static bool simd_available();
+    
+    static constexpr size_t MAX_BULK_LENGTH = 512 * 1024 * 1024;
+    static constexpr long long MAX_ARRAY_LENGTH = 1024 * 1024;
+    
 private:
-    static ParsedCommand parse_plain_text(const std::string& input);
-    static ParsedCommand parse_resp(const std::string& input);
+    static void parse_plain_line(std::string_view line, CommandView& out);
+    static size_t parse_resp(const char* data, size_t len, CommandView& out);
+    static void interpret_resp(std::string_view name, CommandView& out);
+    static size_t protocol_error(size_t len, CommandView& out);
 };
-
@@ -0,0 +1,52 @@
+#include "backlog.h"
+#include <algorithm>
+#include <cstring>
+
+ReplicationBacklog::ReplicationBacklog(size_t capacity)
+    : ring_(new char[std::max<size_t>(capacity, 1)]), capacity_(std::max<size_t>(capacity, 1)) {}
+
+void ReplicationBacklog::append(const char* data, size_t len) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    // Only the last capacity_ bytes can survive
+    if (len > capacity_) {
+        end_ += len - capacity_;
+        data += len - capacity_;
+        len = capacity_;
+    }
+    size_t pos = end_ % capacity_;
+    size_t first = std::min(len, capacity_ - pos);
+    std::memcpy(ring_.get() + pos, data, first);
+    std::memcpy(ring_.get(), data + first, len - first);
+    end_ += len;
+}
+
+uint64_t ReplicationBacklog::offset() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return end_;
+}
+
+uint64_t ReplicationBacklog::start_offset() const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    return end_ > capacity_ ? end_ - capacity_ : 0;
+}
+
+bool ReplicationBacklog::contains(uint64_t offset) const {
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t start = end_ > capacity_ ? end_ - capacity_ : 0;
+    return offset >= start && offset <= end_;
+}
+
+bool ReplicationBacklog::read(uint64_t offset, size_t max, std::string& out) const {
+    out.clear();
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint64_t start = end_ > capacity_ ? end_ - capacity_ : 0;
+    if (offset < start || offset > end_) {
+        return false;
+    }
+    size_t len = static_cast<size_t>(std::min<uint64_t>(end_ - offset, max));
+    size_t pos = offset % capacity_;
+    size_t first = std::min(len, capacity_ - pos);
+    out.append(ring_.get() + pos, first);
+    out.append(ring_.get(), len - first);
+    return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Ring of the most recent WAL record bytes, in log order, addressed by a
+// replication offset: the total number of bytes ever appended. The WAL
+// appends every record here under its buffer lock, so the ring always holds
+// whole records in LSN order and offset() is always a record boundary.
+// Replicas resume from the offset they acknowledged as long as it is still
+// in the ring; older offsets need a full sync.
+class ReplicationBacklog {
+public:
+    explicit ReplicationBacklog(size_t capacity);
+    
+    ReplicationBacklog(const ReplicationBacklog&) = delete;
+    ReplicationBacklog& operator=(const ReplicationBacklog&) = delete;
+    
+    // WAL append path: one memcpy under the ring lock
+    void append(const char* data, size_t len);
+    
+    uint64_t offset() const;        // Just past the newest byte
+    uint64_t start_offset() const;  // Oldest byte still held
+    bool contains(uint64_t offset) const;
+    
+    // Replaces out with up to max bytes starting at offset. Returns false if
+    // offset has already been overwritten (or is past offset()).
+    bool read(uint64_t offset, size_t max, std::string& out) const;
+
+private:
+    mutable std::mutex mtx_;
+    std::unique_ptr<char[]> ring_;
+    size_t capacity_;
+    uint64_t end_ = 0;
+};
@@ -0,0 +1,278 @@
+#include "primary.h"
+#include "wire.h"
+#include <arpa/inet.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace replication_wire;
+
+namespace {
+
+std::string random_replid() {
+    static const char HEX[] = "0123456789abcdef";
+    std::random_device rd;
+    std::string id(40, '0');
+    for (char& c : id) {
+        c = HEX[rd() & 0xF];
+    }
+    return id;
+}
+
+} // namespace
+
+ReplicationPrimary::ReplicationPrimary(int port, KVStore& store, size_t backlog_bytes)
+    : port_(port), store_(store), backlog_(backlog_bytes), replid_(random_replid()) {
+    store_.attach_backlog(&backlog_);
+}
+
+ReplicationPrimary::~ReplicationPrimary() {
+    running_ = false;
+    if (listen_fd_ >= 0) {
+        shutdown(listen_fd_, SHUT_RDWR); // Wakes accept()
+    }
+    if (accept_thread_.joinable()) {
+        accept_thread_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
+    reap(true);
+    store_.attach_backlog(nullptr);
+}
+
+bool ReplicationPrimary::start() {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        perror("Replication socket failed");
+        return false;
+    }
+    
+    int opt = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port_);
+    if (bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        listen(listen_fd_, 16) < 0) {
+        perror("Replication bind/listen failed");
+        close(listen_fd_);
+        listen_fd_ = -1;
+        return false;
+    }
+    
+    running_ = true;
+    accept_thread_ = std::thread([this]() { accept_loop(); });
+    std::cout << "Replication listening on port " << port_ << " (replid " << replid_ << ")" << std::endl;
+    return true;
+}
+
+void ReplicationPrimary::accept_loop() {
+    while (running_) {
+        sockaddr_in address{};
+        socklen_t addrlen = sizeof(address);
+        int fd = accept(listen_fd_, reinterpret_cast<sockaddr*>(&address), &addrlen);
+        if (fd < 0) {
+            if (running_ && errno != EINTR) {
+                perror("Replication accept failed");
+            }
+            continue;
+        }
+        
+        reap(false);
+        
+        auto replica = std::make_unique<Replica>();
+        char ip[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+        replica->fd = fd;
+        replica->addr = std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+        
+        Replica* raw = replica.get();
+        std::lock_guard<std::mutex> lock(replicas_mtx_);
+        replicas_.push_back(std::move(replica));
+        raw->thread = std::thread([this, raw]() { serve(*raw); });
+    }
+}
+
+// Joins the senders of replicas that went away (all of them on shutdown)
+void ReplicationPrimary::reap(bool all) {
+    std::vector<std::unique_ptr<Replica>> finished;
+    {
+        std::lock_guard<std::mutex> lock(replicas_mtx_);
+        for (auto it = replicas_.begin(); it != replicas_.end();) {
+            if (all || (*it)->done) {
+                if (all) {
+                    shutdown((*it)->fd, SHUT_RDWR);
+                }
+                finished.push_back(std::move(*it));
+                it = replicas_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& replica : finished) {
+        if (replica->thread.joinable()) {
+            replica->thread.join();
+        }
+    }
+}
+
+void ReplicationPrimary::serve(Replica& replica) {
+    timeval timeout{HANDSHAKE_TIMEOUT_S, 0};
+    setsockopt(replica.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    std::string in;
+    uint64_t offset = 0;
+    if (handshake(replica, in, offset)) {
+        replica.online = true;
+        std::cout << "Replica " << replica.addr << " online at offset " << offset << std::endl;
+        stream(replica, in, offset);
+        std::cout << "Replica " << replica.addr << " disconnected" << std::endl;
+    }
+    
+    close(replica.fd);
+    replica.online = false;
+    replica.done = true;
+}
+
+bool ReplicationPrimary::handshake(Replica& replica, std::string& in, uint64_t& offset) {
+    std::string line;
+    if (!read_line(replica.fd, in, line)) {
+        return false;
+    }
+    
+    std::istringstream request(line);
+    std::string verb, id, requested;
+    request >> verb >> id >> requested;
+    uint64_t from = 0;
+    if (verb != "PSYNC" || !parse_u64(requested, from)) {
+        send_all(replica.fd, "ERROR: expected PSYNC <replid> <offset>\n");
+        return false;
+    }
+    
+    if (id == replid_ && backlog_.contains(from)) {
+        offset = from;
+        replica.acked = from;
+        return send_all(replica.fd, "+CONTINUE " + replid_ + " " + std::to_string(offset) + "\n");
+    }
+    
+    // Everything appended from here on is in the backlog, and the snapshot
+    // is taken afterwards, so replaying the backlog over it converges
+    offset = backlog_.offset();
+    replica.acked = offset;
+    if (!send_all(replica.fd, "+FULLRESYNC " + replid_ + " " + std::to_string(offset) + "\n")) {
+        return false;
+    }
+    
+    bool ok = true;
+    store_.snapshot([&](const std::string& chunk) {
+        std::string header = "$" + std::to_string(chunk.size()) + "\n";
+        ok = ok && running_ && send_all(replica.fd, header) && send_all(replica.fd, chunk);
+    });
+    if (!ok || !send_all(replica.fd, "$0\n")) {
+        return false;
+    }
+    if (!backlog_.contains(offset)) {
+        std::cerr << "Warning: replica " << replica.addr << " full sync outlasted the replication backlog;"
+                  << " raise --repl-backlog" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ReplicationPrimary::stream(Replica& replica, std::string& in, uint64_t offset) {
+    std::string chunk;
+    replica.sent = offset;
+    
+    while (running_) {
+        if (!backlog_.read(offset, STREAM_CHUNK, chunk)) {
+            std::cerr << "Warning: replica " << replica.addr << " fell out of the replication backlog;"
+                      << " it will resync" << std::endl;
+            return false;
+        }
+        
+        if (!chunk.empty()) {
+            if (!send_all(replica.fd, chunk)) {
+                return false;
+            }
+            offset += chunk.size();
+            replica.sent = offset;
+            if (!read_acks(replica, in)) {
+                return false;
+            }
+            continue;
+        }
+        
+        // Caught up: waiting on the socket doubles as the poll interval
+        pollfd pfd{replica.fd, POLLIN, 0};
+        if (poll(&pfd, 1, POLL_MS) > 0 && !read_acks(replica, in)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Consumes any "ACK <offset>" lines already received. False once the
+// replica has gone.
+bool ReplicationPrimary::read_acks(Replica& replica, std::string& in) {
+    char buf[4096];
+    while (true) {
+        ssize_t n = recv(replica.fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            in.append(buf, static_cast<size_t>(n));
+            continue;
+        }
+        if (n == 0) {
+            return false;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return false;
+        }
+        break;
+    }
+    
+    size_t end;
+    while ((end = in.find('\n')) != std::string::npos) {
+        std::string line = in.substr(0, end);
+        in.erase(0, end + 1);
+        uint64_t acked = 0;
+        if (line.compare(0, 4, "ACK ") == 0 && parse_u64(line.substr(4), acked)) {
+            replica.acked = acked;
+        }
+    }
+    return in.size() <= 1024;
+}
+
+void ReplicationPrimary::describe(std::string& out) {
+    uint64_t offset = backlog_.offset();
+    out += "{\"role\":\"primary\",\"replid\":\"" + replid_ + "\"";
+    out += ",\"offset\":" + std::to_string(offset);
+    out += ",\"backlog_start\":" + std::to_string(backlog_.start_offset());
+    out += ",\"replicas\":[";
+    
+    std::lock_guard<std::mutex> lock(replicas_mtx_);
+    bool first = true;
+    for (const auto& replica : replicas_) {
+        if (replica->done) {
+            continue;
+        }
+        uint64_t acked = replica->acked.load();
+        out += first ? "" : ",";
+        out += "{\"addr\":\"" + replica->addr + "\"";
+        out += ",\"state\":\"" + std::string(replica->online ? "online" : "sync") + "\"";
+        out += ",\"sent_offset\":" + std::to_string(replica->sent.load());
+        out += ",\"acked_offset\":" + std::to_string(acked);
+        out += ",\"lag_bytes\":" + std::to_string(offset > acked ? offset - acked : 0) + "}";
+        first = false;
+    }
+    out += "]}";
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "backlog.h"
+#include "../storage/kv_store.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Primary side of replication. Attaches a ReplicationBacklog to the store's
+// WAL, which is the only cost on the write path: each append is also copied
+// into the ring, under the lock it already holds. Replicas connect to a
+// separate port and say where they are:
+//
+//   replica: PSYNC <replid> <offset>\n       ("?" and 0 when it has nothing)
+//   primary: +CONTINUE <replid> <offset>\n   offset still in the backlog
+//        or: +FULLRESYNC <replid> <offset>\n then chunks of SET records, each
+//            "$<bytes>\n<bytes>", ended by "$0\n"
+//
+// After that the primary streams the backlog's raw WAL records from offset
+// and the replica sends "ACK <offset>\n" as it applies them. Each replica
+// has one sender thread that polls the backlog, so the write path never
+// signals anyone. replid is random per process: the backlog does not
+// survive a restart, and neither can a replica's offset into it.
+class ReplicationPrimary {
+public:
+    ReplicationPrimary(int port, KVStore& store, size_t backlog_bytes);
+    ~ReplicationPrimary();
+    
+    bool start(); // Binds the replication port and starts accepting
+    
+    // ROLE reply: one JSON object
+    void describe(std::string& out);
+    
+    const std::string& replid() const { return replid_; }
+
+private:
+    struct Replica {
+        int fd = -1;
+        std::string addr;
+        std::atomic<bool> online{false};   // Past the handshake and any full sync
+        std::atomic<uint64_t> sent{0};     // Offset streamed up to
+        std::atomic<uint64_t> acked{0};    // Offset the replica has applied
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+    
+    void accept_loop();
+    void serve(Replica& replica);
+    bool handshake(Replica& replica, std::string& in, uint64_t& offset);
+    bool stream(Replica& replica, std::string& in, uint64_t offset);
+    bool read_acks(Replica& replica, std::string& in);
+    void reap(bool all);
+    
+    int port_;
+    KVStore& store_;
+    ReplicationBacklog backlog_;
+    std::string replid_;
+    
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread accept_thread_;
+    
+    std::mutex replicas_mtx_;
+    std::vector<std::unique_ptr<Replica>> replicas_;
+    
+    static constexpr size_t STREAM_CHUNK = 64 * 1024;
+    static constexpr int POLL_MS = 1;              // Sender's wait for new records
+    static constexpr int HANDSHAKE_TIMEOUT_S = 10;
+};
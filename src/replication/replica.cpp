@@ -0,0 +1,221 @@
+#include "replica.h"
+#include "wire.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace replication_wire;
+
+ReplicaClient::ReplicaClient(const std::string& host, int port, KVStore& store)
+    : host_(host), port_(port), store_(store) {
+    store_.set_read_only(true);
+}
+
+ReplicaClient::~ReplicaClient() {
+    running_ = false;
+    int fd = fd_.load();
+    if (fd >= 0) {
+        shutdown(fd, SHUT_RDWR); // Wakes a blocked recv()
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void ReplicaClient::start() {
+    running_ = true;
+    thread_ = std::thread([this]() { run(); });
+}
+
+void ReplicaClient::run() {
+    bool warned = false;
+    while (running_) {
+        int fd = connect_to(host_, port_);
+        if (fd >= 0) {
+            fd_ = fd;
+            if (session(fd)) {
+                warned = false;
+            }
+            fd_ = -1;
+            close(fd);
+        }
+        link_ = Link::DOWN;
+        
+        if (!running_) {
+            break;
+        }
+        if (!warned) {
+            std::cerr << "Warning: replication link to " << host_ << ":" << port_
+                      << " is down, retrying every " << RETRY_MS << "ms" << std::endl;
+            warned = true;
+        }
+        for (int waited = 0; waited < RETRY_MS && running_; waited += 50) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+}
+
+// One connection. Returns true if it got past the handshake.
+bool ReplicaClient::session(int fd) {
+    std::string replid;
+    {
+        std::lock_guard<std::mutex> lock(state_mtx_);
+        replid = replid_;
+    }
+    if (!send_all(fd, "PSYNC " + replid + " " + std::to_string(offset_.load()) + "\n")) {
+        return false;
+    }
+    
+    std::string in;
+    std::string line;
+    if (!read_line(fd, in, line)) {
+        return false;
+    }
+    
+    std::istringstream reply(line);
+    std::string verb, id, offset_text;
+    reply >> verb >> id >> offset_text;
+    uint64_t offset = 0;
+    if ((verb != "+FULLRESYNC" && verb != "+CONTINUE") || !parse_u64(offset_text, offset)) {
+        std::cerr << "Warning: unexpected replication handshake reply: " << line << std::endl;
+        return false;
+    }
+    
+    if (verb == "+FULLRESYNC") {
+        link_ = Link::SYNC;
+        // Until the new data set is complete there is nothing to resume from
+        {
+            std::lock_guard<std::mutex> lock(state_mtx_);
+            replid_ = "?";
+        }
+        if (!full_sync(fd, in)) {
+            return true;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(state_mtx_);
+        replid_ = id;
+    }
+    offset_ = offset;
+    link_ = Link::UP;
+    std::cout << "Replicating from " << host_ << ":" << port_ << " at offset " << offset << std::endl;
+    stream(fd, in);
+    return true;
+}
+
+bool ReplicaClient::full_sync(int fd, std::string& in) {
+    auto start = std::chrono::steady_clock::now();
+    store_.clear();
+    
+    std::string line;
+    std::string chunk;
+    size_t bytes = 0;
+    while (true) {
+        uint64_t len = 0;
+        if (!read_line(fd, in, line) || line.empty() || line[0] != '$' || !parse_u64(line.substr(1), len)) {
+            return false;
+        }
+        if (len == 0) {
+            break;
+        }
+        if (!read_exact(fd, in, len, chunk)) {
+            return false;
+        }
+        bool corrupt = false;
+        if (apply(chunk.data(), chunk.size(), corrupt) != chunk.size() || corrupt) {
+            std::cerr << "Warning: corrupt full sync chunk from the primary" << std::endl;
+            return false;
+        }
+        bytes += chunk.size();
+    }
+    
+    // The local log still holds the old data set; rewrite it from memory
+    store_.request_compaction();
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Full sync loaded " << bytes << " bytes in " << ms << "ms" << std::endl;
+    return true;
+}
+
+bool ReplicaClient::stream(int fd, std::string& in) {
+    // Short receive timeouts keep ACKs flowing while the primary is idle
+    timeval timeout{0, ACK_INTERVAL_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    
+    auto last_ack = std::chrono::steady_clock::now();
+    uint64_t acked = static_cast<uint64_t>(-1);
+    while (running_) {
+        if (!in.empty()) {
+            bool corrupt = false;
+            size_t consumed = apply(in.data(), in.size(), corrupt);
+            in.erase(0, consumed);
+            offset_ += consumed;
+            if (corrupt) {
+                std::cerr << "Warning: corrupt record in the replication stream, resyncing" << std::endl;
+                std::lock_guard<std::mutex> lock(state_mtx_);
+                replid_ = "?";
+                return false;
+            }
+        }
+        
+        auto now = std::chrono::steady_clock::now();
+        uint64_t offset = offset_.load();
+        if (offset != acked || now - last_ack >= std::chrono::milliseconds(ACK_INTERVAL_MS)) {
+            if (!send_all(fd, "ACK " + std::to_string(offset) + "\n")) {
+                return false;
+            }
+            acked = offset;
+            last_ack = now;
+        }
+        
+        bool timed_out = false;
+        if (!receive(fd, in, &timed_out) && !timed_out) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decodes every complete record at the front of data and applies them as
+// one batch. Stops before a partial record; corrupt is set on a bad one.
+size_t ReplicaClient::apply(const char* data, size_t len, bool& corrupt) {
+    thread_local std::vector<WalRecord> records;
+    records.clear();
+    
+    size_t pos = 0;
+    while (pos < len) {
+        WalRecord rec;
+        size_t consumed = 0;
+        auto status = WriteAheadLog::decode(data + pos, len - pos, rec, consumed);
+        if (status == WriteAheadLog::DecodeStatus::INCOMPLETE) {
+            break;
+        }
+        if (status == WriteAheadLog::DecodeStatus::CORRUPT) {
+            corrupt = true;
+            break;
+        }
+        records.push_back(rec);
+        pos += consumed;
+    }
+    
+    store_.apply_replicated(records);
+    return pos;
+}
+
+void ReplicaClient::describe(std::string& out) {
+    static const char* LINKS[] = {"down", "sync", "up"};
+    std::string replid;
+    {
+        std::lock_guard<std::mutex> lock(state_mtx_);
+        replid = replid_;
+    }
+    out += "{\"role\":\"replica\",\"primary\":\"" + host_ + ":" + std::to_string(port_) + "\"";
+    out += ",\"link\":\"" + std::string(LINKS[static_cast<int>(link_.load())]) + "\"";
+    out += ",\"replid\":\"" + replid + "\"";
+    out += ",\"offset\":" + std::to_string(offset_.load()) + "}";
+}
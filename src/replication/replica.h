@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../storage/kv_store.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Replica side of replication (--replicaof host:port). One thread keeps a
+// link to the primary's replication port: it asks to continue from the last
+// applied offset, falls back to a full sync (clear, load the snapshot, then
+// compact the local log), and then applies the streamed WAL records in
+// batches, acknowledging the applied offset every ACK_INTERVAL_MS. The store
+// is read-only to clients meanwhile, and serves GET/MGET on its own. A lost
+// link is retried every RETRY_MS, resuming where it left off whenever the
+// primary's backlog still covers it.
+class ReplicaClient {
+public:
+    ReplicaClient(const std::string& host, int port, KVStore& store);
+    ~ReplicaClient();
+    
+    void start();
+    
+    // ROLE reply: one JSON object
+    void describe(std::string& out);
+
+private:
+    enum class Link { DOWN, SYNC, UP };
+    
+    void run();
+    bool session(int fd);
+    bool full_sync(int fd, std::string& in);
+    bool stream(int fd, std::string& in);
+    size_t apply(const char* data, size_t len, bool& corrupt); // Returns bytes consumed
+    
+    std::string host_;
+    int port_;
+    KVStore& store_;
+    
+    // Where to resume; only the replica thread writes them
+    std::mutex state_mtx_;
+    std::string replid_ = "?";
+    std::atomic<uint64_t> offset_{0};
+    std::atomic<Link> link_{Link::DOWN};
+    
+    std::atomic<bool> running_{false};
+    std::atomic<int> fd_{-1};
+    std::thread thread_;
+    
+    static constexpr int ACK_INTERVAL_MS = 100;
+    static constexpr int RETRY_MS = 1000;
+};
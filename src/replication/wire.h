@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <netdb.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Blocking socket helpers shared by both ends of a replication link, and by
+// cluster slot migration. The handshake and the full sync framing are text
+// lines; the stream itself is raw WAL records, which carry their own length
+// and checksum.
+namespace replication_wire {
+
+// Returns a connected socket, or -1
+inline int connect_to(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0) {
+        return -1;
+    }
+    
+    int fd = -1;
+    for (addrinfo* ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+inline bool send_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool send_all(int fd, const std::string& data) {
+    return send_all(fd, data.data(), data.size());
+}
+
+// Appends whatever the socket has to in. Returns false on EOF or an error
+// other than a receive timeout; timed_out tells the two apart.
+inline bool receive(int fd, std::string& in, bool* timed_out = nullptr) {
+    char chunk[64 * 1024];
+    while (true) {
+        ssize_t n = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (n > 0) {
+            in.append(chunk, static_cast<size_t>(n));
+            return true;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (timed_out) {
+            *timed_out = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        return false;
+    }
+}
+
+// Takes one '\n'-terminated line off the front of in, reading more as needed
+inline bool read_line(int fd, std::string& in, std::string& line, size_t max_len = 1024) {
+    while (true) {
+        size_t end = in.find('\n');
+        if (end != std::string::npos) {
+            line.assign(in, 0, end);
+            in.erase(0, end + 1);
+            return true;
+        }
+        if (in.size() > max_len || !receive(fd, in)) {
+            return false;
+        }
+    }
+}
+
+// Takes exactly len bytes off the front of in, reading more as needed
+inline bool read_exact(int fd, std::string& in, size_t len, std::string& out) {
+    while (in.size() < len) {
+        if (!receive(fd, in)) {
+            return false;
+        }
+    }
+    out.assign(in, 0, len);
+    in.erase(0, len);
+    return true;
+}
+
+inline bool parse_u64(const std::string& text, uint64_t& value) {
+    if (text.empty() || text.size() > 20) {
+        return false;
+    }
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+    return true;
+}
+
+} // namespace replication_wire
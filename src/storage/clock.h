@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// Millisecond wall clock refreshed by a background ticker. Hot paths (TTL
+// checks on GET/MGET, expiry computation on SET) read one relaxed atomic
+// instead of calling system_clock::now(). Resolution is ~1ms.
+class CoarseClock {
+public:
+    static long long now_ms() {
+        return instance().now_ms_.load(std::memory_order_relaxed);
+    }
+    
+    static long long precise_now_ms() {
+        auto now = std::chrono::system_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+    }
+
+private:
+    CoarseClock() : now_ms_(precise_now_ms()) {
+        ticker_ = std::thread([this]() {
+            while (running_.load(std::memory_order_relaxed)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(TICK_MS));
+                now_ms_.store(precise_now_ms(), std::memory_order_relaxed);
+            }
+        });
+    }
+    
+    ~CoarseClock() {
+        running_ = false;
+        if (ticker_.joinable()) {
+            ticker_.join();
+        }
+    }
+    
+    CoarseClock(const CoarseClock&) = delete;
+    CoarseClock& operator=(const CoarseClock&) = delete;
+    
+    static CoarseClock& instance() {
+        static CoarseClock inst;
+        return inst;
+    }
+    
+    std::atomic<long long> now_ms_;
+    std::atomic<bool> running_{true};
+    std::thread ticker_;
+    
+    static constexpr int TICK_MS = 1;
+};
@@ -0,0 +1,312 @@
+#include "cold_log.h"
+#include "crc32c.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <unistd.h>
+
+namespace {
+
+inline void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+bool pwrite_all(int fd, const char* data, size_t len, uint64_t at) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = ::pwrite(fd, data + written, len - written, static_cast<off_t>(at + written));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool pread_all(int fd, char* data, size_t len, uint64_t at) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, data + done, len - done, static_cast<off_t>(at + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (n == 0) {
+            return false; // Past the end of the file
+        }
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+constexpr size_t SCAN_CHUNK_BYTES = 1024 * 1024;
+
+} // namespace
+
+ColdLog::Segment::~Segment() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+ColdLog::ColdLog(const std::string& dir, size_t segment_bytes)
+    : dir_(dir), segment_bytes_(std::min(segment_bytes, MAX_SEGMENT_BYTES)),
+      segments_(new Handle[MAX_SEGMENTS]),
+      written_(new std::atomic<uint64_t>[MAX_SEGMENTS]),
+      live_(new std::atomic<uint64_t>[MAX_SEGMENTS]) {
+    for (size_t i = 0; i < MAX_SEGMENTS; ++i) {
+        written_[i].store(0, std::memory_order_relaxed);
+        live_[i].store(0, std::memory_order_relaxed);
+    }
+    
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    if (!std::filesystem::is_directory(dir_, ec)) {
+        std::cerr << "Warning: Could not create tier directory " << dir_ << std::endl;
+        return;
+    }
+    // Segments of a previous run; everything in them is in the WAL or snapshot
+    for (const auto& file : std::filesystem::directory_iterator(dir_, ec)) {
+        std::string name = file.path().filename().string();
+        if (name.compare(0, 5, "cold-") == 0 && file.path().extension() == ".seg") {
+            std::filesystem::remove(file.path(), ec);
+        }
+    }
+    open_ = true;
+}
+
+ColdLog::~ColdLog() = default;
+
+bool ColdLog::roll() {
+    uint32_t index;
+    if (!free_slots_.empty()) {
+        index = free_slots_.back();
+        free_slots_.pop_back();
+    } else if (next_index_ < MAX_SEGMENTS) {
+        index = next_index_++;
+    } else {
+        if (!full_warned_) {
+            std::cerr << "Warning: Cold log has " << MAX_SEGMENTS << " segments; values stay in memory" << std::endl;
+            full_warned_ = true;
+        }
+        return false;
+    }
+    
+    auto segment = std::make_shared<Segment>();
+    segment->index = index;
+    segment->path = dir_ + "/cold-" + std::to_string(index) + ".seg";
+    segment->fd = ::open(segment->path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (segment->fd < 0) {
+        std::cerr << "Warning: Could not create cold segment " << segment->path << ": " << strerror(errno) << std::endl;
+        free_slots_.push_back(index);
+        return false;
+    }
+    
+    written_[index].store(0, std::memory_order_relaxed);
+    live_[index].store(0, std::memory_order_relaxed);
+    std::atomic_store(&segments_[index], segment);
+    head_ = std::move(segment);
+    head_offset_ = 0;
+    if (slots_used_.load(std::memory_order_relaxed) <= index) {
+        slots_used_.store(index + 1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+uint64_t ColdLog::append(std::string_view key, std::string_view value) {
+    size_t bytes = record_bytes(key.size(), value.size());
+    if (!open_ || !fits(value.size()) || bytes > segment_bytes_) {
+        return 0;
+    }
+    
+    Handle segment;
+    uint64_t offset;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!head_ || head_offset_ + bytes > segment_bytes_) {
+            if (!roll()) {
+                return 0;
+            }
+        }
+        segment = head_;
+        offset = head_offset_;
+        head_offset_ += bytes;
+        written_[segment->index].store(head_offset_, std::memory_order_relaxed);
+        segment->writers.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    thread_local std::string record;
+    record.assign(bytes, '\0');
+    char* p = &record[0];
+    put_u32(p, crc32c(value.data(), value.size()));
+    put_u32(p + 4, crc32c(key.data(), key.size()));
+    put_u32(p + 8, static_cast<uint32_t>(value.size()));
+    put_u32(p + 12, static_cast<uint32_t>(key.size()));
+    if (!value.empty()) std::memcpy(p + HEADER_BYTES, value.data(), value.size());
+    if (!key.empty()) std::memcpy(p + HEADER_BYTES + value.size(), key.data(), key.size());
+    
+    bool ok = pwrite_all(segment->fd, record.data(), record.size(), offset);
+    if (ok) {
+        live_[segment->index].fetch_add(bytes, std::memory_order_relaxed);
+    }
+    segment->writers.fetch_sub(1, std::memory_order_release);
+    return ok ? encode(segment->index, offset, value.size()) : 0;
+}
+
+ColdLog::Handle ColdLog::hold(uint64_t loc) const {
+    return std::atomic_load(&segments_[segment_of(loc)]);
+}
+
+bool ColdLog::read(uint64_t loc, const Handle& segment, std::string& out) const {
+    if (!segment) {
+        return false;
+    }
+    size_t size = value_size(loc);
+    thread_local std::string buffer;
+    buffer.resize(HEADER_BYTES + size);
+    if (!pread_all(segment->fd, &buffer[0], buffer.size(), offset_of(loc))) {
+        return false;
+    }
+    const char* value = buffer.data() + HEADER_BYTES;
+    if (get_u32(buffer.data() + 8) != size || crc32c(value, size) != get_u32(buffer.data())) {
+        return false;
+    }
+    out.append(value, size);
+    return true;
+}
+
+void ColdLog::release(uint64_t loc, size_t key_size) {
+    live_[segment_of(loc)].fetch_sub(record_bytes(key_size, value_size(loc)), std::memory_order_relaxed);
+}
+
+long ColdLog::pick_garbage() const {
+    uint32_t head_index;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!head_) {
+            return -1;
+        }
+        head_index = head_->index;
+    }
+    
+    long best = -1;
+    double best_ratio = GC_LIVE_RATIO;
+    uint32_t used = slots_used_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < used; ++i) {
+        uint64_t written = written_[i].load(std::memory_order_relaxed);
+        if (i == head_index || written == 0) {
+            continue;
+        }
+        double ratio = static_cast<double>(live_[i].load(std::memory_order_relaxed)) / static_cast<double>(written);
+        if (ratio >= best_ratio) {
+            continue;
+        }
+        Handle segment = std::atomic_load(&segments_[i]);
+        if (!segment || segment->damaged.load() || segment->writers.load(std::memory_order_acquire) != 0) {
+            continue;
+        }
+        best = i;
+        best_ratio = ratio;
+    }
+    return best;
+}
+
+bool ColdLog::scan(uint32_t index, const std::function<void(uint64_t, std::string_view, std::string_view)>& fn) {
+    Handle segment = std::atomic_load(&segments_[index]);
+    if (!segment) {
+        return false;
+    }
+    uint64_t end = written_[index].load(std::memory_order_relaxed);
+    std::string buffer;
+    uint64_t buffer_at = 0; // File offset of buffer[0]
+    uint64_t offset = 0;
+    
+    // Makes [offset, offset + n) available in buffer
+    auto fill = [&](size_t n) {
+        if (offset >= buffer_at && offset + n <= buffer_at + buffer.size()) {
+            return true;
+        }
+        size_t want = static_cast<size_t>(std::min<uint64_t>(std::max(SCAN_CHUNK_BYTES, n), end - offset));
+        if (want < n) {
+            return false;
+        }
+        buffer.resize(want);
+        buffer_at = offset;
+        return pread_all(segment->fd, &buffer[0], want, offset);
+    };
+    
+    bool ok = true;
+    while (ok && offset < end) {
+        if (!fill(HEADER_BYTES)) {
+            ok = false;
+            break;
+        }
+        const char* p = buffer.data() + (offset - buffer_at);
+        size_t value_len = get_u32(p + 8);
+        size_t key_len = get_u32(p + 12);
+        size_t bytes = record_bytes(key_len, value_len);
+        if (!fits(value_len) || bytes > end - offset || !fill(bytes)) {
+            ok = false;
+            break;
+        }
+        p = buffer.data() + (offset - buffer_at);
+        std::string_view value(p + HEADER_BYTES, value_len);
+        std::string_view key(p + HEADER_BYTES + value_len, key_len);
+        if (crc32c(value.data(), value.size()) != get_u32(p) || crc32c(key.data(), key.size()) != get_u32(p + 4)) {
+            ok = false;
+            break;
+        }
+        // An empty record is the hole left by a failed write
+        if (value_len != 0 || key_len != 0) {
+            fn(encode(index, offset, value_len), key, value);
+        }
+        offset += bytes;
+    }
+    
+    if (!ok) {
+        std::cerr << "Warning: Cold segment " << segment->path << " is unreadable at offset " << offset
+                  << "; it will not be collected" << std::endl;
+        segment->damaged = true;
+    }
+    return ok;
+}
+
+bool ColdLog::drop(uint32_t index) {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (live_[index].load(std::memory_order_relaxed) != 0 || (head_ && head_->index == index)) {
+        return false;
+    }
+    Handle segment = std::atomic_exchange(&segments_[index], Handle());
+    if (!segment) {
+        return false;
+    }
+    ::unlink(segment->path.c_str());
+    written_[index].store(0, std::memory_order_relaxed);
+    free_slots_.push_back(index);
+    return true;
+}
+
+ColdLog::Stats ColdLog::stats() const {
+    Stats s;
+    uint32_t used = slots_used_.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < used; ++i) {
+        uint64_t written = written_[i].load(std::memory_order_relaxed);
+        if (written == 0 && !std::atomic_load(&segments_[i])) {
+            continue;
+        }
+        s.segments++;
+        s.disk_bytes += written;
+        s.live_bytes += live_[i].load(std::memory_order_relaxed);
+    }
+    return s;
+}
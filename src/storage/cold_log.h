@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Values that tiered storage (--tier-path) moved out of memory. Records are
+// appended to the head of a set of segment files and never rewritten; the
+// shard's entry keeps a location word instead of a value pointer, so the
+// key index stays in memory and a cold read is one pread. A record dies when
+// its key is overwritten, erased or its value is read back into memory; the
+// garbage collector copies the live records of a mostly dead segment to the
+// head and deletes the file.
+//
+// The log is a cache of the store, not a second copy of it: the WAL and
+// snapshot still hold every value, so the directory is emptied at startup.
+//
+// Record layout, 16-byte aligned, little-endian:
+//   u32 crc32c(value) | u32 crc32c(key) | u32 value_len | u32 key_len | value | key
+// Location word: bit 0 set (slab pointers are 16-byte aligned, so an
+// entry's word tells the two apart) | 15 bits segment | 24 bits offset / 16
+// | 24 bits value size.
+class ColdLog {
+public:
+    struct Segment {
+        int fd = -1;
+        uint32_t index = 0;
+        std::string path;
+        std::atomic<uint32_t> writers{0};   // Appends reserved but not yet written
+        std::atomic<bool> damaged{false};   // Failed a GC scan; never collected
+        
+        ~Segment();
+    };
+    // Keeps a segment's file open for a read started before GC deleted it
+    using Handle = std::shared_ptr<Segment>;
+    
+    explicit ColdLog(const std::string& dir, size_t segment_bytes = DEFAULT_SEGMENT_BYTES);
+    ~ColdLog();
+    ColdLog(const ColdLog&) = delete;
+    ColdLog& operator=(const ColdLog&) = delete;
+    
+    bool is_open() const { return open_; }
+    
+    static bool is_cold(uint64_t word) { return (word & 1) != 0; }
+    static size_t value_size(uint64_t loc) { return static_cast<size_t>(loc >> 40); }
+    static bool fits(size_t value_size) { return value_size <= MAX_VALUE_BYTES; }
+    
+    // Writes a record and returns its location, or 0 if the write failed or
+    // every segment slot is in use. Thread-safe; the file write happens
+    // outside the log's mutex.
+    uint64_t append(std::string_view key, std::string_view value);
+    
+    // The segment holding loc. Cheap enough to take under a shard lock, so a
+    // reader can pin the file there and read() after releasing it.
+    Handle hold(uint64_t loc) const;
+    
+    // Appends the value at loc to out. False on an I/O error, a checksum
+    // mismatch or an empty handle.
+    bool read(uint64_t loc, const Handle& segment, std::string& out) const;
+    
+    // The record at loc, whose key has key_size bytes, is no longer referenced
+    void release(uint64_t loc, size_t key_size);
+    
+    // Garbage collection. pick_garbage() returns a segment other than the
+    // head whose live bytes are below GC_LIVE_RATIO of what was written to
+    // it, or -1. scan() calls fn for each of its records and returns false if
+    // one is unreadable, marking the segment damaged. drop() deletes it, but
+    // only once no live bytes are left in it, so a record appended before a
+    // roll and still being published keeps its segment.
+    long pick_garbage() const;
+    bool scan(uint32_t segment, const std::function<void(uint64_t loc, std::string_view key, std::string_view value)>& fn);
+    bool drop(uint32_t segment);
+    
+    struct Stats {
+        size_t segments = 0;
+        size_t disk_bytes = 0; // Bytes written to current segments
+        size_t live_bytes = 0; // Of which still referenced
+    };
+    Stats stats() const;
+    
+    static constexpr size_t RECORD_ALIGN = 16;
+    static constexpr size_t HEADER_BYTES = 16;
+    static constexpr size_t MAX_SEGMENTS = 1 << 15;
+    static constexpr size_t MAX_SEGMENT_BYTES = RECORD_ALIGN << 24;
+    static constexpr size_t DEFAULT_SEGMENT_BYTES = 64 * 1024 * 1024;
+    static constexpr size_t MAX_VALUE_BYTES = (1 << 24) - 1;
+    static constexpr double GC_LIVE_RATIO = 0.5;
+    
+    static size_t record_bytes(size_t key_size, size_t value_size) {
+        return (HEADER_BYTES + key_size + value_size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+    }
+
+private:
+    static uint64_t encode(uint32_t segment, uint64_t offset, size_t value_size) {
+        return 1 | (static_cast<uint64_t>(segment) << 1) | ((offset / RECORD_ALIGN) << 16) |
+               (static_cast<uint64_t>(value_size) << 40);
+    }
+    static uint32_t segment_of(uint64_t loc) { return static_cast<uint32_t>((loc >> 1) & (MAX_SEGMENTS - 1)); }
+    static uint64_t offset_of(uint64_t loc) { return ((loc >> 16) & 0xFFFFFF) * RECORD_ALIGN; }
+    
+    bool roll();  // Caller holds mtx_
+    
+    std::string dir_;
+    size_t segment_bytes_;
+    bool open_ = false;
+    
+    mutable std::mutex mtx_;   // Guards the head and the free slots
+    Handle head_;
+    uint64_t head_offset_ = 0;
+    uint32_t next_index_ = 0;  // Slots below it have been used
+    std::vector<uint32_t> free_slots_;
+    bool full_warned_ = false;
+    
+    // Per slot, read with std::atomic_load so readers need no lock
+    std::unique_ptr<Handle[]> segments_;
+    std::unique_ptr<std::atomic<uint64_t>[]> written_;
+    std::unique_ptr<std::atomic<uint64_t>[]> live_;
+    std::atomic<uint32_t> slots_used_{0};
+};
@@ -0,0 +1,259 @@
+#include "compression.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t LAST_LITERALS = 5;      // A block ends with at least this many literals
+constexpr size_t MATCH_FIND_LIMIT = 12;  // and its last match starts at least this far before the end
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_LOG = 12;
+constexpr int SKIP_TRIGGER = 6;          // The search step grows by one every 64 failed probes
+constexpr size_t MAX_RAW_BYTES = size_t(1) << 30;
+
+inline uint32_t read_u32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read_u64(const char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+inline uint32_t hash_sequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// How many bytes from a (up to limit) match those from b, where b < a
+inline size_t common_length(const char* a, const char* b, const char* limit) {
+    const char* start = a;
+    while (a + 8 <= limit) {
+        uint64_t diff = read_u64(a) ^ read_u64(b);
+        if (diff != 0) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return static_cast<size_t>(a - start) + (__builtin_ctzll(diff) >> 3);
+#else
+            return static_cast<size_t>(a - start) + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return static_cast<size_t>(a - start);
+}
+
+// Bytes a length takes beyond its four token bits
+inline size_t length_bytes(size_t n) {
+    return n >= 15 ? (n - 15) / 255 + 1 : 0;
+}
+
+inline char* put_length(char* op, size_t n) {
+    for (n -= 15; n >= 255; n -= 255) {
+        *op++ = static_cast<char>(255);
+    }
+    *op++ = static_cast<char>(n);
+    return op;
+}
+
+// Reads the bytes extending a length whose token bits were 15. False if
+// the block ends first.
+inline bool read_length(const char*& ip, const char* end, size_t& n) {
+    uint8_t b;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        b = static_cast<uint8_t>(*ip++);
+        n += b;
+    } while (b == 255);
+    return true;
+}
+
+} // namespace
+
+size_t lz4_compress(const char* src, size_t size, char* dst, size_t capacity) {
+    const char* end = src + size;
+    const char* anchor = src;  // Start of the literals not yet written
+    char* op = dst;
+    char* out_end = dst + capacity;
+    
+    if (size > MATCH_FIND_LIMIT) {
+        // Offsets from src of the last position each 4-byte sequence was seen
+        uint32_t table[1 << HASH_LOG] = {};
+        const char* match_limit = end - LAST_LITERALS;
+        const char* find_limit = end - MATCH_FIND_LIMIT;
+        const char* ip = src + 1;
+        
+        while (true) {
+            const char* ref = nullptr;
+            size_t probes = size_t(1) << SKIP_TRIGGER;
+            while (ip < find_limit) {
+                uint32_t h = hash_sequence(read_u32(ip));
+                const char* candidate = src + table[h];
+                table[h] = static_cast<uint32_t>(ip - src);
+                if (candidate < ip && static_cast<size_t>(ip - candidate) <= MAX_OFFSET &&
+                    read_u32(candidate) == read_u32(ip)) {
+                    ref = candidate;
+                    break;
+                }
+                ip += probes++ >> SKIP_TRIGGER;
+            }
+            if (ref == nullptr) {
+                break;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            
+            size_t literals = static_cast<size_t>(ip - anchor);
+            size_t match = MIN_MATCH + common_length(ip + MIN_MATCH, ref + MIN_MATCH, match_limit);
+            size_t need = 1 + length_bytes(literals) + literals + 2 + length_bytes(match - MIN_MATCH);
+            if (need > static_cast<size_t>(out_end - op)) {
+                return 0;
+            }
+            
+            char* token = op++;
+            uint8_t bits = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+            if (literals >= 15) {
+                op = put_length(op, literals);
+            }
+            std::memcpy(op, anchor, literals);
+            op += literals;
+            size_t offset = static_cast<size_t>(ip - ref);
+            *op++ = static_cast<char>(offset & 0xFF);
+            *op++ = static_cast<char>(offset >> 8);
+            bits |= static_cast<uint8_t>(std::min<size_t>(match - MIN_MATCH, 15));
+            if (match - MIN_MATCH >= 15) {
+                op = put_length(op, match - MIN_MATCH);
+            }
+            *token = static_cast<char>(bits);
+            
+            ip += match;
+            anchor = ip;
+            if (ip < find_limit) {
+                table[hash_sequence(read_u32(ip - 2))] = static_cast<uint32_t>(ip - 2 - src);
+            }
+        }
+    }
+    
+    // The last sequence is literals only
+    size_t literals = static_cast<size_t>(end - anchor);
+    if (1 + length_bytes(literals) + literals > static_cast<size_t>(out_end - op)) {
+        return 0;
+    }
+    *op++ = static_cast<char>(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) {
+        op = put_length(op, literals);
+    }
+    if (literals > 0) {
+        std::memcpy(op, anchor, literals);
+        op += literals;
+    }
+    return static_cast<size_t>(op - dst);
+}
+
+bool lz4_decompress(const char* src, size_t size, char* dst, size_t raw_size) {
+    const char* ip = src;
+    const char* end = src + size;
+    size_t op = 0;
+    
+    while (ip < end) {
+        uint8_t token = static_cast<uint8_t>(*ip++);
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(ip, end, literals)) {
+            return false;
+        }
+        if (literals > static_cast<size_t>(end - ip) || literals > raw_size - op) {
+            return false;
+        }
+        std::memcpy(dst + op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == end) {
+            return op == raw_size;
+        }
+        
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = static_cast<uint8_t>(ip[0]) | (static_cast<size_t>(static_cast<uint8_t>(ip[1])) << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !read_length(ip, end, match)) {
+            return false;
+        }
+        match += MIN_MATCH;
+        if (offset == 0 || offset > op || match > raw_size - op) {
+            return false;
+        }
+        // An overlapping match repeats the last `offset` bytes; copying in
+        // chunks that double keeps each memcpy free of overlap
+        size_t distance = offset;
+        while (match > 0) {
+            size_t n = std::min(distance, match);
+            std::memcpy(dst + op, dst + op - distance, n);
+            op += n;
+            match -= n;
+            distance += n;
+        }
+    }
+    return false; // A block ends with a literals-only sequence
+}
+
+bool compress_value(std::string_view value, std::string& out) {
+    size_t budget = value.size() - value.size() / 8;
+    if (value.size() > MAX_RAW_BYTES || budget <= FRAME_HEADER_BYTES) {
+        return false;
+    }
+    size_t start = out.size();
+    out.resize(start + budget);
+    char* frame = &out[start];
+    size_t n = lz4_compress(value.data(), value.size(), frame + FRAME_HEADER_BYTES, budget - FRAME_HEADER_BYTES);
+    if (n == 0) {
+        out.resize(start);
+        return false;
+    }
+    put_u32(frame, static_cast<uint32_t>(value.size()));
+    out.resize(start + FRAME_HEADER_BYTES + n);
+    return true;
+}
+
+bool decompress_value(std::string_view frame, std::string& out) {
+    if (frame.size() < FRAME_HEADER_BYTES) {
+        return false;
+    }
+    size_t raw_size = get_u32(frame.data());
+    if (raw_size > MAX_RAW_BYTES) {
+        return false;
+    }
+    size_t start = out.size();
+    out.resize(start + raw_size);
+    if (!lz4_decompress(frame.data() + FRAME_HEADER_BYTES, frame.size() - FRAME_HEADER_BYTES, &out[start], raw_size)) {
+        out.resize(start);
+        return false;
+    }
+    return true;
+}
+
+size_t frame_raw_size(std::string_view frame) {
+    return frame.size() < FRAME_HEADER_BYTES ? 0 : get_u32(frame.data());
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Value compression. A compressed value is stored, logged and spilled as a
+// frame: u32 raw_size (little-endian) | LZ4 block. The codec is flagged on
+// the entry and on its WAL and snapshot records; the frame carries what is
+// needed to decode it, so the bytes can move between memory, the cold log,
+// the WAL and replicas unchanged.
+//
+// The LZ4 block format is implemented here (greedy matcher, 4K-entry hash
+// table, 64KB window), so blocks can be read by any LZ4 decoder and no
+// library is needed.
+enum class Codec : uint8_t { NONE, LZ4 };
+
+constexpr size_t FRAME_HEADER_BYTES = 4;
+
+// Compresses src into dst and returns the block's size, or 0 if it would
+// not fit in capacity bytes
+size_t lz4_compress(const char* src, size_t size, char* dst, size_t capacity);
+
+// Decodes a block into exactly raw_size bytes at dst. False on a malformed
+// block or one that decodes to another size; never reads or writes out of
+// bounds.
+bool lz4_decompress(const char* src, size_t size, char* dst, size_t raw_size);
+
+// Appends value's frame to out if it saves at least an eighth of its size;
+// otherwise leaves out as it was and returns false
+bool compress_value(std::string_view value, std::string& out);
+
+// Appends the value a frame holds to out. False if the frame is damaged,
+// with out left as it was.
+bool decompress_value(std::string_view frame, std::string& out);
+
+// The value size recorded in a frame's header, or 0 for a truncated frame
+size_t frame_raw_size(std::string_view frame);
@@ -0,0 +1,114 @@
+#include "crc32c.h"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define MEMKV_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define MEMKV_CRC32C_ARM 1
+#endif
+
+namespace {
+
+constexpr uint32_t POLY = 0x82F63B78u; // Reflected Castagnoli polynomial
+
+struct Tables {
+    uint32_t t[8][256];
+    
+    Tables() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (POLY & (0u - (crc & 1u)));
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int s = 1; s < 8; ++s) {
+                t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+            }
+        }
+    }
+};
+
+const Tables& tables() {
+    static const Tables instance;
+    return instance;
+}
+
+uint32_t crc32c_software(const uint8_t* p, size_t len, uint32_t crc) {
+    const Tables& tb = tables();
+    while (len >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = tb.t[7][lo & 0xFF] ^ tb.t[6][(lo >> 8) & 0xFF] ^
+              tb.t[5][(lo >> 16) & 0xFF] ^ tb.t[4][lo >> 24] ^
+              tb.t[3][hi & 0xFF] ^ tb.t[2][(hi >> 8) & 0xFF] ^
+              tb.t[1][(hi >> 16) & 0xFF] ^ tb.t[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ tb.t[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(MEMKV_CRC32C_X86)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(const uint8_t* p, size_t len, uint32_t crc) {
+    uint64_t c = crc;
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        c = _mm_crc32_u64(c, word);
+        p += 8;
+        len -= 8;
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    while (len-- > 0) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return c32;
+}
+
+bool has_hardware_crc() {
+    static const bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#elif defined(MEMKV_CRC32C_ARM)
+uint32_t crc32c_hardware(const uint8_t* p, size_t len, uint32_t crc) {
+    while (len >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+bool has_hardware_crc() {
+    return true;
+}
+#endif
+
+} // namespace
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#if defined(MEMKV_CRC32C_X86) || defined(MEMKV_CRC32C_ARM)
+    if (has_hardware_crc()) {
+        return ~crc32c_hardware(p, len, crc);
+    }
+#endif
+    return ~crc32c_software(p, len, crc);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 / ARMv8 CRC instructions when the
+// CPU has them and a slicing-by-8 table otherwise. Pass a previous result as
+// `crc` to extend a checksum over more bytes.
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
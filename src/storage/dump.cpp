@@ -0,0 +1,143 @@
+#include "dump.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+inline uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+} // namespace
+
+DumpFile::DumpFile(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error_ = "could not open " + path + ": " + strerror(errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        error_ = path + " is not a regular file";
+        ::close(fd);
+        return;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+        ::close(fd);
+        return;
+    }
+    void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        error_ = "mmap of " + path + " failed: " + strerror(errno);
+        size_ = 0;
+        return;
+    }
+    base_ = static_cast<const char*>(mapping);
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    madvise(mapping, size_, MADV_WILLNEED);
+    
+    binary_ = size_ >= sizeof(MAGIC) && std::memcmp(base_, MAGIC, sizeof(MAGIC)) == 0;
+    if (!binary_) {
+        return;
+    }
+    start_ = sizeof(MAGIC);
+    size_t pos = start_;
+    while (pos < size_) {
+        if (records_ % CHUNK_STRIDE == 0) {
+            boundaries_.push_back(pos);
+        }
+        if (size_ - pos < SnapshotReader::ENTRY_FIXED) {
+            error_ = path + " is truncated at byte " + std::to_string(pos);
+            return;
+        }
+        uint64_t key_len = get_u32(base_ + pos + 8);
+        uint64_t value_len = get_u32(base_ + pos + 12) & ~SnapshotReader::FLAGS;
+        if (key_len == 0 || key_len + value_len > size_ - pos - SnapshotReader::ENTRY_FIXED) {
+            error_ = path + " has a bad record at byte " + std::to_string(pos);
+            return;
+        }
+        pos += SnapshotReader::ENTRY_FIXED + key_len + value_len;
+        records_++;
+    }
+}
+
+DumpFile::~DumpFile() {
+    if (base_ != nullptr) {
+        munmap(const_cast<char*>(base_), size_);
+    }
+}
+
+std::vector<std::pair<size_t, size_t>> DumpFile::chunks(size_t n) const {
+    std::vector<std::pair<size_t, size_t>> out;
+    if (base_ == nullptr || start_ >= size_ || n == 0) {
+        return out;
+    }
+    size_t begin = start_;
+    for (size_t i = 1; i <= n && begin < size_; ++i) {
+        size_t end = size_;
+        if (i < n) {
+            size_t target = start_ + (size_ - start_) / n * i;
+            if (binary_) {
+                // The first boundary at or past the target
+                auto it = std::lower_bound(boundaries_.begin(), boundaries_.end(), target);
+                end = it == boundaries_.end() ? size_ : *it;
+            } else {
+                const void* newline = target < size_ ? std::memchr(base_ + target, '\n', size_ - target) : nullptr;
+                end = newline ? static_cast<const char*>(newline) - base_ + 1 : size_;
+            }
+        }
+        if (end > begin) {
+            out.emplace_back(begin, end);
+            begin = end;
+        }
+    }
+    return out;
+}
+
+size_t DumpFile::decode(size_t offset, Record& record) const {
+    const char* p = base_ + offset;
+    if (binary_) {
+        record.expiry_at_ms = static_cast<long long>(get_u64(p));
+        uint32_t key_len = get_u32(p + 8);
+        uint32_t value_word = get_u32(p + 12);
+        uint32_t value_len = value_word & ~SnapshotReader::FLAGS;
+        record.flags = value_word & SnapshotReader::FLAGS;
+        record.key = std::string_view(p + SnapshotReader::ENTRY_FIXED, key_len);
+        record.value = std::string_view(p + SnapshotReader::ENTRY_FIXED + key_len, value_len);
+        return offset + SnapshotReader::ENTRY_FIXED + key_len + value_len;
+    }
+    
+    const void* newline = std::memchr(p, '\n', size_ - offset);
+    size_t next = newline ? static_cast<const char*>(newline) - base_ + 1 : size_;
+    std::string_view line(p, next - offset - (newline ? 1 : 0));
+    if (!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    size_t split = line.find_first_of(" \t");
+    record.expiry_at_ms = 0;
+    record.flags = 0;
+    if (split == 0 || split == std::string_view::npos) {
+        record.key = std::string_view();
+        record.value = std::string_view();
+    } else {
+        record.key = line.substr(0, split);
+        record.value = line.substr(split + 1);
+    }
+    return next;
+}
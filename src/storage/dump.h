@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A bulk-import dump (IMPORT, --import), memory-mapped read-only. Two
+// formats, told apart by the magic:
+//   text:   one "key value" per line; the value is the rest of the line
+//           after the first space or tab, with a trailing \r dropped
+//   binary: "MKVDUMP1" | entries laid out as in a snapshot section:
+//           i64 expiry_at_ms | u32 key_len | u32 value_len | key | value,
+//           little-endian, with the same flag bits in value_len
+// Binary files are walked once on open, so a truncated one is refused
+// before anything is loaded. Records are then decoded from chunks in
+// parallel, by offset, with views into the mapping.
+class DumpFile {
+public:
+    explicit DumpFile(const std::string& path);
+    ~DumpFile();
+    DumpFile(const DumpFile&) = delete;
+    DumpFile& operator=(const DumpFile&) = delete;
+    
+    // Empty when the file is open and well formed
+    const std::string& error() const { return error_; }
+    bool binary() const { return binary_; }
+    size_t size() const { return size_; }
+    // Record count, known up front for binary files only
+    size_t records() const { return records_; }
+    
+    // Up to n [begin, end) ranges of about equal size that start and end on
+    // record boundaries and cover every record
+    std::vector<std::pair<size_t, size_t>> chunks(size_t n) const;
+    
+    struct Record {
+        std::string_view key;   // Empty for a text line that is not "key value"
+        std::string_view value;
+        long long expiry_at_ms = 0;
+        uint32_t flags = 0;     // SnapshotReader flags, binary files only
+    };
+    // Decodes the record at offset, a chunk start or what the previous call
+    // returned, and returns the offset of the next one
+    size_t decode(size_t offset, Record& record) const;
+    
+    static constexpr char MAGIC[8] = {'M', 'K', 'V', 'D', 'U', 'M', 'P', '1'};
+
+private:
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+    size_t start_ = 0;                // First record
+    bool binary_ = false;
+    size_t records_ = 0;
+    std::vector<size_t> boundaries_;  // Binary files: every CHUNK_STRIDE-th record's offset
+    std::string error_;
+    
+    static constexpr size_t CHUNK_STRIDE = 1024;
+};
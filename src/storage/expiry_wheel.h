@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+
+// Per-shard expiry index: a hashed timing wheel of SLOTS buckets, SLOT_MS
+// wide. A key with a TTL is filed under the slot of its expiry time; keys
+// due more than one revolution out stay in their slot and are re-checked
+// each time it comes round. schedule() returns where the item went, which
+// the owner keeps on the entry so that cancel() on a rewrite with another
+// expiry or a delete is O(1). Items move within their slot when another is
+// taken out; the owner is told through relocate(key, pos) and updates the
+// entry's handle.
+//
+// Not thread safe: guarded by the owning shard's lock.
+class ExpiryWheel {
+public:
+    static constexpr size_t SLOTS = 1024;
+    static constexpr long long SLOT_MS = 100;
+    
+    struct Handle {
+        uint32_t pos = 0;  // Index within the slot
+        uint16_t slot = 0;
+    };
+    
+    ExpiryWheel() : slots_(SLOTS), cursor_tick_(CoarseClock::now_ms() / SLOT_MS) {}
+    
+    Handle schedule(std::string_view key, long long expiry_at_ms) {
+        long long tick = expiry_at_ms / SLOT_MS;
+        if (tick < cursor_tick_) {
+            tick = cursor_tick_; // Already overdue: handle on the next advance
+        }
+        auto& slot = slots_[tick % SLOTS];
+        Handle h{static_cast<uint32_t>(slot.size()), static_cast<uint16_t>(tick % SLOTS)};
+        slot.emplace_back(expiry_at_ms, std::string(key));
+        ++size_;
+        return h;
+    }
+    
+    // Removes the item at h, which must still be scheduled
+    template <typename Relocate>
+    void cancel(Handle h, Relocate&& relocate) {
+        take(slots_[h.slot], h.pos, relocate);
+        --size_;
+    }
+    
+    size_t size() const { return size_; }
+    
+    // Processes every slot that has fully elapsed by now_ms. on_due(key,
+    // expiry_at_ms) is called for each due item, already off the wheel, and
+    // returns true if it removed a key. Stops after max_due due items and
+    // resumes from the same slot next time. Returns true when the wheel is
+    // caught up.
+    template <typename OnDue, typename Relocate>
+    bool advance(long long now_ms, size_t max_due, size_t& removed, OnDue&& on_due, Relocate&& relocate) {
+        long long now_tick = now_ms / SLOT_MS;
+        size_t due = 0;
+        size_t steps = 0;
+        
+        while (size_ > 0 && cursor_tick_ < now_tick && steps < SLOTS) {
+            auto& slot = slots_[cursor_tick_ % SLOTS];
+            // Back to front, so the item moved into a freed place was already checked
+            for (size_t i = slot.size(); i-- > 0;) {
+                if (slot[i].first >= now_ms) {
+                    continue; // A later revolution
+                }
+                if (due >= max_due) {
+                    return false;
+                }
+                
+                auto item = std::move(slot[i]);
+                take(slot, i, relocate);
+                --size_;
+                ++due;
+                if (on_due(item.second, item.first)) {
+                    ++removed;
+                }
+            }
+            
+            ++cursor_tick_;
+            ++steps;
+        }
+        
+        if (size_ == 0 || steps == SLOTS) {
+            cursor_tick_ = now_tick; // Idle or far behind: every slot was just visited
+        }
+        return true;
+    }
+
+private:
+    using Item = std::pair<long long, std::string>;
+    
+    // Swap-and-pop of slot[pos]
+    template <typename Relocate>
+    static void take(std::vector<Item>& slot, size_t pos, Relocate& relocate) {
+        if (pos + 1 != slot.size()) {
+            slot[pos] = std::move(slot.back());
+            relocate(std::string_view(slot[pos].second), static_cast<uint32_t>(pos));
+        }
+        slot.pop_back();
+    }
+    
+    std::vector<std::vector<Item>> slots_;
+    long long cursor_tick_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <utility>
+
+#include "hash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Short-string key for FlatMap slots. Keys of up to INLINE_CAPACITY bytes are
+// stored in the object itself; longer keys take one heap allocation, or point
+// at bytes owned elsewhere (external()). The last byte holds
+// INLINE_CAPACITY - size for inline keys, HEAP_TAG or EXTERNAL_TAG.
+class InlineKey {
+public:
+    static constexpr size_t INLINE_CAPACITY = 23;
+
+    InlineKey() { set_inline_size(0); }
+
+    explicit InlineKey(std::string_view key) {
+        if (key.size() <= INLINE_CAPACITY) {
+            std::memcpy(buf_, key.data(), key.size());
+            set_inline_size(key.size());
+            return;
+        }
+
+        char* heap = new char[key.size()];
+        size_t len = key.size();
+        std::memcpy(heap, key.data(), len);
+        std::memcpy(buf_, &heap, sizeof(heap));
+        std::memcpy(buf_ + sizeof(heap), &len, sizeof(len));
+        buf_[TAG] = static_cast<char>(HEAP_TAG);
+    }
+
+    // Refers to len bytes at data without owning them; the caller keeps them
+    // alive for as long as the key is in a map
+    static InlineKey external(const char* data, size_t len) {
+        InlineKey key;
+        std::memcpy(key.buf_, &data, sizeof(data));
+        std::memcpy(key.buf_ + sizeof(data), &len, sizeof(len));
+        key.buf_[TAG] = static_cast<char>(EXTERNAL_TAG);
+        return key;
+    }
+
+    InlineKey(InlineKey&& other) noexcept {
+        std::memcpy(buf_, other.buf_, sizeof(buf_));
+        other.set_inline_size(0);
+    }
+
+    InlineKey& operator=(InlineKey&& other) noexcept {
+        if (this != &other) {
+            release();
+            std::memcpy(buf_, other.buf_, sizeof(buf_));
+            other.set_inline_size(0);
+        }
+        return *this;
+    }
+
+    InlineKey(const InlineKey&) = delete;
+    InlineKey& operator=(const InlineKey&) = delete;
+
+    ~InlineKey() { release(); }
+
+    bool is_inline() const {
+        return static_cast<unsigned char>(buf_[TAG]) < EXTERNAL_TAG;
+    }
+
+    bool is_external() const {
+        return static_cast<unsigned char>(buf_[TAG]) == EXTERNAL_TAG;
+    }
+
+    std::string_view view() const {
+        if (is_inline()) {
+            return std::string_view(buf_, INLINE_CAPACITY - static_cast<unsigned char>(buf_[TAG]));
+        }
+        const char* heap;
+        size_t len;
+        std::memcpy(&heap, buf_, sizeof(heap));
+        std::memcpy(&len, buf_ + sizeof(heap), sizeof(len));
+        return std::string_view(heap, len);
+    }
+
+private:
+    static constexpr size_t TAG = INLINE_CAPACITY;
+    static constexpr unsigned char HEAP_TAG = 0xFF;
+    static constexpr unsigned char EXTERNAL_TAG = 0xFE;
+    static_assert(sizeof(char*) + sizeof(size_t) <= INLINE_CAPACITY, "heap key must fit before the tag");
+
+    void set_inline_size(size_t n) {
+        buf_[TAG] = static_cast<char>(INLINE_CAPACITY - n);
+    }
+
+    void release() {
+        if (static_cast<unsigned char>(buf_[TAG]) == HEAP_TAG) {
+            char* heap;
+            std::memcpy(&heap, buf_, sizeof(heap));
+            delete[] heap;
+            set_inline_size(0);
+        }
+    }
+
+    char buf_[INLINE_CAPACITY + 1];
+};
+
+// Open-addressing string-keyed hash table in the SwissTable layout: a control
+// byte per slot (EMPTY, DELETED, or the low 7 hash bits) probed 16 at a time
+// with SSE2, and slots holding the full hash, an InlineKey and the value in one
+// flat array. A lookup touches the control group and, on a 7-bit match, one
+// slot; the stored hash filters nearly all false matches before the key
+// compare, and rehashing never rehashes keys.
+//
+// Groups are aligned and probed triangularly. Erase leaves DELETED only when
+// the group has no EMPTY byte, since a probe that reached a group with an
+// EMPTY byte would have stopped there anyway.
+//
+// Slots are addressed by index. An index stays valid until the next insert
+// (which may rehash); capacity() only changes on rehash, so callers scanning
+// slot ranges across lock releases can detect a rehash and restart.
+template <typename V>
+class FlatMap {
+public:
+    struct Slot {
+        uint64_t hash;
+        InlineKey key_;
+        V value;
+
+        std::string_view key() const { return key_.view(); }
+    };
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr size_t GROUP_WIDTH = 16;
+
+    FlatMap() = default;
+    ~FlatMap() { destroy(); }
+
+    FlatMap(const FlatMap&) = delete;
+    FlatMap& operator=(const FlatMap&) = delete;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return capacity_; }
+
+    // Bytes of the slot and control arrays (not of heap keys or what values own)
+    size_t memory_bytes() const { return capacity_ * (sizeof(Slot) + 1); }
+
+    bool is_full(size_t i) const { return ctrl_[i] >= 0; }
+    Slot& slot(size_t i) { return slots_[i]; }
+    const Slot& slot(size_t i) const { return slots_[i]; }
+
+    static uint64_t hash_of(std::string_view key) {
+        return hash_key(key);
+    }
+
+    size_t find(std::string_view key) const {
+        return find(key, hash_of(key));
+    }
+
+    size_t find(std::string_view key, uint64_t hash) const {
+        if (capacity_ == 0) {
+            return npos;
+        }
+
+        int8_t tag = tag_of(hash);
+        size_t group_mask = capacity_ / GROUP_WIDTH - 1;
+        size_t group = (hash >> 7) & group_mask;
+
+        for (size_t step = 1; ; ++step) {
+            const int8_t* ctrl = ctrl_.get() + group * GROUP_WIDTH;
+            for (uint32_t m = match_byte(ctrl, tag); m != 0; m &= m - 1) {
+                size_t i = group * GROUP_WIDTH + __builtin_ctz(m);
+                const Slot& s = slots_[i];
+                if (s.hash == hash && s.key() == key) {
+                    return i;
+                }
+            }
+            if (match_byte(ctrl, EMPTY) != 0) {
+                return npos;
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    // Returns the slot for key and whether it was inserted. A new slot holds
+    // a default-constructed value.
+    std::pair<size_t, bool> insert(std::string_view key) {
+        return insert(key, hash_of(key));
+    }
+
+    std::pair<size_t, bool> insert(std::string_view key, uint64_t hash) {
+        size_t existing = find(key, hash);
+        if (existing != npos) {
+            return {existing, false};
+        }
+        return {insert_new(InlineKey(key), hash), true};
+    }
+
+    // Inserts a key the caller knows is absent, with a default-constructed
+    // value, and returns its slot
+    size_t insert_new(InlineKey key, uint64_t hash) {
+        // Max load 7/8, tombstones included
+        if ((size_ + deleted_ + 1) * 8 > capacity_ * 7) {
+            rehash_for_insert();
+        }
+
+        size_t i = find_insert_slot(hash);
+        if (ctrl_[i] == DELETED) {
+            deleted_--;
+        }
+        ctrl_[i] = tag_of(hash);
+        new (&slots_[i]) Slot{hash, std::move(key), V()};
+        size_++;
+        return i;
+    }
+
+    void erase_at(size_t i) {
+        slots_[i].~Slot();
+        size_--;
+
+        const int8_t* group = ctrl_.get() + (i / GROUP_WIDTH) * GROUP_WIDTH;
+        if (match_byte(group, EMPTY) != 0) {
+            ctrl_[i] = EMPTY;
+        } else {
+            ctrl_[i] = DELETED;
+            deleted_++;
+        }
+    }
+
+    bool erase(std::string_view key) {
+        return erase(key, hash_of(key));
+    }
+
+    bool erase(std::string_view key, uint64_t hash) {
+        size_t i = find(key, hash);
+        if (i == npos) {
+            return false;
+        }
+        erase_at(i);
+        return true;
+    }
+
+    // Sizes the table so n entries fit without a rehash
+    void reserve(size_t n) {
+        size_t cap = GROUP_WIDTH;
+        while (cap * 7 < n * 8) {
+            cap *= 2;
+        }
+        if (cap > capacity_) {
+            rehash(cap);
+        }
+    }
+
+    // Moves the table into fresh arrays that the calling thread allocates and
+    // writes first, so under first-touch they land on its NUMA node
+    void rebuild() {
+        if (capacity_ > 0) {
+            rehash(capacity_);
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (is_full(i)) {
+                slots_[i].~Slot();
+            }
+            ctrl_[i] = EMPTY;
+        }
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+private:
+    static constexpr int8_t EMPTY = -128;  // 0x80
+    static constexpr int8_t DELETED = -2;  // 0xFE
+
+    static int8_t tag_of(uint64_t hash) {
+        return static_cast<int8_t>(hash & 0x7F);
+    }
+
+    // Bit i set when byte i of the group equals b
+    static uint32_t match_byte(const int8_t* group, int8_t b) {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+            mask |= static_cast<uint32_t>(group[i] == b) << i;
+        }
+        return mask;
+#endif
+    }
+
+    // EMPTY and DELETED are the only control bytes with the high bit set
+    static uint32_t match_free(const int8_t* group) {
+#if defined(__SSE2__)
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(ctrl));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_WIDTH; ++i) {
+            mask |= static_cast<uint32_t>(group[i] < 0) << i;
+        }
+        return mask;
+#endif
+    }
+
+    size_t find_insert_slot(uint64_t hash) const {
+        size_t group_mask = capacity_ / GROUP_WIDTH - 1;
+        size_t group = (hash >> 7) & group_mask;
+
+        for (size_t step = 1; ; ++step) {
+            uint32_t m = match_free(ctrl_.get() + group * GROUP_WIDTH);
+            if (m != 0) {
+                return group * GROUP_WIDTH + __builtin_ctz(m);
+            }
+            group = (group + step) & group_mask;
+        }
+    }
+
+    // Doubles once live entries pass 7/16 of capacity; below that the table
+    // is rebuilt at the same size to clear tombstones
+    void rehash_for_insert() {
+        size_t cap = capacity_ == 0 ? GROUP_WIDTH : capacity_;
+        if ((size_ + 1) * 16 > cap * 7) {
+            cap *= 2;
+        }
+        rehash(cap);
+    }
+
+    void rehash(size_t new_capacity) {
+        std::unique_ptr<int8_t[]> old_ctrl = std::move(ctrl_);
+        Slot* old_slots = slots_;
+        size_t old_capacity = capacity_;
+
+        ctrl_.reset(new int8_t[new_capacity]);
+        std::memset(ctrl_.get(), static_cast<unsigned char>(EMPTY), new_capacity);
+        slots_ = std::allocator<Slot>().allocate(new_capacity);
+        capacity_ = new_capacity;
+        deleted_ = 0;
+
+        for (size_t i = 0; i < old_capacity; ++i) {
+            if (old_ctrl[i] < 0) {
+                continue;
+            }
+            size_t j = find_insert_slot(old_slots[i].hash);
+            ctrl_[j] = old_ctrl[i];
+            new (&slots_[j]) Slot(std::move(old_slots[i]));
+            old_slots[i].~Slot();
+        }
+
+        if (old_slots) {
+            std::allocator<Slot>().deallocate(old_slots, old_capacity);
+        }
+    }
+
+    void destroy() {
+        if (!slots_) {
+            return;
+        }
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (is_full(i)) {
+                slots_[i].~Slot();
+            }
+        }
+        std::allocator<Slot>().deallocate(slots_, capacity_);
+        slots_ = nullptr;
+    }
+
+    std::unique_ptr<int8_t[]> ctrl_;
+    Slot* slots_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    size_t deleted_ = 0;
+};
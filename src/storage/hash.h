@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// wyhash-style 64-bit string hash: a few 64x64->128 multiplies per 16 bytes
+// and no per-byte loop, with good avalanche in both halves. Shared by shard
+// selection (high bits) and FlatMap (low bits: 7-bit tag, then group index)
+// so each key is hashed once per operation.
+namespace hash_detail {
+
+constexpr uint64_t SECRET0 = 0xa0761d6478bd642fULL;
+constexpr uint64_t SECRET1 = 0xe7037ed1a0b428dbULL;
+constexpr uint64_t SECRET2 = 0x8ebc6af09c88c6e3ULL;
+constexpr uint64_t SECRET3 = 0x589965cc75374cc3ULL;
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 1-3 bytes: first, middle and last byte cover every length
+inline uint64_t read_small(const uint8_t* p, size_t len) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[len >> 1]) << 8) | p[len - 1];
+}
+
+} // namespace hash_detail
+
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t seed = 0) {
+    using namespace hash_detail;
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    seed ^= mix(seed ^ SECRET0, SECRET1);
+    uint64_t a;
+    uint64_t b;
+    
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping 4-byte reads from each end
+            size_t mid = (len >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + mid);
+            b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = read_small(p, len);
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            // Three independent lanes keep the multipliers busy on long keys
+            uint64_t lane1 = seed;
+            uint64_t lane2 = seed;
+            do {
+                seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+                lane1 = mix(read64(p + 16) ^ SECRET2, read64(p + 24) ^ lane1);
+                lane2 = mix(read64(p + 32) ^ SECRET3, read64(p + 40) ^ lane2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= lane1 ^ lane2;
+        }
+        while (i > 16) {
+            seed = mix(read64(p) ^ SECRET1, read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    
+    a ^= SECRET1;
+    b ^= seed;
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+    return mix(a ^ SECRET0 ^ len, b ^ SECRET1);
+}
+
+inline uint64_t hash_key(std::string_view key) {
+    return hash_bytes(key.data(), key.size());
+}
@@ -0,0 +1,144 @@
+#include "hot_keys.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+std::atomic<uint64_t> next_id{1};
+
+} // namespace
+
+HotKeys::HotKeys(size_t capacity)
+    : capacity_(std::min(capacity, MAX_KEYS)), id_(next_id.fetch_add(1)),
+      sketch_(new std::atomic<uint32_t>[SKETCH_DEPTH * SKETCH_WIDTH]),
+      hot_(capacity_) {
+    for (size_t i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; ++i) {
+        sketch_[i].store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint64_t>& word : filter_) {
+        word.store(0, std::memory_order_relaxed);
+    }
+}
+
+void HotKeys::sample(std::string_view key, uint64_t hash) {
+    uint32_t estimate = std::numeric_limits<uint32_t>::max();
+    for (size_t row = 0; row < SKETCH_DEPTH; ++row) {
+        size_t column = (hash >> (row * 16)) % SKETCH_WIDTH;
+        uint32_t count = sketch_[row * SKETCH_WIDTH + column].fetch_add(1, std::memory_order_relaxed) + 1;
+        estimate = std::min(estimate, count);
+    }
+    // Tracked keys are re-read from the sketch by rotate()
+    if (estimate < HOT_MIN_SAMPLES || hash == 0 || find(hash) >= 0) {
+        return;
+    }
+    
+    std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return; // Another sampler is here; a hot key comes round again soon
+    }
+    for (Candidate& c : candidates_) {
+        if (c.hash == hash) {
+            c.estimate = std::max(c.estimate, estimate);
+            return;
+        }
+    }
+    if (candidates_.size() < capacity_ * CANDIDATES_PER_KEY) {
+        candidates_.push_back({std::string(key), hash, estimate});
+        return;
+    }
+    auto coldest = std::min_element(candidates_.begin(), candidates_.end(),
+                                    [](const Candidate& a, const Candidate& b) { return a.estimate < b.estimate; });
+    if (coldest->estimate < estimate) {
+        *coldest = {std::string(key), hash, estimate};
+    }
+}
+
+void HotKeys::rotate() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    
+    // Tracked keys compete with the new candidates on their current estimate
+    std::vector<Candidate> picked;
+    picked.swap(candidates_);
+    for (const Candidate& h : hot_) {
+        if (h.hash == 0) {
+            continue;
+        }
+        uint32_t estimate = std::numeric_limits<uint32_t>::max();
+        for (size_t row = 0; row < SKETCH_DEPTH; ++row) {
+            size_t column = (h.hash >> (row * 16)) % SKETCH_WIDTH;
+            estimate = std::min(estimate, sketch_[row * SKETCH_WIDTH + column].load(std::memory_order_relaxed));
+        }
+        if (estimate >= HOT_MIN_SAMPLES) {
+            picked.push_back({h.key, h.hash, estimate});
+        }
+    }
+    std::sort(picked.begin(), picked.end(),
+              [](const Candidate& a, const Candidate& b) { return a.estimate > b.estimate; });
+    if (picked.size() > capacity_) {
+        picked.resize(capacity_);
+    }
+    
+    // Keys that stay keep their slot, and the copies readers hold of them
+    std::vector<bool> kept(capacity_, false);
+    std::vector<const Candidate*> added;
+    for (const Candidate& c : picked) {
+        int slot = find(c.hash);
+        if (slot >= 0) {
+            kept[slot] = true;
+            hot_[slot].estimate = c.estimate;
+        } else {
+            added.push_back(&c);
+        }
+    }
+    // A reassigned slot gets its filter bit before its hash, so a writer
+    // that can see the hash finds it, and a new version after both
+    for (size_t slot = 0, next = 0; slot < capacity_; ++slot) {
+        if (kept[slot]) {
+            continue;
+        }
+        uint64_t hash = 0;
+        if (next < added.size()) {
+            hot_[slot] = *added[next++];
+            hash = hot_[slot].hash;
+            tracked_.fetch_add(1, std::memory_order_acq_rel);
+            filter_[filter_bit(hash) / 64].fetch_or(uint64_t(1) << (filter_bit(hash) % 64), std::memory_order_release);
+        } else if (hot_[slot].hash == 0) {
+            continue;
+        } else {
+            hot_[slot] = Candidate();
+        }
+        slots_[slot].hash.store(hash, std::memory_order_release);
+        slots_[slot].version.fetch_add(1, std::memory_order_acq_rel);
+    }
+    // Then the bits of the keys that left are cleared
+    uint64_t filter[FILTER_BITS / 64] = {};
+    size_t tracked = 0;
+    for (const Candidate& h : hot_) {
+        if (h.hash != 0) {
+            filter[filter_bit(h.hash) / 64] |= uint64_t(1) << (filter_bit(h.hash) % 64);
+            tracked++;
+        }
+    }
+    tracked_.store(tracked, std::memory_order_release);
+    for (size_t i = 0; i < FILTER_BITS / 64; ++i) {
+        filter_[i].store(filter[i], std::memory_order_release);
+    }
+    
+    for (size_t i = 0; i < SKETCH_DEPTH * SKETCH_WIDTH; ++i) {
+        sketch_[i].store(sketch_[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+}
+
+std::vector<HotKeys::Hot> HotKeys::keys() const {
+    std::vector<Hot> out;
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (const Candidate& h : hot_) {
+            if (h.hash != 0) {
+                out.push_back({h.key, static_cast<uint64_t>(h.estimate) << SAMPLE_SHIFT});
+            }
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const Hot& a, const Hot& b) { return a.reads > b.reads; });
+    return out;
+}
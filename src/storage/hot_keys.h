@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Hot-key detection (--hot-keys). One GET in 1 << SAMPLE_SHIFT is counted in
+// a count-min sketch; a key whose estimate passes HOT_MIN_SAMPLES is offered
+// to a short candidate list, and each rotate() makes the top candidates the
+// tracked hot keys and halves the sketch, so estimates follow the recent rate.
+//
+// Each tracked key has a slot with a version. Writers bump it, under the
+// key's shard lock, whenever they change or remove the key's value, and a
+// reassigned slot is bumped too, so a copy of a hot value taken together
+// with its slot's version stays valid exactly while that version does. That
+// is what lets GETs of hot keys be served from per-thread copies without
+// touching the shard lock. Lookups by readers and writers are lock-free: a
+// 1024-bit filter, then a scan of the 64-bit key hashes in the slots.
+class HotKeys {
+public:
+    static constexpr size_t MAX_KEYS = 64;
+    static constexpr unsigned SAMPLE_SHIFT = 5;  // One GET in 32 is counted
+    static constexpr uint32_t HOT_MIN_SAMPLES = 32;
+    
+    explicit HotKeys(size_t capacity);
+    HotKeys(const HotKeys&) = delete;
+    HotKeys& operator=(const HotKeys&) = delete;
+    
+    size_t capacity() const { return capacity_; }
+    // Whether any key is tracked, so writers can skip hashing
+    bool active() const { return tracked_.load(std::memory_order_acquire) > 0; }
+    // Unique per instance, so a copy made for one store is never taken for another's
+    uint64_t id() const { return id_; }
+    
+    // Counts a sampled read of key; any thread, any time
+    void record(std::string_view key, uint64_t hash) {
+        thread_local uint32_t reads = 0;
+        if ((++reads & ((1u << SAMPLE_SHIFT) - 1)) == 0) {
+            sample(key, hash);
+        }
+    }
+    
+    // The slot tracking hash, or -1
+    int find(uint64_t hash) const {
+        if (hash == 0 || (filter_[filter_bit(hash) / 64].load(std::memory_order_acquire) &
+                          (uint64_t(1) << (filter_bit(hash) % 64))) == 0) {
+            return -1;
+        }
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (slots_[i].hash.load(std::memory_order_acquire) == hash) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+    
+    // A copy taken under the shard lock is valid while version(slot) still
+    // returns what was read there, and tracks(slot, hash) held after that read
+    uint64_t version(int slot) const { return slots_[slot].version.load(std::memory_order_acquire); }
+    bool tracks(int slot, uint64_t hash) const { return slots_[slot].hash.load(std::memory_order_acquire) == hash; }
+    
+    // Called by writers holding the key's shard lock exclusively, after
+    // changing or removing its value
+    void invalidate(uint64_t hash) {
+        int slot = find(hash);
+        if (slot >= 0) {
+            slots_[slot].version.fetch_add(1, std::memory_order_acq_rel);
+        }
+    }
+    
+    // Replaces the tracked keys with the top candidates and decays the
+    // sketch. Run periodically by one thread.
+    void rotate();
+    
+    struct Hot {
+        std::string key;
+        uint64_t reads; // Estimated reads, decayed by half every rotation
+    };
+    // The tracked keys, hottest first
+    std::vector<Hot> keys() const;
+
+private:
+    static constexpr size_t SKETCH_DEPTH = 4;
+    static constexpr size_t SKETCH_WIDTH = 4096;
+    static constexpr size_t FILTER_BITS = 1024;
+    static constexpr size_t CANDIDATES_PER_KEY = 4;
+    
+    struct Slot {
+        std::atomic<uint64_t> hash{0};     // 0 = unused
+        std::atomic<uint64_t> version{1};
+    };
+    struct Candidate {
+        std::string key;
+        uint64_t hash = 0;
+        uint32_t estimate = 0;
+    };
+    
+    static size_t filter_bit(uint64_t hash) { return (hash >> 20) % FILTER_BITS; }
+    void sample(std::string_view key, uint64_t hash);
+    
+    size_t capacity_;
+    uint64_t id_;
+    std::unique_ptr<std::atomic<uint32_t>[]> sketch_; // SKETCH_DEPTH rows of SKETCH_WIDTH
+    std::atomic<uint64_t> filter_[FILTER_BITS / 64];
+    std::atomic<size_t> tracked_{0};
+    Slot slots_[MAX_KEYS];
+    
+    mutable std::mutex mtx_; // Guards candidates_ and hot_; samplers only try it
+    std::vector<Candidate> candidates_;
+    std::vector<Candidate> hot_; // By slot, as of the last rotation
+};
@@ -1,8 +1,23 @@
 #include "kv_store.h"
 #include "../metrics/metrics.h"
 #include "../protocol/parser.h"
+#include "../vector/embedding.h"
+#include "wal.h"
+#include "snapshot.h"
+#include "cold_log.h"
+#include "compression.h"
+#include "dump.h"
+#include "hot_keys.h"
+#include "clock.h"
+#include "expiry_wheel.h"
+#include "flat_map.h"
+#include "slab.h"
+#include "value_ref.h"
+#include "hash.h"
 #include <unordered_map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -10,52 +25,456 @@
 #include <thread>
 #include <atomic>
 #include <chrono>
+#include <algorithm>
+#include <vector>
 #include <cerrno>
+#include <cmath>
+#include <condition_variable>
 #include <cstring>
+#include <future>
+#include <limits>
+#include <functional>
+
+// Copyable atomic for metadata that readers update under a shared lock.
+// Relaxed: a lost or stale update only nudges which key gets evicted.
+template <typename T>
+struct RelaxedAtomic {
+    std::atomic<T> v;
+    
+    RelaxedAtomic(T x = T()) : v(x) {}
+    RelaxedAtomic(const RelaxedAtomic& other) : v(other.load()) {}
+    RelaxedAtomic& operator=(const RelaxedAtomic& other) {
+        store(other.load());
+        return *this;
+    }
+    
+    T load() const { return v.load(std::memory_order_relaxed); }
+    void store(T x) { v.store(x, std::memory_order_relaxed); }
+};
+
+// Acquires a request-path shard lock, adding any time spent blocked to the
+// calling thread's RequestTrace. Uncontended, it is one try_lock and no
+// clock reads.
+template <typename Lock>
+void lock_timed(Lock& lock) {
+    RequestTrace& trace = Metrics::trace();
+    trace.locks++;
+    if (lock.try_lock()) {
+        return;
+    }
+    uint64_t start = Metrics::now_ns();
+    lock.lock();
+    trace.lock_wait_ns += Metrics::now_ns() - start;
+}
+
+// Adds the time since `start` to the calling thread's RequestTrace WAL stage
+inline void trace_wal(uint64_t start) {
+    RequestTrace& trace = Metrics::trace();
+    trace.wal_appends++;
+    trace.wal_ns += Metrics::now_ns() - start;
+}
+
+// What a value holds. VECTOR values are float32 arrays written by VSET,
+// which GET and MGET do not return.
+enum class ValueKind : uint8_t { STRING, VECTOR };
+
+// The WAL record type that stores a value of this kind and codec, and its
+// snapshot flags
+inline WalRecordType set_record_type(ValueKind kind, Codec codec) {
+    if (kind == ValueKind::VECTOR) {
+        return WalRecordType::VSET;
+    }
+    return codec == Codec::LZ4 ? WalRecordType::SET_LZ4 : WalRecordType::SET;
+}
+
+inline uint32_t snapshot_flags(ValueKind kind, Codec codec) {
+    return (kind == ValueKind::VECTOR ? SnapshotReader::VECTOR_FLAG : 0) |
+           (codec == Codec::LZ4 ? SnapshotReader::LZ4_FLAG : 0);
+}
 
 struct CacheEntry {
-    std::string value;
+    // Immutable value in the owning shard's slab; the map's reference (see
+    // Shard::put). Overwrites swap the pointer. With tiered storage the word
+    // may hold a ColdLog location instead, told apart by its low bit.
+    uintptr_t value_word = 0;
     long long expiry_at_ms = 0; // Unix timestamp in ms. 0 = permanent.
     
-    bool is_expired() const {
-        if (expiry_at_ms == 0) return false;
-        auto now = std::chrono::system_clock::now().time_since_epoch();
-        auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
-        return now_ms > expiry_at_ms;
+    // Eviction metadata, packed into the padding after expiry_at_ms. Written
+    // by readers on a hit, so it is atomic.
+    RelaxedAtomic<uint32_t> access_tick; // Last access in ACCESS_TICK_MS units (wraps)
+    RelaxedAtomic<uint8_t> lfu_counter;  // Logarithmic access frequency
+    ValueKind kind = ValueKind::STRING;  // Set with the value
+    Codec codec = Codec::NONE;           // How the value's bytes are encoded
+    ExpiryWheel::Handle wheel_item;      // The shard wheel's item, while expiry_at_ms != 0
+    
+    static constexpr long long ACCESS_TICK_MS = 10;
+    
+    bool is_cold() const { return ColdLog::is_cold(value_word); }
+    uint64_t cold_loc() const { return value_word; }
+    void set_cold(uint64_t loc) { value_word = loc; }
+    
+    // The slab value, or nullptr while the value is cold
+    StoredValue* value() const {
+        return is_cold() ? nullptr : reinterpret_cast<StoredValue*>(value_word);
+    }
+    void set_value(StoredValue* value) { value_word = reinterpret_cast<uintptr_t>(value); }
+    
+    // Kind and codec of the value a SET, VSET or SET_LZ4 record carries
+    void set_record_type(WalRecordType type) {
+        kind = type == WalRecordType::VSET ? ValueKind::VECTOR : ValueKind::STRING;
+        codec = type == WalRecordType::SET_LZ4 ? Codec::LZ4 : Codec::NONE;
+    }
+    
+    size_t value_size() const {
+        if (is_cold()) {
+            return ColdLog::value_size(value_word);
+        }
+        return value_word ? value()->size : 0;
+    }
+    
+    static uint32_t tick_at(long long now_ms) {
+        return static_cast<uint32_t>(now_ms / ACCESS_TICK_MS);
+    }
+    
+    long long idle_ms(long long now_ms) const {
+        // Unsigned difference stays correct across a wrap of the tick
+        return static_cast<long long>(static_cast<uint32_t>(tick_at(now_ms) - access_tick.load())) * ACCESS_TICK_MS;
+    }
+    
+    bool is_expired(long long now_ms = CoarseClock::now_ms()) const {
+        return expiry_at_ms != 0 && now_ms > expiry_at_ms;
     }
 };
 
-struct Shard {
-    std::unordered_map<std::string, CacheEntry> data;
-    std::mutex mtx;
+// Aligned so neighbouring shards' mutexes and counters never share a cache line
+struct alignas(64) Shard {
+    using Map = FlatMap<CacheEntry>;
+    
+    Map data;
+    ExpiryWheel expiry; // Keys with a TTL, for the active sweep
+    SlabAllocator slab; // Values of data, and keys too long to inline
+    RetiredValues retired; // Values whose last reader let go after they were replaced
+    size_t used_bytes = 0;    // Exact footprint of data's entries, see footprint()
+    size_t payload_bytes = 0; // Key and value bytes as written, before rounding
+    ColdLog* cold = nullptr;  // Tiered storage's log, which cold entries point into
+    size_t cold_keys = 0;     // Entries whose value is in the cold log
+    size_t cold_bytes = 0;    // Their value bytes
+    HotKeys* hot = nullptr;   // Told of every change to a key's value, see HotKeys::invalidate()
+    // GET/MGET, snapshots and STATS take it shared; anything that changes
+    // data, expiry, slab or the byte counts takes it exclusive
+    std::shared_mutex mtx;
+    
+    // Slot and control byte, plus the slab chunks of the value, unless it is
+    // cold, and of a key too long to inline
+    static size_t footprint(std::string_view key, size_t value_size, bool cold = false) {
+        size_t bytes = sizeof(Map::Slot) + 1;
+        if (!cold) {
+            bytes += SlabAllocator::chunk_size(StoredValue::bytes_for(value_size));
+        }
+        if (key.size() > InlineKey::INLINE_CAPACITY) {
+            bytes += SlabAllocator::chunk_size(key.size());
+        }
+        return bytes;
+    }
+    
+    // A reference to entry's value for use after the lock is released.
+    // Callers hold the lock, shared or exclusive, and entry is not cold.
+    ValueRef ref(const CacheEntry& entry) {
+        return ValueRef(entry.value(), &retired);
+    }
+    
+    // The wheel's relocate callback: points the moved item's entry at it
+    auto wheel_moved() {
+        return [this](std::string_view key, uint32_t pos) {
+            data.slot(data.find(key)).value.wheel_item.pos = pos;
+        };
+    }
+    
+    // Copies value into the slab under key; meta supplies its kind, codec,
+    // the expiry and access metadata. An overwrite swaps in a new value, except that one
+    // no reader holds and whose size maps to the same chunk is rewritten
+    // in place.
+    void put(std::string_view key, uint64_t hash, std::string_view value, const CacheEntry& meta) {
+        reclaim();
+        long long old_expiry = 0;
+        size_t i = data.find(key, hash);
+        if (i == Map::npos) {
+            i = data.insert_new(make_key(key), hash);
+            payload_bytes += key.size();
+        } else {
+            const CacheEntry& old = data.slot(i).value;
+            used_bytes -= footprint(key, old.value_size(), old.is_cold());
+            payload_bytes -= old.value_size();
+            old_expiry = old.expiry_at_ms;
+        }
+        // One wheel item per key: an unchanged expiry keeps the one it has
+        if (old_expiry != meta.expiry_at_ms) {
+            if (old_expiry != 0) {
+                expiry.cancel(data.slot(i).value.wheel_item, wheel_moved());
+            }
+            if (meta.expiry_at_ms != 0) {
+                data.slot(i).value.wheel_item = expiry.schedule(key, meta.expiry_at_ms);
+            }
+        }
+        
+        CacheEntry& entry = data.slot(i).value;
+        if (entry.is_cold()) {
+            drop_cold(key, entry);
+        }
+        StoredValue* stored = entry.value();
+        // Readers only add references under the shared lock, so with the
+        // exclusive lock held a count of one stays one
+        bool reuse = stored != nullptr && stored->refs.load(std::memory_order_acquire) == 1 &&
+                     SlabAllocator::same_chunk(StoredValue::bytes_for(stored->size), StoredValue::bytes_for(value.size()));
+        if (!reuse) {
+            if (stored != nullptr) {
+                release(stored);
+            }
+            stored = reinterpret_cast<StoredValue*>(slab.allocate(StoredValue::bytes_for(value.size())));
+            new (stored) StoredValue{{1}, 0, nullptr};
+            entry.set_value(stored);
+        }
+        std::memcpy(stored->data(), value.data(), value.size());
+        stored->size = static_cast<uint32_t>(value.size());
+        entry.expiry_at_ms = meta.expiry_at_ms;
+        entry.access_tick = meta.access_tick;
+        entry.lfu_counter = meta.lfu_counter;
+        entry.kind = meta.kind;
+        entry.codec = meta.codec;
+        
+        used_bytes += footprint(key, value.size());
+        payload_bytes += value.size();
+        if (hot) {
+            hot->invalidate(hash);
+        }
+    }
+    
+    void erase_at(size_t i) {
+        reclaim();
+        Map::Slot& slot = data.slot(i);
+        std::string_view key = slot.key();
+        if (hot && hot->active()) {
+            hot->invalidate(hash_key(key));
+        }
+        if (slot.value.expiry_at_ms != 0) {
+            expiry.cancel(slot.value.wheel_item, wheel_moved());
+        }
+        used_bytes -= footprint(key, slot.value.value_size(), slot.value.is_cold());
+        payload_bytes -= key.size() + slot.value.value_size();
+        if (slot.value.is_cold()) {
+            drop_cold(key, slot.value);
+        } else if (slot.value.value() != nullptr) {
+            release(slot.value.value());
+        }
+        if (slot.key_.is_external()) {
+            slab.deallocate(const_cast<char*>(key.data()), key.size());
+        }
+        data.erase_at(i);
+    }
+    
+    bool erase(std::string_view key, uint64_t hash) {
+        size_t i = data.find(key, hash);
+        if (i == Map::npos) {
+            return false;
+        }
+        erase_at(i);
+        return true;
+    }
+    
+    // Drops the map's reference to a value; readers still holding one retire
+    // it when they let go. Caller holds the lock exclusively.
+    void release(StoredValue* value) {
+        if (value->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            slab.deallocate(reinterpret_cast<char*>(value), StoredValue::bytes_for(value->size));
+        }
+    }
+    
+    // Tiered storage. make_cold() swaps a hot entry's value for its copy at
+    // loc in the cold log and make_hot() brings a cold one back into the
+    // slab; drop_cold() lets go of the record, leaving the entry empty.
+    // Callers hold the lock exclusively.
+    void make_cold(std::string_view key, CacheEntry& entry, uint64_t loc) {
+        size_t size = entry.value_size();
+        used_bytes -= footprint(key, size) - footprint(key, size, true);
+        release(entry.value());
+        entry.set_cold(loc);
+        cold_keys++;
+        cold_bytes += size;
+    }
+    
+    void make_hot(std::string_view key, CacheEntry& entry, std::string_view value) {
+        drop_cold(key, entry);
+        StoredValue* stored = reinterpret_cast<StoredValue*>(slab.allocate(StoredValue::bytes_for(value.size())));
+        new (stored) StoredValue{{1}, static_cast<uint32_t>(value.size()), nullptr};
+        std::memcpy(stored->data(), value.data(), value.size());
+        entry.set_value(stored);
+        used_bytes += footprint(key, value.size()) - footprint(key, value.size(), true);
+    }
+    
+    void drop_cold(std::string_view key, CacheEntry& entry) {
+        cold->release(entry.cold_loc(), key.size());
+        cold_keys--;
+        cold_bytes -= entry.value_size();
+        entry.set_value(nullptr);
+    }
+    
+    // Returns retired values to the slab. Caller holds the lock exclusively.
+    void reclaim() {
+        if (retired.empty()) {
+            return;
+        }
+        for (StoredValue* value = retired.take_all(); value != nullptr; ) {
+            StoredValue* next = value->next_retired;
+            slab.deallocate(reinterpret_cast<char*>(value), StoredValue::bytes_for(value->size));
+            value = next;
+        }
+    }
+    
+    // Short keys live in the slot; longer ones in the slab
+    InlineKey make_key(std::string_view key) {
+        if (key.size() <= InlineKey::INLINE_CAPACITY) {
+            return InlineKey(key);
+        }
+        char* bytes = slab.allocate(key.size());
+        std::memcpy(bytes, key.data(), key.size());
+        return InlineKey::external(bytes, key.size());
+    }
 };
 
 class KVStore::Impl {
 public:
-    static constexpr size_t NUM_SHARDS = 16;
-    Shard shards[NUM_SHARDS];
-    std::ofstream journal_;
-    std::mutex journal_mtx_;
+    size_t num_shards_;
+    size_t shard_mask_;
+    std::unique_ptr<Shard[]> shards;
+    StoreOptions options_;
+    std::unique_ptr<WriteAheadLog> wal_;
     std::atomic<bool> running_{true};
     std::atomic<bool> is_compacting_{false};
-    std::thread flusher_thread_;
+    std::mutex compaction_mtx_;               // With compaction_done_, for compact(true)
+    std::condition_variable compaction_done_;
+    std::atomic<bool> compaction_requested_{false};
+    std::atomic<bool> importing_{false};
+    std::atomic<bool> replicated_{false};     // A replication backlog is attached
+    std::mutex import_mtx_;
+    std::string import_path_;                 // IMPORT handed to the maintenance thread
+    std::function<void(std::string)> import_done_;
+    std::function<bool(std::string_view)> import_filter_; // Set before any import; empty = every key
+    std::thread maintenance_thread_;
+    std::thread expiry_thread_;
     std::string journal_path_;
+    std::string snapshot_path_; // Written by compaction; the WAL then holds only newer records
+    static constexpr size_t MAX_SHARDS = 4096;
     static constexpr size_t COMPACTION_THRESHOLD = 100 * 1024 * 1024;
+    static constexpr size_t COMPACTION_SLICE_SLOTS = 4096;
+    static constexpr size_t SNAPSHOT_CHUNK_BYTES = 1024 * 1024;
+    static constexpr size_t IMPORT_BATCH_KEYS = 1024;     // Records per hold of a shard lock in an import
+    static constexpr size_t SLOWLOG_DEFAULT_COUNT = 10;   // SLOWLOG GET without a count
+    // GET/MGET copy values up to this size under the shard lock and
+    // reference larger ones; a refcount round trip costs more than the copy
+    // below it
+    static constexpr size_t COPY_UNDER_LOCK_BYTES = 512;
+    // VSIM PREFIX scores vectors under a shard's shared lock, a slice of
+    // this many slots at a time
+    static constexpr size_t VSIM_SLICE_SLOTS = 256;
+    
+    // Active expiry: every EXPIRE_CYCLE_MS the sweeper walks each shard's
+    // wheel, holding a shard lock for at most EXPIRE_STEP_KEYS removals and
+    // spending at most EXPIRE_CYCLE_BUDGET_MS per cycle before yielding.
+    static constexpr int EXPIRE_CYCLE_MS = 100;
+    static constexpr long long EXPIRE_CYCLE_BUDGET_MS = 25;
+    static constexpr size_t EXPIRE_STEP_KEYS = 256;
+    
+    // maxmemory: each shard gets an equal slice of the budget and evicts
+    // locally, so no global lock or counter is touched on writes
+    size_t shard_budget_ = 0; // 0 = unlimited
+    static constexpr size_t EVICTION_SAMPLES = 5;
     
-    Impl(const std::string& filename) : journal_path_(filename) {
+    // LFU counter, as in Redis: new keys start at LFU_INIT so they are not
+    // evicted straight away, increments get rarer as the counter grows, and
+    // the counter decays by one per LFU_DECAY_MS of idle time
+    static constexpr uint8_t LFU_INIT = 5;
+    static constexpr double LFU_LOG_FACTOR = 10.0;
+    static constexpr long long LFU_DECAY_MS = 60 * 1000;
+    
+    // Tiered storage (--tier-path): the tier thread moves the idlest values
+    // of each shard over its slice of the hot budget into the cold log, in
+    // rounds of TIER_SPILL_BATCH chosen from TIER_SAMPLES sampled entries,
+    // and collects one mostly dead segment per cycle. A cold value read again
+    // within TIER_PROMOTE_MS of its last access goes back into memory.
+    std::unique_ptr<ColdLog> cold_;
+    size_t tier_budget_ = 0;
+    size_t tier_cursor_ = 0; // Shard the next cycle starts at
+    std::thread tier_thread_;
+    static constexpr int TIER_CYCLE_MS = 10;
+    static constexpr long long TIER_CYCLE_BUDGET_MS = 50;
+    static constexpr size_t TIER_SAMPLES = 32;
+    static constexpr size_t TIER_SPILL_BATCH = 8;
+    static constexpr size_t TIER_MIN_VALUE_BYTES = 64; // Smaller values free too little to be worth a read
+    static constexpr long long TIER_PROMOTE_MS = 1000;
+    // Loading spills inline, and reads stop promoting, past this many budgets
+    static constexpr size_t TIER_LOAD_SLACK = 2;
+    
+    // Hot keys (--hot-keys): every HOT_CYCLE_MS the detector picks the keys
+    // GETs hit most, and each reading thread keeps a copy of their values up
+    // to NEAR_CACHE_MAX_BYTES, served without the shard lock until a write
+    // changes the key's version. The cycle also touches each hot key, since
+    // reads served from a copy do not.
+    std::unique_ptr<HotKeys> hot_keys_;
+    std::thread hot_thread_;
+    static constexpr int HOT_CYCLE_MS = 1000;
+    static constexpr size_t NEAR_CACHE_MAX_BYTES = 64 * 1024;
+    
+    Impl(const std::string& filename, const StoreOptions& options)
+        : options_(options), journal_path_(filename),
+          snapshot_path_(std::filesystem::path(filename).replace_extension(".snap").string()) {
+        num_shards_ = 1;
+        while (num_shards_ < options_.shard_count && num_shards_ < MAX_SHARDS) {
+            num_shards_ <<= 1;
+        }
+        if (num_shards_ != options_.shard_count) {
+            std::cerr << "Warning: Shard count " << options_.shard_count
+                      << " is not a power of two in [1, " << MAX_SHARDS << "], using " << num_shards_ << std::endl;
+        }
+        shard_mask_ = num_shards_ - 1;
+        shards.reset(new Shard[num_shards_]);
+        
+        if (options_.maxmemory_bytes > 0) {
+            shard_budget_ = std::max<size_t>(1, options_.maxmemory_bytes / num_shards_);
+        }
+        
+        if (!options_.tier_path.empty()) {
+            cold_ = std::make_unique<ColdLog>(options_.tier_path);
+            if (cold_->is_open()) {
+                tier_budget_ = std::max<size_t>(1, options_.tier_memory_bytes / num_shards_);
+                for (size_t i = 0; i < num_shards_; ++i) {
+                    shards[i].cold = cold_.get();
+                }
+            } else {
+                std::cerr << "Warning: Tiered storage disabled" << std::endl;
+                cold_.reset();
+            }
+        }
+        
+        if (options_.hot_keys > 0) {
+            if (options_.hot_keys > HotKeys::MAX_KEYS) {
+                std::cerr << "Warning: At most " << HotKeys::MAX_KEYS << " hot keys are tracked" << std::endl;
+            }
+            hot_keys_ = std::make_unique<HotKeys>(options_.hot_keys);
+            for (size_t i = 0; i < num_shards_; ++i) {
+                shards[i].hot = hot_keys_.get();
+            }
+        }
+        
         std::filesystem::path file_path(filename);
         std::filesystem::path dir_path = file_path.parent_path();
         if (!dir_path.empty() && !std::filesystem::exists(dir_path)) {
             std::filesystem::create_directories(dir_path);
         }
         
-        load_from_disk(filename);
-        journal_.open(filename, std::ios::app);
-        if (!journal_.is_open()) {
-            std::cerr << "Warning: Could not open journal file: " << filename << std::endl;
-        }
+        uint64_t last_lsn = load_from_disk(filename);
+        wal_ = std::make_unique<WriteAheadLog>(filename, options_.fsync_policy, last_lsn + 1);
         
-        flusher_thread_ = std::thread([this]() {
+        maintenance_thread_ = std::thread([this]() {
             auto last_compaction_check = std::chrono::steady_clock::now();
             
             while (running_) {
@@ -63,13 +482,12 @@ public:
                 
                 if (is_compacting_) continue;
                 
-                {
-                    std::lock_guard<std::mutex> lock(journal_mtx_);
-                    if (journal_.is_open()) {
-                        journal_.flush();
-                    }
+                if (compaction_requested_.exchange(false)) {
+                    compact();
                 }
                 
+                run_import_command();
+                
                 auto now = std::chrono::steady_clock::now();
                 if (std::chrono::duration_cast<std::chrono::seconds>(now - last_compaction_check).count() >= 60) {
                     last_compaction_check = now;
@@ -83,285 +501,2848 @@ public:
                 }
             }
         });
+        
+        expiry_thread_ = std::thread([this]() {
+            while (running_) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(EXPIRE_CYCLE_MS));
+                expire_cycle();
+            }
+        });
+        
+        if (cold_) {
+            tier_thread_ = std::thread([this]() {
+                while (running_) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(TIER_CYCLE_MS));
+                    tier_cycle();
+                }
+            });
+        }
+        
+        if (hot_keys_) {
+            hot_thread_ = std::thread([this]() {
+                auto last_cycle = std::chrono::steady_clock::now();
+                while (running_) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(EXPIRE_CYCLE_MS));
+                    auto now = std::chrono::steady_clock::now();
+                    if (now - last_cycle >= std::chrono::milliseconds(HOT_CYCLE_MS)) {
+                        last_cycle = now;
+                        hot_cycle();
+                    }
+                }
+            });
+        }
     }
     
     ~Impl() {
         running_ = false;
-        if (flusher_thread_.joinable()) {
-            flusher_thread_.join();
+        if (maintenance_thread_.joinable()) {
+            maintenance_thread_.join();
+        }
+        if (import_done_) {
+            import_done_("ERROR: IMPORT cancelled, the server is shutting down\n");
+        }
+        if (expiry_thread_.joinable()) {
+            expiry_thread_.join();
+        }
+        if (tier_thread_.joinable()) {
+            tier_thread_.join();
+        }
+        if (hot_thread_.joinable()) {
+            hot_thread_.join();
         }
         
-        if (journal_.is_open()) {
-            journal_.flush();
-            journal_.close();
+        if (wal_) {
+            wal_->sync();
         }
     }
     
-    size_t get_shard_index(const std::string& key) {
-        return std::hash<std::string>{}(key) % NUM_SHARDS;
+    // FlatMap consumes the low hash bits (tag, then group index), so shards
+    // are picked from the high half to keep the two independent
+    size_t shard_for(uint64_t hash) const {
+        return (hash >> 32) & shard_mask_;
     }
     
-    void load_from_disk(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            return;
-        }
+    size_t get_shard_index(std::string_view key) const {
+        return shard_for(hash_key(key));
+    }
+    
+    static long long now_ms() {
+        return CoarseClock::now_ms();
+    }
+    
+    // One sweep over all shards. A shard whose wheel is not caught up after
+    // a step is revisited until the cycle budget runs out; the rest carries
+    // over to the next cycle.
+    void expire_cycle() {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(EXPIRE_CYCLE_BUDGET_MS);
+        size_t removed = 0;
         
-        std::string line;
-        while (std::getline(file, line)) {
-            if (line.empty()) continue;
-            
-            ParsedCommand cmd = Parser::parse(line);
-            
-            if (cmd.type == CommandType::SET) {
-                size_t idx = get_shard_index(cmd.key);
-                std::lock_guard<std::mutex> lock(shards[idx].mtx);
+        for (size_t i = 0; i < num_shards_ && running_; ++i) {
+            bool caught_up = false;
+            while (!caught_up && running_) {
+                std::lock_guard<std::shared_mutex> lock(shards[i].mtx);
+                long long now = now_ms();
+                caught_up = shards[i].expiry.advance(now, EXPIRE_STEP_KEYS, removed,
+                    [&](const std::string& key, long long) {
+                        // Items are cancelled with their key, so the entry is the one filed
+                        size_t slot = shards[i].data.find(key);
+                        if (slot == Shard::Map::npos) {
+                            return false;
+                        }
+                        shards[i].data.slot(slot).value.expiry_at_ms = 0; // Its item is already off the wheel
+                        shards[i].erase_at(slot);
+                        return true;
+                    },
+                    shards[i].wheel_moved());
                 
-                CacheEntry entry;
-                entry.value = cmd.value;
-                if (cmd.ttl_seconds > 0) {
-                    // On load, expired entries will be evicted on first access
-                    auto now = std::chrono::system_clock::now().time_since_epoch();
-                    auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
-                    entry.expiry_at_ms = now_ms + (cmd.ttl_seconds * 1000LL);
-                } else {
-                    entry.expiry_at_ms = 0;
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    break;
                 }
-                
-                shards[idx].data[cmd.key] = entry;
             }
-            else if (cmd.type == CommandType::DEL) {
-                size_t idx = get_shard_index(cmd.key);
-                std::lock_guard<std::mutex> lock(shards[idx].mtx);
-                shards[idx].data.erase(cmd.key);
+            if (std::chrono::steady_clock::now() >= deadline) {
+                break;
             }
         }
-    }
-    
-    void set(const std::string& key, const std::string& value, int ttl_seconds = 0) {
-        size_t idx = get_shard_index(key);
-        std::lock_guard<std::mutex> lock(shards[idx].mtx);
         
-        CacheEntry entry;
-        entry.value = value;
-        
-        if (ttl_seconds > 0) {
-            auto now = std::chrono::system_clock::now().time_since_epoch();
-            auto now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
-            entry.expiry_at_ms = now_ms + (ttl_seconds * 1000LL);
-        } else {
-            entry.expiry_at_ms = 0; // Permanent
+        if (removed > 0) {
+            Metrics::instance().expired_keys.add(removed);
         }
-        
-        shards[idx].data[key] = entry;
-        
-        if (journal_.is_open()) {
-            std::lock_guard<std::mutex> journal_lock(journal_mtx_);
-            journal_ << "SET " << key << " " << value;
-            if (ttl_seconds > 0) {
-                journal_ << " EX " << ttl_seconds;
+    }
+    
+    // One pass of the tier thread. Shards are visited from a rotating start
+    // so one that keeps the cycle busy does not starve the others.
+    void tier_cycle() {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TIER_CYCLE_BUDGET_MS);
+        size_t start = tier_cursor_++;
+        for (size_t n = 0; n < num_shards_ && running_; ++n) {
+            Shard& shard = shards[(start + n) & shard_mask_];
+            while (running_ && spill(shard) > 0 && std::chrono::steady_clock::now() < deadline) {
             }
-            journal_ << "\n";
         }
+        collect_garbage();
     }
     
-    std::string get(const std::string& key) {
-        auto start = std::chrono::high_resolution_clock::now();
-        
-        size_t idx = get_shard_index(key);
-        std::lock_guard<std::mutex> lock(shards[idx].mtx);
-        
-        Metrics::instance().total_requests++;
-        
-        auto it = shards[idx].data.find(key);
-        if (it == shards[idx].data.end()) {
-            Metrics::instance().cache_misses++;
-            
-            auto end = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-            Metrics::instance().record_latency(duration.count());
-            
-            return "(nil)";
+    // Moves up to TIER_SPILL_BATCH of the shard's idlest hot values into the
+    // cold log while it is over its hot budget. The candidates are sampled
+    // and referenced under the shared lock, appended with no lock held, and
+    // swapped in under the exclusive lock only where the entry still holds
+    // the sampled value; the reference keeps that value from being reused in
+    // place meanwhile. Returns how many moved.
+    size_t spill(Shard& shard) {
+        struct Candidate {
+            std::string key;
+            StoredValue* value;
+            ValueRef ref;
+            uint64_t loc;
+        };
+        thread_local std::vector<std::pair<long long, size_t>> sampled; // (score, slot)
+        thread_local std::vector<Candidate> picked;
+        sampled.clear();
+        picked.clear();
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            auto& data = shard.data;
+            if (shard.used_bytes <= tier_budget_ || data.empty()) {
+                return 0;
+            }
+            long long now = now_ms();
+            size_t capacity = data.capacity();
+            size_t i = random_u64() & (capacity - 1);
+            size_t seen = 0;
+            for (size_t probe = 0; probe < capacity && seen < TIER_SAMPLES; ++probe, i = (i + 1) & (capacity - 1)) {
+                if (!data.is_full(i)) {
+                    continue;
+                }
+                seen++;
+                const CacheEntry& entry = data.slot(i).value;
+                size_t size = entry.value_size();
+                if (entry.is_cold() || size < TIER_MIN_VALUE_BYTES || !ColdLog::fits(size) || entry.is_expired(now)) {
+                    continue;
+                }
+                // Higher score = colder, as in evict_one()
+                long long score = entry.idle_ms(now);
+                if (options_.eviction_policy == EvictionPolicy::ALLKEYS_LFU) {
+                    score += (255 - decayed_lfu(entry, now)) * (1LL << 40);
+                }
+                sampled.emplace_back(score, i);
+            }
+            size_t keep = std::min(sampled.size(), TIER_SPILL_BATCH);
+            std::partial_sort(sampled.begin(), sampled.begin() + keep, sampled.end(),
+                              [](const auto& a, const auto& b) { return a.first > b.first; });
+            for (size_t k = 0; k < keep; ++k) {
+                const auto& slot = data.slot(sampled[k].second);
+                picked.push_back({std::string(slot.key()), slot.value.value(), shard.ref(slot.value), 0});
+            }
         }
-        
-        // TTL Eviction Logic for Inference Results
-        if (it->second.is_expired()) {
-            shards[idx].data.erase(it); // Lazy eviction
-            Metrics::instance().cache_misses++;
-            
-            auto end = std::chrono::high_resolution_clock::now();
-            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-            Metrics::instance().record_latency(duration.count());
-            
-            return "(nil)";
+        if (picked.empty()) {
+            return 0;
         }
         
-        Metrics::instance().cache_hits++;
-        
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        Metrics::instance().record_latency(duration.count());
-        
-        return it->second.value;
-    }
-    
-    std::vector<std::string> mget(const std::vector<std::string>& keys) {
-        auto start = std::chrono::high_resolution_clock::now();
-        
-        std::vector<std::string> results;
-        results.reserve(keys.size());
-        
-        // Group keys by shard to minimize lock acquisitions, but preserve order
-        std::unordered_map<size_t, std::vector<size_t>> shard_to_indices;
-        std::vector<size_t> shard_order;
-        
-        for (size_t i = 0; i < keys.size(); ++i) {
-            size_t idx = get_shard_index(keys[i]);
-            if (shard_to_indices.find(idx) == shard_to_indices.end()) {
-                shard_order.push_back(idx);
+        for (Candidate& c : picked) {
+            c.loc = cold_->append(c.key, c.ref.view());
+            if (c.loc == 0) {
+                break; // The log is full or failing; the rest stay hot
             }
-            shard_to_indices[idx].push_back(i);
         }
         
-        // Pre-allocate results
-        results.resize(keys.size());
-        
-        // Process each shard group (in order of first appearance)
-        for (size_t shard_idx : shard_order) {
-            std::lock_guard<std::mutex> lock(shards[shard_idx].mtx);
-            
-            for (size_t key_idx : shard_to_indices[shard_idx]) {
-                const auto& key = keys[key_idx];
-                auto it = shards[shard_idx].data.find(key);
-                if (it == shards[shard_idx].data.end()) {
-                    results[key_idx] = "(nil)";
-                } else if (it->second.is_expired()) {
-                    shards[shard_idx].data.erase(it);
-                    results[key_idx] = "(nil)";
+        size_t moved = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            for (Candidate& c : picked) {
+                if (c.loc == 0) {
+                    break;
+                }
+                size_t slot = shard.data.find(c.key);
+                if (slot != Shard::Map::npos && shard.data.slot(slot).value.value() == c.value) {
+                    shard.make_cold(c.key, shard.data.slot(slot).value, c.loc);
+                    moved++;
                 } else {
-                    results[key_idx] = it->second.value;
+                    cold_->release(c.loc, c.key.size()); // Overwritten or erased meanwhile
                 }
             }
+            // Drop the references while the lock is held so the values just
+            // moved go straight back to the slab
+            for (Candidate& c : picked) {
+                c.ref.reset();
+            }
+            shard.reclaim();
         }
-        
-        // Record latency for MGET
-        auto end = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-        Metrics::instance().record_latency(duration.count());
-        
-        return results;
+        picked.clear();
+        if (moved > 0) {
+            Metrics::instance().cold_spills.add(moved);
+        }
+        return moved;
     }
     
-    bool del(const std::string& key) {
-        size_t idx = get_shard_index(key);
-        std::lock_guard<std::mutex> lock(shards[idx].mtx);
-        bool existed = shards[idx].data.erase(key) > 0;
-        
-        if (journal_.is_open() && existed) {
-            std::lock_guard<std::mutex> journal_lock(journal_mtx_);
-            journal_ << "DEL " << key << "\n";
+    // Spills a shard that loading pushed past TIER_LOAD_SLACK budgets back
+    // under its budget, so a data set larger than the hot budget can load
+    void relieve(Shard& shard) {
+        while (spill(shard) > 0) {
         }
-        
-        return existed;
     }
     
-    void compact() {
-        is_compacting_ = true;
-        
-        std::string temp_filename = journal_path_ + ".tmp";
-        
-        {
-            std::ofstream temp_journal(temp_filename, std::ios::trunc);
-            if (!temp_journal.is_open()) {
-                std::cerr << "Warning: Could not open temp file for compaction" << std::endl;
-                is_compacting_ = false;
+    bool over_load_slack(const Shard& shard) const {
+        return tier_budget_ > 0 && shard.used_bytes > tier_budget_ * TIER_LOAD_SLACK;
+    }
+    
+    // Copies the live records of one mostly dead segment to the head of the
+    // cold log and deletes it. A record is live while its key's entry holds
+    // its location; each copy is swapped in under the exclusive lock only if
+    // that is still so.
+    void collect_garbage() {
+        long segment = cold_->pick_garbage();
+        if (segment < 0) {
+            return;
+        }
+        bool copied_all = true;
+        bool ok = cold_->scan(static_cast<uint32_t>(segment), [&](uint64_t loc, std::string_view key, std::string_view value) {
+            if (!running_ || !copied_all) {
+                copied_all = false;
                 return;
             }
-            
-            for (size_t i = 0; i < NUM_SHARDS; ++i) {
-                std::lock_guard<std::mutex> lock(shards[i].mtx);
-                
-                for (const auto& [key, entry] : shards[i].data) {
-                    if (!entry.is_expired()) {
-                        temp_journal << "SET " << key << " " << entry.value << "\n";
-                    }
+            uint64_t hash = hash_key(key);
+            Shard& shard = shards[shard_for(hash)];
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                size_t slot = shard.data.find(key, hash);
+                if (slot == Shard::Map::npos || shard.data.slot(slot).value.value_word != loc) {
+                    return;
                 }
             }
-            
-            temp_journal.close();
-        }
-        
-        {
-            std::lock_guard<std::mutex> lock(journal_mtx_);
-            
-            if (journal_.is_open()) {
-                journal_.close();
+            uint64_t fresh = cold_->append(key, value);
+            if (fresh == 0) {
+                copied_all = false;
+                return;
             }
-            
-            if (std::rename(temp_filename.c_str(), journal_path_.c_str()) != 0) {
-                std::cerr << "Warning: Failed to rename temp journal during compaction: " << strerror(errno) << std::endl;
+            std::unique_lock<std::shared_mutex> lock(shard.mtx);
+            size_t slot = shard.data.find(key, hash);
+            if (slot != Shard::Map::npos && shard.data.slot(slot).value.value_word == loc) {
+                shard.data.slot(slot).value.set_cold(fresh);
+                cold_->release(loc, key.size());
+            } else {
+                cold_->release(fresh, key.size());
             }
-            
-            journal_.open(journal_path_, std::ios::app);
-            if (!journal_.is_open()) {
-                std::cerr << "Warning: Could not reopen journal after compaction" << std::endl;
+        });
+        // drop() refuses while a record is still live, e.g. one appended
+        // just before the head rolled whose entry was swapped in after the
+        // scan passed it; the segment is then picked again later
+        if (ok && copied_all) {
+            cold_->drop(static_cast<uint32_t>(segment));
+        }
+    }
+    
+    // Appends a cold value, read after the shard lock was released, to out.
+    // With promote set, and the entry still pointing at loc, the value goes
+    // back into the slab; the tier thread then spills something idler if the
+    // shard is over budget. A shard the tier thread has fallen far behind on
+    // is not promoted into. False if the record could not be read.
+    bool read_cold(std::string_view key, uint64_t hash, uint64_t loc, const ColdLog::Handle& segment,
+                   bool promote, std::string& out) {
+        Metrics& metrics = Metrics::instance();
+        size_t start = out.size();
+        if (!cold_->read(loc, segment, out)) {
+            metrics.cold_read_errors.add();
+            static std::atomic<bool> warned{false};
+            if (!warned.exchange(true)) {
+                std::cerr << "Warning: Read from the cold log failed; the key is reported missing and "
+                          << "later failures are only counted in STATS" << std::endl;
             }
+            return false;
         }
-        
-        is_compacting_ = false;
+        metrics.cold_reads.add();
+        if (promote) {
+            Shard& shard = shards[shard_for(hash)];
+            std::unique_lock<std::shared_mutex> lock(shard.mtx, std::defer_lock);
+            lock_timed(lock);
+            size_t slot = shard.data.find(key, hash);
+            if (slot != Shard::Map::npos && shard.data.slot(slot).value.value_word == loc && !over_load_slack(shard)) {
+                shard.make_hot(key, shard.data.slot(slot).value, std::string_view(out).substr(start));
+                metrics.cold_promotions.add();
+            }
+        }
+        return true;
     }
-};
-
-KVStore::KVStore(const std::string& filename) : filename_(filename), impl_(new Impl(filename)) {}
-
-KVStore::~KVStore() {
-    delete impl_;
-}
-
-void KVStore::compact() {
-    impl_->compact();
-}
-
-std::vector<std::string> KVStore::mget(const std::vector<std::string>& keys) {
-    return impl_->mget(keys);
-}
-
-std::string KVStore::execute(const ParsedCommand& cmd) {
-    if (!cmd.valid) {
-        return "ERROR: Unknown command\n";
+    
+    // Appends value's LZ4 frame to out if compression is on, the value is at
+    // least compress_min_bytes and it shrinks by an eighth. Runs before any
+    // shard lock is taken.
+    bool compress(std::string_view value, std::string& out) {
+        if (options_.compress_min_bytes == 0 || value.size() < options_.compress_min_bytes) {
+            return false;
+        }
+        Metrics& metrics = Metrics::instance();
+        uint64_t start = Metrics::now_ns();
+        size_t before = out.size();
+        bool packed = compress_value(value, out);
+        metrics.compress_ns.add(Metrics::now_ns() - start);
+        if (!packed) {
+            metrics.incompressible_writes.add();
+            return false;
+        }
+        metrics.compressed_writes.add();
+        metrics.compress_in_bytes.add(value.size());
+        metrics.compress_out_bytes.add(out.size() - before);
+        return true;
     }
     
-    switch (cmd.type) {
-        case CommandType::SET:
-            impl_->set(cmd.key, cmd.value, cmd.ttl_seconds);
-            return "OK\n";
-            
-        case CommandType::GET:
-            return impl_->get(cmd.key) + "\n";
-            
-        case CommandType::MGET: {
-            auto results = impl_->mget(cmd.keys);
-            std::string response;
-            for (size_t i = 0; i < results.size(); ++i) {
-                if (i > 0) response += " ";
-                response += results[i];
+    // Appends the value held in an LZ4 frame to out, after the shard lock
+    // was released. False, and the key reported missing, on a damaged frame.
+    bool decompress(std::string_view frame, std::string& out) {
+        Metrics& metrics = Metrics::instance();
+        uint64_t start = Metrics::now_ns();
+        bool ok = decompress_value(frame, out);
+        metrics.decompress_ns.add(Metrics::now_ns() - start);
+        metrics.decompressions.add();
+        if (!ok) {
+            metrics.decompress_errors.add();
+            static std::atomic<bool> warned{false};
+            if (!warned.exchange(true)) {
+                std::cerr << "Warning: A compressed value failed to decode; the key is reported missing and "
+                          << "later failures are only counted in STATS" << std::endl;
             }
-            return response + "\n";
         }
-            
-        case CommandType::DEL:
-            impl_->del(cmd.key);
-            return "OK\n";
-            
-        case CommandType::COMPACT:
-            impl_->compact();
-            return "OK\n";
-            
-        case CommandType::STATS:
-            return Metrics::instance().to_json() + "\n";
-            
-        default:
-            return "ERROR: Unknown command\n";
+        return ok;
     }
-}
-
+    
+    // Loads the snapshot, then replays the WAL records newer than it.
+    // Returns the highest LSN found so new records continue the sequence.
+    uint64_t load_from_disk(const std::string& filename) {
+        uint64_t snapshot_lsn = load_snapshot();
+        if (!std::filesystem::exists(filename) || std::filesystem::file_size(filename) == 0) {
+            return snapshot_lsn;
+        }
+        
+        if (!WriteAheadLog::has_header(filename)) {
+            // Pre-binary text journal: replay it, then rewrite it in the
+            // binary format before the WAL is opened for appends
+            load_legacy_journal(filename);
+            write_compacted_log(filename + ".tmp");
+            if (std::rename((filename + ".tmp").c_str(), filename.c_str()) != 0) {
+                std::cerr << "Warning: Failed to convert legacy journal: " << strerror(errno) << std::endl;
+            }
+            return 0;
+        }
+        
+        long long load_time_ms = now_ms();
+        size_t threads = std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 4;
+        }
+        
+        // Lanes are shards: each shard is rebuilt by one thread in log order
+        WalReplayResult result = WriteAheadLog::replay_parallel(
+            filename, threads, num_shards_,
+            [this](std::string_view key) { return get_shard_index(key); },
+            [&](const WalRecord& rec) {
+                // Older records are already in the snapshot, or were
+                // superseded before it was taken
+                if (rec.lsn <= snapshot_lsn) {
+                    return;
+                }
+                uint64_t hash = hash_key(rec.key);
+                size_t idx = shard_for(hash);
+                bool over;
+                {
+                    std::lock_guard<std::shared_mutex> lock(shards[idx].mtx);
+                    
+                    if (rec.type == WalRecordType::DEL ||
+                        (rec.expiry_at_ms != 0 && rec.expiry_at_ms <= load_time_ms)) {
+                        shards[idx].erase(rec.key, hash);
+                        return;
+                    }
+                    
+                    CacheEntry meta;
+                    meta.expiry_at_ms = rec.expiry_at_ms;
+                    meta.set_record_type(rec.type);
+                    init_access(meta, load_time_ms);
+                    shards[idx].put(rec.key, hash, rec.value, meta);
+                    over = over_load_slack(shards[idx]);
+                }
+                if (over) {
+                    relieve(shards[idx]);
+                }
+            });
+        
+        if (result.corrupt_tail) {
+            // Drop the torn tail so new appends are not hidden behind it
+            std::cerr << "Warning: Journal has a torn or corrupt tail after " << result.records
+                      << " records, truncating to " << result.valid_bytes << " bytes" << std::endl;
+            std::filesystem::resize_file(filename, result.valid_bytes);
+        }
+        return std::max(result.last_lsn, snapshot_lsn);
+    }
+    
+    // Bulk-builds the shards from the memory-mapped snapshot, one section
+    // per thread at a time. With the shard count it was written with, each
+    // section fills one shard, whose table is sized once up front. Returns
+    // the snapshot's LSN, or 0 without a usable snapshot.
+    uint64_t load_snapshot() {
+        if (!std::filesystem::exists(snapshot_path_)) {
+            return 0;
+        }
+        SnapshotReader reader(snapshot_path_);
+        if (!reader.valid()) {
+            // Kept for inspection; the next compaction would overwrite it
+            std::string kept = snapshot_path_ + ".corrupt";
+            std::cerr << "Warning: Snapshot unusable, moved to " << kept
+                      << "; only the WAL tail is loaded" << std::endl;
+            std::rename(snapshot_path_.c_str(), kept.c_str());
+            return 0;
+        }
+        
+        auto start = std::chrono::steady_clock::now();
+        long long load_time_ms = now_ms();
+        bool same_layout = reader.sections() == num_shards_;
+        std::atomic<size_t> next_section{0};
+        std::atomic<size_t> loaded{0};
+        
+        auto worker = [&]() {
+            size_t section;
+            while ((section = next_section.fetch_add(1)) < reader.sections()) {
+                if (same_layout) {
+                    std::lock_guard<std::shared_mutex> lock(shards[section].mtx);
+                    shards[section].data.reserve(reader.entries(section));
+                }
+                size_t count = 0;
+                bool ok = reader.for_each(section, [&](std::string_view key, std::string_view value,
+                                                       long long expiry_at_ms, uint32_t flags) {
+                    if (expiry_at_ms != 0 && expiry_at_ms <= load_time_ms) {
+                        return;
+                    }
+                    uint64_t hash = hash_key(key);
+                    size_t idx = shard_for(hash);
+                    bool over;
+                    {
+                        std::lock_guard<std::shared_mutex> lock(shards[idx].mtx);
+                        CacheEntry meta;
+                        meta.expiry_at_ms = expiry_at_ms;
+                        meta.kind = (flags & SnapshotReader::VECTOR_FLAG) ? ValueKind::VECTOR : ValueKind::STRING;
+                        meta.codec = (flags & SnapshotReader::LZ4_FLAG) ? Codec::LZ4 : Codec::NONE;
+                        init_access(meta, load_time_ms);
+                        shards[idx].put(key, hash, value, meta);
+                        over = over_load_slack(shards[idx]);
+                    }
+                    if (over) {
+                        relieve(shards[idx]);
+                    }
+                    count++;
+                });
+                if (!ok) {
+                    std::cerr << "Warning: Snapshot section " << section << " is corrupt; "
+                              << reader.entries(section) - count << " of its keys were not loaded" << std::endl;
+                }
+                loaded += count;
+            }
+        };
+        
+        size_t threads = std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 4;
+        }
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < std::min(threads, reader.sections()); ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& t : pool) {
+            t.join();
+        }
+        
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded " << loaded.load() << " keys from snapshot at LSN " << reader.lsn()
+                  << " in " << ms << "ms" << std::endl;
+        return reader.lsn();
+    }
+    
+    void load_legacy_journal(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file.is_open()) {
+            return;
+        }
+        
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty()) continue;
+            
+            ParsedCommand cmd = Parser::parse(line);
+            
+            if (cmd.type == CommandType::SET) {
+                uint64_t hash = hash_key(cmd.key);
+                size_t idx = shard_for(hash);
+                std::lock_guard<std::shared_mutex> lock(shards[idx].mtx);
+                
+                CacheEntry meta;
+                // Legacy records only kept the relative TTL
+                meta.expiry_at_ms = cmd.ttl_seconds > 0 ? now_ms() + (cmd.ttl_seconds * 1000LL) : 0;
+                init_access(meta, now_ms());
+                shards[idx].put(cmd.key, hash, cmd.value, meta);
+            }
+            else if (cmd.type == CommandType::DEL) {
+                uint64_t hash = hash_key(cmd.key);
+                size_t idx = shard_for(hash);
+                std::lock_guard<std::shared_mutex> lock(shards[idx].mtx);
+                shards[idx].erase(cmd.key, hash);
+            }
+        }
+    }
+    
+    // Bulk import (IMPORT, --import) of a dump file, bypassing the command
+    // path. Chunks of the file are decoded in parallel and their records
+    // bucketed by shard; then the shards are filled in parallel, each table
+    // reserved once for what it receives and locked once per
+    // IMPORT_BATCH_KEYS records, compressing outside the lock. No record is
+    // logged: one compaction afterwards writes every key to a snapshot.
+    // Within a shard the chunks are applied in file order, so the last
+    // occurrence of a key wins. Since nothing reaches the backlog either, an
+    // import is refused once replication is on.
+    KVStore::ImportResult import_file(const std::string& path) {
+        KVStore::ImportResult result;
+        bool expected = false;
+        if (!importing_.compare_exchange_strong(expected, true)) {
+            result.error = "IMPORT already running";
+            return result;
+        }
+        run_import(path, result);
+        importing_ = false;
+        return result;
+    }
+    
+    void run_import(const std::string& path, KVStore::ImportResult& result) {
+        auto start = std::chrono::steady_clock::now();
+        if (wal_->failed()) {
+            result.error = "the journal has failed, writes are refused until a restart";
+        } else if (replicated_) {
+            result.error = "IMPORT is refused while replication is on, replicas would not see the keys; "
+                           "use --import at startup";
+        } else {
+            load_dump(path, result);
+        }
+        if (result.error.empty() && result.imported > 0 && !compact(true)) {
+            result.error = "keys were loaded but the snapshot holding them could not be written; "
+                           "they are not durable until a later compaction succeeds";
+        }
+        result.ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    
+    void import_command(std::string_view file, std::function<void(std::string)> done) {
+        // Only files in the operator's import directory
+        if (options_.import_dir.empty()) {
+            done("ERROR: IMPORT is disabled, start the server with --import-dir\n");
+            return;
+        }
+        if (read_only_) {
+            done("ERROR: READONLY replica, send writes to the primary\n");
+            return;
+        }
+        std::string name(file);
+        if (name.find('/') != std::string::npos || name == "." || name == "..") {
+            done("ERROR: IMPORT takes a file name in the import directory\n");
+            return;
+        }
+        bool expected = false;
+        if (!importing_.compare_exchange_strong(expected, true)) {
+            done("ERROR: IMPORT already running\n");
+            return;
+        }
+        std::lock_guard<std::mutex> lock(import_mtx_);
+        import_path_ = options_.import_dir + "/" + name;
+        import_done_ = std::move(done);
+    }
+    
+    // On the maintenance thread: the IMPORT import_command() handed over, if any
+    void run_import_command() {
+        std::string path;
+        std::function<void(std::string)> done;
+        {
+            std::lock_guard<std::mutex> lock(import_mtx_);
+            if (!import_done_) {
+                return;
+            }
+            path.swap(import_path_);
+            done.swap(import_done_);
+        }
+        KVStore::ImportResult result;
+        run_import(path, result);
+        importing_ = false;
+        done(result.error.empty() ? import_json(result) + "\n" : "ERROR: " + result.error + "\n");
+    }
+    
+    // A record is loaded if it has a key the filter accepts, is not expired
+    // and, if a vector, holds 1 to MAX_VECTOR_DIMS floats
+    bool importable(const DumpFile::Record& rec, long long now) const {
+        if (rec.key.empty() || (rec.expiry_at_ms != 0 && rec.expiry_at_ms <= now)) {
+            return false;
+        }
+        if (rec.flags & SnapshotReader::VECTOR_FLAG) {
+            size_t dims = rec.value.size() / sizeof(float);
+            if ((rec.flags & SnapshotReader::LZ4_FLAG) || rec.value.size() % sizeof(float) != 0 ||
+                dims == 0 || dims > MAX_VECTOR_DIMS) {
+                return false;
+            }
+        }
+        return !import_filter_ || import_filter_(rec.key);
+    }
+    
+    void load_dump(const std::string& path, KVStore::ImportResult& result) {
+        DumpFile dump(path);
+        if (!dump.error().empty()) {
+            result.error = dump.error();
+            return;
+        }
+        size_t threads = std::thread::hardware_concurrency();
+        if (threads == 0) {
+            threads = 4;
+        }
+        std::vector<std::pair<size_t, size_t>> chunks = dump.chunks(threads);
+        long long now = now_ms();
+        
+        // Phase 1, by chunk: where each loadable record is, and its hash
+        struct Item {
+            size_t offset;
+            uint64_t hash;
+        };
+        std::vector<std::vector<std::vector<Item>>> buckets(chunks.size(), std::vector<std::vector<Item>>(num_shards_));
+        std::atomic<size_t> skipped{0};
+        parallel_for(chunks.size(), threads, [&](size_t c) {
+            DumpFile::Record rec;
+            size_t bad = 0;
+            for (size_t pos = chunks[c].first; pos < chunks[c].second;) {
+                size_t at = pos;
+                pos = dump.decode(pos, rec);
+                if (!importable(rec, now)) {
+                    bad++;
+                    continue;
+                }
+                uint64_t hash = hash_key(rec.key);
+                buckets[c][shard_for(hash)].push_back({at, hash});
+            }
+            skipped += bad;
+        });
+        
+        // Phase 2, by shard
+        std::atomic<size_t> imported{0};
+        std::atomic<size_t> refused{0};
+        parallel_for(num_shards_, threads, [&](size_t s) {
+            Shard& shard = shards[s];
+            size_t incoming = 0;
+            for (const auto& chunk : buckets) {
+                incoming += chunk[s].size();
+            }
+            if (incoming == 0) {
+                return;
+            }
+            {
+                std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                shard.data.reserve(shard.data.size() + incoming);
+            }
+            
+            struct Pending {
+                DumpFile::Record rec;
+                uint64_t hash;
+                size_t packed_start;
+                size_t packed_size; // 0 = store rec.value as it is
+            };
+            std::vector<Pending> batch;
+            std::string packed;
+            WalBatch log;
+            size_t loaded = 0;
+            size_t rejected = 0;
+            for (auto& chunk : buckets) {
+                const std::vector<Item>& items = chunk[s];
+                for (size_t begin = 0; begin < items.size(); begin += IMPORT_BATCH_KEYS) {
+                    size_t end = std::min(items.size(), begin + IMPORT_BATCH_KEYS);
+                    batch.clear();
+                    packed.clear();
+                    for (size_t i = begin; i < end; ++i) {
+                        Pending& p = batch.emplace_back();
+                        dump.decode(items[i].offset, p.rec);
+                        p.hash = items[i].hash;
+                        p.packed_start = packed.size();
+                        p.packed_size = 0;
+                        if (p.rec.flags == 0 && compress(p.rec.value, packed)) {
+                            p.packed_size = packed.size() - p.packed_start;
+                        }
+                    }
+                    
+                    bool over;
+                    {
+                        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                        long long load_time_ms = now_ms();
+                        for (const Pending& p : batch) {
+                            std::string_view value = p.rec.value;
+                            if (p.packed_size > 0) {
+                                value = std::string_view(packed).substr(p.packed_start, p.packed_size);
+                            }
+                            if (shard_budget_ > 0 && options_.eviction_policy == EvictionPolicy::NOEVICTION &&
+                                shard.used_bytes + Shard::footprint(p.rec.key, value.size()) > shard_budget_) {
+                                Metrics::instance().rejected_writes.add();
+                                rejected++;
+                                continue;
+                            }
+                            CacheEntry meta;
+                            meta.expiry_at_ms = p.rec.expiry_at_ms;
+                            meta.kind = (p.rec.flags & SnapshotReader::VECTOR_FLAG) ? ValueKind::VECTOR : ValueKind::STRING;
+                            meta.codec = p.packed_size > 0 || (p.rec.flags & SnapshotReader::LZ4_FLAG) ? Codec::LZ4 : Codec::NONE;
+                            init_access(meta, load_time_ms);
+                            shard.put(p.rec.key, p.hash, value, meta);
+                            loaded++;
+                            if (shard_budget_ > 0) {
+                                enforce_budget(shard, p.rec.key, load_time_ms, log);
+                            }
+                        }
+                        // Evictions of keys that were there before the import
+                        if (!log.empty()) {
+                            wal_->append_batch(log);
+                            log.clear();
+                        }
+                        over = over_load_slack(shard);
+                    }
+                    if (over) {
+                        relieve(shard);
+                    }
+                }
+            }
+            imported += loaded;
+            refused += rejected;
+        });
+        
+        result.imported = imported;
+        result.skipped = skipped;
+        result.refused = refused;
+    }
+    
+    // Runs fn(0..count-1) on up to threads threads, the calling one included
+    void parallel_for(size_t count, size_t threads, const std::function<void(size_t)>& fn) {
+        std::atomic<size_t> next{0};
+        auto worker = [&]() {
+            size_t i;
+            while ((i = next.fetch_add(1)) < count) {
+                fn(i);
+            }
+        };
+        std::vector<std::thread> pool;
+        for (size_t i = 1; i < std::min(threads, count); ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& t : pool) {
+            t.join();
+        }
+    }
+    
+    // OOM when the write was refused under the noeviction policy, IO_ERROR
+    // once the WAL has failed. A string value is compressed, if it
+    // qualifies, before the lock is taken.
+    WriteStatus set(std::string_view key, std::string_view value, int ttl_seconds = 0,
+                    ValueKind kind = ValueKind::STRING) {
+        if (wal_->failed()) {
+            return WriteStatus::IO_ERROR;
+        }
+        uint64_t hash = hash_key(key);
+        Shard& shard = shards[shard_for(hash)];
+        thread_local WalBatch log;
+        thread_local std::string packed;
+        log.clear();
+        packed.clear();
+        Codec codec = Codec::NONE;
+        if (kind == ValueKind::STRING && compress(value, packed)) {
+            value = packed;
+            codec = Codec::LZ4;
+        }
+        uint64_t lsn;
+        uint64_t wal_start;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mtx, std::defer_lock);
+            lock_timed(lock);
+            if (!apply_set(shard, key, hash, value, ttl_seconds, now_ms(), log, kind, codec)) {
+                return WriteStatus::OOM;
+            }
+            
+            // Appended under the shard lock so records for one key reach the
+            // log in the order they were applied
+            wal_start = Metrics::now_ns();
+            lsn = wal_->append_batch(log);
+        }
+        
+        WriteStatus status = logged(lsn, options_.fsync_policy == FsyncPolicy::ALWAYS);
+        trace_wal(wal_start);
+        return status;
+    }
+    
+    // The outcome of a write appended as lsn (0 if it logged nothing):
+    // IO_ERROR if the WAL failed before taking it or, with wait set, before
+    // making it durable
+    WriteStatus logged(uint64_t lsn, bool wait) {
+        bool ok = wait ? wal_->wait_durable(lsn) : !(lsn == 0 && wal_->failed());
+        return ok ? WriteStatus::OK : WriteStatus::IO_ERROR;
+    }
+    
+    // Applies one SET to a shard the caller holds exclusively and queues its
+    // WAL record, followed by DELs for anything it evicted. value is stored
+    // as given, already encoded with codec.
+    bool apply_set(Shard& shard, std::string_view key, uint64_t hash, std::string_view value,
+                   int ttl_seconds, long long now, WalBatch& log, ValueKind kind = ValueKind::STRING,
+                   Codec codec = Codec::NONE) {
+        CacheEntry meta;
+        meta.expiry_at_ms = ttl_seconds > 0 ? now + (ttl_seconds * 1000LL) : 0;
+        meta.kind = kind;
+        meta.codec = codec;
+        init_access(meta, now);
+        
+        if (shard_budget_ > 0 && options_.eviction_policy == EvictionPolicy::NOEVICTION &&
+            shard.used_bytes + Shard::footprint(key, value.size()) > shard_budget_) {
+            Metrics::instance().rejected_writes.add();
+            return false;
+        }
+        shard.put(key, hash, value, meta);
+        log.add(set_record_type(kind, codec), key, value, meta.expiry_at_ms);
+        
+        if (shard_budget_ > 0) {
+            enforce_budget(shard, key, now, log);
+        }
+        return true;
+    }
+    
+    // Bulk write path for the WriteBatcher, MSET and multi-key DEL. The keys
+    // of every op are grouped by shard; every touched shard is locked once,
+    // in ascending index order (MGET is the only other path holding several,
+    // shared and in the same order, so this cannot deadlock), and all records
+    // reach the WAL in one append while the locks are still held. Per-key
+    // order is the order of ops and, within an op, of its keys. An op with
+    // several keys is applied whole or not at all (noeviction checks its
+    // total footprint up front) and logged as one MULTI record. Returns the
+    // last LSN; status, if given, gets each op's outcome.
+    template <typename Command>
+    uint64_t apply_writes(const Command* ops, size_t count, WriteStatus* status = nullptr) {
+        struct Write {
+            size_t shard;
+            size_t op;
+            size_t item; // Index within the op's keys
+            uint64_t hash;
+            size_t packed_size; // Bytes of its LZ4 frame in `packed`, 0 if stored as is
+            size_t packed;
+            size_t footprint;   // Shard::footprint() of what it stores, 0 for a DEL
+        };
+        thread_local std::vector<Write> order;
+        thread_local std::vector<Write> by_op;       // order before sorting, for the budget check
+        thread_local WalBatch log;
+        thread_local std::vector<WalBatch> op_logs;  // Records by op when some op has several keys
+        thread_local std::vector<size_t> reserved;   // Bytes admitted so far by shard
+        thread_local std::vector<char> refused;      // By op
+        thread_local std::vector<std::string> vectors; // VSET values by op, encoded before locking
+        thread_local std::string packed;               // Frames of the values compressed before locking
+        order.clear();
+        log.clear();
+        packed.clear();
+        if (status) {
+            std::fill(status, status + count, wal_->failed() ? WriteStatus::IO_ERROR : WriteStatus::OK);
+        }
+        if (wal_->failed()) {
+            return 0;
+        }
+        
+        bool grouped = false;
+        for (size_t op = 0; op < count; ++op) {
+            if (!ops[op].valid) {
+                continue;
+            }
+            if (ops[op].type == CommandType::VSET) {
+                vectors.resize(std::max(vectors.size(), count));
+                if (!encode_vector(ops[op], vectors[op])) {
+                    if (status) {
+                        status[op] = WriteStatus::BAD_VECTOR;
+                    }
+                    continue;
+                }
+            }
+            size_t n = write_count(ops[op]);
+            grouped = grouped || n > 1;
+            for (size_t item = 0; item < n; ++item) {
+                const auto& key = write_key(ops[op], item);
+                uint64_t hash = hash_key(key);
+                size_t start = packed.size();
+                size_t packed_size = 0;
+                size_t stored = 0;
+                if (ops[op].type == CommandType::SET || ops[op].type == CommandType::MSET) {
+                    const auto& value = ops[op].type == CommandType::SET ? ops[op].value : ops[op].values[item];
+                    packed_size = compress(value, packed) ? packed.size() - start : 0;
+                    stored = packed_size > 0 ? packed_size : value.size();
+                } else if (ops[op].type == CommandType::VSET) {
+                    stored = vectors[op].size();
+                }
+                size_t footprint = ops[op].type == CommandType::DEL ? 0 : Shard::footprint(key, stored);
+                order.push_back({shard_for(hash), op, item, hash, packed_size, start, footprint});
+            }
+        }
+        if (order.empty()) {
+            return 0;
+        }
+        bool check_budget = shard_budget_ > 0 && options_.eviction_policy == EvictionPolicy::NOEVICTION;
+        if (check_budget) {
+            by_op = order;
+        }
+        // By shard, then op and key order
+        std::sort(order.begin(), order.end(), [](const Write& a, const Write& b) {
+            return a.shard != b.shard ? a.shard < b.shard : a.op != b.op ? a.op < b.op : a.item < b.item;
+        });
+        
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i == 0 || order[i].shard != order[i - 1].shard) {
+                locks.emplace_back(shards[order[i].shard].mtx, std::defer_lock);
+                lock_timed(locks.back());
+            }
+        }
+        
+        // Under noeviction an op goes in only if all of its keys fit, counting
+        // the ops admitted before it. Overwrites only free bytes, so nothing
+        // admitted here is refused by apply_set() below.
+        refused.assign(count, 0);
+        if (check_budget) {
+            reserved.assign(num_shards_, 0);
+            for (size_t begin = 0, end; begin < by_op.size(); begin = end) {
+                bool fits = true;
+                for (end = begin; end < by_op.size() && by_op[end].op == by_op[begin].op; ++end) {
+                    const Write& w = by_op[end];
+                    reserved[w.shard] += w.footprint;
+                    fits = fits && shards[w.shard].used_bytes + reserved[w.shard] <= shard_budget_;
+                }
+                if (!fits) {
+                    for (size_t i = begin; i < end; ++i) {
+                        reserved[by_op[i].shard] -= by_op[i].footprint;
+                    }
+                    refused[by_op[begin].op] = 1;
+                    Metrics::instance().rejected_writes.add();
+                    if (status) {
+                        status[by_op[begin].op] = WriteStatus::OOM;
+                    }
+                }
+            }
+        }
+        if (grouped) {
+            op_logs.resize(std::max(op_logs.size(), count));
+            for (size_t op = 0; op < count; ++op) {
+                op_logs[op].clear();
+            }
+        }
+        
+        long long now = now_ms();
+        for (const Write& w : order) {
+            if (refused[w.op]) {
+                continue;
+            }
+            const Command& cmd = ops[w.op];
+            Shard& shard = shards[w.shard];
+            WalBatch& out = grouped ? op_logs[w.op] : log;
+            bool applied = true;
+            if (w.packed_size > 0) {
+                std::string_view frame(packed.data() + w.packed, w.packed_size);
+                bool single = cmd.type == CommandType::SET;
+                applied = apply_set(shard, single ? cmd.key : cmd.keys[w.item], w.hash, frame,
+                                    single ? cmd.ttl_seconds : cmd.ttls[w.item], now, out, ValueKind::STRING,
+                                    Codec::LZ4);
+            } else if (cmd.type == CommandType::SET) {
+                applied = apply_set(shard, cmd.key, w.hash, cmd.value, cmd.ttl_seconds, now, out);
+            } else if (cmd.type == CommandType::MSET) {
+                applied = apply_set(shard, cmd.keys[w.item], w.hash, cmd.values[w.item], cmd.ttls[w.item], now, out);
+            } else if (cmd.type == CommandType::VSET) {
+                applied = apply_set(shard, cmd.key, w.hash, vectors[w.op], cmd.ttl_seconds, now, out, ValueKind::VECTOR);
+            } else if (cmd.type == CommandType::DEL) {
+                const auto& key = write_key(cmd, w.item);
+                if (shard.erase(key, w.hash)) {
+                    out.add_del(key);
+                }
+            }
+            if (!applied && status) {
+                status[w.op] = WriteStatus::OOM;
+            }
+        }
+        if (grouped) {
+            for (size_t op = 0; op < count; ++op) {
+                log.add_group(op_logs[op]);
+            }
+        }
+        
+        uint64_t wal_start = Metrics::now_ns();
+        bool logging = !log.empty();
+        uint64_t lsn = wal_->append_batch(log);
+        trace_wal(wal_start);
+        if (logging && lsn == 0 && wal_->failed() && status) {
+            std::replace(status, status + count, WriteStatus::OK, WriteStatus::IO_ERROR);
+        }
+        return lsn;
+    }
+    
+    template <typename Command>
+    uint64_t apply_batch(const std::vector<Command>& ops, std::vector<WriteStatus>* status) {
+        if (status) {
+            status->resize(ops.size());
+        }
+        return apply_writes(ops.data(), ops.size(), status ? status->data() : nullptr);
+    }
+    
+    // MSET or multi-key DEL executed on the caller's thread rather than
+    // queued on the WriteBatcher. OOM when the keys do not all fit under
+    // noeviction, in which case none of them is written.
+    template <typename Command>
+    WriteStatus write_many(const Command& cmd) {
+        WriteStatus status;
+        uint64_t lsn = apply_writes(&cmd, 1, &status);
+        if (status == WriteStatus::OK && lsn != 0 && options_.fsync_policy == FsyncPolicy::ALWAYS) {
+            status = logged(lsn, true);
+        }
+        return status;
+    }
+    
+    bool wait_durable(uint64_t lsn) {
+        return wal_->wait_durable(lsn);
+    }
+    
+    void init_access(CacheEntry& entry, long long now) {
+        entry.access_tick.store(CacheEntry::tick_at(now));
+        entry.lfu_counter.store(LFU_INIT);
+    }
+    
+    // Updates eviction metadata on a read hit; safe under a shared lock
+    void touch(CacheEntry& entry, long long now) {
+        if (options_.eviction_policy == EvictionPolicy::ALLKEYS_LFU) {
+            uint8_t counter = decayed_lfu(entry, now);
+            if (counter < 255) {
+                double base = counter > LFU_INIT ? counter - LFU_INIT : 0;
+                double p = 1.0 / (base * LFU_LOG_FACTOR + 1.0);
+                if (random_unit() < p) {
+                    counter++;
+                }
+            }
+            entry.lfu_counter.store(counter);
+        }
+        uint32_t tick = CacheEntry::tick_at(now);
+        if (entry.access_tick.load() != tick) {
+            entry.access_tick.store(tick); // Skip the store to keep the line shared
+        }
+    }
+    
+    static uint8_t decayed_lfu(const CacheEntry& entry, long long now) {
+        long long periods = entry.idle_ms(now) / LFU_DECAY_MS;
+        uint8_t counter = entry.lfu_counter.load();
+        return periods >= counter ? 0 : static_cast<uint8_t>(counter - periods);
+    }
+    
+    static uint64_t random_u64() {
+        // xorshift64*, one state per thread
+        thread_local uint64_t state = 0x9E3779B97F4A7C15ULL ^
+            std::hash<std::thread::id>{}(std::this_thread::get_id());
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1DULL;
+    }
+    
+    static double random_unit() {
+        return (random_u64() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    
+    // Evicts sampled victims until the shard fits its budget. The key just
+    // written is never chosen. Caller holds the shard lock.
+    void enforce_budget(Shard& shard, std::string_view protect, long long now, WalBatch& log) {
+        size_t evicted = 0;
+        while (shard.used_bytes > shard_budget_ && evict_one(shard, protect, now, log)) {
+            evicted++;
+        }
+        if (evicted > 0) {
+            Metrics::instance().evicted_keys.add(evicted);
+        }
+    }
+    
+    // Samples up to EVICTION_SAMPLES entries from a random point in the slot
+    // array and evicts the worst: any expired entry first, then the longest
+    // idle (LRU) or the least frequently used (LFU). The eviction is logged as
+    // a DEL, queued after the SET that caused it, so replay does not bring the
+    // key back.
+    bool evict_one(Shard& shard, std::string_view protect, long long now, WalBatch& log) {
+        auto& data = shard.data;
+        if (data.empty()) {
+            return false;
+        }
+        
+        size_t victim = Shard::Map::npos;
+        long long victim_score = 0;
+        size_t sampled = 0;
+        size_t capacity = data.capacity();
+        size_t i = random_u64() & (capacity - 1);
+        
+        for (size_t probe = 0; probe < capacity && sampled < EVICTION_SAMPLES; ++probe, i = (i + 1) & (capacity - 1)) {
+            if (!data.is_full(i) || data.slot(i).key() == protect) {
+                continue;
+            }
+            sampled++;
+            const CacheEntry& entry = data.slot(i).value;
+            
+            // Higher score = better victim
+            long long score;
+            if (entry.is_expired(now)) {
+                score = std::numeric_limits<long long>::max();
+            } else if (options_.eviction_policy == EvictionPolicy::ALLKEYS_LFU) {
+                score = (255 - decayed_lfu(entry, now)) * (1LL << 40) + entry.idle_ms(now);
+            } else {
+                score = entry.idle_ms(now);
+            }
+            
+            if (victim == Shard::Map::npos || score > victim_score) {
+                victim = i;
+                victim_score = score;
+            }
+        }
+        
+        if (victim == Shard::Map::npos) {
+            return false;
+        }
+        
+        log.add_del(data.slot(victim).key());
+        shard.erase_at(victim);
+        return true;
+    }
+    
+    // One shard's entry memory, for STATS
+    struct ShardMemory {
+        size_t keys = 0;
+        size_t used = 0;          // Shard::used_bytes, what maxmemory is checked against
+        size_t payload = 0;       // Key and value bytes as written
+        size_t table = 0;         // FlatMap slot and control arrays
+        size_t slab_used = 0;     // Slab chunks holding live keys and values
+        size_t slab_reserved = 0; // Slab pages and large allocations
+        size_t cold_keys = 0;     // Keys whose value is in the cold log
+        size_t cold_bytes = 0;    // Their value bytes, on disk rather than in the slab
+        
+        // Bytes taken from the system allocator for entries
+        size_t allocated() const { return table + slab_reserved; }
+        
+        void add(const ShardMemory& other) {
+            keys += other.keys;
+            used += other.used;
+            payload += other.payload;
+            table += other.table;
+            slab_used += other.slab_used;
+            slab_reserved += other.slab_reserved;
+            cold_keys += other.cold_keys;
+            cold_bytes += other.cold_bytes;
+        }
+    };
+    
+    std::vector<ShardMemory> memory_by_shard() {
+        std::vector<ShardMemory> out(num_shards_);
+        for (size_t i = 0; i < num_shards_; ++i) {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+            out[i].keys = shards[i].data.size();
+            out[i].used = shards[i].used_bytes;
+            out[i].payload = shards[i].payload_bytes;
+            out[i].table = shards[i].data.memory_bytes();
+            out[i].slab_used = shards[i].slab.used_bytes();
+            out[i].slab_reserved = shards[i].slab.reserved_bytes();
+            out[i].cold_keys = shards[i].cold_keys;
+            out[i].cold_bytes = shards[i].cold_bytes;
+        }
+        return out;
+    }
+    
+    static std::string memory_json(const ShardMemory& m) {
+        return "\"keys\":" + std::to_string(m.keys) +
+               ",\"used_bytes\":" + std::to_string(m.used) +
+               ",\"allocated_bytes\":" + std::to_string(m.allocated()) +
+               ",\"payload_bytes\":" + std::to_string(m.payload) +
+               ",\"table_bytes\":" + std::to_string(m.table) +
+               ",\"slab_used_bytes\":" + std::to_string(m.slab_used) +
+               ",\"slab_reserved_bytes\":" + std::to_string(m.slab_reserved) +
+               ",\"cold_keys\":" + std::to_string(m.cold_keys) +
+               ",\"cold_bytes\":" + std::to_string(m.cold_bytes);
+    }
+    
+    // The cold log and its counters, for STATS with tiered storage
+    std::string tier_json() {
+        ColdLog::Stats log = cold_->stats();
+        Metrics& metrics = Metrics::instance();
+        return "{\"tier_memory\":" + std::to_string(options_.tier_memory_bytes) +
+               ",\"segments\":" + std::to_string(log.segments) +
+               ",\"disk_bytes\":" + std::to_string(log.disk_bytes) +
+               ",\"live_bytes\":" + std::to_string(log.live_bytes) +
+               ",\"spills\":" + std::to_string(metrics.cold_spills.load()) +
+               ",\"reads\":" + std::to_string(metrics.cold_reads.load()) +
+               ",\"promotions\":" + std::to_string(metrics.cold_promotions.load()) +
+               ",\"read_errors\":" + std::to_string(metrics.cold_read_errors.load()) + "}";
+    }
+    
+    // The tracked hot keys and how often their GETs were served from a copy
+    std::string hot_keys_json() {
+        Metrics& metrics = Metrics::instance();
+        std::string keys;
+        for (const HotKeys::Hot& hot : hot_keys_->keys()) {
+            if (!keys.empty()) keys += ',';
+            keys += "{\"key\":\"" + SlowLog::json_escape(hot.key) + "\",\"reads\":" + std::to_string(hot.reads) + "}";
+        }
+        return "{\"capacity\":" + std::to_string(hot_keys_->capacity()) +
+               ",\"near_cache_hits\":" + std::to_string(metrics.hot_key_hits.load()) +
+               ",\"near_cache_fills\":" + std::to_string(metrics.hot_key_fills.load()) +
+               ",\"keys\":[" + keys + "]}";
+    }
+    
+    std::string stats_json(const std::vector<ShardMemory>& shards_memory, const ShardMemory& total) {
+        std::string memory = "{" + memory_json(total) + ",\"shards\":[";
+        for (size_t i = 0; i < shards_memory.size(); ++i) {
+            if (i > 0) memory += ',';
+            memory += "{" + memory_json(shards_memory[i]) + "}";
+        }
+        memory += "]}";
+        
+        return Metrics::instance().to_json(
+            ",\"used_memory\":" + std::to_string(total.used) +
+            ",\"maxmemory\":" + std::to_string(options_.maxmemory_bytes) +
+            ",\"vector_kernel\":\"" + vector_kernel_name(vector_kernel()) + "\"" +
+            ",\"memory\":" + memory +
+            (cold_ ? ",\"tier\":" + tier_json() : std::string()) +
+            (hot_keys_ ? ",\"hot_keys\":" + hot_keys_json() : std::string())) + "\n";
+    }
+    
+    std::string stats_prometheus(const std::vector<ShardMemory>& shards_memory, const ShardMemory& total) {
+        std::string out;
+        out += Metrics::prometheus_metric("memkv_used_memory_bytes", "gauge",
+                                          "Bytes charged to entries against maxmemory", total.used);
+        out += Metrics::prometheus_metric("memkv_maxmemory_bytes", "gauge",
+                                          "Configured memory limit (0 = unlimited)", options_.maxmemory_bytes);
+        out += Metrics::prometheus_metric("memkv_allocated_bytes", "gauge",
+                                          "Bytes allocated for entries: tables and slab pages", total.allocated());
+        out += Metrics::prometheus_metric("memkv_payload_bytes", "gauge",
+                                          "Key and value bytes as written", total.payload);
+        if (cold_) {
+            Metrics& metrics = Metrics::instance();
+            ColdLog::Stats log = cold_->stats();
+            out += Metrics::prometheus_metric("memkv_cold_keys", "gauge",
+                                              "Keys whose value is in the cold log", total.cold_keys);
+            out += Metrics::prometheus_metric("memkv_cold_bytes", "gauge",
+                                              "Value bytes in the cold log", total.cold_bytes);
+            out += Metrics::prometheus_metric("memkv_cold_log_disk_bytes", "gauge",
+                                              "Bytes in cold log segments, live or not", log.disk_bytes);
+            out += Metrics::prometheus_metric("memkv_cold_log_live_bytes", "gauge",
+                                              "Cold log bytes still referenced", log.live_bytes);
+            out += Metrics::prometheus_metric("memkv_cold_spills_total", "counter",
+                                              "Values moved to the cold log", metrics.cold_spills.load());
+            out += Metrics::prometheus_metric("memkv_cold_reads_total", "counter",
+                                              "Values read from the cold log", metrics.cold_reads.load());
+            out += Metrics::prometheus_metric("memkv_cold_promotions_total", "counter",
+                                              "Cold values brought back into memory", metrics.cold_promotions.load());
+            out += Metrics::prometheus_metric("memkv_cold_read_errors_total", "counter",
+                                              "Cold reads that failed", metrics.cold_read_errors.load());
+        }
+        if (hot_keys_) {
+            Metrics& metrics = Metrics::instance();
+            out += Metrics::prometheus_metric("memkv_hot_keys", "gauge",
+                                              "Keys tracked as hot", hot_keys_->keys().size());
+            out += Metrics::prometheus_metric("memkv_hot_key_near_cache_hits_total", "counter",
+                                              "GETs of hot keys served from a thread's copy", metrics.hot_key_hits.load());
+            out += Metrics::prometheus_metric("memkv_hot_key_near_cache_fills_total", "counter",
+                                              "Copies of hot values taken under the shard lock", metrics.hot_key_fills.load());
+        }
+        
+        out += "# HELP memkv_shard_keys Keys per shard\n";
+        out += "# TYPE memkv_shard_keys gauge\n";
+        for (size_t i = 0; i < shards_memory.size(); ++i) {
+            out += "memkv_shard_keys{shard=\"" + std::to_string(i) + "\"} " +
+                   std::to_string(shards_memory[i].keys) + "\n";
+        }
+        
+        out += "# HELP memkv_shard_memory_bytes Entry memory per shard\n";
+        out += "# TYPE memkv_shard_memory_bytes gauge\n";
+        for (size_t i = 0; i < shards_memory.size(); ++i) {
+            const ShardMemory& m = shards_memory[i];
+            const std::pair<const char*, size_t> kinds[] = {
+                {"used", m.used}, {"payload", m.payload}, {"table", m.table},
+                {"slab_used", m.slab_used}, {"slab_reserved", m.slab_reserved},
+            };
+            for (const auto& [kind, bytes] : kinds) {
+                out += "memkv_shard_memory_bytes{shard=\"" + std::to_string(i) + "\",kind=\"" + kind + "\"} " +
+                       std::to_string(bytes) + "\n";
+            }
+        }
+        return Metrics::instance().to_prometheus(out);
+    }
+    
+    // Picks the hot keys for the next cycle and refreshes their access
+    // metadata, under the shared lock as GET does
+    void hot_cycle() {
+        hot_keys_->rotate();
+        long long now = now_ms();
+        for (const HotKeys::Hot& hot : hot_keys_->keys()) {
+            uint64_t hash = hash_key(hot.key);
+            Shard& shard = shards[shard_for(hash)];
+            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            size_t slot = shard.data.find(hot.key, hash);
+            if (slot != Shard::Map::npos) {
+                touch(shard.data.slot(slot).value, now);
+            }
+        }
+    }
+    
+    // A reading thread's copy of the value of the hot key in one HotKeys
+    // slot, valid while owner and version match the store's HotKeys
+    struct NearLine {
+        uint64_t owner = 0;
+        uint64_t version = 0;
+        std::string key;
+        std::string value;
+        long long expiry_at_ms = 0;
+        ValueKind kind = ValueKind::STRING;
+    };
+    
+    static NearLine& near_line(int slot) {
+        thread_local NearLine lines[HotKeys::MAX_KEYS];
+        return lines[slot];
+    }
+    
+    // Appends the thread's copy of the value in hot slot `slot`, if it is
+    // still current and holds key with the given kind
+    bool near_get(int slot, std::string_view key, ValueKind kind, std::string& out) {
+        const NearLine& line = near_line(slot);
+        if (line.owner != hot_keys_->id() || line.version != hot_keys_->version(slot) || line.kind != kind ||
+            line.key != key || (line.expiry_at_ms != 0 && line.expiry_at_ms <= now_ms())) {
+            return false;
+        }
+        out += line.value;
+        return true;
+    }
+    
+    enum class Lookup { HIT, MISS, WRONG_KIND };
+    static constexpr std::string_view WRONGTYPE_ERROR =
+        "ERROR: WRONGTYPE Operation against a key holding the wrong kind of value";
+    
+    // Appends key's value to out if it holds one of the given kind. Large
+    // values are referenced under the shard lock and copied into out after it
+    // is released, so the lock hold time does not grow with value size. Cold
+    // values are read from the cold log after it is released too, and
+    // compressed ones, always referenced, are decompressed after it. A hot
+    // key is served from the thread's copy when that is current, and a hit
+    // otherwise refreshes the copy.
+    Lookup fetch(std::string_view key, ValueKind kind, std::string& out) {
+        uint64_t hash = hash_key(key);
+        size_t idx = shard_for(hash);
+        int hot = -1;
+        if (hot_keys_) {
+            hot_keys_->record(key, hash);
+            hot = hot_keys_->find(hash);
+            if (hot >= 0 && near_get(hot, key, kind, out)) {
+                Metrics& metrics = Metrics::instance();
+                metrics.total_requests.add();
+                metrics.cache_hits.add();
+                metrics.hot_key_hits.add();
+                return Lookup::HIT;
+            }
+        }
+        size_t start = out.size();
+        uint64_t hot_version = 0;
+        long long expiry_at_ms = 0;
+        bool hit = false;
+        bool wrong_kind = false;
+        ValueRef value;
+        uint64_t cold_loc = 0;
+        ColdLog::Handle segment;
+        bool promote = false;
+        bool compressed = false;
+        {
+            std::shared_lock<std::shared_mutex> lock(shards[idx].mtx, std::defer_lock);
+            lock_timed(lock);
+            
+            // TTL Eviction Logic for Inference Results. Readers only report
+            // the miss; the key is already in the shard's expiry wheel, so the
+            // sweep (or the next overwrite) removes it under the exclusive lock.
+            size_t slot = shards[idx].data.find(key, hash);
+            if (slot != Shard::Map::npos) {
+                long long now = now_ms();
+                CacheEntry& entry = shards[idx].data.slot(slot).value;
+                if (entry.is_expired(now)) {
+                    // A miss
+                } else if (entry.kind != kind) {
+                    wrong_kind = true;
+                } else {
+                    if (entry.is_cold()) {
+                        cold_loc = entry.cold_loc();
+                        segment = cold_->hold(cold_loc);
+                        promote = entry.idle_ms(now) < TIER_PROMOTE_MS;
+                    }
+                    touch(entry, now);
+                    hit = true;
+                    compressed = entry.codec != Codec::NONE;
+                    if (hot >= 0) {
+                        // Read with the value: a write changes both under the exclusive lock
+                        hot_version = hot_keys_->version(hot);
+                        expiry_at_ms = entry.expiry_at_ms;
+                        if (!hot_keys_->tracks(hot, hash)) {
+                            hot = -1;
+                        }
+                    }
+                    if (cold_loc != 0) {
+                        // Read below
+                    } else if (entry.value()->size <= COPY_UNDER_LOCK_BYTES && !compressed) {
+                        out.append(entry.value()->data(), entry.value()->size);
+                    } else {
+                        value = shards[idx].ref(entry);
+                    }
+                }
+            }
+        }
+        if (compressed) {
+            thread_local std::string frame;
+            frame.clear();
+            if (cold_loc != 0) {
+                hit = read_cold(key, hash, cold_loc, segment, promote, frame);
+            } else {
+                frame.assign(value.data(), value.size());
+                value.reset();
+            }
+            hit = hit && decompress(frame, out);
+        } else if (cold_loc != 0) {
+            hit = read_cold(key, hash, cold_loc, segment, promote, out);
+        }
+        if (value) {
+            out.append(value.data(), value.size());
+            value.reset();
+        }
+        if (hit && hot >= 0 && out.size() - start <= NEAR_CACHE_MAX_BYTES) {
+            NearLine& line = near_line(hot);
+            line.owner = hot_keys_->id();
+            line.version = hot_version;
+            line.key.assign(key.data(), key.size());
+            line.value.assign(out, start, std::string::npos);
+            line.expiry_at_ms = expiry_at_ms;
+            line.kind = kind;
+            Metrics::instance().hot_key_fills.add();
+        }
+        
+        // Metrics are recorded after the shard lock is released
+        Metrics& metrics = Metrics::instance();
+        metrics.total_requests.add();
+        if (wrong_kind) {
+            return Lookup::WRONG_KIND;
+        }
+        if (hit) {
+            metrics.cache_hits.add();
+        } else {
+            metrics.cache_misses.add();
+        }
+        return hit ? Lookup::HIT : Lookup::MISS;
+    }
+    
+    // Appends the value for key and a newline to out, or "(nil)\n"
+    void get(std::string_view key, std::string& out) {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        Lookup result = fetch(key, ValueKind::STRING, out);
+        if (result == Lookup::MISS) {
+            out += "(nil)";
+        } else if (result == Lookup::WRONG_KIND) {
+            out += WRONGTYPE_ERROR;
+        }
+        out += '\n';
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        Metrics::instance().record_latency(duration.count());
+    }
+    
+    // VSET's numbers as float32 bytes, in the CPU's byte order (little-endian
+    // on x86-64 and aarch64). The parser has checked them; false only for a
+    // command built some other way.
+    template <typename Command>
+    static bool encode_vector(const Command& cmd, std::string& out) {
+        thread_local std::vector<float> vector;
+        vector.clear();
+        for (const auto& text : cmd.values) {
+            if (!parse_vector(text, vector)) {
+                return false;
+            }
+        }
+        if (vector.empty() || vector.size() > MAX_VECTOR_DIMS) {
+            return false;
+        }
+        out.assign(reinterpret_cast<const char*>(vector.data()), vector.size() * sizeof(float));
+        return true;
+    }
+    
+    // Appends the vector at key as space-separated numbers and a newline
+    void vget(std::string_view key, std::string& out) {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        thread_local std::string bytes;
+        bytes.clear();
+        Lookup result = fetch(key, ValueKind::VECTOR, bytes);
+        if (result == Lookup::HIT) {
+            format_vector(bytes, out);
+        } else if (result == Lookup::MISS) {
+            out += "(nil)";
+        } else {
+            out += WRONGTYPE_ERROR;
+        }
+        out += '\n';
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        Metrics::instance().record_latency(duration.count());
+    }
+    
+    // A key's live entry, found with its shard locked
+    struct Resolved {
+        CacheEntry* entry;   // nullptr for a miss
+        Shard* shard;
+        bool promote;        // Cold, and read again within TIER_PROMOTE_MS
+    };
+    
+    // Locks every shard the keys touch, shared, and resolves each key; one
+    // holding a value of another kind is a miss. Shards are locked in ascending index order, the order apply_batch takes
+    // them exclusive, so the two cannot deadlock, and the entries are a
+    // consistent view of all the keys until the caller clears `locks`. No
+    // value is read here, so the value loads of the caller's next pass are
+    // independent and their cache misses overlap.
+    template <typename Key>
+    void resolve_all(const std::vector<Key>& keys,
+                     std::vector<std::shared_lock<std::shared_mutex>>& locks,
+                     std::vector<Resolved>& out, ValueKind kind = ValueKind::STRING) {
+        thread_local std::vector<uint64_t> hashes;
+        thread_local std::vector<size_t> touched;
+        hashes.resize(keys.size());
+        touched.clear();
+        for (size_t i = 0; i < keys.size(); ++i) {
+            hashes[i] = hash_key(keys[i]);
+            touched.push_back(shard_for(hashes[i]));
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        
+        locks.clear();
+        for (size_t idx : touched) {
+            locks.emplace_back(shards[idx].mtx, std::defer_lock);
+            lock_timed(locks.back());
+        }
+        
+        long long now = now_ms();
+        out.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            Shard& shard = shards[shard_for(hashes[i])];
+            size_t slot = shard.data.find(keys[i], hashes[i]);
+            out[i] = {nullptr, &shard, false};
+            if (slot == Shard::Map::npos) {
+                continue;
+            }
+            CacheEntry& entry = shard.data.slot(slot).value;
+            if (!entry.is_expired(now) && entry.kind == kind) { // Expired entries are left for the sweep
+                out[i].promote = entry.is_cold() && entry.idle_ms(now) < TIER_PROMOTE_MS;
+                touch(entry, now);
+                out[i].entry = &entry;
+            }
+        }
+    }
+    
+    // Values of resolved keys, in key order, that outlive the shard locks:
+    // small ones copied into `bytes`, larger ones referenced, cold ones
+    // pinned until read_deferred_parts() reads them into `bytes`. Compressed
+    // values are referenced or pinned whatever their size and decompressed
+    // into `bytes` there.
+    struct Gathered {
+        static constexpr size_t MISS = static_cast<size_t>(-1);
+        static constexpr size_t REF = MISS - 1;
+        static constexpr size_t COLD = MISS - 2;
+        
+        struct ColdPart {
+            uint64_t loc = 0;
+            ColdLog::Handle segment;
+            bool promote = false;
+        };
+        
+        std::string bytes;
+        std::vector<std::pair<size_t, size_t>> parts; // (offset in bytes, or MISS, REF or COLD; size)
+        std::vector<ValueRef> refs;                   // Set where parts says REF
+        std::vector<ColdPart> colds;                  // Set where parts says COLD
+        std::vector<bool> compressed;                 // Parts held as LZ4 frames, always REF or COLD
+        bool has_cold = false;
+        bool has_compressed = false;
+        
+        bool hit(size_t i) const { return parts[i].first != MISS; }
+        
+        std::string_view value(size_t i) const {
+            if (parts[i].first == REF) {
+                return refs[i].view();
+            }
+            return std::string_view(bytes).substr(parts[i].first, parts[i].second);
+        }
+        
+        void clear() {
+            bytes.clear();
+            parts.clear();
+            refs.clear();
+            colds.clear();
+            compressed.clear();
+            has_cold = false;
+            has_compressed = false;
+        }
+    };
+    
+    // Caller still holds the locks of resolve_all()
+    void gather(const std::vector<Resolved>& resolved, Gathered& out) {
+        out.clear();
+        out.parts.resize(resolved.size(), {Gathered::MISS, 0});
+        out.refs.resize(resolved.size());
+        for (size_t i = 0; i < resolved.size(); ++i) {
+            if (resolved[i].entry == nullptr) {
+                continue;
+            }
+            if (resolved[i].entry->codec != Codec::NONE) {
+                if (!out.has_compressed) {
+                    out.compressed.resize(resolved.size());
+                    out.has_compressed = true;
+                }
+                out.compressed[i] = true;
+            }
+            if (resolved[i].entry->is_cold()) {
+                uint64_t loc = resolved[i].entry->cold_loc();
+                if (!out.has_cold) {
+                    out.colds.resize(resolved.size());
+                    out.has_cold = true;
+                }
+                out.parts[i] = {Gathered::COLD, ColdLog::value_size(loc)};
+                out.colds[i] = {loc, cold_->hold(loc), resolved[i].promote};
+                continue;
+            }
+            const StoredValue* value = resolved[i].entry->value();
+            if (value->size <= COPY_UNDER_LOCK_BYTES && !(out.has_compressed && out.compressed[i])) {
+                out.parts[i] = {out.bytes.size(), value->size};
+                out.bytes.append(value->data(), value->size);
+            } else {
+                out.parts[i] = {Gathered::REF, value->size};
+                out.refs[i] = resolved[i].shard->ref(*resolved[i].entry);
+            }
+        }
+    }
+    
+    // Reads the cold parts of out into its bytes and decompresses the
+    // compressed ones there, after the shard locks are released; one that
+    // cannot be read or decoded becomes a miss
+    template <typename Key>
+    void read_deferred_parts(const std::vector<Key>& keys, Gathered& out) {
+        if (!out.has_cold && !out.has_compressed) {
+            return;
+        }
+        thread_local std::string frame;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            size_t offset = out.bytes.size();
+            bool cold = out.parts[i].first == Gathered::COLD;
+            bool ok = true;
+            if (out.has_compressed && out.compressed[i]) {
+                frame.clear();
+                if (cold) {
+                    Gathered::ColdPart& part = out.colds[i];
+                    ok = read_cold(keys[i], hash_key(keys[i]), part.loc, part.segment, part.promote, frame);
+                    part.segment.reset();
+                } else {
+                    frame.assign(out.refs[i].data(), out.refs[i].size());
+                    out.refs[i].reset();
+                }
+                ok = ok && decompress(frame, out.bytes);
+            } else if (cold) {
+                Gathered::ColdPart& part = out.colds[i];
+                ok = read_cold(keys[i], hash_key(keys[i]), part.loc, part.segment, part.promote, out.bytes);
+                part.segment.reset();
+            } else {
+                continue;
+            }
+            if (ok) {
+                out.parts[i] = {offset, out.bytes.size() - offset};
+            } else {
+                out.parts[i] = {Gathered::MISS, 0};
+            }
+        }
+    }
+    
+    std::vector<std::string> mget(const std::vector<std::string>& keys) {
+        thread_local std::vector<std::shared_lock<std::shared_mutex>> locks;
+        thread_local std::vector<Resolved> resolved;
+        thread_local Gathered gathered;
+        resolve_all(keys, locks, resolved);
+        gather(resolved, gathered);
+        locks.clear();
+        read_deferred_parts(keys, gathered);
+        
+        std::vector<std::string> results(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            results[i] = gathered.hit(i) ? std::string(gathered.value(i)) : "(nil)";
+        }
+        gathered.clear();
+        return results;
+    }
+    
+    // Appends the space-separated values and a newline to out, reserving the
+    // reply once so the cost tracks the bytes returned. When every value is
+    // small they are copied straight into the reply under the shard locks;
+    // otherwise large values are referenced and cold ones read (see gather())
+    // and the reply is assembled after the locks are released, so lock hold
+    // time never grows with value size.
+    template <typename Key>
+    void mget(const std::vector<Key>& keys, std::string& out) {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        thread_local std::vector<std::shared_lock<std::shared_mutex>> locks;
+        thread_local std::vector<Resolved> resolved;
+        thread_local Gathered gathered;
+        static constexpr std::string_view NIL = "(nil)";
+        resolve_all(keys, locks, resolved);
+        
+        size_t total = keys.size(); // Separators and the newline
+        bool large = false;
+        for (const Resolved& r : resolved) {
+            size_t size = r.entry ? r.entry->value_size() : NIL.size();
+            total += size;
+            large = large || size > COPY_UNDER_LOCK_BYTES ||
+                    (r.entry && (r.entry->is_cold() || r.entry->codec != Codec::NONE));
+        }
+        out.reserve(out.size() + total);
+        
+        if (!large) {
+            for (size_t i = 0; i < resolved.size(); ++i) {
+                if (i > 0) out += ' ';
+                out += resolved[i].entry ? resolved[i].entry->value()->view() : NIL;
+            }
+            locks.clear();
+        } else {
+            gather(resolved, gathered);
+            locks.clear();
+            read_deferred_parts(keys, gathered);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (i > 0) out += ' ';
+                out += gathered.hit(i) ? gathered.value(i) : NIL;
+            }
+            gathered.clear();
+        }
+        out += '\n';
+        
+        // Record latency for MGET
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        Metrics::instance().record_latency(duration.count());
+    }
+    
+    void localize_shard(size_t index) {
+        Shard& shard = shards[index];
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        shard.data.rebuild();
+    }
+    
+    void mget_values(const std::vector<std::string_view>& keys, std::string& bytes, std::vector<size_t>& sizes) {
+        thread_local std::vector<std::shared_lock<std::shared_mutex>> locks;
+        thread_local std::vector<Resolved> resolved;
+        thread_local Gathered gathered;
+        resolve_all(keys, locks, resolved);
+        
+        bool large = false;
+        for (const Resolved& r : resolved) {
+            large = large || (r.entry && (r.entry->is_cold() || r.entry->codec != Codec::NONE ||
+                                          r.entry->value_size() > COPY_UNDER_LOCK_BYTES));
+        }
+        if (!large) {
+            for (const Resolved& r : resolved) {
+                sizes.push_back(r.entry ? r.entry->value()->size : KVStore::MISS);
+                if (r.entry) {
+                    bytes.append(r.entry->value()->data(), r.entry->value()->size);
+                }
+            }
+            locks.clear();
+            return;
+        }
+        
+        gather(resolved, gathered);
+        locks.clear();
+        read_deferred_parts(keys, gathered);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (gathered.hit(i)) {
+                std::string_view value = gathered.value(i);
+                sizes.push_back(value.size());
+                bytes.append(value.data(), value.size());
+            } else {
+                sizes.push_back(KVStore::MISS);
+            }
+        }
+        gathered.clear();
+    }
+    
+    // VSIM's results: the best `count` scores pushed so far, the worst of
+    // them at the front of the heap, so a better one replaces it in
+    // O(log count) and most candidates are turned away by one compare
+    class TopK {
+    public:
+        using Hit = std::pair<float, std::string>;
+        
+        // ascending: smaller scores are better (L2 distance)
+        void reset(size_t count, bool ascending) {
+            count_ = count;
+            ascending_ = ascending;
+            heap_.clear();
+        }
+        size_t count() const { return count_; }
+        bool ascending() const { return ascending_; }
+        
+        void push(std::string_view key, float score) {
+            if (heap_.size() == count_ && !better(score, heap_.front().first)) {
+                return;
+            }
+            auto worse = [this](const Hit& a, const Hit& b) { return better(a.first, b.first); };
+            if (heap_.size() == count_) {
+                std::pop_heap(heap_.begin(), heap_.end(), worse);
+                heap_.back().first = score;
+                heap_.back().second.assign(key.data(), key.size());
+            } else {
+                heap_.emplace_back(score, std::string(key));
+            }
+            std::push_heap(heap_.begin(), heap_.end(), worse);
+        }
+        
+        void merge_into(TopK& other) {
+            for (const Hit& hit : heap_) {
+                other.push(hit.second, hit.first);
+            }
+            heap_.clear();
+        }
+        
+        // Best first; the heap is spent
+        const std::vector<Hit>& sorted() {
+            std::sort_heap(heap_.begin(), heap_.end(), [this](const Hit& a, const Hit& b) { return better(a.first, b.first); });
+            return heap_;
+        }
+    
+    private:
+        bool better(float a, float b) const { return ascending_ ? a < b : a > b; }
+        
+        size_t count_ = 0;
+        bool ascending_ = false;
+        std::vector<Hit> heap_;
+    };
+    
+    struct VectorQuery {
+        const float* values;
+        size_t dims;
+        float norm; // For cosine
+        VectorMetric metric;
+    };
+    
+    // Scores a candidate's bytes against the query: cosine similarity, dot
+    // product or L2 distance. False if its dimension differs from the query's.
+    static bool score(const VectorQuery& q, std::string_view bytes, float& out) {
+        if (bytes.size() != q.dims * sizeof(float)) {
+            return false;
+        }
+        // Slab values are 16-byte aligned and gathered copies of vectors sit
+        // at multiples of four bytes, so this copy is only a safeguard
+        const float* v = reinterpret_cast<const float*>(bytes.data());
+        thread_local std::vector<float> aligned;
+        if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(float) != 0) {
+            aligned.resize(q.dims);
+            std::memcpy(aligned.data(), bytes.data(), bytes.size());
+            v = aligned.data();
+        }
+        switch (q.metric) {
+            case VectorMetric::DOT:
+                out = vector_dot(q.values, v, q.dims);
+                break;
+            case VectorMetric::L2:
+                out = std::sqrt(vector_l2_squared(q.values, v, q.dims));
+                break;
+            case VectorMetric::COSINE: {
+                float dot;
+                float norm_sq;
+                vector_dot_norm(q.values, v, q.dims, dot, norm_sq);
+                out = q.norm > 0 && norm_sq > 0 ? dot / (q.norm * std::sqrt(norm_sq)) : 0;
+                break;
+            }
+        }
+        return true;
+    }
+    
+    // VSIM: the candidates closest to the query vector, best first, as
+    // "key score" pairs on one line. Candidates that are missing, hold a
+    // string or have another dimension are skipped; "(nil)" if none is left
+    // or the query key holds no vector.
+    template <typename Command>
+    void vsim(const Command& cmd, std::string& out) {
+        auto start = std::chrono::high_resolution_clock::now();
+        
+        thread_local std::vector<float> query;
+        thread_local std::string bytes;
+        query.clear();
+        std::string_view q = cmd.key;
+        if (!q.empty() && q.front() == '[') {
+            if (!parse_vector(q, query) || query.empty() || query.size() > MAX_VECTOR_DIMS) {
+                out += "ERROR: VSIM query must be a key or [number,...]\n";
+                return;
+            }
+        } else {
+            bytes.clear();
+            Lookup result = fetch(q, ValueKind::VECTOR, bytes);
+            if (result != Lookup::HIT) {
+                out += result == Lookup::MISS ? std::string_view("(nil)") : WRONGTYPE_ERROR;
+                out += '\n';
+                return;
+            }
+            query.resize(bytes.size() / sizeof(float));
+            std::memcpy(query.data(), bytes.data(), query.size() * sizeof(float));
+        }
+        
+        VectorQuery vq{query.data(), query.size(), std::sqrt(vector_dot(query.data(), query.data(), query.size())),
+                       cmd.metric};
+        thread_local TopK best;
+        best.reset(static_cast<size_t>(cmd.count), cmd.metric == VectorMetric::L2);
+        if (cmd.prefix) {
+            std::string_view prefix = cmd.value;
+            if (!prefix.empty() && prefix.back() == '*') {
+                prefix.remove_suffix(1); // "doc:*" reads as the prefix "doc:"
+            }
+            score_prefix(vq, prefix, best);
+        } else {
+            score_keys(vq, cmd.keys, best);
+        }
+        
+        const auto& hits = best.sorted();
+        for (size_t i = 0; i < hits.size(); ++i) {
+            if (i > 0) out += ' ';
+            out += hits[i].second;
+            out += ' ';
+            format_float(hits[i].first, out);
+        }
+        if (hits.empty()) {
+            out += "(nil)";
+        }
+        out += '\n';
+        
+        auto end = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        Metrics::instance().record_latency(duration.count());
+    }
+    
+    // VSIM over listed keys: resolved and gathered like MGET, so a large
+    // vector is scored straight from the slab through its reference once
+    // the shard locks are released
+    template <typename Key>
+    void score_keys(const VectorQuery& q, const std::vector<Key>& keys, TopK& best) {
+        thread_local std::vector<std::shared_lock<std::shared_mutex>> locks;
+        thread_local std::vector<Resolved> resolved;
+        thread_local Gathered gathered;
+        resolve_all(keys, locks, resolved, ValueKind::VECTOR);
+        gather(resolved, gathered);
+        locks.clear();
+        read_deferred_parts(keys, gathered);
+        
+        float s = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (gathered.hit(i) && score(q, gathered.value(i), s)) {
+                best.push(keys[i], s);
+            }
+        }
+        gathered.clear();
+    }
+    
+    // VSIM PREFIX: a brute-force pass over every vector whose key starts with
+    // prefix. Shards are read in slices of VSIM_SLICE_SLOTS, scoring hot
+    // vectors in place under the shared lock; cold ones are pinned and read
+    // after the slice's lock is released, without promotion. A key enters
+    // the results, and is copied, only when it beats the worst kept. A
+    // rehash between slices restarts the shard from an empty shard result.
+    void score_prefix(const VectorQuery& q, std::string_view prefix, TopK& best) {
+        struct ColdCandidate {
+            std::string key;
+            uint64_t loc;
+            ColdLog::Handle segment;
+        };
+        thread_local TopK shard_best;
+        thread_local std::vector<ColdCandidate> colds;
+        thread_local std::string bytes;
+        long long now = now_ms();
+        float s = 0;
+        
+        for (size_t i = 0; i < num_shards_; ++i) {
+            shard_best.reset(best.count(), best.ascending());
+            size_t pos = 0;
+            size_t seen_capacity = 0;
+            while (true) {
+                {
+                    std::shared_lock<std::shared_mutex> lock(shards[i].mtx, std::defer_lock);
+                    lock_timed(lock);
+                    auto& data = shards[i].data;
+                    if (data.capacity() != seen_capacity) {
+                        seen_capacity = data.capacity();
+                        pos = 0;
+                        shard_best.reset(best.count(), best.ascending());
+                    }
+                    
+                    size_t end = std::min(seen_capacity, pos + VSIM_SLICE_SLOTS);
+                    for (; pos < end; ++pos) {
+                        if (!data.is_full(pos)) {
+                            continue;
+                        }
+                        const auto& slot = data.slot(pos);
+                        std::string_view key = slot.key();
+                        if (slot.value.kind != ValueKind::VECTOR || slot.value.is_expired(now) ||
+                            key.substr(0, prefix.size()) != prefix) {
+                            continue;
+                        }
+                        if (slot.value.is_cold()) {
+                            uint64_t loc = slot.value.cold_loc();
+                            colds.push_back({std::string(key), loc, cold_->hold(loc)});
+                        } else if (score(q, slot.value.value()->view(), s)) {
+                            shard_best.push(key, s);
+                        }
+                    }
+                }
+                
+                for (ColdCandidate& c : colds) {
+                    bytes.clear();
+                    if (read_cold(c.key, hash_key(c.key), c.loc, c.segment, false, bytes) && score(q, bytes, s)) {
+                        shard_best.push(c.key, s);
+                    }
+                }
+                colds.clear();
+                if (pos >= seen_capacity) {
+                    break;
+                }
+            }
+            shard_best.merge_into(best);
+        }
+    }
+    
+    WriteStatus del(std::string_view key) {
+        if (wal_->failed()) {
+            return WriteStatus::IO_ERROR;
+        }
+        uint64_t hash = hash_key(key);
+        size_t idx = shard_for(hash);
+        bool existed;
+        uint64_t lsn = 0;
+        uint64_t wal_start = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(shards[idx].mtx, std::defer_lock);
+            lock_timed(lock);
+            existed = shards[idx].erase(key, hash);
+            if (existed) {
+                wal_start = Metrics::now_ns();
+                lsn = wal_->append_del(key);
+            }
+        }
+        
+        if (!existed) {
+            return WriteStatus::OK;
+        }
+        WriteStatus status = logged(lsn, options_.fsync_policy == FsyncPolicy::ALWAYS);
+        trace_wal(wal_start);
+        return status;
+    }
+    
+    // Appends the reply for cmd to out
+    template <typename Command>
+    void execute(const Command& cmd, std::string& out) {
+        if (!cmd.valid) {
+            out += "ERROR: Unknown command\n";
+            return;
+        }
+        
+        switch (cmd.type) {
+            case CommandType::SET: {
+                WriteStatus status = set(cmd.key, cmd.value, cmd.ttl_seconds);
+                if (status != WriteStatus::OK) {
+                    out += write_error(status);
+                    return;
+                }
+                out += "OK\n";
+                return;
+            }
+            
+            case CommandType::GET:
+                get(cmd.key, out);
+                return;
+            
+            case CommandType::MGET:
+                mget(cmd.keys, out);
+                return;
+            
+            case CommandType::DEL: {
+                WriteStatus status = cmd.keys.empty() ? del(cmd.key) : write_many(cmd);
+                if (status != WriteStatus::OK) {
+                    out += write_error(status);
+                    return;
+                }
+                out += "OK\n";
+                return;
+            }
+            
+            case CommandType::MSET: {
+                WriteStatus status = write_many(cmd);
+                if (status != WriteStatus::OK) {
+                    out += write_error(status);
+                    return;
+                }
+                out += "OK\n";
+                return;
+            }
+            
+            case CommandType::VSET: {
+                thread_local std::string bytes;
+                if (!encode_vector(cmd, bytes)) {
+                    out += write_error(WriteStatus::BAD_VECTOR);
+                    return;
+                }
+                WriteStatus status = set(cmd.key, bytes, cmd.ttl_seconds, ValueKind::VECTOR);
+                if (status != WriteStatus::OK) {
+                    out += write_error(status);
+                    return;
+                }
+                out += "OK\n";
+                return;
+            }
+            
+            case CommandType::VGET:
+                vget(cmd.key, out);
+                return;
+            
+            case CommandType::VSIM:
+                vsim(cmd, out);
+                return;
+            
+            case CommandType::ROLE:
+                if (role_reporter_) {
+                    role_reporter_(out);
+                } else {
+                    out += "{\"role\":\"standalone\"}";
+                }
+                out += "\n";
+                return;
+            
+            case CommandType::COMPACT:
+                request_compaction();
+                out += "OK\n";
+                return;
+            
+            case CommandType::IMPORT: {
+                // The import runs on the maintenance thread; this caller
+                // waits for it. Per-core loops use import_command() instead.
+                std::promise<std::string> reply;
+                std::future<std::string> done = reply.get_future();
+                import_command(cmd.key, [&reply](std::string text) { reply.set_value(std::move(text)); });
+                out += done.get();
+                return;
+            }
+            
+            case CommandType::STATS: {
+                std::vector<ShardMemory> shards_memory = memory_by_shard();
+                ShardMemory total;
+                for (const ShardMemory& m : shards_memory) {
+                    total.add(m);
+                }
+                if (cmd.key == "prometheus") {
+                    out += stats_prometheus(shards_memory, total);
+                } else {
+                    out += stats_json(shards_memory, total);
+                }
+                return;
+            }
+            
+            case CommandType::SLOWLOG:
+                out += slowlog(cmd.key, cmd.value);
+                return;
+            
+            case CommandType::CLUSTER:
+            case CommandType::ASKING:
+                // Connections hand these to the Cluster when there is one
+                out += "ERROR: This instance has cluster support disabled\n";
+                return;
+            
+            default:
+                out += "ERROR: Unknown command\n";
+                return;
+        }
+    }
+    
+    static std::string import_json(const KVStore::ImportResult& result) {
+        return "{\"imported\":" + std::to_string(result.imported) + ",\"skipped\":" + std::to_string(result.skipped) +
+               ",\"refused\":" + std::to_string(result.refused) + ",\"ms\":" + std::to_string(result.ms) + "}";
+    }
+    
+    // SLOWLOG GET [count] | LEN | RESET; the parser has validated the arguments
+    std::string slowlog(std::string_view subcommand, std::string_view count) {
+        SlowLog& log = Metrics::instance().slowlog;
+        if (subcommand == "LEN") {
+            return std::to_string(log.len()) + "\n";
+        }
+        if (subcommand == "RESET") {
+            log.reset();
+            return "OK\n";
+        }
+        size_t n = count.empty() ? SLOWLOG_DEFAULT_COUNT : std::stoul(std::string(count));
+        return SlowLog::to_json(log.get(n)) + "\n";
+    }
+    
+    // Copies one shard's live entries in slices of slots so the shard lock
+    // is never held for long. A rehash between slices moves entries across
+    // slots, so the shard is restarted rather than risk skipping any.
+    struct SnapshotEntry {
+        std::string key;
+        ValueRef value;         // Referenced, so the value is not copied under the lock
+        long long expiry_at_ms;
+        uint64_t cold_loc = 0;  // Instead of value for a cold entry, read by snapshot_value()
+        ColdLog::Handle segment;
+        ValueKind kind = ValueKind::STRING;
+        Codec codec = Codec::NONE;
+        
+        WalRecordType record_type() const { return set_record_type(kind, codec); }
+    };
+    
+    void snapshot_shard(size_t i, std::vector<SnapshotEntry>& out) {
+        out.clear();
+        size_t pos = 0;
+        size_t seen_capacity = 0;
+        long long now = now_ms();
+        
+        while (true) {
+            std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+            auto& data = shards[i].data;
+            
+            if (data.capacity() != seen_capacity) {
+                seen_capacity = data.capacity();
+                pos = 0;
+                out.clear();
+                out.reserve(data.size());
+            }
+            
+            size_t end = std::min(seen_capacity, pos + COMPACTION_SLICE_SLOTS);
+            for (; pos < end; ++pos) {
+                if (!data.is_full(pos)) {
+                    continue;
+                }
+                const CacheEntry& entry = data.slot(pos).value;
+                if (entry.expiry_at_ms != 0 && entry.expiry_at_ms <= now) {
+                    continue;
+                }
+                if (entry.is_cold()) {
+                    out.push_back({std::string(data.slot(pos).key()), ValueRef(), entry.expiry_at_ms,
+                                   entry.cold_loc(), cold_->hold(entry.cold_loc()), entry.kind, entry.codec});
+                } else {
+                    out.push_back({std::string(data.slot(pos).key()), shards[i].ref(entry), entry.expiry_at_ms,
+                                   0, ColdLog::Handle(), entry.kind, entry.codec});
+                }
+            }
+            
+            if (pos >= seen_capacity) {
+                return;
+            }
+        }
+    }
+    
+    // A snapshot entry's value: its slab bytes, or its cold copy read into
+    // scratch. False if the cold read failed.
+    bool snapshot_value(const SnapshotEntry& entry, std::string& scratch, std::string_view& value) {
+        if (entry.cold_loc == 0) {
+            value = entry.value.view();
+            return true;
+        }
+        scratch.clear();
+        if (!cold_->read(entry.cold_loc, entry.segment, scratch)) {
+            Metrics::instance().cold_read_errors.add();
+            return false;
+        }
+        value = scratch;
+        return true;
+    }
+    
+    // Writes every live entry as a SET, VSET or SET_LZ4 record carrying its absolute expiry.
+    // Only used to convert a legacy text journal, before the WAL is open;
+    // compaction writes a snapshot instead.
+    bool write_compacted_log(const std::string& temp_filename) {
+        std::ofstream temp_journal(temp_filename, std::ios::binary | std::ios::trunc);
+        if (!temp_journal.is_open()) {
+            std::cerr << "Warning: Could not open temp file for compaction" << std::endl;
+            return false;
+        }
+        
+        temp_journal << WriteAheadLog::file_header();
+        
+        std::vector<SnapshotEntry> snapshot;
+        std::string record;
+        std::string scratch;
+        for (size_t i = 0; i < num_shards_; ++i) {
+            snapshot_shard(i, snapshot);
+            for (const SnapshotEntry& entry : snapshot) {
+                std::string_view value;
+                if (!snapshot_value(entry, scratch, value)) {
+                    std::cerr << "Warning: Could not read a cold value for compaction" << std::endl;
+                    return false;
+                }
+                record.clear();
+                WriteAheadLog::encode(record, entry.record_type(), 0, entry.key, value, entry.expiry_at_ms);
+                temp_journal << record;
+            }
+        }
+        
+        temp_journal.close();
+        return temp_journal.good();
+    }
+    
+    // Compaction output: a snapshot of every live entry as of lsn, written
+    // shard by shard with no shard lock held during I/O, and a new WAL with
+    // only the records appended since, drained in between shards. The
+    // snapshot is synced and renamed into place before the WAL is swapped,
+    // so a crash in between leaves it next to the old, complete log, whose
+    // records up to lsn are then skipped.
+    bool write_snapshot(const std::string& temp_log, uint64_t lsn) {
+        std::string temp_snapshot = snapshot_path_ + ".tmp";
+        SnapshotWriter writer(temp_snapshot, static_cast<uint32_t>(num_shards_), lsn);
+        std::ofstream tail(temp_log, std::ios::binary | std::ios::trunc);
+        if (!writer.is_open() || !tail.is_open()) {
+            std::cerr << "Warning: Could not open temp files for compaction" << std::endl;
+            return false;
+        }
+        tail << WriteAheadLog::file_header();
+        
+        std::vector<SnapshotEntry> entries;
+        std::string records;
+        std::string scratch;
+        bool values_ok = true;
+        for (size_t i = 0; i < num_shards_ && values_ok; ++i) {
+            snapshot_shard(i, entries);
+            for (const SnapshotEntry& entry : entries) {
+                std::string_view value;
+                if (!snapshot_value(entry, scratch, value)) {
+                    values_ok = false;
+                    break;
+                }
+                writer.add(entry.key, value, entry.expiry_at_ms, snapshot_flags(entry.kind, entry.codec));
+            }
+            writer.end_section();
+            
+            wal_->drain_rewrite(records);
+            tail << records;
+        }
+        tail.close();
+        
+        if (!values_ok) {
+            std::cerr << "Warning: Could not read a cold value; compaction abandoned" << std::endl;
+            std::remove(temp_snapshot.c_str());
+            return false;
+        }
+        if (!writer.finish() || !tail.good() || std::rename(temp_snapshot.c_str(), snapshot_path_.c_str()) != 0) {
+            std::cerr << "Warning: Failed to write snapshot during compaction" << std::endl;
+            std::remove(temp_snapshot.c_str());
+            return false;
+        }
+        return true;
+    }
+    
+    // Returns whether a snapshot was written. A compaction already running
+    // makes this a no-op, or with wait set, one that runs after it.
+    bool compact(bool wait = false) {
+        bool expected = false;
+        if (!is_compacting_.compare_exchange_strong(expected, true)) {
+            if (!wait) {
+                return false; // Already running
+            }
+            std::unique_lock<std::mutex> lock(compaction_mtx_);
+            compaction_done_.wait(lock, [this]() {
+                bool idle = false;
+                return is_compacting_.compare_exchange_strong(idle, true);
+            });
+        }
+        
+        std::string temp_filename = journal_path_ + ".tmp";
+        uint64_t lsn = wal_->begin_rewrite();
+        bool written = write_snapshot(temp_filename, lsn);
+        if (written) {
+            wal_->finish_rewrite(temp_filename);
+        } else {
+            wal_->abort_rewrite();
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(compaction_mtx_);
+            is_compacting_ = false;
+        }
+        compaction_done_.notify_all();
+        return written;
+    }
+    
+    // COMPACT from a client only schedules the rewrite on the maintenance thread
+    void request_compaction() {
+        compaction_requested_ = true;
+    }
+    
+    // Full sync source: every live entry as SET or VSET records (LSN 0) in chunks of
+    // about SNAPSHOT_CHUNK_BYTES, shard by shard, sliced like compaction so
+    // writers are never held up for long. The result is fuzzy; a replica
+    // replays the backlog from an offset taken before the call on top of it,
+    // which, as with compaction, leaves every key at its newest version.
+    void snapshot(const std::function<void(const std::string&)>& sink) {
+        std::vector<SnapshotEntry> entries;
+        std::string chunk;
+        std::string scratch;
+        for (size_t i = 0; i < num_shards_; ++i) {
+            snapshot_shard(i, entries);
+            for (const SnapshotEntry& entry : entries) {
+                std::string_view value;
+                if (!snapshot_value(entry, scratch, value)) {
+                    std::cerr << "Warning: Full sync skips key " << entry.key << ", whose cold copy is unreadable" << std::endl;
+                    continue;
+                }
+                WriteAheadLog::encode(chunk, entry.record_type(), 0, entry.key, value, entry.expiry_at_ms);
+                if (chunk.size() >= SNAPSHOT_CHUNK_BYTES) {
+                    sink(chunk);
+                    chunk.clear();
+                }
+            }
+        }
+        if (!chunk.empty()) {
+            sink(chunk);
+        }
+    }
+    
+    // Replica apply path: records from the primary's log, keeping their
+    // absolute expiries, grouped and locked per shard like apply_writes().
+    // No budget is enforced, since the primary's evictions arrive as DELs.
+    // The records are logged locally, a MULTI again as one record; returns
+    // the last local LSN.
+    uint64_t apply_replicated(const std::vector<WalRecord>& records) {
+        struct Write {
+            size_t shard;
+            size_t index; // Into `flat`
+            uint64_t hash;
+        };
+        thread_local std::vector<Write> order;
+        thread_local std::vector<std::pair<WalRecord, size_t>> flat; // With the index of its record
+        thread_local std::vector<WalBatch> logs;                     // By record
+        thread_local WalBatch log;
+        order.clear();
+        flat.clear();
+        log.clear();
+        
+        for (size_t i = 0; i < records.size(); ++i) {
+            WriteAheadLog::for_each(records[i], [&](const WalRecord& rec) { flat.emplace_back(rec, i); });
+        }
+        logs.resize(std::max(logs.size(), records.size()));
+        for (size_t i = 0; i < records.size(); ++i) {
+            logs[i].clear();
+        }
+        for (size_t i = 0; i < flat.size(); ++i) {
+            uint64_t hash = hash_key(flat[i].first.key);
+            order.push_back({shard_for(hash), i, hash});
+        }
+        if (order.empty()) {
+            return 0;
+        }
+        std::sort(order.begin(), order.end(), [](const Write& a, const Write& b) {
+            return a.shard != b.shard ? a.shard < b.shard : a.index < b.index;
+        });
+        
+        std::vector<std::unique_lock<std::shared_mutex>> locks;
+        for (size_t i = 0; i < order.size(); ++i) {
+            if (i == 0 || order[i].shard != order[i - 1].shard) {
+                locks.emplace_back(shards[order[i].shard].mtx);
+            }
+        }
+        
+        long long now = now_ms();
+        for (const Write& w : order) {
+            const WalRecord& rec = flat[w.index].first;
+            Shard& shard = shards[w.shard];
+            WalBatch& out = logs[flat[w.index].second];
+            if (rec.type == WalRecordType::DEL || (rec.expiry_at_ms != 0 && rec.expiry_at_ms <= now)) {
+                if (shard.erase(rec.key, w.hash)) {
+                    out.add_del(rec.key);
+                }
+                continue;
+            }
+            CacheEntry meta;
+            meta.expiry_at_ms = rec.expiry_at_ms;
+            meta.set_record_type(rec.type);
+            init_access(meta, now);
+            shard.put(rec.key, w.hash, rec.value, meta);
+            out.add(rec.type, rec.key, rec.value, rec.expiry_at_ms);
+        }
+        for (size_t i = 0; i < records.size(); ++i) {
+            log.add_group(logs[i]);
+        }
+        return wal_->append_batch(log);
+    }
+    
+    // Drops every key without logging, ahead of a full sync; the sync is
+    // followed by a compaction, which replaces the log with what it loaded
+    void clear() {
+        for (size_t i = 0; i < num_shards_; ++i) {
+            std::lock_guard<std::shared_mutex> lock(shards[i].mtx);
+            auto& data = shards[i].data;
+            for (size_t slot = 0; slot < data.capacity(); ++slot) {
+                if (data.is_full(slot)) {
+                    shards[i].erase_at(slot);
+                }
+            }
+        }
+    }
+    
+    void attach_backlog(ReplicationBacklog* backlog) {
+        wal_->attach_backlog(backlog);
+        replicated_ = backlog != nullptr;
+    }
+    
+    bool contains(std::string_view key) {
+        uint64_t hash = hash_key(key);
+        Shard& shard = shards[shard_for(hash)];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        size_t slot = shard.data.find(key, hash);
+        return slot != Shard::Map::npos && !shard.data.slot(slot).value.is_expired(now_ms());
+    }
+    
+    // Counts live keys that match accepts, up to limit, copying them into
+    // out if given. Shards are read in slices like snapshot_shard(), and a
+    // rehash between slices restarts the shard.
+    size_t scan_keys(const std::function<bool(std::string_view)>& match, size_t limit, std::vector<std::string>* out) {
+        size_t found = 0;
+        long long now = now_ms();
+        for (size_t i = 0; i < num_shards_ && found < limit; ++i) {
+            size_t found_before = found;
+            size_t out_before = out ? out->size() : 0;
+            size_t pos = 0;
+            size_t seen_capacity = 0;
+            
+            while (found < limit) {
+                std::shared_lock<std::shared_mutex> lock(shards[i].mtx);
+                auto& data = shards[i].data;
+                if (data.capacity() != seen_capacity) {
+                    seen_capacity = data.capacity();
+                    pos = 0;
+                    found = found_before;
+                    if (out) {
+                        out->resize(out_before);
+                    }
+                }
+                
+                size_t end = std::min(seen_capacity, pos + COMPACTION_SLICE_SLOTS);
+                for (; pos < end && found < limit; ++pos) {
+                    if (!data.is_full(pos) || data.slot(pos).value.is_expired(now)) {
+                        continue;
+                    }
+                    std::string_view key = data.slot(pos).key();
+                    if (match(key)) {
+                        found++;
+                        if (out) {
+                            out->emplace_back(key);
+                        }
+                    }
+                }
+                if (pos >= seen_capacity) {
+                    break;
+                }
+            }
+        }
+        return found;
+    }
+    
+    // Cluster migration. Keys are grouped by shard; each group is copied
+    // under the shared lock, holding a reference to every value (or a pin on
+    // its cold segment), then encoded and handed to transfer() as SET or VSET
+    // records with their absolute expiry with the lock released, since
+    // transfer() waits on the target. Back under the exclusive lock, an entry
+    // whose value and expiry are unchanged is erased (logged as a DEL); one
+    // rewritten in between is sent again. Missing and expired keys are
+    // skipped. Returns how many moved, or -1 once a transfer fails or a key
+    // keeps changing; that group and the ones after it stay here.
+    long long move_keys(const std::vector<std::string>& keys, const std::function<bool(const std::string&)>& transfer) {
+        struct Move {
+            size_t shard;
+            size_t index;
+            uint64_t hash;
+        };
+        struct Copy {
+            const Move* move;
+            uintptr_t value_word; // The entry's value when copied, pinned by ref or segment
+            long long expiry_at_ms;
+            WalRecordType type;
+            ValueRef ref;
+            ColdLog::Handle segment;
+        };
+        static constexpr int MOVE_ATTEMPTS = 3;
+        
+        std::vector<Move> order;
+        order.reserve(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            uint64_t hash = hash_key(keys[i]);
+            order.push_back({shard_for(hash), i, hash});
+        }
+        std::sort(order.begin(), order.end(), [](const Move& a, const Move& b) {
+            return a.shard != b.shard ? a.shard < b.shard : a.index < b.index;
+        });
+        
+        long long moved = 0;
+        std::string records;
+        std::string scratch;
+        std::vector<const Move*> pending;
+        std::vector<Copy> copies;
+        WalBatch log;
+        for (size_t begin = 0; begin < order.size(); ) {
+            size_t end = begin;
+            while (end < order.size() && order[end].shard == order[begin].shard) {
+                ++end;
+            }
+            Shard& shard = shards[order[begin].shard];
+            pending.clear();
+            for (size_t i = begin; i < end; ++i) {
+                pending.push_back(&order[i]);
+            }
+            
+            for (int attempt = 0; !pending.empty(); ++attempt) {
+                if (attempt == MOVE_ATTEMPTS) {
+                    return -1;
+                }
+                copies.clear();
+                {
+                    std::shared_lock<std::shared_mutex> lock(shard.mtx);
+                    long long now = now_ms();
+                    for (const Move* m : pending) {
+                        size_t slot = shard.data.find(keys[m->index], m->hash);
+                        if (slot == Shard::Map::npos || shard.data.slot(slot).value.is_expired(now)) {
+                            continue;
+                        }
+                        const CacheEntry& entry = shard.data.slot(slot).value;
+                        copies.push_back({m, entry.value_word, entry.expiry_at_ms,
+                                          set_record_type(entry.kind, entry.codec), ValueRef(), ColdLog::Handle()});
+                        if (entry.is_cold()) {
+                            copies.back().segment = cold_->hold(entry.cold_loc());
+                        } else {
+                            copies.back().ref = shard.ref(entry);
+                        }
+                    }
+                }
+                pending.clear();
+                
+                records.clear();
+                for (Copy& c : copies) {
+                    const std::string& key = keys[c.move->index];
+                    std::string_view value;
+                    if (ColdLog::is_cold(c.value_word)) {
+                        scratch.clear();
+                        if (!cold_->read(c.value_word, c.segment, scratch)) {
+                            Metrics::instance().cold_read_errors.add();
+                            std::cerr << "Warning: Key " << key << " stays here, its cold copy is unreadable" << std::endl;
+                            c.move = nullptr;
+                            continue;
+                        }
+                        value = scratch;
+                    } else {
+                        value = c.ref.view();
+                    }
+                    WriteAheadLog::encode(records, c.type, 0, key, value, c.expiry_at_ms);
+                }
+                if (records.empty()) {
+                    break;
+                }
+                if (!transfer(records)) {
+                    return -1;
+                }
+                
+                log.clear();
+                long long erased = 0;
+                {
+                    std::unique_lock<std::shared_mutex> lock(shard.mtx);
+                    for (const Copy& c : copies) {
+                        if (c.move == nullptr) {
+                            continue;
+                        }
+                        const std::string& key = keys[c.move->index];
+                        size_t slot = shard.data.find(key, c.move->hash);
+                        if (slot == Shard::Map::npos) {
+                            continue; // Expired or evicted since the copy
+                        }
+                        const CacheEntry& entry = shard.data.slot(slot).value;
+                        if (entry.value_word != c.value_word || entry.expiry_at_ms != c.expiry_at_ms) {
+                            pending.push_back(c.move); // Rewritten, spilled or promoted since the copy
+                            continue;
+                        }
+                        shard.erase_at(slot);
+                        log.add_del(key);
+                        erased++;
+                    }
+                }
+                copies.clear();
+                wal_->append_batch(log);
+                moved += erased;
+            }
+            begin = end;
+        }
+        return moved;
+    }
+    
+    std::atomic<bool> read_only_{false};
+    std::function<void(std::string&)> role_reporter_;
+};
+
+const std::string& write_error(WriteStatus status) {
+    static const std::string oom = "ERROR: OOM command not allowed when used memory > maxmemory\n";
+    static const std::string bad_vector = "ERROR: VSET takes 1 to " + std::to_string(MAX_VECTOR_DIMS) + " finite numbers\n";
+    static const std::string io_error = "ERROR: MISCONF journal write failed, writes are refused until a restart\n";
+    static const std::string none;
+    switch (status) {
+        case WriteStatus::OOM: return oom;
+        case WriteStatus::BAD_VECTOR: return bad_vector;
+        case WriteStatus::IO_ERROR: return io_error;
+        default: return none;
+    }
+}
+
+KVStore::KVStore(const std::string& filename, const StoreOptions& options)
+    : filename_(filename), impl_(new Impl(filename, options)) {}
+
+KVStore::~KVStore() {
+    delete impl_;
+}
+
+void KVStore::compact() {
+    impl_->compact();
+}
+
+KVStore::ImportResult KVStore::import_file(const std::string& path) {
+    return impl_->import_file(path);
+}
+
+void KVStore::import_command(std::string_view file, std::function<void(std::string)> done) {
+    impl_->import_command(file, std::move(done));
+}
+
+void KVStore::set_import_filter(std::function<bool(std::string_view)> accept) {
+    impl_->import_filter_ = std::move(accept);
+}
+
+std::vector<std::string> KVStore::mget(const std::vector<std::string>& keys) {
+    return impl_->mget(keys);
+}
+
+std::string KVStore::execute(const ParsedCommand& cmd) {
+    std::string out;
+    impl_->execute(cmd, out);
+    return out;
+}
+
+std::string KVStore::execute(const CommandView& cmd) {
+    std::string out;
+    impl_->execute(cmd, out);
+    return out;
+}
+
+void KVStore::execute(const ParsedCommand& cmd, std::string& out) {
+    impl_->execute(cmd, out);
+}
+
+void KVStore::execute(const CommandView& cmd, std::string& out) {
+    impl_->execute(cmd, out);
+}
+
+uint64_t KVStore::apply_batch(const std::vector<ParsedCommand>& ops, std::vector<WriteStatus>* status) {
+    return impl_->apply_batch(ops, status);
+}
+
+bool KVStore::wait_durable(uint64_t lsn) {
+    return impl_->wait_durable(lsn);
+}
+
+size_t KVStore::shard_count() const {
+    return impl_->num_shards_;
+}
+
+size_t KVStore::shard_of(std::string_view key) const {
+    return impl_->get_shard_index(key);
+}
+
+void KVStore::snapshot(const std::function<void(const std::string&)>& sink) {
+    impl_->snapshot(sink);
+}
+
+uint64_t KVStore::apply_replicated(const std::vector<WalRecord>& records) {
+    return impl_->apply_replicated(records);
+}
+
+void KVStore::clear() {
+    impl_->clear();
+}
+
+void KVStore::request_compaction() {
+    impl_->request_compaction();
+}
+
+void KVStore::attach_backlog(ReplicationBacklog* backlog) {
+    impl_->attach_backlog(backlog);
+}
+
+void KVStore::set_read_only(bool read_only) {
+    impl_->read_only_ = read_only;
+}
+
+bool KVStore::read_only() const {
+    return impl_->read_only_.load(std::memory_order_relaxed);
+}
+
+void KVStore::set_role_reporter(std::function<void(std::string&)> reporter) {
+    impl_->role_reporter_ = std::move(reporter);
+}
+
+bool KVStore::contains(std::string_view key) {
+    return impl_->contains(key);
+}
+
+size_t KVStore::scan_keys(const std::function<bool(std::string_view)>& match, size_t limit, std::vector<std::string>* out) {
+    return impl_->scan_keys(match, limit, out);
+}
+
+long long KVStore::move_keys(const std::vector<std::string>& keys, const std::function<bool(const std::string&)>& transfer) {
+    return impl_->move_keys(keys, transfer);
+}
+
+void KVStore::localize_shard(size_t shard) {
+    impl_->localize_shard(shard);
+}
+
+void KVStore::mget_values(const std::vector<std::string_view>& keys, std::string& bytes, std::vector<size_t>& sizes) {
+    impl_->mget_values(keys, bytes, sizes);
+}
@@ -1,16 +1,128 @@
 #pragma once
 
+#include <functional>
 #include <string>
+#include <string_view>
+#include <vector>
 #include "../protocol/command.h"
+#include "wal.h"
+
+enum class EvictionPolicy {
+    NOEVICTION,  // Refuse SETs once the budget is reached
+    ALLKEYS_LRU, // Evict the longest idle of a random sample
+    ALLKEYS_LFU  // Evict the least frequently used of a random sample
+};
+
+struct StoreOptions {
+    FsyncPolicy fsync_policy = FsyncPolicy::EVERYSEC;
+    size_t maxmemory_bytes = 0; // 0 = unlimited
+    EvictionPolicy eviction_policy = EvictionPolicy::ALLKEYS_LRU;
+    size_t shard_count = 16; // Power of two; each shard has its own lock
+    // Tiered storage: with a directory, values beyond tier_memory_bytes of
+    // entry memory move to a cold log there, idlest first
+    std::string tier_path;
+    size_t tier_memory_bytes = 0;
+    // SET values at least this large are stored LZ4-compressed when that
+    // saves an eighth or more; 0 = off
+    size_t compress_min_bytes = 0;
+    // Keys GETs hit most are tracked, up to this many (at most 64), and
+    // served from per-thread copies; 0 = off
+    size_t hot_keys = 16;
+    // IMPORT <name> reads <import_dir>/<name>; empty = IMPORT disabled
+    std::string import_dir;
+};
+
+// Outcome of one write command, reported per op by apply_batch()
+enum class WriteStatus : uint8_t {
+    OK,
+    OOM,        // A SET refused under noeviction
+    BAD_VECTOR, // A VSET without 1 to MAX_VECTOR_DIMS finite numbers
+    IO_ERROR    // The WAL failed (see WriteAheadLog::failed()), or did before the write was durable
+};
+
+// The error line (newline included) the client gets for a failed write,
+// the same through the WriteBatcher as on the direct path
+const std::string& write_error(WriteStatus status);
 
 class KVStore {
 public:
-    KVStore(const std::string& filename);
+    KVStore(const std::string& filename, const StoreOptions& options = StoreOptions());
     ~KVStore();
     
     std::string execute(const ParsedCommand& cmd);
+    std::string execute(const CommandView& cmd);
+    // Append the reply to out instead, so a connection can reuse one buffer
+    // and GET/MGET copy values straight into it
+    void execute(const ParsedCommand& cmd, std::string& out);
+    void execute(const CommandView& cmd, std::string& out);
     void compact();
+    
+    // Bulk load of a dump file (see dump.h) that bypasses the command path
+    // and the WAL, then compacts so the keys are durable once it returns.
+    // Records the filter rejects are skipped; a cluster node keeps the keys
+    // of its own slots. A second import while one runs fails, and so does
+    // one once a replication backlog is attached, as replicas would miss it.
+    struct ImportResult {
+        size_t imported = 0;
+        size_t skipped = 0;  // Malformed, expired or filtered out
+        size_t refused = 0;  // Over maxmemory under noeviction
+        long long ms = 0;
+        std::string error;   // Empty on success
+    };
+    ImportResult import_file(const std::string& path);
+    void set_import_filter(std::function<bool(std::string_view)> accept);
+    // IMPORT <file> from a client: runs the import on the maintenance
+    // thread, never the caller's, and calls done there with the reply once
+    // it finishes. A refused IMPORT calls done at once, on the caller's thread.
+    void import_command(std::string_view file, std::function<void(std::string)> done);
+    
     std::vector<std::string> mget(const std::vector<std::string>& keys);
+    
+    // Applies SET/DEL/MSET commands with one lock acquisition per touched shard
+    // and one WAL append for the batch. Returns the batch's last LSN, which
+    // wait_durable() blocks on; with status, also each op's outcome.
+    uint64_t apply_batch(const std::vector<ParsedCommand>& ops, std::vector<WriteStatus>* status = nullptr);
+    bool wait_durable(uint64_t lsn); // False if the WAL failed first
+    
+    // Routing for callers that partition shards between threads
+    size_t shard_count() const;
+    size_t shard_of(std::string_view key) const;
+    
+    // Rebuilds the shard's table on the calling thread, for a thread pinned
+    // to a NUMA node that owns the shard. Values stay where they were written.
+    void localize_shard(size_t shard);
+    
+    // Replication. The primary attaches a backlog to its WAL and builds full
+    // syncs from snapshot(), which hands sink chunks of SET records. A replica
+    // is read-only to clients: it clear()s before a full sync, applies the
+    // primary's records with apply_replicated() (returns the last local LSN)
+    // and compacts its own log once the sync has loaded.
+    void attach_backlog(ReplicationBacklog* backlog);
+    void snapshot(const std::function<void(const std::string&)>& sink);
+    uint64_t apply_replicated(const std::vector<WalRecord>& records);
+    void clear();
+    void request_compaction();
+    void set_read_only(bool read_only);
+    bool read_only() const;
+    
+    // ROLE replies with what the reporter appends (one JSON object)
+    void set_role_reporter(std::function<void(std::string&)> reporter);
+    
+    // Cluster slot support. contains() is true for a live key; scan_keys()
+    // counts the live keys match accepts, up to limit, copying them into out
+    // if given; move_keys() hands keys to transfer() shard group by shard
+    // group as SET records, without holding the shard lock, and erases the
+    // ones left unchanged once it returns true, returning how many moved or
+    // -1 if a transfer failed.
+    bool contains(std::string_view key);
+    size_t scan_keys(const std::function<bool(std::string_view)>& match, size_t limit, std::vector<std::string>* out);
+    long long move_keys(const std::vector<std::string>& keys, const std::function<bool(const std::string&)>& transfer);
+    
+    // MGET that appends each value to bytes and its size to sizes (MISS for
+    // a missing or expired key) instead of formatting a reply. The keys are
+    // read under their shard locks together, as in MGET.
+    static constexpr size_t MISS = static_cast<size_t>(-1);
+    void mget_values(const std::vector<std::string_view>& keys, std::string& bytes, std::vector<size_t>& sizes);
 
 private:
     void set(const std::string& key, const std::string& value);
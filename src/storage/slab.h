@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Size-class allocator for one shard's value bytes and long keys. Requests
+// are rounded up to a class: multiples of 16 up to 128 bytes, then four
+// classes per power of two (at most 25% waste) up to MAX_CLASS_SIZE. Each
+// class carves chunks out of its own pages with a bump pointer and recycles
+// freed chunks through an intrusive free list, so steady-state SETs and
+// overwrites never reach malloc. A class's pages start small and double up to
+// MAX_PAGE_BYTES, keeping the footprint of sparsely used classes (and of
+// stores with many shards) low. Larger requests get their own allocation.
+//
+// Pages are kept until the allocator is destroyed: used_bytes() versus
+// reserved_bytes() shows how much of the reservation is free chunks.
+// Not thread-safe; the owning shard serializes calls under its exclusive lock.
+class SlabAllocator {
+public:
+    static constexpr size_t MAX_CLASS_SIZE = 64 * 1024;
+    static constexpr size_t MIN_PAGE_BYTES = 4096;
+    static constexpr size_t MAX_PAGE_BYTES = 1024 * 1024;
+    static constexpr size_t MIN_PAGE_CHUNKS = 4;
+
+    SlabAllocator() = default;
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    ~SlabAllocator() {
+        for (Class& c : classes_) {
+            while (c.pages != nullptr) {
+                Page* next = c.pages->next;
+                ::operator delete(c.pages);
+                c.pages = next;
+            }
+        }
+        while (large_ != nullptr) {
+            Large* next = large_->next;
+            ::operator delete(large_);
+            large_ = next;
+        }
+    }
+
+    // n must be non-zero; pass the same n to deallocate()
+    char* allocate(size_t n) {
+        if (n > MAX_CLASS_SIZE) {
+            return allocate_large(n);
+        }
+
+        size_t idx = class_of(n);
+        Class& c = classes_[idx];
+        size_t size = class_size(idx);
+        used_bytes_ += size;
+
+        if (c.free_list != nullptr) {
+            FreeChunk* chunk = c.free_list;
+            c.free_list = chunk->next;
+            return reinterpret_cast<char*>(chunk);
+        }
+        if (c.cursor == nullptr || static_cast<size_t>(c.end - c.cursor) < size) {
+            add_page(c, size);
+        }
+        char* out = c.cursor;
+        c.cursor += size;
+        return out;
+    }
+
+    void deallocate(char* p, size_t n) {
+        if (n > MAX_CLASS_SIZE) {
+            deallocate_large(p, n);
+            return;
+        }
+
+        size_t idx = class_of(n);
+        used_bytes_ -= class_size(idx);
+        FreeChunk* chunk = reinterpret_cast<FreeChunk*>(p);
+        chunk->next = classes_[idx].free_list;
+        classes_[idx].free_list = chunk;
+    }
+
+    // Bytes charged for an n-byte request; 0 for n == 0
+    static size_t chunk_size(size_t n) {
+        if (n == 0) {
+            return 0;
+        }
+        if (n > MAX_CLASS_SIZE) {
+            return n + sizeof(Large);
+        }
+        return class_size(class_of(n));
+    }
+
+    // True when n and m bytes share a chunk size, so one can be rewritten
+    // in place of the other
+    static bool same_chunk(size_t n, size_t m) {
+        return n <= MAX_CLASS_SIZE && m <= MAX_CLASS_SIZE && chunk_size(n) == chunk_size(m);
+    }
+
+    size_t used_bytes() const { return used_bytes_; }          // Chunks handed out
+    size_t reserved_bytes() const { return reserved_bytes_; }  // Pages and large allocations
+
+private:
+    static constexpr size_t SMALL_STEP = 16;
+    static constexpr size_t SMALL_LIMIT = 128;
+    static constexpr size_t SMALL_CLASSES = SMALL_LIMIT / SMALL_STEP;
+    static constexpr size_t STEPS_PER_DOUBLING = 4;
+    static constexpr size_t SMALL_LIMIT_LOG2 = 7;
+    static constexpr size_t MAX_CLASS_LOG2 = 16;
+    static constexpr size_t CLASS_COUNT = SMALL_CLASSES + (MAX_CLASS_LOG2 - SMALL_LIMIT_LOG2) * STEPS_PER_DOUBLING;
+
+    static_assert(SMALL_LIMIT == size_t(1) << SMALL_LIMIT_LOG2, "small classes end at a power of two");
+    static_assert(MAX_CLASS_SIZE == size_t(1) << MAX_CLASS_LOG2, "classes end at a power of two");
+
+    struct FreeChunk {
+        FreeChunk* next;
+    };
+
+    // Header of each page; chunks follow it
+    struct alignas(16) Page {
+        Page* next;
+    };
+
+    // Header of a large allocation, linked so the destructor can free it
+    struct alignas(16) Large {
+        Large* prev;
+        Large* next;
+    };
+
+    struct Class {
+        FreeChunk* free_list = nullptr;
+        char* cursor = nullptr;     // Next uncarved chunk in the newest page
+        char* end = nullptr;
+        Page* pages = nullptr;
+        size_t next_page_bytes = 0;
+    };
+
+    static size_t class_of(size_t n) {
+        if (n <= SMALL_LIMIT) {
+            return (n + SMALL_STEP - 1) / SMALL_STEP - 1;
+        }
+        // 2^p < n <= 2^(p+1); the doubling is split into four equal steps
+        size_t p = 63 - __builtin_clzll(static_cast<unsigned long long>(n - 1));
+        size_t step_log2 = p - 2;
+        return SMALL_CLASSES + (p - SMALL_LIMIT_LOG2) * STEPS_PER_DOUBLING +
+               ((n - 1 - (size_t(1) << p)) >> step_log2);
+    }
+
+    static size_t class_size(size_t idx) {
+        if (idx < SMALL_CLASSES) {
+            return (idx + 1) * SMALL_STEP;
+        }
+        size_t p = SMALL_LIMIT_LOG2 + (idx - SMALL_CLASSES) / STEPS_PER_DOUBLING;
+        size_t k = (idx - SMALL_CLASSES) % STEPS_PER_DOUBLING;
+        return (size_t(1) << p) + (k + 1) * (size_t(1) << (p - 2));
+    }
+
+    void add_page(Class& c, size_t size) {
+        size_t bytes = c.next_page_bytes;
+        if (bytes == 0) {
+            bytes = MIN_PAGE_BYTES;
+        }
+        if (bytes < size * MIN_PAGE_CHUNKS) {
+            bytes = size * MIN_PAGE_CHUNKS;
+        }
+        c.next_page_bytes = bytes < MAX_PAGE_BYTES ? bytes * 2 : bytes;
+
+        // The unused tail of the previous page is given up
+        Page* page = static_cast<Page*>(::operator new(sizeof(Page) + bytes));
+        page->next = c.pages;
+        c.pages = page;
+        c.cursor = reinterpret_cast<char*>(page + 1);
+        c.end = c.cursor + bytes;
+        reserved_bytes_ += sizeof(Page) + bytes;
+    }
+
+    char* allocate_large(size_t n) {
+        Large* block = static_cast<Large*>(::operator new(sizeof(Large) + n));
+        block->prev = nullptr;
+        block->next = large_;
+        if (large_ != nullptr) {
+            large_->prev = block;
+        }
+        large_ = block;
+        used_bytes_ += sizeof(Large) + n;
+        reserved_bytes_ += sizeof(Large) + n;
+        return reinterpret_cast<char*>(block + 1);
+    }
+
+    void deallocate_large(char* p, size_t n) {
+        Large* block = reinterpret_cast<Large*>(p) - 1;
+        if (block->prev != nullptr) {
+            block->prev->next = block->next;
+        } else {
+            large_ = block->next;
+        }
+        if (block->next != nullptr) {
+            block->next->prev = block->prev;
+        }
+        used_bytes_ -= sizeof(Large) + n;
+        reserved_bytes_ -= sizeof(Large) + n;
+        ::operator delete(block);
+    }
+
+    Class classes_[CLASS_COUNT];
+    Large* large_ = nullptr;
+    size_t used_bytes_ = 0;
+    size_t reserved_bytes_ = 0;
+};
@@ -0,0 +1,245 @@
+#include "snapshot.h"
+#include "crc32c.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = {'M', 'K', 'V', 'S', 'N', 'P', '0', '1'};
+
+inline void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline void put_u64(char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+inline uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+bool write_all(int fd, const char* data, size_t len, off_t* at = nullptr) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = at ? ::pwrite(fd, data + written, len - written, *at + written)
+                       : ::write(fd, data + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+SnapshotWriter::SnapshotWriter(const std::string& path, uint32_t sections, uint64_t lsn)
+    : lsn_(lsn), sections_(sections) {
+    offset_ = SnapshotReader::HEADER_BYTES + sections * SnapshotReader::TABLE_ENTRY_BYTES;
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Warning: Could not create snapshot " << path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    // Sections start after the header and table, which finish() fills in
+    if (::lseek(fd_, static_cast<off_t>(offset_), SEEK_SET) < 0) {
+        ok_ = false;
+    }
+    if (!sections_.empty()) {
+        sections_[0].offset = offset_;
+    }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void SnapshotWriter::add(std::string_view key, std::string_view value, long long expiry_at_ms, uint32_t flags) {
+    if (current_ >= sections_.size()) {
+        ok_ = false;
+        return;
+    }
+    size_t start = buffer_.size();
+    buffer_.resize(start + SnapshotReader::ENTRY_FIXED + key.size() + value.size());
+    char* p = &buffer_[start];
+    put_u64(p, static_cast<uint64_t>(expiry_at_ms));
+    put_u32(p + 8, static_cast<uint32_t>(key.size()));
+    put_u32(p + 12, static_cast<uint32_t>(value.size()) | (flags & SnapshotReader::FLAGS));
+    if (!key.empty()) std::memcpy(p + SnapshotReader::ENTRY_FIXED, key.data(), key.size());
+    if (!value.empty()) std::memcpy(p + SnapshotReader::ENTRY_FIXED + key.size(), value.data(), value.size());
+    
+    Section& s = sections_[current_];
+    s.crc = crc32c(p, buffer_.size() - start, s.crc);
+    s.entries++;
+    if (buffer_.size() >= FLUSH_BYTES) {
+        flush();
+    }
+}
+
+void SnapshotWriter::end_section() {
+    if (current_ >= sections_.size()) {
+        ok_ = false;
+        return;
+    }
+    uint64_t end = offset_ + buffer_.size();
+    sections_[current_].bytes = end - sections_[current_].offset;
+    if (++current_ < sections_.size()) {
+        sections_[current_].offset = end;
+    }
+}
+
+bool SnapshotWriter::flush() {
+    if (ok_ && fd_ >= 0 && !write_all(fd_, buffer_.data(), buffer_.size())) {
+        ok_ = false;
+    }
+    offset_ += buffer_.size();
+    buffer_.clear();
+    return ok_;
+}
+
+bool SnapshotWriter::finish() {
+    if (fd_ < 0) {
+        return false;
+    }
+    if (current_ != sections_.size()) {
+        ok_ = false;
+    }
+    flush();
+    
+    std::string head(SnapshotReader::HEADER_BYTES + sections_.size() * SnapshotReader::TABLE_ENTRY_BYTES, '\0');
+    long long created_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::memcpy(&head[0], SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    put_u32(&head[8], static_cast<uint32_t>(sections_.size()));
+    put_u64(&head[12], lsn_);
+    put_u64(&head[20], static_cast<uint64_t>(created_ms));
+    char* table = &head[SnapshotReader::HEADER_BYTES];
+    for (size_t i = 0; i < sections_.size(); ++i) {
+        char* t = table + i * SnapshotReader::TABLE_ENTRY_BYTES;
+        put_u64(t, sections_[i].offset);
+        put_u64(t + 8, sections_[i].bytes);
+        put_u64(t + 16, sections_[i].entries);
+        put_u32(t + 24, sections_[i].crc);
+    }
+    // The header checksum skips its own field
+    uint32_t crc = crc32c(head.data(), SnapshotReader::HEADER_BYTES - 4);
+    crc = crc32c(table, head.size() - SnapshotReader::HEADER_BYTES, crc);
+    put_u32(&head[SnapshotReader::HEADER_BYTES - 4], crc);
+    
+    off_t at = 0;
+    if (ok_ && !write_all(fd_, head.data(), head.size(), &at)) {
+        ok_ = false;
+    }
+#if defined(__linux__)
+    if (ok_ && ::fdatasync(fd_) != 0) {
+        ok_ = false;
+    }
+#else
+    if (ok_ && ::fsync(fd_) != 0) {
+        ok_ = false;
+    }
+#endif
+    ::close(fd_);
+    fd_ = -1;
+    return ok_;
+}
+
+SnapshotReader::SnapshotReader(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(HEADER_BYTES)) {
+        std::cerr << "Warning: Snapshot " << path << " is truncated, ignoring it" << std::endl;
+        ::close(fd);
+        return;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Warning: mmap of snapshot " << path << " failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    madvise(mapping, size, MADV_WILLNEED);
+    const char* base = static_cast<const char*>(mapping);
+    
+    uint32_t count = get_u32(base + 8);
+    size_t head_bytes = HEADER_BYTES + static_cast<size_t>(count) * TABLE_ENTRY_BYTES;
+    bool ok = std::memcmp(base, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 && head_bytes <= size;
+    if (ok) {
+        uint32_t crc = crc32c(base, HEADER_BYTES - 4);
+        crc = crc32c(base + HEADER_BYTES, head_bytes - HEADER_BYTES, crc);
+        ok = crc == get_u32(base + HEADER_BYTES - 4);
+    }
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        const char* t = base + HEADER_BYTES + i * TABLE_ENTRY_BYTES;
+        Section s{get_u64(t), get_u64(t + 8), get_u64(t + 16), get_u32(t + 24)};
+        ok = s.offset >= head_bytes && s.offset <= size && s.bytes <= size - s.offset;
+        sections_.push_back(s);
+    }
+    if (!ok) {
+        std::cerr << "Warning: Snapshot " << path << " has a damaged header, ignoring it" << std::endl;
+        sections_.clear();
+        munmap(mapping, size);
+        return;
+    }
+    
+    base_ = base;
+    size_ = size;
+    lsn_ = get_u64(base + 12);
+    created_ms_ = static_cast<long long>(get_u64(base + 20));
+}
+
+SnapshotReader::~SnapshotReader() {
+    if (base_) {
+        munmap(const_cast<char*>(base_), size_);
+    }
+}
+
+bool SnapshotReader::for_each(size_t section,
+                              const std::function<void(std::string_view, std::string_view, long long, uint32_t)>& fn) const {
+    const Section& s = sections_[section];
+    const char* p = base_ + s.offset;
+    const char* end = p + s.bytes;
+    if (crc32c(p, s.bytes) != s.crc) {
+        return false;
+    }
+    
+    for (uint64_t n = 0; n < s.entries; ++n) {
+        if (static_cast<size_t>(end - p) < ENTRY_FIXED) {
+            return false;
+        }
+        long long expiry_at_ms = static_cast<long long>(get_u64(p));
+        size_t key_len = get_u32(p + 8);
+        uint32_t value_word = get_u32(p + 12);
+        size_t value_len = value_word & ~FLAGS;
+        p += ENTRY_FIXED;
+        if (static_cast<size_t>(end - p) < key_len + value_len) {
+            return false;
+        }
+        fn(std::string_view(p, key_len), std::string_view(p + key_len, value_len), expiry_at_ms,
+           value_word & FLAGS);
+        p += key_len + value_len;
+    }
+    return p == end;
+}
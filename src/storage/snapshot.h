@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Point-in-time binary snapshot of the store, written by compaction next to
+// the WAL, which then only keeps records newer than the snapshot's LSN.
+//
+// File layout, all integers little-endian:
+//   header  = 8-byte magic | u32 section_count | u64 lsn | i64 created_ms | u32 crc32c(header + table)
+//   table   = section_count x (u64 offset | u64 bytes | u64 entries | u32 crc32c(section))
+//   section = entries x (i64 expiry_at_ms | u32 key_len | u32 value_len | key | value)
+// The top bits of value_len are flags: VECTOR_FLAG marks a value written by
+// VSET, LZ4_FLAG one stored as an LZ4 frame.
+// Section i holds shard i's entries, so a loader with the same shard count
+// can size each shard's table up front and build the shards independently.
+// The header and table are written last; a snapshot is renamed into place
+// only once it is complete and synced.
+class SnapshotWriter {
+public:
+    SnapshotWriter(const std::string& path, uint32_t sections, uint64_t lsn);
+    ~SnapshotWriter();
+    
+    bool is_open() const { return fd_ >= 0; }
+    
+    // Entries go into the current section; end_section() moves to the next
+    void add(std::string_view key, std::string_view value, long long expiry_at_ms, uint32_t flags = 0);
+    void end_section();
+    
+    // Writes the header and table, syncs and closes. False if any write failed.
+    bool finish();
+
+private:
+    struct Section {
+        uint64_t offset = 0;
+        uint64_t bytes = 0;
+        uint64_t entries = 0;
+        uint32_t crc = 0;
+    };
+    
+    bool flush();
+    
+    int fd_ = -1;
+    bool ok_ = true;
+    uint64_t lsn_;
+    std::vector<Section> sections_;
+    size_t current_ = 0;
+    uint64_t offset_;          // File offset of the first byte in buffer_
+    std::string buffer_;
+    
+    static constexpr size_t FLUSH_BYTES = 1024 * 1024;
+};
+
+// Memory-maps a snapshot and checks its header. Sections are verified and
+// decoded on demand, so several threads may each load their own.
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& path);
+    ~SnapshotReader();
+    SnapshotReader(const SnapshotReader&) = delete;
+    SnapshotReader& operator=(const SnapshotReader&) = delete;
+    
+    // False when the file is missing, truncated or fails its header checksum
+    bool valid() const { return base_ != nullptr; }
+    uint64_t lsn() const { return lsn_; }
+    long long created_ms() const { return created_ms_; }
+    size_t sections() const { return sections_.size(); }
+    uint64_t entries(size_t section) const { return sections_[section].entries; }
+    
+    // Calls fn for each entry of the section, whose views point into the
+    // mapping. Returns false, before calling fn at all, if the section fails
+    // its checksum.
+    bool for_each(size_t section,
+                  const std::function<void(std::string_view key, std::string_view value, long long expiry_at_ms,
+                                           uint32_t flags)>& fn) const;
+    
+    static constexpr uint32_t VECTOR_FLAG = 1u << 31;
+    static constexpr uint32_t LZ4_FLAG = 1u << 30;
+    static constexpr uint32_t FLAGS = VECTOR_FLAG | LZ4_FLAG;
+    static constexpr size_t HEADER_BYTES = 8 + 4 + 8 + 8 + 4;
+    static constexpr size_t TABLE_ENTRY_BYTES = 8 + 8 + 8 + 4;
+    static constexpr size_t ENTRY_FIXED = 8 + 4 + 4;
+
+private:
+    struct Section {
+        uint64_t offset;
+        uint64_t bytes;
+        uint64_t entries;
+        uint32_t crc;
+    };
+    
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+    uint64_t lsn_ = 0;
+    long long created_ms_ = 0;
+    std::vector<Section> sections_;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+// An immutable value as stored in a shard's slab: this header, then the
+// bytes. The shard's map holds one reference; readers take more under the
+// shard lock (shared is enough) and drop them after releasing it, so the
+// copy or send of a large value happens outside the critical section.
+//
+// Only the shard frees values, under its exclusive lock. When an overwrite or
+// erase drops the map's reference while readers still hold theirs, the last
+// reader pushes the value onto the shard's retired stack instead, and the
+// next writer on that shard returns it to the slab.
+struct StoredValue {
+    std::atomic<uint32_t> refs;
+    uint32_t size;
+    StoredValue* next_retired;
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    std::string_view view() const { return std::string_view(data(), size); }
+
+    // Slab bytes needed for an n-byte value
+    static size_t bytes_for(size_t n) { return sizeof(StoredValue) + n; }
+};
+
+static_assert(sizeof(StoredValue) == 16, "value bytes stay 16-byte aligned in slab chunks");
+
+// Lock-free stack of values whose last reference was dropped outside the
+// shard lock. Readers push; the shard's writer takes the whole stack at once,
+// so there is no ABA.
+class RetiredValues {
+public:
+    void push(StoredValue* value) {
+        StoredValue* head = head_.load(std::memory_order_relaxed);
+        do {
+            value->next_retired = head;
+        } while (!head_.compare_exchange_weak(head, value, std::memory_order_release,
+                                              std::memory_order_relaxed));
+    }
+
+    bool empty() const { return head_.load(std::memory_order_relaxed) == nullptr; }
+
+    StoredValue* take_all() { return head_.exchange(nullptr, std::memory_order_acquire); }
+
+private:
+    std::atomic<StoredValue*> head_{nullptr};
+};
+
+// A counted reference to a StoredValue. Move-only; releasing the last
+// reference retires the value to its shard.
+class ValueRef {
+public:
+    ValueRef() = default;
+
+    // Takes a new reference. The caller holds the owning shard's lock, which
+    // guarantees the map's reference is still there.
+    ValueRef(StoredValue* value, RetiredValues* retired) : value_(value), retired_(retired) {
+        value_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ValueRef(ValueRef&& other) noexcept
+        : value_(std::exchange(other.value_, nullptr)), retired_(other.retired_) {}
+
+    ValueRef& operator=(ValueRef&& other) noexcept {
+        if (this != &other) {
+            reset();
+            value_ = std::exchange(other.value_, nullptr);
+            retired_ = other.retired_;
+        }
+        return *this;
+    }
+
+    ValueRef(const ValueRef&) = delete;
+    ValueRef& operator=(const ValueRef&) = delete;
+
+    ~ValueRef() { reset(); }
+
+    void reset() {
+        if (value_ != nullptr) {
+            if (value_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                retired_->push(value_);
+            }
+            value_ = nullptr;
+        }
+    }
+
+    explicit operator bool() const { return value_ != nullptr; }
+    const char* data() const { return value_->data(); }
+    size_t size() const { return value_->size; }
+    std::string_view view() const { return value_->view(); }
+
+private:
+    StoredValue* value_ = nullptr;
+    RetiredValues* retired_ = nullptr;
+};
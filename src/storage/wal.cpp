@@ -0,0 +1,754 @@
+#include "wal.h"
+#include "crc32c.h"
+#include "../replication/backlog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <unistd.h>
+
+namespace {
+
+const char WAL_MAGIC[8] = {'M', 'K', 'V', 'W', 'A', 'L', '0', '1'};
+
+inline void put_u32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline void put_u64(char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = static_cast<char>(v >> (8 * i));
+}
+
+inline uint32_t get_u32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+inline uint64_t get_u64(const char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+    return v;
+}
+
+// Lays out header + body for one record in dst (which must be sized
+// RECORD_HEADER + body_len). The LSN slot and CRC are left for the caller.
+size_t layout_record(char* dst, WalRecordType type, std::string_view key,
+                     std::string_view value, long long expiry_at_ms) {
+    size_t body_len = WriteAheadLog::BODY_FIXED + key.size() + value.size();
+    put_u32(dst, static_cast<uint32_t>(body_len));
+    char* body = dst + WriteAheadLog::RECORD_HEADER;
+    body[0] = static_cast<char>(type);
+    put_u64(body + 1, static_cast<uint64_t>(expiry_at_ms));
+    put_u32(body + 9, static_cast<uint32_t>(key.size()));
+    put_u32(body + 13, static_cast<uint32_t>(value.size()));
+    if (!key.empty()) std::memcpy(body + 17, key.data(), key.size());
+    if (!value.empty()) std::memcpy(body + 17 + key.size(), value.data(), value.size());
+    return body_len;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(const std::string& path, FsyncPolicy policy, uint64_t next_lsn)
+    : path_(path), policy_(policy), next_lsn_(next_lsn > 0 ? next_lsn : 1) {
+    durable_lsn_ = next_lsn_ - 1;
+    open_file();
+    opened_ = fd_ >= 0;
+    if (opened_) {
+        writer_thread_ = std::thread([this]() { writer_loop(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mtx_);
+        stop_ = true;
+    }
+    buffer_cv_.notify_all();
+    if (writer_thread_.joinable()) {
+        writer_thread_.join();
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void WriteAheadLog::open_file() {
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        std::cerr << "Warning: Could not open journal file: " << path_ << std::endl;
+        return;
+    }
+    
+    struct stat st{};
+    if (fstat(fd_, &st) == 0 && st.st_size == 0) {
+        if (!write_all(fd_, file_header())) {
+            std::cerr << "Warning: Could not write journal header: " << path_ << std::endl;
+        }
+    }
+}
+
+const std::string& WriteAheadLog::file_header() {
+    static const std::string header(WAL_MAGIC, sizeof(WAL_MAGIC));
+    return header;
+}
+
+bool WriteAheadLog::has_header(const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    char magic[sizeof(WAL_MAGIC)];
+    bool ok = std::fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+              std::memcmp(magic, WAL_MAGIC, sizeof(magic)) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+void WriteAheadLog::encode(std::string& out, WalRecordType type, uint64_t lsn,
+                           std::string_view key, std::string_view value, long long expiry_at_ms) {
+    size_t offset = out.size();
+    out.resize(offset + RECORD_HEADER + BODY_FIXED + key.size() + value.size());
+    char* dst = &out[offset];
+    size_t body_len = layout_record(dst, type, key, value, expiry_at_ms);
+    char* body = dst + RECORD_HEADER;
+    put_u64(body + body_len - 8, lsn);
+    put_u32(dst + 4, crc32c(body, body_len));
+}
+
+void WalBatch::add_set(std::string_view key, std::string_view value, long long expiry_at_ms) {
+    add(WalRecordType::SET, key, value, expiry_at_ms);
+}
+
+void WalBatch::add_del(std::string_view key) {
+    add(WalRecordType::DEL, key, std::string_view(), 0);
+}
+
+void WalBatch::add(WalRecordType type, std::string_view key, std::string_view value, long long expiry_at_ms) {
+    size_t offset = data_.size();
+    data_.resize(offset + WriteAheadLog::RECORD_HEADER + WriteAheadLog::BODY_FIXED + key.size() + value.size());
+    char* dst = &data_[offset];
+    size_t body_len = layout_record(dst, type, key, value, expiry_at_ms);
+    records_.push_back({offset, body_len, crc32c(dst + WriteAheadLog::RECORD_HEADER, body_len - 8)});
+}
+
+void WalBatch::add_group(const WalBatch& group) {
+    if (group.records_.size() == 1) {
+        const Pending& rec = group.records_[0];
+        records_.push_back({data_.size(), rec.body_len, rec.partial_crc});
+        data_.append(group.data_);
+        return;
+    }
+    if (group.empty()) {
+        return;
+    }
+    // The group's records still have zero CRC and LSN fields
+    size_t offset = data_.size();
+    size_t body_len = WriteAheadLog::BODY_FIXED + group.data_.size();
+    data_.resize(offset + WriteAheadLog::RECORD_HEADER + body_len);
+    char* dst = &data_[offset];
+    put_u32(dst, static_cast<uint32_t>(body_len));
+    char* body = dst + WriteAheadLog::RECORD_HEADER;
+    body[0] = static_cast<char>(WalRecordType::MULTI);
+    put_u64(body + 1, 0);
+    put_u32(body + 9, 0);
+    put_u32(body + 13, static_cast<uint32_t>(group.data_.size()));
+    std::memcpy(body + 17, group.data_.data(), group.data_.size());
+    records_.push_back({offset, body_len, crc32c(body, body_len - 8)});
+}
+
+uint64_t WriteAheadLog::append_set(std::string_view key, std::string_view value, long long expiry_at_ms) {
+    return append(WalRecordType::SET, key, value, expiry_at_ms);
+}
+
+uint64_t WriteAheadLog::append_del(std::string_view key) {
+    return append(WalRecordType::DEL, key, std::string_view(), 0);
+}
+
+uint64_t WriteAheadLog::append(WalRecordType type, std::string_view key, std::string_view value, long long expiry_at_ms) {
+    if (!opened_ || failed()) {
+        return 0;
+    }
+    
+    // Encode and checksum outside the lock; only the LSN is patched in under it
+    thread_local std::string scratch;
+    scratch.resize(RECORD_HEADER + BODY_FIXED + key.size() + value.size());
+    char* dst = &scratch[0];
+    size_t body_len = layout_record(dst, type, key, value, expiry_at_ms);
+    char* body = dst + RECORD_HEADER;
+    uint32_t partial_crc = crc32c(body, body_len - 8);
+    
+    uint64_t lsn;
+    bool wake_writer;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mtx_);
+        lsn = next_lsn_++;
+        put_u64(body + body_len - 8, lsn);
+        put_u32(dst + 4, crc32c(body + body_len - 8, 8, partial_crc));
+        buffer_.append(scratch);
+        if (rewriting_) {
+            rewrite_buffer_.append(scratch);
+        }
+        if (backlog_) {
+            backlog_->append(scratch.data(), scratch.size());
+        }
+        wake_writer = policy_ == FsyncPolicy::ALWAYS || buffer_.size() >= FLUSH_BYTES;
+    }
+    if (wake_writer) {
+        buffer_cv_.notify_one();
+    }
+    return lsn;
+}
+
+uint64_t WriteAheadLog::append_batch(WalBatch& batch) {
+    if (!opened_ || failed() || batch.empty()) {
+        return 0;
+    }
+    
+    uint64_t lsn;
+    bool wake_writer;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mtx_);
+        for (const auto& rec : batch.records_) {
+            char* dst = &batch.data_[rec.offset];
+            char* lsn_field = dst + RECORD_HEADER + rec.body_len - 8;
+            put_u64(lsn_field, next_lsn_++);
+            put_u32(dst + 4, crc32c(lsn_field, 8, rec.partial_crc));
+        }
+        lsn = next_lsn_ - 1;
+        buffer_.append(batch.data_);
+        if (rewriting_) {
+            rewrite_buffer_.append(batch.data_);
+        }
+        if (backlog_) {
+            backlog_->append(batch.data_.data(), batch.data_.size());
+        }
+        wake_writer = policy_ == FsyncPolicy::ALWAYS || buffer_.size() >= FLUSH_BYTES;
+    }
+    if (wake_writer) {
+        buffer_cv_.notify_one();
+    }
+    return lsn;
+}
+
+bool WriteAheadLog::wait_durable(uint64_t lsn) {
+    if (lsn == 0 || !opened_) {
+        return !failed();
+    }
+    std::unique_lock<std::mutex> lock(durable_mtx_);
+    durable_cv_.wait(lock, [this, lsn] { return durable_lsn_ >= lsn || failed(); });
+    return durable_lsn_ >= lsn;
+}
+
+void WriteAheadLog::fail(const char* what) {
+    {
+        std::lock_guard<std::mutex> lock(durable_mtx_);
+        if (failed_.exchange(true)) {
+            return;
+        }
+    }
+    std::cerr << "Warning: Journal " << what << " failed; writes are refused until the server is restarted"
+              << std::endl;
+    durable_cv_.notify_all();
+}
+
+uint64_t WriteAheadLog::last_lsn() {
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    return next_lsn_ - 1;
+}
+
+void WriteAheadLog::attach_backlog(ReplicationBacklog* backlog) {
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    backlog_ = backlog;
+}
+
+void WriteAheadLog::writer_loop() {
+    std::string batch;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool dirty = false;
+    
+    while (true) {
+        bool stopping;
+        {
+            std::unique_lock<std::mutex> lock(buffer_mtx_);
+            buffer_cv_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this] {
+                return stop_ || buffer_.size() >= FLUSH_BYTES ||
+                       (policy_ == FsyncPolicy::ALWAYS && !buffer_.empty());
+            });
+            stopping = stop_;
+        }
+        
+        uint64_t batch_lsn;
+        {
+            // io_mtx_ is taken before the swap so batches reach the file in
+            // LSN order even when sync() or finish_rewrite() run concurrently
+            std::lock_guard<std::mutex> io_lock(io_mtx_);
+            {
+                std::lock_guard<std::mutex> lock(buffer_mtx_);
+                batch.swap(buffer_);
+                batch_lsn = next_lsn_ - 1;
+            }
+            
+            // After a failure the file may end in a torn record, so nothing
+            // more is written behind it; what was buffered is dropped
+            if (!batch.empty() && !failed()) {
+                if (!write_all(fd_, batch)) {
+                    fail("write");
+                }
+                dirty = true;
+            }
+            batch.clear();
+            
+            auto now = std::chrono::steady_clock::now();
+            bool sync_due = policy_ == FsyncPolicy::ALWAYS || stopping ||
+                            (policy_ == FsyncPolicy::EVERYSEC && now - last_sync >= std::chrono::seconds(1));
+            if (dirty && sync_due && !failed()) {
+                if (!sync_fd(fd_)) {
+                    fail("sync");
+                }
+                dirty = false;
+                last_sync = now;
+            }
+        }
+        
+        if (!failed()) {
+            std::lock_guard<std::mutex> lock(durable_mtx_);
+            if (batch_lsn > durable_lsn_) {
+                durable_lsn_ = batch_lsn;
+            }
+        }
+        durable_cv_.notify_all();
+        
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+bool WriteAheadLog::sync() {
+    if (!opened_) {
+        return true;
+    }
+    
+    uint64_t batch_lsn;
+    {
+        std::lock_guard<std::mutex> io_lock(io_mtx_);
+        std::string batch;
+        {
+            std::lock_guard<std::mutex> lock(buffer_mtx_);
+            batch.swap(buffer_);
+            batch_lsn = next_lsn_ - 1;
+        }
+        if (failed()) {
+            return false;
+        }
+        if (!write_all(fd_, batch)) {
+            fail("write");
+            return false;
+        }
+        if (!sync_fd(fd_)) {
+            fail("sync");
+            return false;
+        }
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(durable_mtx_);
+        if (batch_lsn > durable_lsn_) {
+            durable_lsn_ = batch_lsn;
+        }
+    }
+    durable_cv_.notify_all();
+    return true;
+}
+
+uint64_t WriteAheadLog::begin_rewrite() {
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    rewriting_ = true;
+    rewrite_buffer_.clear();
+    return next_lsn_ - 1;
+}
+
+void WriteAheadLog::drain_rewrite(std::string& out) {
+    out.clear();
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    out.swap(rewrite_buffer_);
+}
+
+void WriteAheadLog::abort_rewrite() {
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    rewriting_ = false;
+    rewrite_buffer_.clear();
+    rewrite_buffer_.shrink_to_fit();
+}
+
+bool WriteAheadLog::finish_rewrite(const std::string& compacted_path) {
+    // Appenders are blocked only for the final drain, sync and rename
+    std::lock_guard<std::mutex> io_lock(io_mtx_);
+    std::lock_guard<std::mutex> lock(buffer_mtx_);
+    rewriting_ = false;
+    
+    int tmp_fd = ::open(compacted_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (tmp_fd < 0) {
+        std::cerr << "Warning: Could not reopen compacted journal: " << strerror(errno) << std::endl;
+        rewrite_buffer_.clear();
+        return false;
+    }
+    
+    bool ok = write_all(tmp_fd, rewrite_buffer_) && sync_fd(tmp_fd);
+    ::close(tmp_fd);
+    rewrite_buffer_.clear();
+    rewrite_buffer_.shrink_to_fit();
+    
+    if (!ok || std::rename(compacted_path.c_str(), path_.c_str()) != 0) {
+        std::cerr << "Warning: Failed to rename temp journal during compaction: " << strerror(errno) << std::endl;
+        return false;
+    }
+    
+    // The snapshot was renamed into the same directory just before
+    if (!sync_dir(path_)) {
+        std::cerr << "Warning: Could not sync the journal directory after compaction: " << strerror(errno)
+                  << std::endl;
+    }
+    
+    // Everything still in buffer_ is already part of the compacted file
+    buffer_.clear();
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+    open_file();
+    if (fd_ < 0) {
+        fail("reopen after compaction");
+        return false;
+    }
+    
+    {
+        std::lock_guard<std::mutex> durable_lock(durable_mtx_);
+        durable_lsn_ = next_lsn_ - 1;
+    }
+    durable_cv_.notify_all();
+    return true;
+}
+
+bool WriteAheadLog::write_all(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Warning: Journal write failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool WriteAheadLog::sync_fd(int fd) {
+#if defined(__linux__)
+    bool ok = ::fdatasync(fd) == 0;
+#else
+    bool ok = ::fsync(fd) == 0;
+#endif
+    if (!ok) {
+        std::cerr << "Warning: Journal sync failed: " << strerror(errno) << std::endl;
+    }
+    return ok;
+}
+
+bool WriteAheadLog::sync_dir(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+WriteAheadLog::DecodeStatus WriteAheadLog::decode(const char* data, size_t len, WalRecord& rec, size_t& consumed,
+                                                  bool verify_crc) {
+    if (len < RECORD_HEADER) {
+        return DecodeStatus::INCOMPLETE;
+    }
+    
+    uint32_t body_len = get_u32(data);
+    if (body_len < BODY_FIXED || body_len > MAX_BODY) {
+        return DecodeStatus::CORRUPT;
+    }
+    if (len < RECORD_HEADER + body_len) {
+        return DecodeStatus::INCOMPLETE;
+    }
+    
+    const char* body = data + RECORD_HEADER;
+    if (verify_crc && crc32c(body, body_len) != get_u32(data + 4)) {
+        return DecodeStatus::CORRUPT;
+    }
+    
+    uint8_t type = static_cast<uint8_t>(body[0]);
+    uint32_t key_len = get_u32(body + 9);
+    uint32_t value_len = get_u32(body + 13);
+    if (type < static_cast<uint8_t>(WalRecordType::SET) || type > static_cast<uint8_t>(WalRecordType::MULTI) ||
+        static_cast<uint64_t>(BODY_FIXED) + key_len + value_len != body_len) {
+        return DecodeStatus::CORRUPT;
+    }
+    
+    rec.type = static_cast<WalRecordType>(type);
+    rec.expiry_at_ms = static_cast<long long>(get_u64(body + 1));
+    rec.key = std::string_view(body + 17, key_len);
+    rec.value = std::string_view(body + 17 + key_len, value_len);
+    rec.lsn = get_u64(body + body_len - 8);
+    consumed = RECORD_HEADER + body_len;
+    
+    if (rec.type == WalRecordType::MULTI) {
+        // Every inner record must be whole and plain, or the MULTI is corrupt
+        size_t pos = 0;
+        while (pos < rec.value.size()) {
+            WalRecord inner;
+            size_t used = 0;
+            if (!rec.key.empty() ||
+                decode(rec.value.data() + pos, rec.value.size() - pos, inner, used, false) != DecodeStatus::OK ||
+                inner.type == WalRecordType::MULTI) {
+                return DecodeStatus::CORRUPT;
+            }
+            pos += used;
+        }
+    }
+    return DecodeStatus::OK;
+}
+
+void WriteAheadLog::for_each(const WalRecord& rec, const std::function<void(const WalRecord&)>& fn) {
+    if (rec.type != WalRecordType::MULTI) {
+        fn(rec);
+        return;
+    }
+    size_t pos = 0;
+    while (pos < rec.value.size()) {
+        WalRecord inner;
+        size_t used = 0;
+        decode(rec.value.data() + pos, rec.value.size() - pos, inner, used, false); // Checked by decode()
+        inner.lsn = rec.lsn;
+        fn(inner);
+        pos += used;
+    }
+}
+
+WalReplayResult WriteAheadLog::replay(const std::string& path,
+                                      const std::function<void(const WalRecord&)>& fn) {
+    WalReplayResult result;
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return result;
+    }
+    
+    char magic[sizeof(WAL_MAGIC)];
+    if (std::fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        std::memcmp(magic, WAL_MAGIC, sizeof(magic)) != 0) {
+        result.corrupt_tail = true;
+        std::fclose(f);
+        return result;
+    }
+    result.valid_bytes = sizeof(WAL_MAGIC);
+    
+    std::string record;
+    while (true) {
+        record.resize(RECORD_HEADER);
+        size_t n = std::fread(&record[0], 1, RECORD_HEADER, f);
+        if (n == 0) {
+            break; // Clean end of log
+        }
+        if (n < RECORD_HEADER) {
+            result.corrupt_tail = true;
+            break;
+        }
+        
+        uint32_t body_len = get_u32(record.data());
+        if (body_len < BODY_FIXED || body_len > MAX_BODY) {
+            result.corrupt_tail = true;
+            break;
+        }
+        record.resize(RECORD_HEADER + body_len);
+        if (std::fread(&record[RECORD_HEADER], 1, body_len, f) != body_len) {
+            result.corrupt_tail = true;
+            break;
+        }
+        
+        WalRecord rec;
+        size_t consumed = 0;
+        if (decode(record.data(), record.size(), rec, consumed) != DecodeStatus::OK) {
+            result.corrupt_tail = true;
+            break;
+        }
+        
+        for_each(rec, [&](const WalRecord& r) {
+            fn(r);
+            result.records++;
+        });
+        if (rec.lsn > result.last_lsn) {
+            result.last_lsn = rec.lsn;
+        }
+        result.valid_bytes += consumed;
+    }
+    
+    std::fclose(f);
+    return result;
+}
+
+WalReplayResult WriteAheadLog::replay_parallel(const std::string& path, size_t threads, size_t partitions,
+                                               const std::function<size_t(std::string_view)>& partition,
+                                               const std::function<void(const WalRecord&)>& apply) {
+    WalReplayResult result;
+    
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return result;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(WAL_MAGIC))) {
+        ::close(fd);
+        result.corrupt_tail = st.st_size > 0;
+        return result;
+    }
+    
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Warning: mmap of journal failed, falling back to sequential replay" << std::endl;
+        return replay(path, apply);
+    }
+    madvise(mapping, file_size, MADV_SEQUENTIAL);
+    madvise(mapping, file_size, MADV_WILLNEED);
+    
+    const char* base = static_cast<const char*>(mapping);
+    if (std::memcmp(base, WAL_MAGIC, sizeof(WAL_MAGIC)) != 0) {
+        munmap(mapping, file_size);
+        result.corrupt_tail = true;
+        return result;
+    }
+    
+    // 1. Chunk boundaries: hop over length prefixes only, no checksums yet
+    std::vector<size_t> bounds{sizeof(WAL_MAGIC)};
+    size_t pos = sizeof(WAL_MAGIC);
+    while (pos + RECORD_HEADER <= file_size) {
+        uint32_t body_len = get_u32(base + pos);
+        if (body_len < BODY_FIXED || body_len > MAX_BODY || pos + RECORD_HEADER + body_len > file_size) {
+            break;
+        }
+        pos += RECORD_HEADER + body_len;
+        if (pos - bounds.back() >= REPLAY_CHUNK_BYTES) {
+            bounds.push_back(pos);
+        }
+    }
+    size_t scanned_end = pos;
+    if (bounds.back() != scanned_end) {
+        bounds.push_back(scanned_end);
+    }
+    size_t num_chunks = bounds.size() - 1;
+    
+    // 2. Decode + verify chunks in parallel, bucketing record offsets by lane.
+    // Offsets are relative to the chunk start; a chunk is < 4 GB by construction.
+    struct ChunkResult {
+        std::vector<std::vector<uint32_t>> lanes;
+        size_t valid_end = 0;
+        size_t records = 0;
+        uint64_t max_lsn = 0;
+        bool corrupt = false;
+    };
+    std::vector<ChunkResult> chunks(num_chunks);
+    std::atomic<size_t> next_chunk{0};
+    
+    auto decode_worker = [&]() {
+        size_t c;
+        while ((c = next_chunk.fetch_add(1)) < num_chunks) {
+            ChunkResult& out = chunks[c];
+            out.lanes.resize(partitions);
+            size_t p = bounds[c];
+            while (p < bounds[c + 1]) {
+                WalRecord rec;
+                size_t consumed = 0;
+                if (decode(base + p, bounds[c + 1] - p, rec, consumed) != DecodeStatus::OK) {
+                    out.corrupt = true;
+                    break;
+                }
+                uint32_t offset = static_cast<uint32_t>(p - bounds[c]);
+                if (rec.type == WalRecordType::MULTI) {
+                    // Filed once under each lane it touches; that lane applies its share
+                    for_each(rec, [&](const WalRecord& r) {
+                        auto& lane = out.lanes[partition(r.key) % partitions];
+                        if (lane.empty() || lane.back() != offset) {
+                            lane.push_back(offset);
+                        }
+                        out.records++;
+                    });
+                } else {
+                    out.lanes[partition(rec.key) % partitions].push_back(offset);
+                    out.records++;
+                }
+                if (rec.lsn > out.max_lsn) out.max_lsn = rec.lsn;
+                p += consumed;
+            }
+            out.valid_end = p;
+        }
+    };
+    
+    size_t workers = std::max<size_t>(1, std::min(threads, num_chunks));
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < workers; ++i) pool.emplace_back(decode_worker);
+    for (auto& t : pool) t.join();
+    pool.clear();
+    
+    // Everything after the first corrupt record is discarded
+    size_t kept_chunks = num_chunks;
+    for (size_t c = 0; c < num_chunks; ++c) {
+        if (chunks[c].corrupt) {
+            kept_chunks = c + 1;
+            break;
+        }
+    }
+    result.valid_bytes = kept_chunks > 0 ? chunks[kept_chunks - 1].valid_end : sizeof(WAL_MAGIC);
+    result.corrupt_tail = result.valid_bytes < file_size;
+    for (size_t c = 0; c < kept_chunks; ++c) {
+        result.records += chunks[c].records;
+        result.last_lsn = std::max(result.last_lsn, chunks[c].max_lsn);
+    }
+    
+    // 3. Apply lanes in parallel, each lane in log order
+    std::atomic<size_t> next_lane{0};
+    auto apply_worker = [&]() {
+        size_t lane;
+        while ((lane = next_lane.fetch_add(1)) < partitions) {
+            for (size_t c = 0; c < kept_chunks; ++c) {
+                for (uint32_t offset : chunks[c].lanes[lane]) {
+                    WalRecord rec;
+                    size_t consumed = 0;
+                    // Already verified in step 2
+                    decode(base + bounds[c] + offset, file_size - bounds[c] - offset, rec, consumed, false);
+                    if (rec.type != WalRecordType::MULTI) {
+                        apply(rec);
+                        continue;
+                    }
+                    for_each(rec, [&](const WalRecord& r) {
+                        if (partition(r.key) % partitions == lane) {
+                            apply(r);
+                        }
+                    });
+                }
+            }
+        }
+    };
+    
+    workers = std::max<size_t>(1, std::min(threads, partitions));
+    for (size_t i = 0; i < workers; ++i) pool.emplace_back(apply_worker);
+    for (auto& t : pool) t.join();
+    
+    munmap(mapping, file_size);
+    return result;
+}
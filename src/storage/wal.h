@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// When appended records are forced to stable storage.
+class ReplicationBacklog;
+
+enum class FsyncPolicy {
+    NO,        // write() every flush interval, let the OS decide when to sync
+    EVERYSEC,  // fdatasync at most once per second (up to ~1s of loss)
+    ALWAYS     // writers wait until their record is fdatasync'ed (group commit)
+};
+
+// VSET is a SET whose value is a float32 vector, SET_LZ4 one whose value is
+// an LZ4 frame (see compression.h). MULTI carries the records of one
+// multi-key command as its value, so they decode and replay all or none.
+enum class WalRecordType : uint8_t { SET = 1, DEL = 2, VSET = 3, SET_LZ4 = 4, MULTI = 5 };
+
+// Decoded record. key/value point into the buffer that was decoded.
+struct WalRecord {
+    WalRecordType type = WalRecordType::SET;
+    uint64_t lsn = 0;
+    long long expiry_at_ms = 0; // Absolute, 0 = permanent
+    std::string_view key;
+    std::string_view value;
+};
+
+struct WalReplayResult {
+    size_t records = 0;
+    uint64_t last_lsn = 0;
+    uint64_t valid_bytes = 0;   // Offset just past the last intact record
+    bool corrupt_tail = false;  // Torn or checksum-failing bytes after valid_bytes
+};
+
+// Records laid out and checksummed (all but the LSN) ahead of time, so
+// WriteAheadLog::append_batch() only patches LSNs under its lock and appends
+// the lot with one copy. Reuse one instance to keep its buffers.
+class WalBatch {
+public:
+    void add_set(std::string_view key, std::string_view value, long long expiry_at_ms);
+    void add_del(std::string_view key);
+    // A record of the given type, for callers that pick it per entry
+    void add(WalRecordType type, std::string_view key, std::string_view value, long long expiry_at_ms);
+    // group's records as one MULTI record sharing one LSN, or as is if it
+    // holds a single record
+    void add_group(const WalBatch& group);
+    
+    bool empty() const { return records_.empty(); }
+    size_t count() const { return records_.size(); }
+    void clear() {
+        data_.clear();
+        records_.clear();
+    }
+
+private:
+    friend class WriteAheadLog;
+    
+    struct Pending {
+        size_t offset;        // Record start within data_
+        size_t body_len;
+        uint32_t partial_crc; // crc32c of the body without the trailing LSN
+    };
+    
+    std::string data_;
+    std::vector<Pending> records_;
+};
+
+// Binary write-ahead log.
+//
+// File layout: an 8-byte magic header followed by records of
+//   u32 body_len | u32 crc32c(body) | body
+//   body = u8 type | i64 expiry_at_ms | u32 key_len | u32 value_len | key | value | u64 lsn
+// All integers are little-endian. The LSN sits at the end of the body so the
+// checksum of everything else can be computed before taking the buffer lock.
+// A MULTI record has no key and its value is a run of SET/DEL/VSET/SET_LZ4
+// records laid out the same way, whose own CRC and LSN fields are zero: the
+// outer checksum covers them and they take the outer LSN.
+//
+// Group commit: writers only encode their record and append it to a shared
+// in-memory buffer. One writer thread swaps that buffer out and write()s it,
+// syncing according to the FsyncPolicy, so a single fdatasync covers every
+// record that arrived while the previous one was in flight.
+class WriteAheadLog {
+public:
+    WriteAheadLog(const std::string& path, FsyncPolicy policy, uint64_t next_lsn = 1);
+    ~WriteAheadLog();
+    
+    bool is_open() const { return opened_; }
+    FsyncPolicy policy() const { return policy_; }
+    
+    // Sticky: set by the first failed write or sync. From then on nothing
+    // is appended or written, and no LSN becomes durable, until a restart.
+    bool failed() const { return failed_.load(std::memory_order_acquire); }
+    
+    // Returns the record's LSN (0 if the log is not open or has failed).
+    uint64_t append_set(std::string_view key, std::string_view value, long long expiry_at_ms);
+    uint64_t append_del(std::string_view key);
+    
+    // Assigns consecutive LSNs to every record in the batch and appends them
+    // with one buffer lock. Returns the last LSN (0 if empty, not open or failed).
+    uint64_t append_batch(WalBatch& batch);
+    
+    // Blocks until `lsn` has been written (and synced under ALWAYS). False if
+    // the log failed first; for lsn 0, whether it has failed.
+    bool wait_durable(uint64_t lsn);
+    
+    // Writes and syncs everything appended so far. False if the log has failed.
+    bool sync();
+    
+    // Compaction support. While a rewrite is active every appended record is
+    // also copied into a side buffer; the compactor drains it into the new
+    // file between shards, and finish_rewrite() appends the remainder and
+    // atomically swaps the new file in. Writes racing the snapshot are
+    // therefore replayed after it instead of being lost. Returns the last
+    // LSN already in the log when the rewrite began.
+    uint64_t begin_rewrite();
+    void drain_rewrite(std::string& out);
+    bool finish_rewrite(const std::string& compacted_path);
+    void abort_rewrite();
+    
+    uint64_t last_lsn();
+    
+    // Replication: every record appended from now on is also copied into
+    // the backlog, under the same lock, so the backlog sees records in LSN
+    // order. nullptr detaches it.
+    void attach_backlog(ReplicationBacklog* backlog);
+    
+    // fsyncs the directory holding path, so a rename into it survives a crash
+    static bool sync_dir(const std::string& path);
+    
+    static const std::string& file_header();
+    static bool has_header(const std::string& path);
+    static void encode(std::string& out, WalRecordType type, uint64_t lsn,
+                       std::string_view key, std::string_view value, long long expiry_at_ms);
+    
+    // Streams every intact record of the file at `path` into fn, stopping at
+    // the first torn or corrupt record.
+    static WalReplayResult replay(const std::string& path,
+                                  const std::function<void(const WalRecord&)>& fn);
+    
+    // Parallel recovery: memory-maps the log, splits it into chunks at record
+    // boundaries and verifies/decodes the chunks on `threads` workers, sorting
+    // records into `partitions` lanes by partition(key). Each lane is then
+    // applied by one thread in log order, so per-key ordering is preserved
+    // while independent lanes (shards) replay concurrently. apply() is called
+    // from several threads at once, never concurrently for the same lane.
+    static WalReplayResult replay_parallel(const std::string& path, size_t threads, size_t partitions,
+                                           const std::function<size_t(std::string_view)>& partition,
+                                           const std::function<void(const WalRecord&)>& apply);
+    
+    // A MULTI record decodes only if every record inside it does; replay
+    // and replay_parallel expand it, other callers use for_each().
+    enum class DecodeStatus { OK, INCOMPLETE, CORRUPT };
+    static DecodeStatus decode(const char* data, size_t len, WalRecord& rec, size_t& consumed,
+                               bool verify_crc = true);
+    
+    // Calls fn for rec itself, or for each record of a decoded MULTI, with its LSN
+    static void for_each(const WalRecord& rec, const std::function<void(const WalRecord&)>& fn);
+    
+    static constexpr size_t RECORD_HEADER = 8;
+    static constexpr size_t BODY_FIXED = 1 + 8 + 4 + 4 + 8;
+    static constexpr size_t MAX_BODY = 1024u * 1024u * 1024u;
+    static constexpr size_t REPLAY_CHUNK_BYTES = 4 * 1024 * 1024;
+
+private:
+    uint64_t append(WalRecordType type, std::string_view key, std::string_view value, long long expiry_at_ms);
+    void writer_loop();
+    bool write_all(int fd, const std::string& data);
+    bool sync_fd(int fd);
+    void fail(const char* what);
+    void open_file();
+    
+    std::string path_;
+    FsyncPolicy policy_;
+    int fd_ = -1;
+    bool opened_ = false;              // The log opened at startup; fixed afterwards
+    std::atomic<bool> failed_{false};
+    
+    std::mutex buffer_mtx_;            // Guards buffer_ and next_lsn_; held only for a memcpy
+    std::condition_variable buffer_cv_;
+    std::string buffer_;
+    std::string rewrite_buffer_;
+    bool rewriting_ = false;
+    ReplicationBacklog* backlog_ = nullptr;
+    uint64_t next_lsn_;
+    bool stop_ = false;
+    
+    std::mutex io_mtx_;                // Guards fd_ against finish_rewrite()
+    
+    std::mutex durable_mtx_;
+    std::condition_variable durable_cv_;
+    uint64_t durable_lsn_ = 0;
+    
+    std::thread writer_thread_;
+    
+    static constexpr size_t FLUSH_BYTES = 256 * 1024;
+    static constexpr int FLUSH_INTERVAL_MS = 10;
+};
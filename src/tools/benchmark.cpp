@@ -1,65 +1,899 @@
+// Load generator for mem-kv-server.
+//
+// Closed loop (default): each client sends `pipeline` requests, waits for all
+// replies, and repeats. Open loop (--rate): requests are scheduled at fixed
+// intervals whether or not earlier replies have arrived, and latency is
+// measured from the scheduled send time, so a stalled server is charged for
+// every request it delayed (no coordinated omission). Closed-loop latencies
+// are corrected the way HdrHistogram does: a reply slower than the expected
+// interval also stands in for the requests a non-stalled client would have
+// sent meanwhile.
+
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cctype>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
-#include <cstring>
+#include "metrics/metrics.h"
+#include "cluster/slots.h"
 
-void run_client(int client_id, int requests) {
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        std::cerr << "Failed to create socket" << std::endl;
-        return;
+namespace {
+
+enum Op { OP_GET, OP_SET, OP_MGET, OP_DEL, OP_MSET, OP_COUNT };
+const char* const OP_NAMES[OP_COUNT] = {"GET", "SET", "MGET", "DEL", "MSET"};
+
+struct Config {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    int clients = 10;
+    long long requests = 1000;      // Per client; ignored when duration_s > 0
+    double duration_s = 0;
+    unsigned mix[OP_COUNT] = {0, 100, 0, 0, 0};
+    size_t keys = 100000;
+    bool zipf = false;
+    double zipf_theta = 0.99;
+    size_t value_min = 16;
+    size_t value_max = 16;
+    bool value_log = false;         // Log-uniform sizes: many small values, few large
+    size_t mget_keys = 10;
+    size_t mset_keys = 10;
+    int pipeline = 1;
+    double rate = 0;                // Requests/s across all clients; 0 = closed loop
+    bool resp = false;
+    bool prefill = false;
+    bool cluster = false;           // Route by hash slot, seeded from --host/--port
+    std::string json_path;
+};
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [clients] [requests_per_client]\n"
+              << "       " << prog << " [options]\n"
+              << "  --host <h>          Server host (default 127.0.0.1)\n"
+              << "  --port <n>          Server port (default 8080)\n"
+              << "  --clients <n>       Connections, one thread each (default 10)\n"
+              << "  --requests <n>      Requests per client (default 1000)\n"
+              << "  --duration <s>      Run for this long instead of a request count\n"
+              << "  --mix <spec>        Op weights, e.g. get=80,set=15,mget=4,del=1 (default set=100)\n"
+              << "  --keys <n>          Key space size (default 100000)\n"
+              << "  --dist <d>          uniform | zipf key popularity (default uniform)\n"
+              << "  --zipf-theta <t>    Zipf skew in (0, 1) (default 0.99)\n"
+              << "  --value-size <s>    Bytes per SET value, N or MIN-MAX (default 16)\n"
+              << "  --value-dist <d>    uniform | log sizes within MIN-MAX (default uniform)\n"
+              << "  --mget-keys <n>     Keys per MGET (default 10)\n"
+              << "  --mset-keys <n>     Key/value pairs per MSET (default 10)\n"
+              << "  --pipeline <n>      Requests in flight per connection (default 1)\n"
+              << "  --rate <rps>        Open loop at this total request rate (default closed loop)\n"
+              << "  --protocol <p>      plain | resp (default plain)\n"
+              << "  --prefill           SET every key once before measuring\n"
+              << "  --cluster           Fetch CLUSTER SLOTS from the host and send each key to its node\n"
+              << "  --json <file>       Also write results as JSON\n";
+}
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64
+struct Rng {
+    uint64_t state;
+    
+    explicit Rng(uint64_t seed) : state(seed) {}
+    
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    
+    double unit() {
+        return (next() >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+    }
+};
+
+// Zipfian ranks over [0, n) as in YCSB, after Gray et al., "Quickly Generating
+// Billion-Record Synthetic Databases". Rank 0 is the most popular key.
+class ZipfGenerator {
+public:
+    ZipfGenerator(size_t n, double theta) : n_(n), theta_(theta) {
+        zetan_ = zeta(n, theta);
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / zetan_);
+    }
+    
+    size_t next(double u) const {
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + std::pow(0.5, theta_)) return 1 % n_;
+        return static_cast<size_t>(n_ * std::pow(eta_ * u - eta_ + 1.0, alpha_)) % n_;
+    }
+
+private:
+    static double zeta(size_t n, double theta) {
+        double sum = 0;
+        for (size_t i = 1; i <= n; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+    
+    size_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+// HdrHistogram's copyCorrectedForCoordinatedOmission on a merged snapshot
+LatencyHistogram::Snapshot correct_for_omission(const LatencyHistogram::Snapshot& raw, uint64_t interval) {
+    LatencyHistogram::Snapshot out = raw;
+    if (interval == 0) {
+        return out;
     }
+    for (size_t b = 0; b < raw.counts.size(); ++b) {
+        uint64_t count = raw.counts[b];
+        if (count == 0) {
+            continue;
+        }
+        uint64_t value = LatencyHistogram::bucket_high(b);
+        for (uint64_t missing = value > interval ? value - interval : 0; missing >= interval; missing -= interval) {
+            out.counts[LatencyHistogram::bucket_of(missing)] += count;
+            out.total += count;
+            out.sum += missing * count;
+        }
+    }
+    return out;
+}
+
+struct Results {
+    // Index OP_COUNT aggregates every op. Values are nanoseconds.
+    LatencyHistogram latency[OP_COUNT + 1];        // From intended send (open loop) or send
+    std::atomic<uint64_t> completed[OP_COUNT] = {};
+    std::atomic<uint64_t> errors{0};
+    std::atomic<uint64_t> redirects{0};            // MOVED, ASK and TRYAGAIN replies
+    std::atomic<uint64_t> rounds{0};               // Closed loop: pipeline round trips
+    std::atomic<uint64_t> busy_ns{0};              // Closed loop: summed client run time
+    std::atomic<bool> failed{false};
     
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(8080);
-    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    void record(Op op, uint64_t ns) {
+        latency[op].record(ns);
+        latency[OP_COUNT].record(ns);
+        completed[op].fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+int connect_to(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res) != 0) {
+        std::cerr << "Failed to resolve " << host << std::endl;
+        return -1;
+    }
     
-    if (connect(sock, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-        std::cerr << "Failed to connect" << std::endl;
+    int sock = -1;
+    for (addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock < 0) {
+            continue;
+        }
+        if (connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
         close(sock);
+        sock = -1;
+    }
+    freeaddrinfo(res);
+    
+    if (sock < 0) {
+        std::cerr << "Failed to connect to " << host << ":" << port << std::endl;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+bool split_addr(std::string_view addr, std::string& host, int& port) {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string_view::npos || colon == 0 || colon + 1 == addr.size()) {
+        return false;
+    }
+    host = std::string(addr.substr(0, colon));
+    port = std::atoi(std::string(addr.substr(colon + 1)).c_str());
+    return port > 0;
+}
+
+// --cluster: slot owners as reported by CLUSTER SLOTS on the seed node.
+// Unassigned slots go to the seed, which answers them with CLUSTERDOWN.
+struct SlotMap {
+    std::vector<std::pair<std::string, int>> nodes; // host, port; [0] is the seed
+    std::vector<uint16_t> owner;                    // Per slot, index into nodes
+};
+
+size_t find_or_add_node(std::vector<std::pair<std::string, int>>& nodes, const std::string& host, int port) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].first == host && nodes[i].second == port) {
+            return i;
+        }
+    }
+    nodes.emplace_back(host, port);
+    return nodes.size() - 1;
+}
+
+bool fetch_slots(const Config& cfg, SlotMap& map) {
+    int sock = connect_to(cfg.host, cfg.port);
+    if (sock < 0) {
+        return false;
+    }
+    const char request[] = "CLUSTER SLOTS\n";
+    std::string reply;
+    bool ok = send(sock, request, sizeof(request) - 1, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(request) - 1);
+    char buf[4096];
+    while (ok && reply.find('\n') == std::string::npos) {
+        ssize_t n = recv(sock, buf, sizeof(buf), 0);
+        ok = n > 0;
+        if (ok) reply.append(buf, n);
+    }
+    close(sock);
+    if (!ok || reply.empty() || reply[0] != '[') {
+        std::cerr << "CLUSTER SLOTS failed: " << reply << std::endl;
+        return false;
+    }
+    
+    // [{"start":0,"end":5461,"id":"a","addr":"10.0.0.1:8080"},...]
+    map.nodes = {{cfg.host, cfg.port}};
+    map.owner.assign(CLUSTER_SLOTS, 0);
+    const std::string START = "{\"start\":", END = "\"end\":", ADDR = "\"addr\":\"";
+    for (size_t pos = 0; (pos = reply.find(START, pos)) != std::string::npos; ) {
+        size_t end_at = reply.find(END, pos);
+        size_t addr_at = reply.find(ADDR, pos);
+        if (end_at == std::string::npos || addr_at == std::string::npos) {
+            break;
+        }
+        size_t first = std::strtoul(reply.c_str() + pos + START.size(), nullptr, 10);
+        size_t last = std::strtoul(reply.c_str() + end_at + END.size(), nullptr, 10);
+        addr_at += ADDR.size();
+        std::string host;
+        int port = 0;
+        if (!split_addr(std::string_view(reply).substr(addr_at, reply.find('"', addr_at) - addr_at), host, port)) {
+            break;
+        }
+        size_t node = find_or_add_node(map.nodes, host, port);
+        for (size_t slot = first; slot <= last && slot < CLUSTER_SLOTS; ++slot) {
+            map.owner[slot] = static_cast<uint16_t>(node);
+        }
+        pos = addr_at;
+    }
+    std::cout << "Cluster: " << map.nodes.size() << " node(s) from " << cfg.host << ":" << cfg.port << std::endl;
+    return true;
+}
+
+// One client: encodes requests and splits replies into lines. The server
+// answers every command with exactly one line. With a slot map a request is
+// split by owning node, one part per node (MGET/MSET keys are grouped), and
+// it completes when the last part has replied. MOVED updates the map but the
+// request is not retried; it and ASK/TRYAGAIN are counted as redirects.
+class Client {
+public:
+    Client(const Config& cfg, const SlotMap* slots, uint64_t seed, const ZipfGenerator* zipf)
+        : cfg_(cfg), rng_(seed), zipf_(zipf), values_(cfg.value_max, 'v') {
+        unsigned total = 0;
+        for (int i = 0; i < OP_COUNT; ++i) {
+            total += cfg_.mix[i];
+            mix_cdf_[i] = total;
+        }
+        if (slots) {
+            addrs_ = slots->nodes;
+            owner_ = slots->owner;
+        } else {
+            addrs_ = {{cfg.host, cfg.port}};
+        }
+        nodes_.resize(addrs_.size());
+    }
+    
+    ~Client() {
+        for (Node& n : nodes_) {
+            if (n.sock >= 0) close(n.sock);
+        }
+    }
+    
+    // Connects to the seed; other nodes are connected on first use
+    bool connect() { return connect_node(0); }
+    
+    uint64_t redirects() const { return redirects_; }
+    
+    Op pick_op() {
+        unsigned r = static_cast<unsigned>(rng_.next() % mix_cdf_[OP_COUNT - 1]);
+        int op = 0;
+        while (r >= mix_cdf_[op]) ++op;
+        return static_cast<Op>(op);
+    }
+    
+    size_t pick_key() {
+        if (zipf_) {
+            return zipf_->next(rng_.unit());
+        }
+        return rng_.next() % cfg_.keys;
+    }
+    
+    size_t pick_value_size() {
+        if (cfg_.value_max == cfg_.value_min) {
+            return cfg_.value_min;
+        }
+        if (cfg_.value_log) {
+            double lo = std::log(static_cast<double>(std::max<size_t>(cfg_.value_min, 1)));
+            double hi = std::log(static_cast<double>(cfg_.value_max));
+            return std::min(cfg_.value_max, static_cast<size_t>(std::exp(lo + rng_.unit() * (hi - lo))));
+        }
+        return cfg_.value_min + rng_.next() % (cfg_.value_max - cfg_.value_min + 1);
+    }
+    
+    // tag is handed back to read_replies' callback when the request completes
+    void append_request(Op op, uint64_t tag = 0) {
+        key_text_.clear();
+        
+        size_t nkeys = op == OP_MGET ? cfg_.mget_keys : op == OP_MSET ? cfg_.mset_keys : 1;
+        key_ends_.clear();
+        for (size_t k = 0; k < nkeys; ++k) {
+            key_text_ += "key:" + std::to_string(pick_key());
+            key_ends_.push_back(key_text_.size());
+        }
+        append_keys(op, tag);
+    }
+    
+    void append_set(size_t key) {
+        key_text_ = "key:" + std::to_string(key);
+        key_ends_.assign({key_text_.size()});
+        append_keys(OP_SET, 0);
+    }
+    
+    bool flush() {
+        if (failed_) {
+            return false;
+        }
+        for (Node& n : nodes_) {
+            size_t sent = 0;
+            while (sent < n.out.size()) {
+                ssize_t r = send(n.sock, n.out.data() + sent, n.out.size() - sent, MSG_NOSIGNAL);
+                if (r <= 0) {
+                    if (r < 0 && errno == EINTR) continue;
+                    return false;
+                }
+                sent += r;
+            }
+            n.out.clear();
+        }
+        return true;
+    }
+    
+    bool has_output() const {
+        for (const Node& n : nodes_) {
+            if (!n.out.empty()) return true;
+        }
+        return false;
+    }
+    
+    // Waits up to timeout_ns (-1 = forever) for data, then calls
+    // on_done(op, tag, is_error) for every request whose last reply arrived.
+    // Returns false once a connection is gone.
+    template <typename OnDone>
+    bool read_replies(int64_t timeout_ns, OnDone on_done) {
+        // Nodes not connected yet have sock -1, which ppoll skips
+        pfds_.resize(nodes_.size());
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            pfds_[i] = {nodes_[i].sock, POLLIN, 0};
+        }
+        timespec ts{static_cast<time_t>(timeout_ns / 1000000000), static_cast<long>(timeout_ns % 1000000000)};
+        int ready = ppoll(pfds_.data(), pfds_.size(), timeout_ns < 0 ? nullptr : &ts, nullptr);
+        if (ready < 0) {
+            return errno == EINTR;
+        }
+        
+        char buf[64 * 1024];
+        for (size_t i = 0; i < pfds_.size() && ready > 0; ++i) {
+            if (pfds_[i].revents == 0) {
+                continue;
+            }
+            ready--;
+            // nodes_ is a deque, so a MOVED that adds a node keeps n valid
+            Node& n = nodes_[i];
+            ssize_t got = recv(n.sock, buf, sizeof(buf), 0);
+            if (got <= 0) {
+                return false;
+            }
+            n.in.append(buf, got);
+            
+            size_t start = 0;
+            size_t nl;
+            while ((nl = n.in.find('\n', start)) != std::string::npos && !n.parts.empty()) {
+                std::string_view line(n.in.data() + start, nl - start);
+                Pending& p = pending_[n.parts.front() - first_seq_];
+                n.parts.pop_front();
+                if (line.compare(0, 6, "ERROR:") == 0) {
+                    p.error = true;
+                } else if (line.compare(0, 6, "MOVED ") == 0) {
+                    moved(line);
+                } else if (line.compare(0, 4, "ASK ") == 0 || line.compare(0, 9, "TRYAGAIN ") == 0) {
+                    redirects_++;
+                }
+                if (--p.parts == 0) {
+                    on_done(p.op, p.tag, p.error);
+                }
+                start = nl + 1;
+            }
+            n.in.erase(0, start);
+        }
+        while (!pending_.empty() && pending_.front().parts == 0) {
+            pending_.pop_front();
+            first_seq_++;
+        }
+        return true;
+    }
+
+private:
+    struct Node {
+        int sock = -1;
+        std::string out;
+        std::string in;
+        std::deque<uint64_t> parts;  // Request sequence number of each reply due
+    };
+    
+    struct Pending {
+        Op op;
+        uint64_t tag;
+        unsigned parts;              // Replies still due
+        bool error;
+    };
+    
+    bool connect_node(size_t index) {
+        if (nodes_[index].sock < 0) {
+            nodes_[index].sock = connect_to(addrs_[index].first, addrs_[index].second);
+        }
+        return nodes_[index].sock >= 0;
+    }
+    
+    size_t node_for(std::string_view key) {
+        return owner_.empty() ? 0 : owner_[key_slot(key)];
+    }
+    
+    // MOVED <slot> <host:port>
+    void moved(std::string_view line) {
+        redirects_++;
+        size_t space = line.find(' ', 6);
+        if (space == std::string_view::npos) {
+            return;
+        }
+        size_t slot = std::strtoul(std::string(line.substr(6, space - 6)).c_str(), nullptr, 10);
+        std::string host;
+        int port = 0;
+        if (owner_.empty() || slot >= CLUSTER_SLOTS || !split_addr(line.substr(space + 1), host, port)) {
+            return;
+        }
+        size_t node = find_or_add_node(addrs_, host, port);
+        if (node == nodes_.size()) {
+            nodes_.emplace_back();
+        }
+        owner_[slot] = static_cast<uint16_t>(node);
+    }
+    
+    // Sends the keys in key_text_ (ending at key_ends_), one command per node
+    void append_keys(Op op, uint64_t tag) {
+        keys_.clear();
+        key_nodes_.clear();
+        size_t begin = 0;
+        for (size_t end : key_ends_) {
+            keys_.push_back(std::string_view(key_text_).substr(begin, end - begin));
+            key_nodes_.push_back(node_for(keys_.back()));
+            begin = end;
+        }
+        
+        const size_t SENT = SIZE_MAX;
+        unsigned parts = 0;
+        for (size_t i = 0; i < keys_.size(); ++i) {
+            size_t node = key_nodes_[i];
+            if (node == SENT) {
+                continue;
+            }
+            args_.assign({OP_NAMES[op]});
+            for (size_t j = i; j < keys_.size(); ++j) {
+                if (key_nodes_[j] != node) continue;
+                args_.push_back(keys_[j]);
+                if (op == OP_MSET || op == OP_SET) {
+                    args_.push_back(std::string_view(values_).substr(0, pick_value_size()));
+                }
+                key_nodes_[j] = SENT;
+            }
+            if (!connect_node(node)) {
+                failed_ = true;
+                continue;
+            }
+            append_command(nodes_[node].out, args_);
+            nodes_[node].parts.push_back(first_seq_ + pending_.size());
+            parts++;
+        }
+        pending_.push_back({op, tag, parts, false});
+    }
+    
+    void append_command(std::string& out, const std::vector<std::string_view>& args) {
+        if (!cfg_.resp) {
+            for (size_t i = 0; i < args.size(); ++i) {
+                if (i > 0) out += ' ';
+                out += args[i];
+            }
+            out += '\n';
+            return;
+        }
+        out += '*' + std::to_string(args.size()) + "\r\n";
+        for (std::string_view a : args) {
+            out += '$' + std::to_string(a.size()) + "\r\n";
+            out += a;
+            out += "\r\n";
+        }
+    }
+    
+    const Config& cfg_;
+    Rng rng_;
+    const ZipfGenerator* zipf_;
+    std::string values_;
+    unsigned mix_cdf_[OP_COUNT];
+    std::vector<std::pair<std::string, int>> addrs_;
+    std::vector<uint16_t> owner_;    // Empty unless --cluster
+    std::deque<Node> nodes_;         // Parallel to addrs_
+    std::deque<Pending> pending_;    // Requests from sequence number first_seq_ on
+    uint64_t first_seq_ = 0;
+    uint64_t redirects_ = 0;
+    bool failed_ = false;
+    std::vector<pollfd> pfds_;
+    std::string key_text_;
+    std::vector<size_t> key_ends_;
+    std::vector<std::string_view> keys_;
+    std::vector<size_t> key_nodes_;
+    std::vector<std::string_view> args_;
+};
+
+// SETs this client's slice of the key space, pipelined, before measuring
+void prefill(const Config& cfg, const SlotMap* slots, int client_id, Results& results) {
+    Client client(cfg, slots, 0xF111 + client_id, nullptr);
+    if (!client.connect()) {
+        results.failed = true;
         return;
     }
+    size_t begin = cfg.keys * client_id / cfg.clients;
+    size_t end = cfg.keys * (client_id + 1) / cfg.clients;
+    const size_t CHUNK = 128;
+    
+    for (size_t k = begin; k < end; k += CHUNK) {
+        size_t n = std::min(CHUNK, end - k);
+        for (size_t i = 0; i < n; ++i) {
+            client.append_set(k + i);
+        }
+        if (!client.flush()) {
+            results.failed = true;
+            return;
+        }
+        size_t got = 0;
+        while (got < n) {
+            if (!client.read_replies(-1, [&](Op, uint64_t, bool) { got++; })) {
+                results.failed = true;
+                return;
+            }
+        }
+    }
+}
+
+void run_closed_loop(const Config& cfg, Client& client, Results& results) {
+    uint64_t start = now_ns();
+    uint64_t deadline = cfg.duration_s > 0 ? start + static_cast<uint64_t>(cfg.duration_s * 1e9) : 0;
+    long long remaining = cfg.requests;
     
-    char buffer[1024];
-    for (int i = 0; i < requests; ++i) {
-        std::string cmd = "SET key_" + std::to_string(client_id) + "_" + std::to_string(i) + " value_" + std::to_string(i) + "\n";
+    while (deadline ? now_ns() < deadline : remaining > 0) {
+        size_t batch = cfg.pipeline;
+        if (!deadline) {
+            batch = std::min<long long>(batch, remaining);
+            remaining -= batch;
+        }
         
-        send(sock, cmd.c_str(), cmd.length(), 0);
+        for (size_t i = 0; i < batch; ++i) {
+            client.append_request(client.pick_op());
+        }
         
-        ssize_t bytes = recv(sock, buffer, sizeof(buffer) - 1, 0);
-        if (bytes <= 0) {
-            break;
+        uint64_t sent_at = now_ns();
+        if (!client.flush()) {
+            results.failed = true;
+            return;
+        }
+        size_t got = 0;
+        while (got < batch) {
+            bool ok = client.read_replies(-1, [&](Op op, uint64_t, bool error) {
+                results.record(op, now_ns() - sent_at);
+                if (error) results.errors++;
+                got++;
+            });
+            if (!ok) {
+                results.failed = true;
+                return;
+            }
         }
+        results.rounds++;
     }
+    results.busy_ns += now_ns() - start;
+}
+
+void run_open_loop(const Config& cfg, Client& client, Results& results) {
+    uint64_t interval = static_cast<uint64_t>(1e9 * cfg.clients / cfg.rate);
+    uint64_t start = now_ns();
+    uint64_t deadline = cfg.duration_s > 0 ? start + static_cast<uint64_t>(cfg.duration_s * 1e9) : 0;
+    uint64_t next = start;
+    long long issued = 0;
+    size_t in_flight = 0;
     
-    close(sock);
+    auto more = [&]() { return deadline ? next < deadline : issued < cfg.requests; };
+    
+    while (true) {
+        uint64_t now = now_ns();
+        while (more() && next <= now && in_flight < static_cast<size_t>(cfg.pipeline)) {
+            // The tag is the intended send time
+            client.append_request(client.pick_op(), next);
+            in_flight++;
+            issued++;
+            next += interval;
+        }
+        if (client.has_output() && !client.flush()) {
+            results.failed = true;
+            return;
+        }
+        
+        if (in_flight == 0) {
+            if (!more()) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+            continue;
+        }
+        
+        // Wake for a reply, or for the next send if the pipeline has room.
+        // Requests held back by a full pipeline keep their scheduled time.
+        int64_t timeout = -1;
+        if (more() && in_flight < static_cast<size_t>(cfg.pipeline)) {
+            timeout = next > now ? static_cast<int64_t>(next - now) : 0;
+        }
+        bool ok = client.read_replies(timeout, [&](Op op, uint64_t intended, bool error) {
+            in_flight--;
+            results.record(op, now_ns() - intended);
+            if (error) results.errors++;
+        });
+        if (!ok) {
+            results.failed = true;
+            return;
+        }
+    }
 }
 
+void run_client(const Config& cfg, const SlotMap* slots, int client_id, const ZipfGenerator* zipf, Results& results) {
+    Client client(cfg, slots, 0x5EED0000ULL + client_id, zipf);
+    if (!client.connect()) {
+        results.failed = true;
+        return;
+    }
+    
+    if (cfg.rate > 0) {
+        run_open_loop(cfg, client, results);
+    } else {
+        run_closed_loop(cfg, client, results);
+    }
+    results.redirects += client.redirects();
+}
+
+bool parse_mix(const std::string& spec, unsigned (&mix)[OP_COUNT]) {
+    unsigned parsed[OP_COUNT] = {};
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) return false;
+        std::string name = item.substr(0, eq);
+        for (char& c : name) c = std::toupper(static_cast<unsigned char>(c));
+        int op = 0;
+        while (op < OP_COUNT && name != OP_NAMES[op]) ++op;
+        if (op == OP_COUNT) return false;
+        parsed[op] = std::stoul(item.substr(eq + 1));
+    }
+    unsigned total = 0;
+    for (unsigned w : parsed) total += w;
+    if (total == 0) return false;
+    std::memcpy(mix, parsed, sizeof(parsed));
+    return true;
+}
+
+bool parse_value_size(const std::string& spec, size_t& min, size_t& max) {
+    size_t dash = spec.find('-');
+    min = std::stoul(spec.substr(0, dash));
+    max = dash == std::string::npos ? min : std::stoul(spec.substr(dash + 1));
+    return min <= max && max > 0;
+}
+
+struct Summary {
+    uint64_t count;
+    double p50_us, p90_us, p99_us, p999_us, max_us, mean_us;
+};
+
+Summary summarize(const LatencyHistogram::Snapshot& snap) {
+    return {snap.total,
+            snap.percentile(0.50) / 1e3, snap.percentile(0.90) / 1e3,
+            snap.percentile(0.99) / 1e3, snap.percentile(0.999) / 1e3,
+            snap.percentile(1.0) / 1e3, snap.mean() / 1e3};
+}
+
+std::string summary_json(const Summary& s) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"count\":%llu,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,"
+             "\"max_us\":%.1f,\"mean_us\":%.1f}",
+             static_cast<unsigned long long>(s.count), s.p50_us, s.p90_us, s.p99_us,
+             s.p999_us, s.max_us, s.mean_us);
+    return buf;
+}
+
+void print_row(const char* name, const Summary& s) {
+    printf("  %-5s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+           static_cast<unsigned long long>(s.count), s.p50_us, s.p99_us, s.p999_us, s.max_us, s.mean_us);
+}
+
+} // namespace
+
 int main(int argc, char* argv[]) {
-    int concurrent_clients = 10;
-    int requests_per_client = 1000;
+    Config cfg;
+    
+    int i = 1;
+    // Legacy form: benchmark [clients] [requests_per_client]
+    if (i < argc && argv[i][0] != '-') {
+        cfg.clients = std::stoi(argv[i++]);
+        if (i < argc && argv[i][0] != '-') {
+            cfg.requests = std::stoll(argv[i++]);
+        }
+    }
     
-    if (argc >= 2) {
-        concurrent_clients = std::stoi(argv[1]);
+    for (; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (arg == "--prefill") {
+            cfg.prefill = true;
+            continue;
+        }
+        if (arg == "--cluster") {
+            cfg.cluster = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        
+        bool ok = true;
+        if (arg == "--host") {
+            cfg.host = value;
+        } else if (arg == "--port") {
+            cfg.port = std::stoi(value);
+        } else if (arg == "--clients") {
+            cfg.clients = std::stoi(value);
+        } else if (arg == "--requests") {
+            cfg.requests = std::stoll(value);
+        } else if (arg == "--duration") {
+            cfg.duration_s = std::stod(value);
+        } else if (arg == "--mix") {
+            ok = parse_mix(value, cfg.mix);
+        } else if (arg == "--keys") {
+            cfg.keys = std::stoul(value);
+        } else if (arg == "--dist") {
+            ok = value == "uniform" || value == "zipf";
+            cfg.zipf = value == "zipf";
+        } else if (arg == "--zipf-theta") {
+            cfg.zipf_theta = std::stod(value);
+            ok = cfg.zipf_theta > 0 && cfg.zipf_theta < 1;
+        } else if (arg == "--value-size") {
+            ok = parse_value_size(value, cfg.value_min, cfg.value_max);
+        } else if (arg == "--value-dist") {
+            ok = value == "uniform" || value == "log";
+            cfg.value_log = value == "log";
+        } else if (arg == "--mget-keys") {
+            cfg.mget_keys = std::stoul(value);
+        } else if (arg == "--mset-keys") {
+            cfg.mset_keys = std::stoul(value);
+        } else if (arg == "--pipeline") {
+            cfg.pipeline = std::stoi(value);
+        } else if (arg == "--rate") {
+            cfg.rate = std::stod(value);
+        } else if (arg == "--protocol") {
+            ok = value == "plain" || value == "resp";
+            cfg.resp = value == "resp";
+        } else if (arg == "--json") {
+            cfg.json_path = value;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (cfg.clients <= 0 || cfg.pipeline <= 0 || cfg.keys == 0 || cfg.mget_keys == 0 || cfg.mset_keys == 0 || cfg.rate < 0) {
+        print_usage(argv[0]);
+        return 1;
     }
-    if (argc >= 3) {
-        requests_per_client = std::stoi(argv[2]);
+    
+    std::unique_ptr<ZipfGenerator> zipf;
+    if (cfg.zipf) {
+        zipf.reset(new ZipfGenerator(cfg.keys, cfg.zipf_theta));
     }
     
-    std::cout << "Starting benchmark: " << concurrent_clients 
-              << " clients, " << requests_per_client << " requests each..." << std::endl;
+    SlotMap slot_map;
+    const SlotMap* slots = nullptr;
+    if (cfg.cluster) {
+        if (!fetch_slots(cfg, slot_map)) {
+            return 1;
+        }
+        slots = &slot_map;
+    }
+    
+    Results results;
+    
+    if (cfg.prefill) {
+        std::cout << "Prefilling " << cfg.keys << " keys..." << std::endl;
+        std::vector<std::thread> threads;
+        for (int c = 0; c < cfg.clients; ++c) {
+            threads.emplace_back(prefill, std::cref(cfg), slots, c, std::ref(results));
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        if (results.failed) {
+            return 1;
+        }
+    }
+    
+    std::cout << "Starting benchmark: " << cfg.clients << " clients, ";
+    if (cfg.duration_s > 0) {
+        std::cout << cfg.duration_s << " s";
+    } else {
+        std::cout << cfg.requests << " requests each";
+    }
+    if (cfg.rate > 0) {
+        std::cout << ", open loop at " << cfg.rate << " req/s";
+    }
+    std::cout << "..." << std::endl;
     
     auto start = std::chrono::high_resolution_clock::now();
     
     std::vector<std::thread> threads;
-    for (int i = 0; i < concurrent_clients; ++i) {
-        threads.emplace_back(run_client, i, requests_per_client);
+    for (int c = 0; c < cfg.clients; ++c) {
+        threads.emplace_back(run_client, std::cref(cfg), slots, c, zipf.get(), std::ref(results));
     }
     
     for (auto& t : threads) {
@@ -69,15 +903,81 @@ int main(int argc, char* argv[]) {
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> diff = end - start;
     
-    int total_reqs = concurrent_clients * requests_per_client;
+    // Closed loop: correct against the mean time between pipeline rounds
+    uint64_t expected_interval = 0;
+    if (cfg.rate == 0 && results.rounds > 0) {
+        expected_interval = results.busy_ns / results.rounds;
+    }
+    
+    Summary summaries[OP_COUNT + 1];
+    Summary raw_total = summarize(results.latency[OP_COUNT].snapshot());
+    for (int op = 0; op <= OP_COUNT; ++op) {
+        summaries[op] = summarize(correct_for_omission(results.latency[op].snapshot(), expected_interval));
+        // Report requests actually completed, not the synthetic samples
+        summaries[op].count = op < OP_COUNT ? results.completed[op].load() : raw_total.count;
+    }
+    
+    uint64_t total_reqs = raw_total.count;
     double rps = total_reqs / diff.count();
     
     std::cout << "------------------------------" << std::endl;
     std::cout << "Total Requests: " << total_reqs << std::endl;
     std::cout << "Total Time:     " << diff.count() << " s" << std::endl;
     std::cout << "Requests/sec:   " << static_cast<int>(rps) << std::endl;
+    std::cout << "Errors:         " << results.errors.load() << std::endl;
+    if (cfg.cluster) {
+        std::cout << "Redirects:      " << results.redirects.load() << std::endl;
+    }
+    if (cfg.rate > 0 && rps < cfg.rate * 0.95) {
+        std::cout << "Warning: achieved rate is below the target; the server is saturated" << std::endl;
+    }
+    std::cout << "Latency (us, corrected for coordinated omission):" << std::endl;
+    printf("  %-5s %10s %10s %10s %10s %10s %10s\n", "op", "count", "p50", "p99", "p999", "max", "mean");
+    for (int op = 0; op < OP_COUNT; ++op) {
+        if (results.completed[op] > 0) {
+            print_row(OP_NAMES[op], summaries[op]);
+        }
+    }
+    print_row("ALL", summaries[OP_COUNT]);
+    if (cfg.rate == 0) {
+        print_row("raw", raw_total);
+    }
     std::cout << "------------------------------" << std::endl;
     
-    return 0;
+    if (!cfg.json_path.empty()) {
+        std::ofstream out(cfg.json_path);
+        out << "{\"config\":{\"host\":\"" << cfg.host << "\",\"port\":" << cfg.port
+            << ",\"clients\":" << cfg.clients << ",\"requests\":" << cfg.requests
+            << ",\"duration_s\":" << cfg.duration_s << ",\"mix\":{";
+        for (int op = 0; op < OP_COUNT; ++op) {
+            out << (op > 0 ? "," : "") << "\"" << OP_NAMES[op] << "\":" << cfg.mix[op];
+        }
+        out << "},\"keys\":" << cfg.keys << ",\"dist\":\"" << (cfg.zipf ? "zipf" : "uniform")
+            << "\",\"zipf_theta\":" << cfg.zipf_theta << ",\"value_min\":" << cfg.value_min
+            << ",\"value_max\":" << cfg.value_max << ",\"value_dist\":\"" << (cfg.value_log ? "log" : "uniform")
+            << "\",\"mget_keys\":" << cfg.mget_keys << ",\"mset_keys\":" << cfg.mset_keys << ",\"pipeline\":" << cfg.pipeline
+            << ",\"rate\":" << cfg.rate << ",\"protocol\":\"" << (cfg.resp ? "resp" : "plain")
+            << "\",\"cluster\":" << (cfg.cluster ? "true" : "false") << "}"
+            << ",\"total_requests\":" << total_reqs << ",\"errors\":" << results.errors.load()
+            << ",\"redirects\":" << results.redirects.load()
+            << ",\"elapsed_s\":" << diff.count() << ",\"rps\":" << rps
+            << ",\"latency\":" << summary_json(summaries[OP_COUNT]);
+        if (cfg.rate == 0) {
+            out << ",\"uncorrected_latency\":" << summary_json(raw_total);
+        }
+        out << ",\"ops\":{";
+        bool first = true;
+        for (int op = 0; op < OP_COUNT; ++op) {
+            if (results.completed[op] == 0) continue;
+            out << (first ? "" : ",") << "\"" << OP_NAMES[op] << "\":" << summary_json(summaries[op]);
+            first = false;
+        }
+        out << "}}\n";
+        if (!out) {
+            std::cerr << "Failed to write " << cfg.json_path << std::endl;
+            return 1;
+        }
+    }
+    
+    return results.failed ? 1 : 0;
 }
-
@@ -0,0 +1,259 @@
+// Operator tool for --cluster-nodes deployments. The nodes do not gossip, so
+// any change to the slot map has to be sent to every node; `move` runs the
+// whole online migration for a slot range:
+//   target: CLUSTER SETSLOT <slots> IMPORTING <source>
+//   source: CLUSTER SETSLOT <slots> MIGRATING <target>
+//   source: CLUSTER MIGRATE <slots> <count>, until it replies 0
+//   target, source, then every other node: CLUSTER SETSLOT <slots> NODE <target>
+//
+// Usage: cluster_admin [--host <h>] [--port <n>] nodes | slots
+//        cluster_admin [--host <h>] [--port <n>] move <first>[-<last>] <to-id> [--count <n>]
+
+#include "replication/wire.h"
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+using namespace replication_wire;
+
+struct Node {
+    std::string id;
+    std::string host;
+    int port = 0;
+    std::vector<std::pair<int, int>> ranges; // Owned slots, inclusive
+    int sock = -1;
+    std::string in;
+};
+
+void print_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--host <h>] [--port <n>] nodes | slots\n"
+              << "       " << prog << " [--host <h>] [--port <n>] move <first>[-<last>] <to-id> [--count <n>]\n"
+              << "  --host <h>          Any cluster node (default 127.0.0.1)\n"
+              << "  --port <n>          Its port (default 8080)\n"
+              << "  --count <n>         Keys per MIGRATE round (default 1000)\n";
+}
+
+bool split_addr(const std::string& addr, std::string& host, int& port) {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos || colon == 0) {
+        return false;
+    }
+    host = addr.substr(0, colon);
+    port = std::atoi(addr.c_str() + colon + 1);
+    return port > 0;
+}
+
+bool parse_range(const std::string& text, int& first, int& last) {
+    size_t dash = text.find('-');
+    char* end = nullptr;
+    first = static_cast<int>(std::strtol(text.c_str(), &end, 10));
+    if (end == text.c_str()) {
+        return false;
+    }
+    last = first;
+    if (dash != std::string::npos) {
+        const char* at = text.c_str() + dash + 1;
+        last = static_cast<int>(std::strtol(at, &end, 10));
+        if (end == at) {
+            return false;
+        }
+    }
+    return *end == '\0' && first >= 0 && first <= last && last < 16384;
+}
+
+// Sends one plain-protocol command and returns its reply line, or "" when
+// the connection failed
+std::string command(Node& node, const std::string& line) {
+    if (node.sock < 0) {
+        node.sock = connect_to(node.host, node.port);
+        if (node.sock < 0) {
+            return "";
+        }
+    }
+    std::string reply;
+    if (!send_all(node.sock, line + "\n") || !read_line(node.sock, node.in, reply, 1 << 20)) {
+        close(node.sock);
+        node.sock = -1;
+        return "";
+    }
+    return reply;
+}
+
+// CLUSTER NODES: a=10.0.0.1:8080@0-5460/16000-16383,b=10.0.0.2:8080,...
+bool load_nodes(Node& seed, std::vector<Node>& nodes) {
+    std::string spec = command(seed, "CLUSTER NODES");
+    if (spec.empty() || spec.compare(0, 6, "ERROR:") == 0) {
+        std::cerr << "CLUSTER NODES failed on " << seed.host << ":" << seed.port << ": " << spec << std::endl;
+        return false;
+    }
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        Node n;
+        size_t eq = item.find('=');
+        size_t at = item.find('@');
+        if (eq == std::string::npos || !split_addr(item.substr(eq + 1, at == std::string::npos ? std::string::npos : at - eq - 1), n.host, n.port)) {
+            std::cerr << "Unexpected CLUSTER NODES entry: " << item << std::endl;
+            return false;
+        }
+        n.id = item.substr(0, eq);
+        if (at != std::string::npos) {
+            std::stringstream rs(item.substr(at + 1));
+            std::string range;
+            while (std::getline(rs, range, '/')) {
+                int first = 0;
+                int last = 0;
+                if (parse_range(range, first, last)) {
+                    n.ranges.emplace_back(first, last);
+                }
+            }
+        }
+        nodes.push_back(std::move(n));
+    }
+    return true;
+}
+
+bool expect_ok(Node& node, const std::string& line) {
+    std::string reply = command(node, line);
+    if (reply != "OK") {
+        std::cerr << node.id << ": " << line << " -> " << (reply.empty() ? "connection failed" : reply) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int move_slots(std::vector<Node>& nodes, const std::string& slots, const std::string& to_id, long long count) {
+    int first = 0;
+    int last = 0;
+    if (!parse_range(slots, first, last)) {
+        std::cerr << "Bad slot range: " << slots << std::endl;
+        return 1;
+    }
+    
+    Node* target = nullptr;
+    Node* source = nullptr;
+    for (Node& n : nodes) {
+        if (n.id == to_id) {
+            target = &n;
+        }
+        for (auto& r : n.ranges) {
+            if (r.first > last || r.second < first) {
+                continue;
+            }
+            if (r.first > first || r.second < last || (source && source != &n)) {
+                std::cerr << "Slots " << slots << " are not all owned by one node; move them in parts" << std::endl;
+                return 1;
+            }
+            source = &n;
+        }
+    }
+    if (!target) {
+        std::cerr << "Unknown node " << to_id << "; add it to every node with CLUSTER MEET first" << std::endl;
+        return 1;
+    }
+    if (!source) {
+        std::cerr << "Slots " << slots << " are not assigned" << std::endl;
+        return 1;
+    }
+    if (source == target) {
+        std::cout << "Slots " << slots << " already belong to " << to_id << std::endl;
+        return 0;
+    }
+    
+    if (!expect_ok(*target, "CLUSTER SETSLOT " + slots + " IMPORTING " + source->id) ||
+        !expect_ok(*source, "CLUSTER SETSLOT " + slots + " MIGRATING " + target->id)) {
+        return 1;
+    }
+    
+    unsigned long long moved = 0;
+    while (true) {
+        std::string reply = command(*source, "CLUSTER MIGRATE " + slots + " " + std::to_string(count));
+        uint64_t n = 0;
+        if (!parse_u64(reply, n)) {
+            // The slots stay MIGRATING/IMPORTING; running move again resumes
+            std::cerr << source->id << ": CLUSTER MIGRATE -> " << (reply.empty() ? "connection failed" : reply) << std::endl;
+            return 1;
+        }
+        if (n == 0) {
+            break;
+        }
+        moved += n;
+        std::cout << "Moved " << moved << " keys" << std::endl;
+    }
+    
+    // The target first, so it serves the slots before the source starts
+    // sending clients there
+    bool ok = expect_ok(*target, "CLUSTER SETSLOT " + slots + " NODE " + target->id) &&
+              expect_ok(*source, "CLUSTER SETSLOT " + slots + " NODE " + target->id);
+    for (Node& n : nodes) {
+        if (ok && &n != source && &n != target) {
+            ok = expect_ok(n, "CLUSTER SETSLOT " + slots + " NODE " + target->id);
+        }
+    }
+    if (!ok) {
+        return 1;
+    }
+    std::cout << "Slots " << slots << " moved from " << source->id << " to " << target->id
+              << " (" << moved << " keys)" << std::endl;
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Node seed;
+    seed.host = "127.0.0.1";
+    seed.port = 8080;
+    long long count = 1000;
+    std::vector<std::string> words;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            print_usage(argv[0]);
+            return 0;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            words.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--host") {
+            seed.host = value;
+        } else if (arg == "--port") {
+            seed.port = std::stoi(value);
+        } else if (arg == "--count") {
+            count = std::stoll(value);
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    
+    if (words.size() == 1 && (words[0] == "nodes" || words[0] == "slots")) {
+        std::string reply = command(seed, words[0] == "nodes" ? "CLUSTER NODES" : "CLUSTER SLOTS");
+        if (reply.empty()) {
+            std::cerr << "Failed to query " << seed.host << ":" << seed.port << std::endl;
+            return 1;
+        }
+        std::cout << reply << std::endl;
+        return reply.compare(0, 6, "ERROR:") == 0 ? 1 : 0;
+    }
+    if (words.size() == 3 && words[0] == "move" && count > 0) {
+        std::vector<Node> nodes;
+        if (!load_nodes(seed, nodes)) {
+            return 1;
+        }
+        return move_slots(nodes, words[1], words[2], count);
+    }
+    print_usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,683 @@
+// In-process microbenchmarks for the components under the socket layer:
+// Parser, KVStore (GET/SET/MGET/MSET across thread and shard counts),
+// LatencyHistogram and StripedCounter, KVStore::apply_batch, the
+// WriteBatcher and the vector similarity kernels, once per kernel the CPU
+// supports.
+//
+// Every benchmark is calibrated so one repetition takes --min-time-ms, run
+// --reps times, and reported as the median and best ns/op (wall time divided
+// by total ops, so multi-threaded rows are inverse throughput) with the spread
+// across repetitions. --json saves the results; --baseline compares against a
+// saved file and exits with status 2 if anything got slower than --tolerance.
+// The comparison uses the best repetition: interference from other processes
+// only ever adds time, so the minimum is far steadier run to run than the
+// median on a shared machine.
+//
+// Usage: microbench [--filter <substr>] [--reps <n>] [--min-time-ms <n>]
+//                   [--threads 1,2,4] [--shards 1,16] [--json <file>]
+//                   [--baseline <file>] [--tolerance <percent>]
+
+#include "storage/kv_store.h"
+#include "storage/compression.h"
+#include "protocol/parser.h"
+#include "protocol/command.h"
+#include "batching/write_batcher.h"
+#include "metrics/metrics.h"
+#include "vector/embedding.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const char* BENCH_DIR = "/tmp/mem-kv-microbench";
+constexpr size_t NUM_KEYS = 100000;
+constexpr size_t MGET_KEYS = 10;
+constexpr size_t MGET_WIDE_KEYS = 500;     // A full feature vector
+constexpr size_t MSET_KEYS = 10;
+constexpr size_t BATCH_SIZE = 256;
+
+struct Options {
+    std::string filter;
+    size_t reps = 5;
+    uint64_t min_time_ms = 100;
+    std::vector<size_t> threads = {1, 2, 4};
+    std::vector<size_t> shards = {1, 16};
+    std::string json_path;
+    std::string baseline_path;
+    double tolerance_pct = 10.0;
+};
+
+struct Result {
+    std::string name;
+    double ns_per_op;    // Median across repetitions
+    double best_ns_per_op;
+    double spread_pct;   // (max - min) / median across repetitions
+};
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the optimizer from discarding a benchmark's work
+template <typename T>
+void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+uint64_t next_rand(uint64_t& state) {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+// A body runs `iters` iterations on thread `tid` and returns the ops done
+using Body = std::function<uint64_t(size_t tid, uint64_t iters)>;
+
+// Wall time of one repetition: all threads start together, timing stops when
+// the last one finishes
+uint64_t run_once(const Body& body, size_t threads, uint64_t iters, uint64_t& ops) {
+    if (threads == 1) {
+        uint64_t start = now_ns();
+        ops = body(0, iters);
+        return now_ns() - start;
+    }
+    
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<uint64_t> total{0};
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            total += body(t, iters);
+        });
+    }
+    while (ready.load() < threads) {
+        std::this_thread::yield();
+    }
+    uint64_t start = now_ns();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        w.join();
+    }
+    uint64_t elapsed = now_ns() - start;
+    ops = total.load();
+    return elapsed;
+}
+
+class Suite {
+public:
+    explicit Suite(const Options& options) : options_(options) {}
+    
+    bool selected(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+    
+    void run(const std::string& name, size_t threads, const Body& body) {
+        if (!selected(name)) {
+            return;
+        }
+        
+        // Calibrate: grow iters until one repetition takes min_time_ms
+        uint64_t target = options_.min_time_ms * 1000000ULL;
+        uint64_t iters = 1;
+        uint64_t ops = 0;
+        while (true) {
+            uint64_t elapsed = run_once(body, threads, iters, ops);
+            if (elapsed >= target / 4) {
+                iters = std::max<uint64_t>(1, iters * target / std::max<uint64_t>(elapsed, 1));
+                break;
+            }
+            iters *= 8;
+        }
+        
+        std::vector<double> samples;
+        for (size_t r = 0; r < options_.reps; ++r) {
+            uint64_t elapsed = run_once(body, threads, iters, ops);
+            samples.push_back(static_cast<double>(elapsed) / std::max<uint64_t>(ops, 1));
+        }
+        std::sort(samples.begin(), samples.end());
+        double median = samples[samples.size() / 2];
+        double spread = median > 0 ? 100.0 * (samples.back() - samples.front()) / median : 0;
+        
+        results_.push_back({name, median, samples.front(), spread});
+        printf("%-44s %12.1f %12.1f %9.1f%%\n", name.c_str(), median, samples.front(), spread);
+        fflush(stdout);
+    }
+    
+    const std::vector<Result>& results() const { return results_; }
+    const Options& options() const { return options_; }
+
+private:
+    Options options_;
+    std::vector<Result> results_;
+};
+
+std::vector<std::string> make_keys() {
+    std::vector<std::string> keys;
+    keys.reserve(NUM_KEYS);
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        keys.push_back("feature:" + std::to_string(i));
+    }
+    return keys;
+}
+
+ParsedCommand make_set(const std::string& key, const std::string& value) {
+    ParsedCommand cmd;
+    cmd.type = CommandType::SET;
+    cmd.key = key;
+    cmd.value = value;
+    return cmd;
+}
+
+std::unique_ptr<KVStore> make_store(size_t shards, const std::vector<std::string>& keys) {
+    std::filesystem::remove_all(BENCH_DIR);
+    StoreOptions options;
+    options.shard_count = shards;
+    options.fsync_policy = FsyncPolicy::NO;
+    auto store = std::make_unique<KVStore>(std::string(BENCH_DIR) + "/wal.log", options);
+    
+    std::vector<ParsedCommand> batch;
+    std::string value(100, 'v');
+    for (size_t i = 0; i < keys.size(); ++i) {
+        batch.push_back(make_set(keys[i], value));
+        if (batch.size() == BATCH_SIZE) {
+            store->apply_batch(batch);
+            batch.clear();
+        }
+    }
+    store->apply_batch(batch);
+    return store;
+}
+
+void bench_parser(Suite& suite) {
+    struct Case {
+        const char* name;
+        std::string input;
+    };
+    std::string mget = "MGET";
+    std::string mget_resp = "*" + std::to_string(MGET_KEYS + 1) + "\r\n$4\r\nMGET\r\n";
+    for (size_t i = 0; i < MGET_KEYS; ++i) {
+        mget += " feature:" + std::to_string(1000 + i);
+        mget_resp += "$12\r\nfeature:" + std::to_string(1000 + i) + "\r\n";
+    }
+    mget += "\n";
+    std::string value(100, 'v');
+    std::string mset = "MSET";
+    for (size_t i = 0; i < MSET_KEYS; ++i) {
+        mset += " feature:" + std::to_string(1000 + i) + " " + value;
+    }
+    mset += " EX 3600\n";
+    
+    const Case cases[] = {
+        {"parse/plain/set", "SET feature:1234 " + value + "\n"},
+        {"parse/plain/set_ex", "SET feature:1234 " + value + " EX 3600\n"},
+        {"parse/plain/get", "GET feature:1234\n"},
+        {"parse/plain/del", "DEL feature:1234\n"},
+        {"parse/plain/mget10", mget},
+        {"parse/plain/mset10", mset},
+        {"parse/resp/set", "*3\r\n$3\r\nSET\r\n$12\r\nfeature:1234\r\n$100\r\n" + value + "\r\n"},
+        {"parse/resp/get", "*2\r\n$3\r\nGET\r\n$12\r\nfeature:1234\r\n"},
+        {"parse/resp/mget10", mget_resp},
+    };
+    
+    for (const Case& c : cases) {
+        suite.run(c.name, 1, [&](size_t, uint64_t iters) {
+            CommandView view;
+            for (uint64_t i = 0; i < iters; ++i) {
+                view.reset();
+                do_not_optimize(Parser::parse_view(c.input.data(), c.input.size(), view));
+                do_not_optimize(view.key.data());
+            }
+            return iters;
+        });
+    }
+    
+    // Owning parse, as used by journal replay and tools
+    std::string line = "SET feature:1234 " + value;
+    suite.run("parse/owning/set", 1, [&](size_t, uint64_t iters) {
+        for (uint64_t i = 0; i < iters; ++i) {
+            ParsedCommand cmd = Parser::parse(line);
+            do_not_optimize(cmd.key.data());
+        }
+        return iters;
+    });
+}
+
+void bench_store(Suite& suite, const std::vector<std::string>& keys) {
+    const Options& opts = suite.options();
+    for (size_t shards : opts.shards) {
+        std::string prefix = "store/shards=" + std::to_string(shards);
+        bool any = false;
+        for (size_t threads : opts.threads) {
+            for (const char* op : {"/get", "/get_hot", "/set", "/mget10", "/mget500", "/mset10"}) {
+                any = any || suite.selected(prefix + op + "/threads=" + std::to_string(threads));
+            }
+        }
+        if (!any) {
+            continue;
+        }
+        
+        std::unique_ptr<KVStore> store = make_store(shards, keys);
+        std::string value(100, 'v');
+        bool hot_warm = false;
+        
+        for (size_t threads : opts.threads) {
+            std::string suffix = "/threads=" + std::to_string(threads);
+            
+            suite.run(prefix + "/get" + suffix, threads, [&](size_t tid, uint64_t iters) {
+                uint64_t rng = 0x9E3779B97F4A7C15ULL + tid;
+                std::string out;
+                CommandView view;
+                view.type = CommandType::GET;
+                view.valid = true;
+                for (uint64_t i = 0; i < iters; ++i) {
+                    view.key = keys[next_rand(rng) % keys.size()];
+                    out.clear();
+                    store->execute(view, out);
+                    do_not_optimize(out.data());
+                }
+                return iters;
+            });
+            
+            // Every thread reads one key, after the hot-key detector has
+            // had a cycle to pick it up
+            if (!hot_warm && suite.selected(prefix + "/get_hot" + suffix)) {
+                hot_warm = true;
+                std::string out;
+                CommandView view;
+                view.type = CommandType::GET;
+                view.key = keys[0];
+                view.valid = true;
+                auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(1500);
+                while (std::chrono::steady_clock::now() < until) {
+                    out.clear();
+                    store->execute(view, out);
+                }
+            }
+            suite.run(prefix + "/get_hot" + suffix, threads, [&](size_t, uint64_t iters) {
+                std::string out;
+                CommandView view;
+                view.type = CommandType::GET;
+                view.key = keys[0];
+                view.valid = true;
+                for (uint64_t i = 0; i < iters; ++i) {
+                    out.clear();
+                    store->execute(view, out);
+                    do_not_optimize(out.data());
+                }
+                return iters;
+            });
+            
+            suite.run(prefix + "/set" + suffix, threads, [&](size_t tid, uint64_t iters) {
+                uint64_t rng = 0xC2B2AE3D27D4EB4FULL + tid;
+                std::string out;
+                CommandView view;
+                view.type = CommandType::SET;
+                view.value = value;
+                view.valid = true;
+                for (uint64_t i = 0; i < iters; ++i) {
+                    view.key = keys[next_rand(rng) % keys.size()];
+                    out.clear();
+                    store->execute(view, out);
+                    do_not_optimize(out.data());
+                }
+                return iters;
+            });
+            
+            for (size_t width : {MGET_KEYS, MGET_WIDE_KEYS}) {
+                std::string name = prefix + "/mget" + std::to_string(width) + suffix;
+                suite.run(name, threads, [&, width](size_t tid, uint64_t iters) {
+                    uint64_t rng = 0x165667B19E3779F9ULL + tid;
+                    std::string out;
+                    CommandView view;
+                    view.type = CommandType::MGET;
+                    view.valid = true;
+                    view.keys.resize(width);
+                    for (uint64_t i = 0; i < iters; ++i) {
+                        for (auto& k : view.keys) {
+                            k = keys[next_rand(rng) % keys.size()];
+                        }
+                        out.clear();
+                        store->execute(view, out);
+                        do_not_optimize(out.data());
+                    }
+                    return iters;
+                });
+            }
+            
+            suite.run(prefix + "/mset" + std::to_string(MSET_KEYS) + suffix, threads, [&](size_t tid, uint64_t iters) {
+                uint64_t rng = 0x27D4EB2F165667C5ULL + tid;
+                std::string out;
+                CommandView view;
+                view.type = CommandType::MSET;
+                view.valid = true;
+                view.keys.resize(MSET_KEYS);
+                view.values.assign(MSET_KEYS, value);
+                view.ttls.assign(MSET_KEYS, 0);
+                for (uint64_t i = 0; i < iters; ++i) {
+                    for (auto& k : view.keys) {
+                        k = keys[next_rand(rng) % keys.size()];
+                    }
+                    out.clear();
+                    store->execute(view, out);
+                    do_not_optimize(out.data());
+                }
+                return iters;
+            });
+        }
+    }
+}
+
+void bench_metrics(Suite& suite) {
+    size_t max_threads = *std::max_element(suite.options().threads.begin(), suite.options().threads.end());
+    
+    for (size_t threads : {size_t(1), max_threads}) {
+        std::string suffix = "/threads=" + std::to_string(threads);
+        
+        LatencyHistogram histogram;
+        suite.run("metrics/histogram_record" + suffix, threads, [&](size_t tid, uint64_t iters) {
+            uint64_t rng = 0xA0761D6478BD642FULL + tid;
+            for (uint64_t i = 0; i < iters; ++i) {
+                histogram.record(next_rand(rng) & 0xFFFFF); // Up to ~1s in us
+            }
+            return iters;
+        });
+        
+        StripedCounter counter;
+        suite.run("metrics/counter_add" + suffix, threads, [&](size_t, uint64_t iters) {
+            for (uint64_t i = 0; i < iters; ++i) {
+                counter.add();
+            }
+            return iters;
+        });
+        
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    
+    // Merge cost paid by STATS
+    LatencyHistogram histogram;
+    for (uint64_t i = 0; i < 100000; ++i) {
+        histogram.record(i);
+    }
+    suite.run("metrics/histogram_snapshot", 1, [&](size_t, uint64_t iters) {
+        for (uint64_t i = 0; i < iters; ++i) {
+            do_not_optimize(histogram.snapshot().percentile(0.99));
+        }
+        return iters;
+    });
+}
+
+void bench_batching(Suite& suite, const std::vector<std::string>& keys) {
+    if (!suite.selected("batch/")) {
+        return;
+    }
+    std::unique_ptr<KVStore> store = make_store(16, keys);
+    std::string value(100, 'v');
+    
+    // ns/op is per write, not per batch
+    suite.run("batch/apply_batch/256", 1, [&](size_t, uint64_t iters) {
+        uint64_t rng = 0xE7037ED1A0B428DBULL;
+        std::vector<ParsedCommand> batch(BATCH_SIZE, make_set("", value));
+        for (uint64_t i = 0; i < iters; ++i) {
+            for (auto& cmd : batch) {
+                cmd.key = keys[next_rand(rng) % keys.size()];
+            }
+            store->apply_batch(batch);
+        }
+        return iters * BATCH_SIZE;
+    });
+    
+    BatcherOptions options;
+    options.max_batch = BATCH_SIZE;
+    options.ack_mode = AckMode::APPLIED;
+    WriteBatcher batcher(*store, options);
+    suite.run("batch/batcher_applied/256", 1, [&](size_t, uint64_t iters) {
+        uint64_t rng = 0x8EBC6AF09C88C6E3ULL;
+        WriteCompletion completion;
+        for (uint64_t i = 0; i < iters; ++i) {
+            for (size_t n = 0; n < BATCH_SIZE; ++n) {
+                batcher.add_to_batch(make_set(keys[next_rand(rng) % keys.size()], value), &completion);
+            }
+            batcher.wait(completion);
+        }
+        return iters * BATCH_SIZE;
+    });
+}
+
+void bench_vector(Suite& suite) {
+    const size_t dims = 768;
+    std::vector<float> a(dims), b(dims);
+    uint64_t rng = 0x589965CC75374CC3ULL;
+    for (size_t i = 0; i < dims; ++i) {
+        a[i] = static_cast<float>(next_rand(rng) % 2001) / 1000.0f - 1.0f;
+        b[i] = static_cast<float>(next_rand(rng) % 2001) / 1000.0f - 1.0f;
+    }
+    
+    VectorKernel best = vector_kernel();
+    for (VectorKernel kernel : {VectorKernel::SCALAR, VectorKernel::AVX2, VectorKernel::AVX512, VectorKernel::NEON}) {
+        if (!vector_kernel_supported(kernel)) {
+            continue;
+        }
+        set_vector_kernel(kernel);
+        std::string suffix = "/" + std::string(vector_kernel_name(kernel)) + "/dims=" + std::to_string(dims);
+        
+        suite.run("vector/dot" + suffix, 1, [&](size_t, uint64_t iters) {
+            for (uint64_t i = 0; i < iters; ++i) {
+                do_not_optimize(vector_dot(a.data(), b.data(), dims));
+            }
+            return iters;
+        });
+        suite.run("vector/cosine" + suffix, 1, [&](size_t, uint64_t iters) {
+            float dot, norm_sq;
+            for (uint64_t i = 0; i < iters; ++i) {
+                vector_dot_norm(a.data(), b.data(), dims, dot, norm_sq);
+                do_not_optimize(dot);
+                do_not_optimize(norm_sq);
+            }
+            return iters;
+        });
+        suite.run("vector/l2" + suffix, 1, [&](size_t, uint64_t iters) {
+            for (uint64_t i = 0; i < iters; ++i) {
+                do_not_optimize(vector_l2_squared(a.data(), b.data(), dims));
+            }
+            return iters;
+        });
+    }
+    set_vector_kernel(best);
+}
+
+// A 4KB JSON-like feature blob, the kind of value --compress-min-size targets
+void bench_compression(Suite& suite) {
+    std::string blob;
+    uint64_t rng = 0x2545F4914F6CDD1DULL;
+    while (blob.size() < 4096) {
+        blob += "{\"feature\":\"f" + std::to_string(next_rand(rng) % 64) + "\",\"weight\":0." +
+                std::to_string(next_rand(rng) % 1000) + "},";
+    }
+    blob.resize(4096);
+    std::string frame;
+    compress_value(blob, frame);
+    
+    suite.run("compress/lz4/bytes=4096", 1, [&](size_t, uint64_t iters) {
+        std::string out;
+        for (uint64_t i = 0; i < iters; ++i) {
+            out.clear();
+            do_not_optimize(compress_value(blob, out));
+        }
+        return iters;
+    });
+    suite.run("decompress/lz4/bytes=4096", 1, [&](size_t, uint64_t iters) {
+        std::string out;
+        for (uint64_t i = 0; i < iters; ++i) {
+            out.clear();
+            do_not_optimize(decompress_value(frame, out));
+        }
+        return iters;
+    });
+}
+
+std::vector<size_t> parse_list(const std::string& text) {
+    std::vector<size_t> out;
+    std::stringstream ss(text);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        out.push_back(std::stoul(item));
+    }
+    return out;
+}
+
+bool write_json(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "{\"results\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.2f", results[i].ns_per_op);
+        out << (i > 0 ? "," : "") << "\n  {\"name\":\"" << results[i].name << "\",\"ns_per_op\":" << buf;
+        snprintf(buf, sizeof(buf), "%.2f", results[i].best_ns_per_op);
+        out << ",\"best_ns_per_op\":" << buf;
+        snprintf(buf, sizeof(buf), "%.2f", results[i].spread_pct);
+        out << ",\"spread_pct\":" << buf << "}";
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+// Reads the name/best_ns_per_op pairs of a file written by write_json()
+std::map<std::string, double> read_baseline(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string text = ss.str();
+    
+    std::map<std::string, double> out;
+    const std::string name_tag = "\"name\":\"";
+    const std::string ns_tag = "\"best_ns_per_op\":";
+    size_t pos = 0;
+    while ((pos = text.find(name_tag, pos)) != std::string::npos) {
+        size_t name_start = pos + name_tag.size();
+        size_t name_end = text.find('"', name_start);
+        size_t ns_pos = text.find(ns_tag, name_end);
+        if (name_end == std::string::npos || ns_pos == std::string::npos) {
+            break;
+        }
+        out[text.substr(name_start, name_end - name_start)] = std::stod(text.substr(ns_pos + ns_tag.size()));
+        pos = ns_pos;
+    }
+    return out;
+}
+
+// Returns the number of benchmarks slower than the baseline by more than the tolerance
+size_t compare(const std::vector<Result>& results, const std::map<std::string, double>& baseline, double tolerance_pct) {
+    printf("\n%-44s %12s %12s %8s\n", "benchmark", "baseline", "current", "delta");
+    size_t regressions = 0;
+    for (const Result& r : results) {
+        auto it = baseline.find(r.name);
+        if (it == baseline.end() || it->second <= 0) {
+            printf("%-44s %12s %12.1f %8s\n", r.name.c_str(), "-", r.best_ns_per_op, "new");
+            continue;
+        }
+        double delta = 100.0 * (r.best_ns_per_op - it->second) / it->second;
+        bool regressed = delta > tolerance_pct;
+        regressions += regressed;
+        printf("%-44s %12.1f %12.1f %+7.1f%%%s\n", r.name.c_str(), it->second, r.best_ns_per_op, delta,
+               regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substr>] [--reps <n>] [--min-time-ms <n>]"
+                      << " [--threads 1,2,4] [--shards 1,16] [--json <file>] [--baseline <file>]"
+                      << " [--tolerance <percent>]" << std::endl;
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+        std::string value = argv[++i];
+        
+        if (arg == "--filter") {
+            options.filter = value;
+        } else if (arg == "--reps") {
+            options.reps = std::max<size_t>(1, std::stoul(value));
+        } else if (arg == "--min-time-ms") {
+            options.min_time_ms = std::max<uint64_t>(1, std::stoull(value));
+        } else if (arg == "--threads") {
+            options.threads = parse_list(value);
+        } else if (arg == "--shards") {
+            options.shards = parse_list(value);
+        } else if (arg == "--json") {
+            options.json_path = value;
+        } else if (arg == "--baseline") {
+            options.baseline_path = value;
+        } else if (arg == "--tolerance") {
+            options.tolerance_pct = std::stod(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (options.threads.empty() || options.shards.empty()) {
+        std::cerr << "--threads and --shards need at least one value" << std::endl;
+        return 1;
+    }
+
+#ifndef __OPTIMIZE__
+    std::cerr << "Warning: microbench built without optimization; configure with "
+              << "-DCMAKE_BUILD_TYPE=Release for meaningful numbers" << std::endl;
+#endif
+
+    printf("%-44s %12s %12s %10s\n", "benchmark", "median ns/op", "best ns/op", "spread");
+    Suite suite(options);
+    std::vector<std::string> keys = make_keys();
+    
+    bench_parser(suite);
+    bench_store(suite, keys);
+    bench_metrics(suite);
+    bench_batching(suite, keys);
+    bench_vector(suite);
+    bench_compression(suite);
+    std::filesystem::remove_all(BENCH_DIR);
+    
+    if (!options.json_path.empty() && !write_json(options.json_path, suite.results())) {
+        std::cerr << "Failed to write " << options.json_path << std::endl;
+        return 1;
+    }
+    
+    if (!options.baseline_path.empty()) {
+        std::map<std::string, double> baseline = read_baseline(options.baseline_path);
+        if (baseline.empty()) {
+            std::cerr << "No results in baseline " << options.baseline_path << std::endl;
+            return 1;
+        }
+        size_t regressions = compare(suite.results(), baseline, options.tolerance_pct);
+        if (regressions > 0) {
+            printf("%zu benchmark(s) regressed by more than %.1f%%\n", regressions, options.tolerance_pct);
+            return 2;
+        }
+    }
+    return 0;
+}
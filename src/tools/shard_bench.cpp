@@ -0,0 +1,107 @@
+// In-process throughput of KVStore as the shard count grows. Each run starts
+// a fresh store, preloads the key space, then has every thread issue a
+// GET/SET mix against uniformly random keys for a fixed duration.
+//
+// Usage: shard_bench [threads] [seconds_per_run] [read_percent] [max_shards]
+
+#include "storage/kv_store.h"
+#include "protocol/command.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr size_t NUM_KEYS = 100000;
+const char* BENCH_DIR = "/tmp/mem-kv-shard-bench";
+
+ParsedCommand make_command(CommandType type, const std::string& key, const std::string& value = "") {
+    ParsedCommand cmd;
+    cmd.type = type;
+    cmd.key = key;
+    cmd.value = value;
+    cmd.valid = true;
+    return cmd;
+}
+
+double run(size_t shards, size_t threads, int seconds, int read_percent) {
+    std::filesystem::remove_all(BENCH_DIR);
+    
+    StoreOptions options;
+    options.shard_count = shards;
+    options.fsync_policy = FsyncPolicy::NO;
+    KVStore store(std::string(BENCH_DIR) + "/wal.log", options);
+    
+    for (size_t i = 0; i < NUM_KEYS; ++i) {
+        store.execute(make_command(CommandType::SET, "feature:" + std::to_string(i), "value"));
+    }
+    
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> total_ops{0};
+    std::vector<std::thread> workers;
+    
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937_64 rng(t + 1);
+            ParsedCommand get_cmd = make_command(CommandType::GET, "");
+            ParsedCommand set_cmd = make_command(CommandType::SET, "", "value");
+            uint64_t ops = 0;
+            
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::string key = "feature:" + std::to_string(rng() % NUM_KEYS);
+                if (static_cast<int>(rng() % 100) < read_percent) {
+                    get_cmd.key = std::move(key);
+                    store.execute(get_cmd);
+                } else {
+                    set_cmd.key = std::move(key);
+                    store.execute(set_cmd);
+                }
+                ops++;
+            }
+            total_ops.fetch_add(ops);
+        });
+    }
+    
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& w : workers) {
+        w.join();
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return total_ops.load() / elapsed;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t threads = std::thread::hardware_concurrency();
+    if (threads == 0) {
+        threads = 8;
+    }
+    int seconds = 2;
+    int read_percent = 90;
+    size_t max_shards = 256;
+    
+    if (argc > 1) threads = std::stoul(argv[1]);
+    if (argc > 2) seconds = std::stoi(argv[2]);
+    if (argc > 3) read_percent = std::stoi(argv[3]);
+    if (argc > 4) max_shards = std::stoul(argv[4]);
+    
+    std::cout << "threads=" << threads << " read_percent=" << read_percent
+              << " keys=" << NUM_KEYS << "\n";
+    std::cout << "shards\tops/sec\n";
+    
+    for (size_t shards = 1; shards <= max_shards; shards *= 2) {
+        double ops = run(shards, threads, seconds, read_percent);
+        std::cout << shards << "\t" << static_cast<uint64_t>(ops) << std::endl;
+    }
+    
+    std::filesystem::remove_all(BENCH_DIR);
+    return 0;
+}
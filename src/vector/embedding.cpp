@@ -0,0 +1,360 @@
+#include "embedding.h"
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define MEMKV_VECTOR_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MEMKV_VECTOR_NEON 1
+#endif
+
+namespace {
+
+inline bool is_separator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == '[' || c == ']';
+}
+
+// Four independent sums so the adds pipeline; the compiler does not
+// reassociate float math on its own
+float dot_scalar(const float* a, const float* b, size_t n) {
+    float s[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; ++k) s[k] += a[i + k] * b[i + k];
+    }
+    for (; i < n; ++i) s[0] += a[i] * b[i];
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+float l2_scalar(const float* a, const float* b, size_t n) {
+    float s[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; ++k) {
+            float d = a[i + k] - b[i + k];
+            s[k] += d * d;
+        }
+    }
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        s[0] += d * d;
+    }
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+void dot_norm_scalar(const float* a, const float* b, size_t n, float& dot, float& norm_sq) {
+    float d[4] = {0, 0, 0, 0};
+    float q[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int k = 0; k < 4; ++k) {
+            d[k] += a[i + k] * b[i + k];
+            q[k] += b[i + k] * b[i + k];
+        }
+    }
+    for (; i < n; ++i) {
+        d[0] += a[i] * b[i];
+        q[0] += b[i] * b[i];
+    }
+    dot = (d[0] + d[1]) + (d[2] + d[3]);
+    norm_sq = (q[0] + q[1]) + (q[2] + q[3]);
+}
+
+#if defined(MEMKV_VECTOR_X86)
+__attribute__((target("avx2,fma")))
+inline float hsum_avx2(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    __m128 shuf = _mm_movehdup_ps(sum);
+    sum = _mm_add_ps(sum, shuf);
+    return _mm_cvtss_f32(_mm_add_ss(sum, _mm_movehl_ps(shuf, sum)));
+}
+
+__attribute__((target("avx2,fma")))
+float dot_avx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+float l2_avx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float sum = hsum_avx2(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+__attribute__((target("avx2,fma")))
+void dot_norm_avx2(const float* a, const float* b, size_t n, float& dot, float& norm_sq) {
+    __m256 d = _mm256_setzero_ps();
+    __m256 q = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vb = _mm256_loadu_ps(b + i);
+        d = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), vb, d);
+        q = _mm256_fmadd_ps(vb, vb, q);
+    }
+    dot = hsum_avx2(d);
+    norm_sq = hsum_avx2(q);
+    for (; i < n; ++i) {
+        dot += a[i] * b[i];
+        norm_sq += b[i] * b[i];
+    }
+}
+
+// The tail is one masked load, so no scalar loop is needed
+__attribute__((target("avx512f")))
+float dot_avx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+float l2_avx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc1 = _mm512_fmadd_ps(d, d, acc1);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f")))
+void dot_norm_avx512(const float* a, const float* b, size_t n, float& dot, float& norm_sq) {
+    __m512 d = _mm512_setzero_ps();
+    __m512 q = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 vb = _mm512_loadu_ps(b + i);
+        d = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), vb, d);
+        q = _mm512_fmadd_ps(vb, vb, q);
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 vb = _mm512_maskz_loadu_ps(m, b + i);
+        d = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), vb, d);
+        q = _mm512_fmadd_ps(vb, vb, q);
+    }
+    dot = _mm512_reduce_add_ps(d);
+    norm_sq = _mm512_reduce_add_ps(q);
+}
+#endif
+
+#if defined(MEMKV_VECTOR_NEON)
+float dot_neon(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0);
+    float32x4_t acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float sum = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+float l2_neon(const float* a, const float* b, size_t n) {
+    float32x4_t acc = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t d = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        acc = vfmaq_f32(acc, d, d);
+    }
+    float sum = vaddvq_f32(acc);
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void dot_norm_neon(const float* a, const float* b, size_t n, float& dot, float& norm_sq) {
+    float32x4_t d = vdupq_n_f32(0);
+    float32x4_t q = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t vb = vld1q_f32(b + i);
+        d = vfmaq_f32(d, vld1q_f32(a + i), vb);
+        q = vfmaq_f32(q, vb, vb);
+    }
+    dot = vaddvq_f32(d);
+    norm_sq = vaddvq_f32(q);
+    for (; i < n; ++i) {
+        dot += a[i] * b[i];
+        norm_sq += b[i] * b[i];
+    }
+}
+#endif
+
+VectorKernel best_kernel() {
+#if defined(MEMKV_VECTOR_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return VectorKernel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return VectorKernel::AVX2;
+    }
+#elif defined(MEMKV_VECTOR_NEON)
+    return VectorKernel::NEON;
+#endif
+    return VectorKernel::SCALAR;
+}
+
+std::atomic<VectorKernel> g_kernel{best_kernel()};
+
+} // namespace
+
+bool parse_vector(std::string_view text, std::vector<float>& out) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+        if (is_separator(text[pos])) {
+            ++pos;
+            continue;
+        }
+        size_t end = pos;
+        while (end < text.size() && !is_separator(text[end])) ++end;
+        const char* first = text.data() + pos;
+        if (*first == '+') {
+            ++first; // from_chars takes no plus sign
+        }
+        float value = 0;
+        auto result = std::from_chars(first, text.data() + end, value);
+        if (result.ec != std::errc() || result.ptr != text.data() + end || !std::isfinite(value)) {
+            return false;
+        }
+        out.push_back(value);
+        pos = end;
+    }
+    return true;
+}
+
+void format_float(float value, std::string& out) {
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+void format_vector(std::string_view bytes, std::string& out) {
+    for (size_t i = 0; i + sizeof(float) <= bytes.size(); i += sizeof(float)) {
+        float value;
+        std::memcpy(&value, bytes.data() + i, sizeof(float));
+        if (i > 0) out += ' ';
+        format_float(value, out);
+    }
+}
+
+float vector_dot(const float* a, const float* b, size_t n) {
+    switch (g_kernel.load(std::memory_order_relaxed)) {
+#if defined(MEMKV_VECTOR_X86)
+        case VectorKernel::AVX512: return dot_avx512(a, b, n);
+        case VectorKernel::AVX2: return dot_avx2(a, b, n);
+#elif defined(MEMKV_VECTOR_NEON)
+        case VectorKernel::NEON: return dot_neon(a, b, n);
+#endif
+        default: return dot_scalar(a, b, n);
+    }
+}
+
+float vector_l2_squared(const float* a, const float* b, size_t n) {
+    switch (g_kernel.load(std::memory_order_relaxed)) {
+#if defined(MEMKV_VECTOR_X86)
+        case VectorKernel::AVX512: return l2_avx512(a, b, n);
+        case VectorKernel::AVX2: return l2_avx2(a, b, n);
+#elif defined(MEMKV_VECTOR_NEON)
+        case VectorKernel::NEON: return l2_neon(a, b, n);
+#endif
+        default: return l2_scalar(a, b, n);
+    }
+}
+
+void vector_dot_norm(const float* a, const float* b, size_t n, float& dot, float& norm_sq) {
+    switch (g_kernel.load(std::memory_order_relaxed)) {
+#if defined(MEMKV_VECTOR_X86)
+        case VectorKernel::AVX512: dot_norm_avx512(a, b, n, dot, norm_sq); return;
+        case VectorKernel::AVX2: dot_norm_avx2(a, b, n, dot, norm_sq); return;
+#elif defined(MEMKV_VECTOR_NEON)
+        case VectorKernel::NEON: dot_norm_neon(a, b, n, dot, norm_sq); return;
+#endif
+        default: dot_norm_scalar(a, b, n, dot, norm_sq); return;
+    }
+}
+
+VectorKernel vector_kernel() {
+    return g_kernel.load(std::memory_order_relaxed);
+}
+
+const char* vector_kernel_name(VectorKernel kernel) {
+    switch (kernel) {
+        case VectorKernel::AVX2: return "avx2";
+        case VectorKernel::AVX512: return "avx512";
+        case VectorKernel::NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+bool vector_kernel_supported(VectorKernel kernel) {
+    VectorKernel best = best_kernel();
+    return kernel == VectorKernel::SCALAR || kernel == best ||
+           (kernel == VectorKernel::AVX2 && best == VectorKernel::AVX512);
+}
+
+void set_vector_kernel(VectorKernel kernel) {
+    g_kernel.store(vector_kernel_supported(kernel) ? kernel : VectorKernel::SCALAR, std::memory_order_relaxed);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Float32 embeddings, the values VSET stores: their text form, and the
+// kernels VSIM scores them with. Each kernel runs on the widest instruction
+// set the CPU has, picked once at startup: AVX-512F, then AVX2 with FMA on
+// x86-64, NEON on aarch64, a scalar loop otherwise. Inputs need only float
+// alignment.
+
+// Largest vector VSET accepts
+constexpr size_t MAX_VECTOR_DIMS = 16384;
+
+// Appends the numbers in text to out. They may be separated by spaces or
+// commas and wrapped in [ ], so "0.5 1" and "[0.5,1]" both parse. False on
+// anything else, including a value that does not fit a finite float.
+bool parse_vector(std::string_view text, std::vector<float>& out);
+
+// Appends the float32 values in bytes, space-separated in their shortest
+// round-trip form. bytes need not be aligned.
+void format_vector(std::string_view bytes, std::string& out);
+void format_float(float value, std::string& out);
+
+float vector_dot(const float* a, const float* b, size_t n);
+float vector_l2_squared(const float* a, const float* b, size_t n);
+// dot(a, b) and dot(b, b) in one pass, for cosine similarity
+void vector_dot_norm(const float* a, const float* b, size_t n, float& dot, float& norm_sq);
+
+enum class VectorKernel { SCALAR, AVX2, AVX512, NEON };
+VectorKernel vector_kernel();
+const char* vector_kernel_name(VectorKernel kernel);
+bool vector_kernel_supported(VectorKernel kernel);
+// For benchmarks; a kernel the CPU lacks falls back to SCALAR
+void set_vector_kernel(VectorKernel kernel);
@@ -0,0 +1,133 @@
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "storage/clock.h"
+#include "storage/expiry_wheel.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+// Handles by key, kept current through relocate like a shard's entries
+using Handles = std::map<std::string, ExpiryWheel::Handle>;
+
+static auto relocate(Handles& handles) {
+    return [&handles](std::string_view key, uint32_t pos) { handles[std::string(key)].pos = pos; };
+}
+
+static std::vector<std::string> advance_all(ExpiryWheel& wheel, long long now_ms, Handles* handles = nullptr,
+                                            size_t max_due = 1024) {
+    Handles unused;
+    Handles& h = handles ? *handles : unused;
+    std::vector<std::string> due;
+    size_t removed = 0;
+    while (!wheel.advance(now_ms, max_due, removed, [&](const std::string& key, long long) {
+        due.push_back(key);
+        h.erase(key);
+        return true;
+    }, relocate(h))) {
+    }
+    return due;
+}
+
+static bool contains(const std::vector<std::string>& keys, const std::string& key) {
+    for (const auto& k : keys) {
+        if (k == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A long TTL scheduled first must not hold back keys due sooner
+static void test_long_ttl_first() {
+    ExpiryWheel wheel;
+    long long now = CoarseClock::now_ms();
+    wheel.schedule("month", now + 30LL * 24 * 3600 * 1000);
+    wheel.schedule("second", now + 1000);
+    
+    auto due = advance_all(wheel, now + 10 * 1000);
+    check(contains(due, "second"), "1s key due after 10s");
+    check(!contains(due, "month"), "30d key not due after 10s");
+    check(wheel.size() == 1, "30d key still scheduled");
+}
+
+static void test_overdue_is_clamped() {
+    ExpiryWheel wheel;
+    long long now = CoarseClock::now_ms();
+    wheel.schedule("past", now - 5000);
+    
+    auto due = advance_all(wheel, now + 2 * ExpiryWheel::SLOT_MS);
+    check(contains(due, "past"), "overdue key due on the next advance");
+    check(wheel.size() == 0, "wheel empty after the overdue key");
+}
+
+static void test_cancel() {
+    ExpiryWheel wheel;
+    Handles handles;
+    long long now = CoarseClock::now_ms();
+    handles["a"] = wheel.schedule("a", now + 1000);
+    handles["b"] = wheel.schedule("b", now + 1000);
+    wheel.cancel(handles["a"], relocate(handles));
+    handles.erase("a");
+    check(wheel.size() == 1, "cancel removes only the handle's item");
+    
+    auto due = advance_all(wheel, now + 10 * 1000, &handles);
+    check(!contains(due, "a"), "cancelled key not due");
+    check(contains(due, "b"), "remaining key due");
+}
+
+// Cancels across one crowded slot keep every other handle valid, also
+// while advance() stops and resumes part way through it
+static void test_cancel_relocates() {
+    ExpiryWheel wheel;
+    Handles handles;
+    long long now = CoarseClock::now_ms();
+    long long expiry = now + 1000;
+    for (int i = 0; i < 1000; ++i) {
+        std::string key = "k" + std::to_string(i);
+        handles[key] = wheel.schedule(key, i % 2 ? expiry : expiry + ExpiryWheel::SLOTS * ExpiryWheel::SLOT_MS);
+    }
+    for (int i = 0; i < 1000; i += 3) {
+        std::string key = "k" + std::to_string(i);
+        wheel.cancel(handles[key], relocate(handles));
+        handles.erase(key);
+    }
+    check(wheel.size() == handles.size(), "one item per remaining handle");
+    
+    auto due = advance_all(wheel, now + 10 * 1000, &handles, 7);
+    bool ok = true;
+    for (int i = 0; i < 1000; ++i) {
+        bool cancelled = i % 3 == 0;
+        bool first_lap = i % 2 == 1;
+        ok = ok && contains(due, "k" + std::to_string(i)) == (!cancelled && first_lap);
+    }
+    check(ok, "exactly the uncancelled first-lap keys are due");
+    
+    for (auto it = handles.begin(); it != handles.end();) {
+        wheel.cancel(it->second, relocate(handles));
+        it = handles.erase(it);
+    }
+    check(wheel.size() == 0, "cancelling every remaining handle empties the wheel");
+}
+
+int main() {
+    test_long_ttl_first();
+    test_overdue_is_clamped();
+    test_cancel();
+    test_cancel_relocates();
+    
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "expiry_wheel_test: OK" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,171 @@
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "storage/flat_map.h"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+using Map = FlatMap<uint64_t>;
+using Oracle = std::unordered_map<std::string, uint64_t>;
+
+// Every oracle entry is found with its value, and the table holds nothing else
+static bool same(const Map& map, const Oracle& oracle) {
+    if (map.size() != oracle.size()) {
+        return false;
+    }
+    for (const auto& [key, value] : oracle) {
+        size_t i = map.find(key);
+        if (i == Map::npos || map.slot(i).value != value) {
+            return false;
+        }
+    }
+    size_t full = 0;
+    for (size_t i = 0; i < map.capacity(); ++i) {
+        if (map.is_full(i)) {
+            auto it = oracle.find(std::string(map.slot(i).key()));
+            if (it == oracle.end() || it->second != map.slot(i).value) {
+                return false;
+            }
+            full++;
+        }
+    }
+    return full == oracle.size();
+}
+
+// Keys on both sides of InlineKey::INLINE_CAPACITY
+static std::string key_for(size_t n) {
+    std::string key = "key:" + std::to_string(n);
+    if (n % 5 == 0) {
+        key += std::string(InlineKey::INLINE_CAPACITY, '-');
+    }
+    return key;
+}
+
+// Random inserts, overwrites and erases over a key space that grows and
+// shrinks, so the table rehashes up several times and rebuilds over
+// tombstones in between
+static void test_churn() {
+    Map map;
+    Oracle oracle;
+    std::mt19937_64 rng(42);
+    size_t rehashes = 0;
+    size_t capacity = map.capacity();
+    
+    for (size_t round = 0; round < 8; ++round) {
+        size_t space = size_t(1000) << round;
+        for (size_t op = 0; op < 4 * space; ++op) {
+            std::string key = key_for(rng() % space);
+            uint64_t value = rng();
+            switch (rng() % 4) {
+            case 0:
+            case 1: {
+                auto [i, inserted] = map.insert(key);
+                check(inserted == (oracle.count(key) == 0), "insert reports whether the key was new");
+                map.slot(i).value = value;
+                oracle[key] = value;
+                break;
+            }
+            case 2:
+                check(map.erase(key) == (oracle.erase(key) == 1), "erase reports whether the key was there");
+                break;
+            default: {
+                size_t i = map.find(key);
+                auto it = oracle.find(key);
+                check((i == Map::npos) == (it == oracle.end()) && (i == Map::npos || map.slot(i).value == it->second),
+                      "find agrees with the oracle");
+                break;
+            }
+            }
+            if (map.capacity() != capacity) {
+                capacity = map.capacity();
+                rehashes++;
+            }
+        }
+        check(same(map, oracle), "contents after round " + std::to_string(round));
+    }
+    check(rehashes >= 8, "table rehashed several times");
+    
+    // Drain it again
+    for (auto it = oracle.begin(); it != oracle.end(); it = oracle.erase(it)) {
+        check(map.erase(it->first), "erase while draining");
+    }
+    check(map.empty() && same(map, oracle), "empty after draining");
+}
+
+// Erasing and reinserting the same keys reuses tombstoned slots: lookups
+// probe past tombstones, and the table does not grow for a steady size
+static void test_reinsert_over_tombstones() {
+    Map map;
+    Oracle oracle;
+    constexpr size_t KEYS = 5000;
+    for (size_t n = 0; n < KEYS; ++n) {
+        map.slot(map.insert(key_for(n)).first).value = n;
+        oracle[key_for(n)] = n;
+    }
+    size_t capacity = map.capacity();
+    
+    for (size_t cycle = 0; cycle < 20; ++cycle) {
+        // Every other key out, then back with a new value
+        for (size_t n = cycle % 2; n < KEYS; n += 2) {
+            map.erase(key_for(n));
+            oracle.erase(key_for(n));
+        }
+        check(same(map, oracle), "contents with tombstones, cycle " + std::to_string(cycle));
+        for (size_t n = cycle % 2; n < KEYS; n += 2) {
+            auto [i, inserted] = map.insert(key_for(n));
+            check(inserted, "reinsert of an erased key is new");
+            map.slot(i).value = n + cycle;
+            oracle[key_for(n)] = n + cycle;
+        }
+        check(same(map, oracle), "contents after reinserting, cycle " + std::to_string(cycle));
+    }
+    check(map.capacity() == capacity, "steady size keeps its capacity");
+}
+
+// Keys sharing one hash all land on the same probe sequence; erasing some
+// leaves tombstones that lookups of the others must step over
+static void test_shared_hash() {
+    Map map;
+    Oracle oracle;
+    constexpr uint64_t HASH = 0x1234567;
+    for (size_t n = 0; n < 200; ++n) {
+        map.slot(map.insert(key_for(n), HASH).first).value = n;
+        oracle[key_for(n)] = n;
+    }
+    for (size_t n = 0; n < 200; n += 3) {
+        check(map.erase(key_for(n), HASH), "erase on a shared probe sequence");
+        oracle.erase(key_for(n));
+    }
+    bool found = true;
+    for (size_t n = 0; n < 200; ++n) {
+        size_t i = map.find(key_for(n), HASH);
+        found = found && (i == Map::npos) == (n % 3 == 0) && (i == Map::npos || map.slot(i).value == n);
+    }
+    check(found, "lookups step over tombstones of the same hash");
+    for (size_t n = 0; n < 200; n += 3) {
+        check(map.insert(key_for(n), HASH).second, "reinsert on a shared probe sequence");
+    }
+    check(map.size() == 200, "every key back");
+}
+
+int main() {
+    test_churn();
+    test_reinsert_over_tombstones();
+    test_shared_hash();
+    
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "flat_map_test: OK" << std::endl;
+    return EXIT_SUCCESS;
+}
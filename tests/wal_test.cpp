@@ -0,0 +1,218 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "storage/wal.h"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << std::endl;
+        failures++;
+    }
+}
+
+// A log image built with encode(); offsets[i] is where record i starts and
+// offsets.back() the end of the last one
+struct Log {
+    std::string data = WriteAheadLog::file_header();
+    std::vector<size_t> offsets{data.size()};
+    
+    void add(std::string_view key, std::string_view value) {
+        uint64_t lsn = offsets.size();
+        WriteAheadLog::encode(data, WalRecordType::SET, lsn, key, value, 0);
+        offsets.push_back(data.size());
+    }
+};
+
+static std::string temp_path() {
+    return "/tmp/wal_test." + std::to_string(getpid()) + ".log";
+}
+
+static void write_file(const std::string& path, const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), static_cast<std::streamsize>(data.size()));
+}
+
+static std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static size_t lane_of(std::string_view key) {
+    return std::hash<std::string_view>()(key);
+}
+
+// Replays path both ways and checks each result against the expected one
+// and against the records passed to the callback
+static void check_replay(const std::string& path, const std::string& what, size_t records, uint64_t last_lsn,
+                         uint64_t valid_bytes, bool corrupt_tail) {
+    for (int parallel = 0; parallel < 2; ++parallel) {
+        std::string name = what + (parallel ? " (parallel)" : " (sequential)");
+        constexpr size_t LANES = 4;
+        std::vector<size_t> applied(LANES, 0);
+        auto apply = [&](const WalRecord& rec) { applied[lane_of(rec.key) % LANES]++; };
+        WalReplayResult result = parallel ? WriteAheadLog::replay_parallel(path, 4, LANES, lane_of, apply)
+                                          : WriteAheadLog::replay(path, apply);
+        size_t total = 0;
+        for (size_t n : applied) {
+            total += n;
+        }
+        check(result.records == records, name + ": records");
+        check(total == records, name + ": records applied");
+        check(result.last_lsn == last_lsn, name + ": last_lsn");
+        check(result.valid_bytes == valid_bytes, name + ": valid_bytes");
+        check(result.corrupt_tail == corrupt_tail, name + ": corrupt_tail");
+    }
+}
+
+static void test_intact() {
+    Log log;
+    for (int i = 0; i < 100; ++i) {
+        log.add("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    std::string path = temp_path();
+    write_file(path, log.data);
+    check_replay(path, "intact log", 100, 100, log.data.size(), false);
+    std::remove(path.c_str());
+}
+
+static void test_crc_mismatch() {
+    Log log;
+    for (int i = 0; i < 10; ++i) {
+        log.add("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    // Flip a byte of record 6's key
+    log.data[log.offsets[6] + WriteAheadLog::RECORD_HEADER + 17] ^= 0x01;
+    std::string path = temp_path();
+    write_file(path, log.data);
+    check_replay(path, "CRC mismatch", 6, 6, log.offsets[6], true);
+    std::remove(path.c_str());
+}
+
+static void test_torn_tail() {
+    Log log;
+    for (int i = 0; i < 10; ++i) {
+        log.add("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    std::string path = temp_path();
+    
+    write_file(path, log.data.substr(0, log.offsets[9] + 5));
+    check_replay(path, "torn header", 9, 9, log.offsets[9], true);
+    
+    write_file(path, log.data.substr(0, log.offsets[10] - 3));
+    check_replay(path, "torn body", 9, 9, log.offsets[9], true);
+    std::remove(path.c_str());
+}
+
+// Parallel replay splits at REPLAY_CHUNK_BYTES. A corrupt record in the
+// middle of the first chunk must discard the rest of that chunk and every
+// later one, even though they verify on their own.
+static void test_corrupt_mid_chunk() {
+    Log log;
+    std::string value(64 * 1024, 'v');
+    size_t count = 3 * WriteAheadLog::REPLAY_CHUNK_BYTES / value.size();
+    for (size_t i = 0; i < count; ++i) {
+        log.add("key" + std::to_string(i), value);
+    }
+    size_t bad = count / 6; // Well inside the first chunk
+    log.data[log.offsets[bad] + WriteAheadLog::RECORD_HEADER + 100] ^= 0x01;
+    std::string path = temp_path();
+    write_file(path, log.data);
+    check_replay(path, "corrupt mid chunk", bad, bad, log.offsets[bad], true);
+    std::remove(path.c_str());
+}
+
+// Keys written in interleaved order over several chunks come back in log
+// order per key, as they would be applied one lane per thread
+static void test_lane_order() {
+    constexpr size_t KEYS = 16;
+    constexpr size_t LANES = 4;
+    Log log;
+    std::string pad(16 * 1024, 'p');
+    size_t count = 2 * WriteAheadLog::REPLAY_CHUNK_BYTES / pad.size();
+    for (size_t i = 0; i < count; ++i) {
+        log.add("key" + std::to_string(i % KEYS), std::to_string(i) + ":" + pad);
+    }
+    std::string path = temp_path();
+    write_file(path, log.data);
+    
+    std::vector<std::map<std::string, std::vector<size_t>>> seen(LANES);
+    WalReplayResult result = WriteAheadLog::replay_parallel(path, 4, LANES, lane_of, [&](const WalRecord& rec) {
+        seen[lane_of(rec.key) % LANES][std::string(rec.key)].push_back(std::stoul(std::string(rec.value)));
+    });
+    check(result.records == count && !result.corrupt_tail, "lane order: every record replayed");
+    
+    bool ordered = true;
+    size_t keys = 0;
+    for (const auto& lane : seen) {
+        for (const auto& [key, values] : lane) {
+            size_t k = std::stoul(key.substr(3));
+            ordered = ordered && values.size() == (count - k + KEYS - 1) / KEYS;
+            for (size_t j = 0; j < values.size(); ++j) {
+                ordered = ordered && values[j] == k + j * KEYS;
+            }
+            keys++;
+        }
+    }
+    check(keys == KEYS, "lane order: every key seen");
+    check(ordered, "lane order: each key's records in log order");
+    std::remove(path.c_str());
+}
+
+// A MULTI record replays as all of its records, with its LSN, or as none
+static void test_multi() {
+    std::string path = temp_path();
+    std::remove(path.c_str());
+    {
+        WriteAheadLog wal(path, FsyncPolicy::ALWAYS);
+        WalBatch single;
+        single.add_set("before", "1", 0);
+        wal.append_batch(single);
+        
+        WalBatch group;
+        group.add_set("a", "1", 0);
+        group.add_set("b", "2", 0);
+        group.add_del("c");
+        WalBatch log;
+        log.add_group(group);
+        check(log.count() == 1, "multi: a group is one record");
+        check(wal.wait_durable(wal.append_batch(log)), "multi: written");
+    }
+    std::string data = read_file(path);
+    check_replay(path, "intact multi", 4, 2, data.size(), false);
+    
+    std::vector<std::string> keys;
+    WriteAheadLog::replay(path, [&](const WalRecord& rec) {
+        keys.push_back(std::string(rec.key) + "@" + std::to_string(rec.lsn));
+    });
+    check(keys == std::vector<std::string>({"before@1", "a@2", "b@2", "c@2"}), "multi: expanded in order with its LSN");
+    
+    write_file(path, data.substr(0, data.size() - 12)); // Inside the third inner record
+    size_t first_end = WriteAheadLog::file_header().size() + WriteAheadLog::RECORD_HEADER +
+                       WriteAheadLog::BODY_FIXED + 7;
+    check_replay(path, "torn multi", 1, 1, first_end, true);
+    std::remove(path.c_str());
+}
+
+int main() {
+    test_intact();
+    test_crc_mismatch();
+    test_torn_tail();
+    test_corrupt_mid_chunk();
+    test_lane_order();
+    test_multi();
+    
+    if (failures > 0) {
+        return EXIT_FAILURE;
+    }
+    std::cout << "wal_test: OK" << std::endl;
+    return EXIT_SUCCESS;
+}